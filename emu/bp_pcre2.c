@@ -35,1060 +35,6243 @@
 #include "picat_utilities.h"
 #include <pcre2.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "regex_dfa.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-/*
-  regex/2:  regex(Pattern,String)
-  true if the regular expression pattern matches the string string
 
-*/
-int regex() {
-   
-  TERM pattern_p = picat_get_call_arg(1,2); /* Regex */
-  TERM subject_p = picat_get_call_arg(2,2); /* Subject string */
+/*
+  Runtime statistics.
 
-  char* pattern_s = picat_string_to_cstring(pattern_p);
-  char* subject_s = picat_string_to_cstring(subject_p);
-   
-  size_t pattern_size = strlen(pattern_s);
-  size_t subject_size = strlen(subject_s);  
+  The counters are always on. Each thread has its own counters
+  (so there is no locking when counting) and regex_stats/1 sums
+  the counters of all threads.
 
-  int ret = PICAT_FALSE; // Return value to Picat
-  
-  uint32_t compile_options = 0;
-  PCRE2_SIZE erroffset;
-  int errcode;
-  PCRE2_UCHAR8 buffer[128];
-  pcre2_code* re = pcre2_compile(pattern_s, pattern_size, compile_options, &errcode, &erroffset, NULL);
-  if (re == NULL) {
-    pcre2_get_error_message(errcode, buffer, 120);
-    fprintf(stderr,"regex: %d\t%s\n", errcode, buffer);
-    
-    free(pattern_s);
-    free(subject_s);
-    
-    return ret;
-  }
+  The time is measured in ticks: rdtsc on x86, otherwise
+  clock_gettime(CLOCK_MONOTONIC) in ns. The ticks are converted
+  to ns when the statistics are read.
 
-  // pcre2_match
-  int match_options = 0;
-  PCRE2_SIZE* ovector;
-  uint32_t ovecsize = 1024;
-  pcre2_match_data* match_data = pcre2_match_data_create(ovecsize, NULL);
-  int rc = pcre2_match(re, subject_s, subject_size, 0, match_options, match_data, NULL);
-  if(rc == 0) {
-    fprintf(stderr,"offset vector too small: %d\n",rc);
-    
-  } else if(rc > 0) {
+  The phases are:
+  - convert: Picat strings to C strings (pattern, subject, replacement)
+  - compile: pcre2_compile (only cache misses)
+  - match:   pcre2_match and pcre2_substitute
+  - build:   building the result terms (captures, matches, replaced string)
 
-    // It's a match
-    ret = PICAT_TRUE;
-    
-  } else if (rc < 0) {
+  The memo counters (see regex_memo/1) are the number of match results
+  found (memo_hits) and not found (memo_misses) in the memo.
+  length_rejects is the number of subjects that the batch predicates
+  rejected by their length, without matching (see regex_length_reject()).
 
-    // No match
-    ; 
+*/
+typedef struct regex_stats {
+  uint64_t compiles;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t matches;
+  uint64_t match_failures;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t convert_ticks;
+  uint64_t compile_ticks;
+  uint64_t match_ticks;
+  uint64_t build_ticks;
+  uint64_t memo_hits;
+  uint64_t memo_misses;
+  uint64_t length_rejects;
+  struct regex_stats* next;
+} regex_stats_t;
+
+static __thread regex_stats_t* regex_thread_stats = NULL;
+static regex_stats_t* regex_all_stats = NULL; // all threads' counters
+static pthread_mutex_t regex_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t regex_base_ticks = 0; // for converting ticks to ns
+static uint64_t regex_base_ns = 0;
+
+static uint64_t regex_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t regex_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return regex_ns();
+#endif
+}
+
+static regex_stats_t* regex_stats_get(void) {
+  regex_stats_t* s = regex_thread_stats;
+  if (s == NULL) {
+    s = calloc(1, sizeof(regex_stats_t));
+    pthread_mutex_lock(&regex_stats_lock);
+    if (regex_all_stats == NULL) {
+      regex_base_ticks = regex_ticks();
+      regex_base_ns = regex_ns();
+    }
+    s->next = regex_all_stats;
+    regex_all_stats = s;
+    pthread_mutex_unlock(&regex_stats_lock);
+    regex_thread_stats = s;
   }
+  return s;
+}
 
-  pcre2_match_data_free(match_data);
-  pcre2_code_free(re);
-  
-  if (pattern_s != NULL) {
-    free(pattern_s);
-  }
+#define REGEX_STAT(field) (regex_stats_get()->field)
 
-  if (subject_s != NULL) {
-    free(subject_s);
+/*
+  USDT probes (static tracepoints for perf, bpftrace, SystemTap).
+
+  Compiled with -DREGEX_USDT (make REGEX_USDT=1, see
+  Makefile.linux64_pcre2) the provider picat_regex has the probes
+  (with their arguments):
+   - compile_start(pattern size)
+     compile_end(cache id, pattern size, error code): the id of the
+     new cache entry, or 0 and the PCRE2 error code
+   - match_start(cache id, subject length)
+     match_end(cache id, subject length, result code): the result of
+     pcre2_match() or pcre2_substitute() (1 or 0 for a DFA match)
+   - convert_start()
+     convert_end(bytes): a Picat string converted to C
+   - build_start()
+     build_end(items, ok): a result written on the heap, where items
+     is the number of elements (or bytes of a string)
+  The cache id is the id of regex_top_patterns/2 (regex_pattern_stats/2),
+  so a probe can be attributed to its pattern. E.g. the match time
+  per pattern:
+    bpftrace -e 'usdt:./picat:picat_regex:match_start { @t[tid] = nsecs; }
+                 usdt:./picat:picat_regex:match_end /@t[tid]/ {
+                   @ns[arg0] = hist(nsecs - @t[tid]); delete(@t[tid]); }'
+
+  A compiled-in probe is a nop (its arguments are only computed to
+  registers). By default the probes are compiled out.
+*/
+#ifdef REGEX_USDT
+#include <sys/sdt.h>
+#define REGEX_PROBE(...) STAP_PROBEV(picat_regex, __VA_ARGS__)
+#else
+#define REGEX_PROBE(...) do { } while (0)
+#endif
+
+// ns per tick, calibrated against the monotonic clock
+static double regex_ns_per_tick(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t ticks = regex_ticks() - regex_base_ticks;
+  uint64_t ns = regex_ns() - regex_base_ns;
+  if (ticks == 0 || ns < 1000000) {
+    // Too short time since start to calibrate: measure 1ms.
+    uint64_t t0 = regex_ticks(), n0 = regex_ns();
+    while (regex_ns() - n0 < 1000000) ;
+    return (double)(regex_ns() - n0) / (double)(regex_ticks() - t0);
   }
+  return (double)ns / (double)ticks;
+#else
+  return 1.0;
+#endif
+}
 
-  return ret;
-  
-} // regex
 
+/*
+  Conversion between Picat strings and C strings, with statistics.
+  regex_get_cstring() is also used by the AOT matchers (bp_pcre2_aot.c).
+*/
+char* regex_get_cstring(TERM t, size_t* size) {
+  REGEX_PROBE(convert_start);
+  uint64_t t0 = regex_ticks();
+  char* s = picat_string_to_cstring(t);
+  *size = strlen(s);
+  REGEX_PROBE(convert_end, *size);
+  regex_stats_t* stats = regex_stats_get();
+  stats->bytes_in += *size;
+  stats->convert_ticks += regex_ticks() - t0;
+  return s;
+}
+
+static TERM regex_build_string(char* s, size_t len) {
+  REGEX_STAT(bytes_out) += len;
+  return cstring_to_picat(s, (int)len);
+}
 
 
 /*
-  regex_capture/2: regex_capture(Pattern,Subject,Capture)
-  True if Subject matches Pattern.
+  Result formats.
+
+  The captures/matches/parts of regex/4, regex_find_all/3,
+  regex_find_num/4 and regex_split/3 (see regex.pi) are built in
+  the format Format, which is an atom or a list of atoms:
+   - string: a capture is a Picat string (the default)
+   - atom:   a capture is an atom. Atoms are interned, so a
+             repeated token is stored only once.
+   - codes:  a capture is a list of character codes
+   - list:   the captures are collected in a list (the default)
+   - array:  the captures are collected in an array {...}
+  Strings are the most memory hungry format (one list cell per
+  character), atoms and arrays are the most compact.
+*/
+#define REGEX_FORMAT_STRING 0
+#define REGEX_FORMAT_ATOM   1
+#define REGEX_FORMAT_CODES  2
+#define REGEX_FORMAT_ARRAY  4
+#define REGEX_FORMAT_VALUE  3 // mask of the capture format
+
+static int regex_format_atom(TERM t, int* format) {
+  if (!picat_is_atom(t)) {
+    return 0;
+  }
+  char* name = picat_get_atom_name(t);
+  if (strcmp(name, "string") == 0) {
+    *format = (*format & ~REGEX_FORMAT_VALUE) | REGEX_FORMAT_STRING;
+  } else if (strcmp(name, "atom") == 0) {
+    *format = (*format & ~REGEX_FORMAT_VALUE) | REGEX_FORMAT_ATOM;
+  } else if (strcmp(name, "codes") == 0) {
+    *format = (*format & ~REGEX_FORMAT_VALUE) | REGEX_FORMAT_CODES;
+  } else if (strcmp(name, "list") == 0) {
+    *format &= ~REGEX_FORMAT_ARRAY;
+  } else if (strcmp(name, "array") == 0) {
+    *format |= REGEX_FORMAT_ARRAY;
+  } else {
+    return 0;
+  }
+  return 1;
+}
 
-  Capture is a list of captures:
-  * Capture[1] is the full captured string
-  * Capture[i] i>1, is the i-1 capture
+/*
+  Reads the format (see above). Returns 0 (with an error message) if
+  it's not a valid format.
+*/
+static int regex_get_format(TERM format_p, char* who, int* format) {
+  *format = REGEX_FORMAT_STRING;
+  int ok = 1;
+  if (picat_is_list(format_p)) {
+    for (TERM t = format_p; ok && picat_is_list(t); t = picat_get_cdr(t)) {
+      ok = regex_format_atom(picat_get_car(t), format);
+    }
+  } else if (!picat_is_nil(format_p)) {
+    ok = regex_format_atom(format_p, format);
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: Format should be string, atom, codes, list, array or a list of these\n", who);
+  }
+  return ok;
+}
 
+/*
+  Building the results.
+
+  The captures/matches/parts are collected as slices (start and end
+  offsets) of the subject in a regex_result, and the whole result is
+  then written directly on the heap: the space is checked once
+  (regex_heap_reserve), the list cells, array slots and characters
+  are written in place (no picat_build_list/picat_unify per element)
+  and the slices are read straight from the subject (no copy).
+
+  An item of the result is either one slice (a value) or a group of
+  slices (a list/array of values, e.g. the captures of a match in
+  regex_find_matches/4).
 */
-int regex_capture() {
-  
-  TERM pattern_p = picat_get_call_arg(1,3); /* Regex */
-  TERM subject_p = picat_get_call_arg(2,3); /* Subject string */
-  TERM capture_p = picat_get_call_arg(3,3); /* output argument: Captures */    
+#define REGEX_HEAP_MARGIN 4096 // words kept free on the heap
+
+typedef struct regex_result {
+  const char* subject;
+  const uint32_t* subject32; // the subject of a 32-bit match (instead of subject)
+  PCRE2_SIZE* bounds;  // start and end of each slice
+  int* sizes;          // number of slices of each item, 0 for a value
+  size_t num_slices, max_slices;
+  size_t num_items, max_items;
+} regex_result;
+
+static TERM regex_char_atoms[128]; // the (interned) atoms of the ASCII characters
+
+static void regex_result_init(regex_result* r, const char* subject) {
+  r->subject = subject;
+  r->subject32 = NULL;
+  r->num_slices = r->num_items = 0;
+  r->max_slices = r->max_items = 16;
+  r->bounds = malloc(2 * r->max_slices * sizeof(PCRE2_SIZE));
+  r->sizes = malloc(r->max_items * sizeof(int));
+}
+
+static void regex_result_init_32(regex_result* r, const uint32_t* subject) {
+  regex_result_init(r, NULL);
+  r->subject32 = subject;
+}
+
+static void regex_result_free(regex_result* r) {
+  free(r->bounds);
+  free(r->sizes);
+}
 
-  char* pattern_s = picat_string_to_cstring(pattern_p);
-  /* printf("pattern_s: %s\n", pattern_s); */
-  /* printf("pattern len: %ld\n", strlen(pattern_s));         */
-  
-  char* subject_s = picat_string_to_cstring(subject_p);
-  /* printf("subject_s: %s\n", subject_s); */
-  /* printf("subject len: %ld\n", strlen(subject_s));       */
-  
-  size_t pattern_size = strlen(pattern_s);
-  size_t subject_size = strlen(subject_s);  
+/*
+  Adds the n slices of ovector (from slice first), as one item if
+  group is 1, otherwise as n items. An unset capture is empty.
+*/
+static void regex_result_add(regex_result* r, PCRE2_SIZE* ovector, int first, int n, int group) {
+  size_t items = group ? 1 : (size_t)n;
+  if (r->num_slices + n > r->max_slices) {
+    while (r->num_slices + n > r->max_slices) {
+      r->max_slices *= 2;
+    }
+    r->bounds = realloc(r->bounds, 2 * r->max_slices * sizeof(PCRE2_SIZE));
+  }
+  if (r->num_items + items > r->max_items) {
+    while (r->num_items + items > r->max_items) {
+      r->max_items *= 2;
+    }
+    r->sizes = realloc(r->sizes, r->max_items * sizeof(int));
+  }
+  for (int i = first; i < first+n; i++) {
+    int unset = ovector[2*i] == PCRE2_UNSET;
+    r->bounds[2*r->num_slices]   = unset ? 0 : ovector[2*i];
+    r->bounds[2*r->num_slices+1] = unset ? 0 : ovector[2*i+1];
+    r->num_slices++;
+    if (!group) {
+      r->sizes[r->num_items++] = 0;
+    }
+  }
+  if (group) {
+    r->sizes[r->num_items++] = n;
+  }
+}
 
-  // printf("pattern_s: %s pattern_size: %ld\n", pattern_s, pattern_size);
-  // printf("subject_s: %s subject_size: %ld\n", subject_s, subject_size);  
-  
-  uint32_t compile_options = 0; 
-  uint32_t match_options = 0;
+/*
+  Adds the slice start..end as one item.
+*/
+static void regex_result_add_slice(regex_result* r, PCRE2_SIZE start, PCRE2_SIZE end) {
+  PCRE2_SIZE ovector[2] = {start, end};
+  regex_result_add(r, ovector, 0, 1, 0);
+}
 
-  // pcre2_match_data *match_data;
-  uint32_t ovecsize = 1024;
+/*
+  One match of regex_find_matches/4: the matched string if the
+  pattern has no capture group, the capture if it has one capture
+  group, otherwise the captures (in a list/array).
+*/
+static void regex_result_add_match(regex_result* matches, PCRE2_SIZE* ovector, int rc) {
+  if (rc <= 2) {
+    regex_result_add(matches, ovector, rc == 2 ? 1 : 0, 1, 0);
+  } else {
+    regex_result_add(matches, ovector, 1, rc-1, 1);
+  }
+}
 
-  TERM ret_list = picat_build_list();
-  TERM car = picat_get_car(ret_list);
-  TERM cdr = picat_get_cdr(ret_list);
+/*
+  Checks that there are (at least) words free words on the heap.
+  This is done before a result is written.
+*/
+static int regex_heap_reserve(size_t words, char* who) {
+  if (local_top - heap_top > (BPLONG)(words + REGEX_HEAP_MARGIN)) {
+    return 1;
+  }
+  fprintf(stderr, "%s: the result (%zu words) doesn't fit on the heap\n", who, words);
+  return 0;
+}
 
+/*
+  The heap words of a value of len bytes (at most one list cell per
+  byte; atoms are in the symbol table), and of a list/array of n
+  values.
+*/
+static size_t regex_value_words(size_t len, int format) {
+  return (format & REGEX_FORMAT_VALUE) == REGEX_FORMAT_ATOM ? 0 : 2*len;
+}
 
-  int ret = PICAT_FALSE;
+static size_t regex_container_words(size_t n, int format) {
+  if (format & REGEX_FORMAT_ARRAY) {
+    return n == 0 ? 0 : n+1;
+  }
+  return 2*n;
+}
 
-  PCRE2_SIZE erroffset;
-  int errcode;
-  PCRE2_UCHAR8 buffer[128];
-  pcre2_code *re = pcre2_compile(pattern_s, pattern_size, compile_options, &errcode, &erroffset, NULL);
-  if (re == NULL) {
-    pcre2_get_error_message(errcode, buffer, 120);
-    fprintf(stderr,"regex_capture: %d\t%s\n", errcode, buffer);
-    pcre2_code_free(re);
-      
-    picat_unify(cdr, picat_build_nil());
-    picat_unify(ret_list, capture_p); // output
+/*
+  Writes a list/array of n elements on the heap. *slots is the first
+  element and stride the distance between the elements; the caller
+  fills them in.
+*/
+static TERM regex_write_container(size_t n, int format, BPLONG_PTR* slots, int* stride) {
+  if (n == 0) {
+    *slots = NULL;
+    *stride = 0;
+    return (format & REGEX_FORMAT_ARRAY) ? picat_build_atom("{}") : nil_sym;
+  }
+  if (format & REGEX_FORMAT_ARRAY) {
+    TERM array = ADDTAG(heap_top, STR);
+    *heap_top = (BPLONG)insert_sym("{}", 2, (BPLONG)n);
+    *slots = heap_top+1;
+    *stride = 1;
+    heap_top += n+1;
+    return array;
+  }
+  TERM list = ADDTAG(heap_top, LST);
+  for (size_t i = 0; i < n; i++) {
+    heap_top[2*i+1] = i+1 < n ? ADDTAG(heap_top+2*i+2, LST) : nil_sym;
+  }
+  *slots = heap_top;
+  *stride = 2;
+  heap_top += 2*n;
+  return list;
+}
 
-    free(pattern_s);
-    free(subject_s);
+/*
+  Decodes the UTF-8 character at p (before end), and sets *n to its
+  length. An invalid byte is its own character.
+*/
+static inline int regex_utf8_decode(const unsigned char* p, const unsigned char* end, int* n) {
+  int c = *p;
+  *n = 1;
+  if (c >= 0xc0 && c < 0xf8) {
+    int len = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+    int code = c & (0x3f >> (len-1));
+    int k = 1;
+    for (; k < len && p+k < end && (p[k] & 0xc0) == 0x80; k++) {
+      code = (code << 6) | (p[k] & 0x3f);
+    }
+    if (k == len) {
+      c = code;
+      *n = len;
+    }
+  }
+  return c;
+}
+
+// Encodes the code point c as UTF-8 in s, returns the length
+static inline int regex_utf8_encode(uint32_t c, char* s) {
+  if (c < 0x80) {
+    s[0] = (char)c;
+    return 1;
+  }
+  if (c < 0x800) {
+    s[0] = (char)(0xc0 | (c >> 6));
+    s[1] = (char)(0x80 | (c & 0x3f));
+    return 2;
+  }
+  if (c < 0x10000) {
+    s[0] = (char)(0xe0 | (c >> 12));
+    s[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+    s[2] = (char)(0x80 | (c & 0x3f));
+    return 3;
+  }
+  s[0] = (char)(0xf0 | (c >> 18));
+  s[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+  s[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+  s[3] = (char)(0x80 | (c & 0x3f));
+  return 4;
+}
+
+// The (one-character) atom of an ASCII character
+static inline TERM regex_char_atom(int c) {
+  if (regex_char_atoms[c] == 0) {
+    char ch = (char)c;
+    regex_char_atoms[c] = ADDTAG(insert_sym(&ch, 1, 0), ATM);
+  }
+  return regex_char_atoms[c];
+}
 
-    return ret;
+/*
+  Writes a value (the len bytes in s) in the format's capture format:
+  a string is a list of the characters (one-character atoms), codes
+  is a list of the code points. A UTF-8 character is decoded, an
+  invalid byte is its own character.
+*/
+static TERM regex_write_value(const char* s, size_t len, int format) {
+  REGEX_STAT(bytes_out) += len;
+  int value_format = format & REGEX_FORMAT_VALUE;
+  if (value_format == REGEX_FORMAT_ATOM) {
+    return ADDTAG(insert_sym((char*)s, (BPLONG)len, 0), ATM);
+  }
+  if (len == 0) {
+    return nil_sym;
+  }
+  TERM list = ADDTAG(heap_top, LST);
+  const unsigned char* p = (const unsigned char*)s;
+  const unsigned char* end = p + len;
+  while (p < end) {
+    int n;
+    int c = regex_utf8_decode(p, end, &n);
+    if (value_format == REGEX_FORMAT_CODES) {
+      heap_top[0] = MAKEINT(c);
+    } else if (c < 128) {
+      heap_top[0] = regex_char_atom(c);
+    } else {
+      heap_top[0] = ADDTAG(insert_sym((char*)p, n, 0), ATM);
+    }
+    heap_top[1] = ADDTAG(heap_top+2, LST);
+    heap_top += 2;
+    p += n;
   }
+  heap_top[-1] = nil_sym;
+  return list;
+}
 
-  pcre2_match_data *match_data = pcre2_match_data_create(ovecsize, NULL);
-  int rc = pcre2_match(re, subject_s, subject_size, 0, match_options, match_data, NULL);
+/*
+  The same for the len code points in s (a 32-bit match).
+*/
+static TERM regex_write_value_32(const uint32_t* s, size_t len, int format) {
+  REGEX_STAT(bytes_out) += len * sizeof(uint32_t);
+  int value_format = format & REGEX_FORMAT_VALUE;
+  char utf8[4];
+  if (value_format == REGEX_FORMAT_ATOM) {
+    char* name = malloc(4*len+1);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+      n += regex_utf8_encode(s[i], name+n);
+    }
+    TERM atom = ADDTAG(insert_sym(name, (BPLONG)n, 0), ATM);
+    free(name);
+    return atom;
+  }
+  if (len == 0) {
+    return nil_sym;
+  }
+  TERM list = ADDTAG(heap_top, LST);
+  for (size_t i = 0; i < len; i++) {
+    uint32_t c = s[i];
+    if (value_format == REGEX_FORMAT_CODES) {
+      heap_top[0] = MAKEINT(c);
+    } else if (c < 128) {
+      heap_top[0] = regex_char_atom(c);
+    } else {
+      heap_top[0] = ADDTAG(insert_sym(utf8, regex_utf8_encode(c, utf8), 0), ATM);
+    }
+    heap_top[1] = ADDTAG(heap_top+2, LST);
+    heap_top += 2;
+  }
+  heap_top[-1] = nil_sym;
+  return list;
+}
+
+// The s'th slice of the result r as a value
+static TERM regex_result_value(regex_result* r, size_t s, int format) {
+  PCRE2_SIZE start = r->bounds[2*s], end = r->bounds[2*s+1];
+  if (r->subject32 != NULL) {
+    return regex_write_value_32(r->subject32 + start, end - start, format);
+  }
+  return regex_write_value(r->subject + start, end - start, format);
+}
 
-  
-  if(rc == 0) {
-    fprintf(stderr,"offset vector too small: %d",rc);
-    
-  } else if(rc > 0) {
-    
-    PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
-    PCRE2_SIZE i;
-    for(int i = 0; i < rc; i++) {
-      PCRE2_SPTR start = subject_s + ovector[2*i];
-      PCRE2_SIZE slen = ovector[2*i+1] - ovector[2*i];
-      // printf( "%2d: %.*s\n", i, (int)slen, (char *)start );
-
-      if (i < rc-1) {
-        // All but last captures
-        picat_unify(car,cstring_to_picat((char*) start, slen));         
-        TERM temp = picat_build_list();
-        
-        picat_unify(cdr, temp);
-        car = picat_get_car(temp);
-        cdr = picat_get_cdr(temp);
-        
-      } else {
-        // Last capture
-        picat_unify(car,cstring_to_picat((char *)start, slen));
+/*
+  Writes the result r (a list/array of its items) in the format
+  format. Returns 0 if it doesn't fit on the heap.
+*/
+static int regex_result_build(regex_result* r, int format, char* who, TERM* result) {
+  REGEX_PROBE(build_start);
+  uint64_t t0 = regex_ticks();
+  size_t words = regex_container_words(r->num_items, format);
+  for (size_t i = 0; i < r->num_slices; i++) {
+    words += regex_value_words(r->bounds[2*i+1] - r->bounds[2*i], format);
+  }
+  for (size_t i = 0; i < r->num_items; i++) {
+    words += regex_container_words(r->sizes[i], format);
+  }
+  if (!regex_heap_reserve(words, who)) {
+    REGEX_PROBE(build_end, r->num_items, 0);
+    return 0;
+  }
+  BPLONG_PTR slots;
+  int stride;
+  *result = regex_write_container(r->num_items, format, &slots, &stride);
+  size_t s = 0;
+  for (size_t i = 0; i < r->num_items; i++) {
+    TERM item;
+    if (r->sizes[i] == 0) {
+      item = regex_result_value(r, s, format);
+      s++;
+    } else {
+      BPLONG_PTR group_slots;
+      int group_stride;
+      item = regex_write_container(r->sizes[i], format, &group_slots, &group_stride);
+      for (int j = 0; j < r->sizes[i]; j++, s++) {
+        group_slots[j*group_stride] = regex_result_value(r, s, format);
       }
     }
-
-    ret = PICAT_TRUE;
-    
-  } else if (rc < 0) {
-
-    // No match
-    ; 
+    slots[i*stride] = item;
   }
+  REGEX_STAT(build_ticks) += regex_ticks() - t0;
+  REGEX_PROBE(build_end, r->num_items, 1);
+  return 1;
+}
 
-  pcre2_match_data_free(match_data);
-  pcre2_code_free(re);
+/*
+  The n terms in items as a list, or as an array (REGEX_FORMAT_ARRAY).
+*/
+static TERM regex_build_container(TERM* items, size_t n, int format, char* who) {
+  if (!regex_heap_reserve(regex_container_words(n, format), who)) {
+    return (TERM)NULL;
+  }
+  BPLONG_PTR slots;
+  int stride;
+  TERM container = regex_write_container(n, format, &slots, &stride);
+  for (size_t i = 0; i < n; i++) {
+    slots[i*stride] = items[i];
+  }
+  return container;
+}
 
-  picat_unify(cdr, picat_build_nil()); // add tail []
-  picat_unify(ret_list, capture_p); // output
 
-  free(pattern_s);
-  free(subject_s);
-  
-  return ret;
+/*
+  Cache of compiled patterns.
+
+  The patterns are compiled once and then kept in a hash table,
+  keyed by the pattern string and the compile options.
+  The cached pattern is owned by the cache: don't call pcre2_code_free
+  on it.
+
+  When the cache has REGEX_CACHE_SIZE entries it's cleared (except for
+  the pinned entries: the pattern from regex_compile/1, and the
+  patterns of a predicate that keeps several entries while it looks up
+  more, e.g. regex_filter_all/2).
+
+  An entry from regex_cache_lookup() is valid until the next lookup
+  in the same predicate: the cache is only cleared by
+  regex_cache_insert() (and by regex_optimize/1 and regex_cache_load/1,
+  which don't hold any entries), and the calls of the Picat C interface
+  never call back into this file. So a predicate pins (pinned++) every
+  entry that it keeps while it looks up another pattern, after it
+  returns (regex_compile/1), or while other threads use it (the
+  thread pool, see regex_extract_run()), and unpins it when it's done.
+
+  Each entry also has the latency statistics of the pattern's matches:
+  the number of calls/failures, the total and max time, and a histogram
+  where bucket i counts the matches that took [2^i,2^(i+1)) ticks.
+  See regex_pattern_stats/2 and regex_top_patterns/2.
 
-} // regex_capture
+*/
+#ifndef REGEX_CACHE_SIZE
+#define REGEX_CACHE_SIZE 8192
+#endif
+#define REGEX_CACHE_BUCKETS 4096
+#define REGEX_HISTOGRAM_BUCKETS 48
+
+typedef struct regex_cache_entry {
+  char* pattern;
+  size_t pattern_size;
+  uint32_t options;
+  uint64_t hash;
+  uint32_t id;      // unique id of the entry
+  int pinned;       // pinned (> 0) entries are not removed when the cache is cleared
+  int width;        // the code unit width: 8, or 32 for re32 (see regex_cache_lookup_32())
+  int limited;      // matched with the ReDoS match limit (see regex_redos_check())
+  int rewritten;    // compiled from the rewritten pattern (see regex_optimize/1)
+  pcre2_code* re;
+  pcre2_code_32* re32;
+  regex_dfa* dfa;   // the DFA of the pattern (built when needed), see regex_entry_dfa()
+  int no_dfa;       // the pattern is not supported by regex_dfa_compile()
+  int lengths_known; // the lengths are computed, see regex_entry_lengths()
+  uint32_t min_length;
+  long max_subject;
+  uint64_t calls;   // latency statistics
+  uint64_t failures;
+  uint64_t total_ticks;
+  uint64_t max_ticks;
+  uint64_t histogram[REGEX_HISTOGRAM_BUCKETS];
+  struct regex_cache_entry* next;
+} regex_cache_entry;
+
+static regex_cache_entry* regex_cache[REGEX_CACHE_BUCKETS];
+static size_t regex_cache_count = 0;
+static uint32_t regex_cache_next_id = 1;
+
+// FNV-1a
+static uint64_t regex_hash(const char* s, size_t len, uint32_t options) {
+  uint64_t h = 14695981039346656037ULL ^ options;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static void regex_cache_clear(void) {
+  for (int b = 0; b < REGEX_CACHE_BUCKETS; b++) {
+    regex_cache_entry** p = &regex_cache[b];
+    while (*p != NULL) {
+      regex_cache_entry* e = *p;
+      if (e->pinned) {
+        p = &e->next;
+      } else {
+        *p = e->next;
+        pcre2_code_free(e->re);
+        pcre2_code_free_32(e->re32);
+        regex_dfa_free(e->dfa);
+        free(e->pattern);
+        free(e);
+        regex_cache_count--;
+      }
+    }
+  }
+}
 
+/*
+  Returns the cache entry for pattern, or NULL if it's not in the cache.
+  This doesn't count as a cache hit/miss.
+*/
+static regex_cache_entry* regex_cache_find(char* pattern, size_t pattern_size, uint32_t options) {
+  uint64_t h = regex_hash(pattern, pattern_size, options);
+  for (regex_cache_entry* e = regex_cache[h % REGEX_CACHE_BUCKETS]; e != NULL; e = e->next) {
+    if (e->hash == h && e->width == 8 && e->options == options && e->pattern_size == pattern_size &&
+        memcmp(e->pattern, pattern, pattern_size) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
 
 /*
+  Inserts the compiled pattern re in the cache (which then owns it)
+  and returns the new entry.
+*/
+static regex_cache_entry* regex_cache_insert(char* pattern, size_t pattern_size, uint32_t options, pcre2_code* re) {
+  uint64_t h = regex_hash(pattern, pattern_size, options);
+  if (regex_cache_count >= REGEX_CACHE_SIZE) {
+    regex_cache_clear();
+  }
+  regex_cache_entry* e = calloc(1, sizeof(regex_cache_entry));
+  e->pattern = malloc(pattern_size+1);
+  memcpy(e->pattern, pattern, pattern_size);
+  e->pattern[pattern_size] = '\0';
+  e->pattern_size = pattern_size;
+  e->options = options;
+  e->hash = h;
+  e->id = regex_cache_next_id++;
+  e->pinned = 0;
+  e->width = 8;
+  e->re = re;
+  e->next = regex_cache[h % REGEX_CACHE_BUCKETS];
+  regex_cache[h % REGEX_CACHE_BUCKETS] = e;
+  regex_cache_count++;
+
+  return e;
+}
 
-  Compiles a regex regex_compile(Pattern).
+/*
+  The ReDoS mode (regex_redos_mode/1). When it's on, each pattern is
+  analyzed with regex_dfa_redos() before it's compiled, and a
+  dangerous pattern (exponential, or polynomial of a degree above
+  REGEX_REDOS_MAX_DEGREE) is either refused (REGEX_REDOS_REFUSE) or
+  matched with the match limit REGEX_REDOS_MATCH_LIMIT
+  (REGEX_REDOS_LIMIT), so that a catastrophic match fails with
+  PCRE2_ERROR_MATCHLIMIT instead of running for hours.
+*/
+#ifndef REGEX_REDOS_MATCH_LIMIT
+#define REGEX_REDOS_MATCH_LIMIT 1000000
+#endif
+#ifndef REGEX_REDOS_MAX_DEGREE
+#define REGEX_REDOS_MAX_DEGREE 2
+#endif
+#define REGEX_REDOS_OFF    0
+#define REGEX_REDOS_REFUSE 1
+#define REGEX_REDOS_LIMIT  2
+
+static int regex_redos_setting = REGEX_REDOS_OFF;
+static pcre2_match_context* regex_redos_context = NULL;
+static pcre2_match_context_32* regex_redos_context_32 = NULL;
 
-  Note: re is a GLOBAL variable, thus it will only hold one pattern.
-  Be careful.
+/*
+  Returns 0 (with an error message) if the pattern is refused in the
+  ReDoS mode. Otherwise *limited is set if it's to be matched with
+  the match limit.
+*/
+static int regex_redos_check(char* pattern, size_t pattern_size, int* limited, char* who) {
+  *limited = 0;
+  if (regex_redos_setting == REGEX_REDOS_OFF) {
+    return 1;
+  }
+  regex_redos r;
+  regex_dfa_redos(pattern, (int)pattern_size, &r);
+  int dangerous = r.complexity == REGEX_REDOS_EXPONENTIAL ||
+    (r.complexity == REGEX_REDOS_POLYNOMIAL && r.degree > REGEX_REDOS_MAX_DEGREE);
+  int offset = 0;
+  for (int i = r.num_findings-1; i >= 0; i--) {
+    if (r.findings[i].complexity == r.complexity && r.findings[i].degree == r.degree) {
+      offset = r.findings[i].start;
+    }
+  }
+  int exponential = r.complexity == REGEX_REDOS_EXPONENTIAL;
+  regex_redos_free(&r);
+  if (!dangerous) {
+    return 1;
+  }
+  if (regex_redos_setting == REGEX_REDOS_REFUSE) {
+    fprintf(stderr,"%s: the pattern can take %s time (offset %d), see regex_analyze/1\n", who,
+            exponential ? "exponential" : "polynomial", offset);
+    return 0;
+  }
+  *limited = 1;
+  return 1;
+}
 
-  To be used with regex_match/1 and regex_match_capture/2
+/*
+  The pattern optimizer (regex_optimize/1): a pattern (with the default
+  compile options) is rewritten by regex_dfa_rewrite() before it's
+  compiled, and the compiled rewritten pattern is cached under the
+  original pattern.
+
+  The callers that don't read the captures (e.g. regex/2) look up the
+  pattern with the REGEX_NO_CAPTURES option (see regex_no_captures()),
+  which is only a part of the cache key: such an entry is compiled from
+  the pattern rewritten with REGEX_REWRITE_NO_CAPTURES, i.e. where the
+  capture groups may be eliminated, and without PCRE2_NO_AUTO_CAPTURE.
+*/
+#define REGEX_NO_CAPTURES PCRE2_NO_AUTO_CAPTURE
 
- */
+static int regex_optimizing = 0;
 
-PCRE2_SIZE erroffset;
-int errcode;
-PCRE2_UCHAR8 buffer[128];
-pcre2_code* re;
-// char* pattern_s;
-int regex_compile() {
-   
-  TERM pattern_p = picat_get_call_arg(1,1); /* Regex */
-  char* pattern_s = picat_string_to_cstring(pattern_p);
-  size_t pattern_size = strlen(pattern_s);
-  
-  uint32_t options = 0;
+// The lookup options of a caller that doesn't read the captures
+static uint32_t regex_no_captures(void) {
+  return regex_optimizing ? REGEX_NO_CAPTURES : 0;
+}
 
-  // Free re from previous run
-  if (re != NULL) {
-    pcre2_code_free(re);
+/*
+  Compiles the pattern, or its rewritten form (*rewritten is set) if
+  the optimizer is on.
+*/
+static pcre2_code* regex_optimize_compile(char* pattern, size_t pattern_size, uint32_t options,
+                                          int* errcode, PCRE2_SIZE* erroffset, int* rewritten) {
+  *rewritten = 0;
+  if (regex_optimizing && (options & ~REGEX_NO_CAPTURES) == 0) {
+    regex_rewrite* rewrites;
+    int num_rewrites;
+    char* optimized = regex_dfa_rewrite(pattern, (int)pattern_size,
+                                        options ? REGEX_REWRITE_NO_CAPTURES : 0, &rewrites, &num_rewrites);
+    regex_rewrites_free(rewrites, num_rewrites);
+    if (optimized != NULL) {
+      pcre2_code* re = pcre2_compile((PCRE2_SPTR)optimized, PCRE2_ZERO_TERMINATED, 0, errcode, erroffset, NULL);
+      free(optimized);
+      if (re != NULL) {
+        *rewritten = 1;
+        return re;
+      }
+    }
   }
-  
-  re = pcre2_compile(pattern_s, pattern_size, options, &errcode, &erroffset, NULL);
-  if (re == NULL) {
-    pcre2_get_error_message(errcode, buffer, 120);
-    fprintf(stderr,"regex_compile: %d\t%s\n", errcode, buffer);
-    pcre2_code_free(re);
+  // the original pattern (also if the rewritten one is not accepted by PCRE2)
+  return pcre2_compile((PCRE2_SPTR)pattern, pattern_size, options & ~REGEX_NO_CAPTURES, errcode, erroffset, NULL);
+}
 
-    free(pattern_s);
+/*
+  Inserts a compiled pattern (from regex_cache_lookup() or
+  regex_cache_load/1) with the flags of the ReDoS check and the
+  optimizer.
+*/
+static regex_cache_entry* regex_cache_add(char* pattern, size_t pattern_size, uint32_t options, pcre2_code* re,
+                                          int limited, int rewritten) {
+  regex_cache_entry* e = regex_cache_insert(pattern, pattern_size, options, re);
+  e->limited = limited;
+  e->rewritten = rewritten;
+  return e;
+}
 
-    return PICAT_FALSE;
+/*
+  Returns the cache entry for pattern (compiling it if needed),
+  or NULL if the pattern could not be compiled.
+  who is the name of the caller, used in the error message.
+*/
+static regex_cache_entry* regex_cache_lookup(char* pattern, size_t pattern_size, uint32_t options, char* who) {
+  regex_stats_t* stats = regex_stats_get();
+  uint64_t h = regex_hash(pattern, pattern_size, options);
+  regex_cache_entry* e;
+  for (e = regex_cache[h % REGEX_CACHE_BUCKETS]; e != NULL; e = e->next) {
+    if (e->hash == h && e->width == 8 && e->options == options && e->pattern_size == pattern_size &&
+        memcmp(e->pattern, pattern, pattern_size) == 0) {
+      stats->cache_hits++;
+      return e;
+    }
   }
+  stats->cache_misses++;
 
-  free(pattern_s);
-  
-  return PICAT_TRUE;
+  int limited;
+  if (!regex_redos_check(pattern, pattern_size, &limited, who)) {
+    return NULL;
+  }
+  int errcode;
+  PCRE2_SIZE erroffset;
+  REGEX_PROBE(compile_start, pattern_size);
+  uint64_t t0 = regex_ticks();
+  int rewritten;
+  pcre2_code* re = regex_optimize_compile(pattern, pattern_size, options, &errcode, &erroffset, &rewritten);
+  stats->compile_ticks += regex_ticks() - t0;
+  stats->compiles++;
+  if (re == NULL) {
+    REGEX_PROBE(compile_end, 0, pattern_size, errcode);
+    PCRE2_UCHAR buffer[256];
+    pcre2_get_error_message(errcode, buffer, sizeof(buffer));
+    fprintf(stderr,"%s: PCRE2 compilation failed at offset %d: %s\n", who, (int)erroffset, buffer);
+    return NULL;
+  }
 
-} // regex_compile
+  e = regex_cache_add(pattern, pattern_size, options, re, limited, rewritten);
+  REGEX_PROBE(compile_end, e->id, pattern_size, 0);
+  return e;
+}
 
+/*
+  The slow log: matches that take longer than regex_slow_ticks are
+  appended to regex_slow_file as a line
+    elapsed_ns <TAB> subject_length <TAB> pattern
+  See regex_slow_log/2.
+*/
+static FILE* regex_slow_file = NULL;
+static uint64_t regex_slow_ticks = 0;
+static double regex_slow_ns_per_tick = 1.0;
+static pthread_mutex_t regex_slow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void regex_slow_log_write(regex_cache_entry* entry, PCRE2_SIZE length, uint64_t ticks) {
+  pthread_mutex_lock(&regex_slow_lock);
+  if (regex_slow_file != NULL) {
+    fprintf(regex_slow_file, "%llu\t%llu\t", (unsigned long long)(ticks * regex_slow_ns_per_tick),
+            (unsigned long long)length);
+    for (size_t i = 0; i < entry->pattern_size; i++) {
+      // keep it one line per entry
+      char c = entry->pattern[i];
+      if (c == '\n') {
+        fputs("\\n", regex_slow_file);
+      } else if (c == '\t') {
+        fputs("\\t", regex_slow_file);
+      } else {
+        fputc(c, regex_slow_file);
+      }
+    }
+    fputc('\n', regex_slow_file);
+    fflush(regex_slow_file);
+  }
+  pthread_mutex_unlock(&regex_slow_lock);
+}
+
+// Add the time of a match/substitute to the statistics
+static void regex_record_match(regex_stats_t* stats, regex_cache_entry* entry, PCRE2_SIZE length,
+                               uint64_t ticks, int failed) {
+  stats->match_ticks += ticks;
+  stats->matches++;
+  if (failed) {
+    stats->match_failures++;
+  }
+  int b = ticks == 0 ? 0 : 63 - __builtin_clzll(ticks);
+  if (b >= REGEX_HISTOGRAM_BUCKETS) {
+    b = REGEX_HISTOGRAM_BUCKETS-1;
+  }
+  // The entry may be shared between threads.
+  __atomic_fetch_add(&entry->calls, 1, __ATOMIC_RELAXED);
+  if (failed) {
+    __atomic_fetch_add(&entry->failures, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&entry->total_ticks, ticks, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&entry->histogram[b], 1, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&entry->max_ticks, __ATOMIC_RELAXED);
+  while (ticks > max &&
+         !__atomic_compare_exchange_n(&entry->max_ticks, &max, ticks, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+  if (regex_slow_ticks > 0 && ticks > regex_slow_ticks) {
+    regex_slow_log_write(entry, length, ticks);
+  }
+}
 
+/*
+  pcre2_match with statistics.
+*/
+static int regex_pcre2_match(regex_cache_entry* entry, PCRE2_SPTR subject, PCRE2_SIZE length, PCRE2_SIZE start_offset,
+                             uint32_t options, pcre2_match_data* match_data) {
+  regex_stats_t* stats = regex_stats_get();
+  REGEX_PROBE(match_start, entry->id, length);
+  uint64_t t0 = regex_ticks();
+  int rc = pcre2_match(entry->re, subject, length, start_offset, options, match_data,
+                       entry->limited ? regex_redos_context : NULL);
+  regex_record_match(stats, entry, length, regex_ticks() - t0, rc < 0);
+  REGEX_PROBE(match_end, entry->id, length, rc);
+  return rc;
+}
 
 /*
-  regex_match/2: regex_capture(Subject)
+  pcre2_substitute with statistics.
+*/
+static int regex_pcre2_substitute(regex_cache_entry* entry, PCRE2_SPTR subject, PCRE2_SIZE length, uint32_t options,
+                                  PCRE2_SPTR replacement, PCRE2_SIZE rlength,
+                                  PCRE2_UCHAR* output, PCRE2_SIZE* outlen) {
+  regex_stats_t* stats = regex_stats_get();
+  REGEX_PROBE(match_start, entry->id, length);
+  uint64_t t0 = regex_ticks();
+  int rc = pcre2_substitute(entry->re, subject, length, 0, options, NULL,
+                            entry->limited ? regex_redos_context : NULL,
+                            replacement, rlength, output, outlen);
+  regex_record_match(stats, entry, length, regex_ticks() - t0, rc < 0 && rc != PCRE2_ERROR_NOMEMORY);
+  REGEX_PROBE(match_end, entry->id, length, rc);
+  return rc;
+}
 
-  Matches the previous compiled pattern.
 
+/*
+  Prepared subjects (regex_subject/1)
+
+  When the same (large) subject is matched against many patterns (e.g.
+  the rules of a rule engine) it can be converted once with
+  regex_subject/1 instead of in each call. A subject has the UTF-8
+  bytes and their length, if they are valid UTF-8 (checked once: the
+  matches of a (*UTF) pattern are then done with PCRE2_NO_UTF_CHECK),
+  and the start of each line. The code points (for the 32-bit library)
+  and the map from byte offsets to code point offsets (for
+  regex_find_positions/3) are built when they are first needed.
+
+  The match predicates (regex/2, regex_capture/3,4, regex_match/1,
+  regex_match_capture/2, regex_find_matches/4,5, regex_split/4,
+  regex_replace/4, regex_replace_first/4 and regex_fullmatch/2) accept
+  a subject instead of a string.
+
+  The subject is referred to from Picat as $regex_subject(Id). The
+  subjects are kept in a hash table indexed by Id (the ids are given
+  out in order, so Id modulo the number of buckets spreads them
+  evenly), which every match predicate looks up.
 */
-int regex_match() {
-
-  if (re == NULL) {
-    fprintf(stderr,"regex_match: No defined pattern!");
-    return PICAT_FALSE;
+#define REGEX_SUBJECT_STEP 64 // bytes per entry in the code point map
+#define REGEX_SUBJECT_BUCKETS 256
+
+typedef struct regex_subject {
+  int id;
+  char* data;
+  size_t length;
+  int utf_valid;          // data is valid UTF-8
+  size_t* lines;          // the offset of the start of each line
+  size_t num_lines;
+  uint32_t* codes;        // the code points (built when needed)
+  size_t num_codes;
+  size_t* code_offsets;   // the code point offset of byte i*REGEX_SUBJECT_STEP (built when needed)
+  struct regex_subject* next; // the next subject in the bucket
+} regex_subject_t;
+
+static regex_subject_t* regex_subjects[REGEX_SUBJECT_BUCKETS];
+static int regex_subject_next_id = 1;
+
+// True if the n bytes in s are valid UTF-8
+static int regex_utf8_valid(const unsigned char* s, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    if (s[i] < 0x80) {
+      i++;
+      continue;
+    }
+    int len;
+    int c = regex_utf8_decode(s+i, s+n, &len);
+    if (len == 1 || (len == 2 && c < 0x80) || (len == 3 && c < 0x800) || (len == 4 && c < 0x10000) ||
+        (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff) {
+      return 0;
+    }
+    i += len;
   }
-  
-  TERM subject_p = picat_get_call_arg(1,1); /* Subject string */
+  return 1;
+}
+
+static int regex_is_subject(TERM t) {
+  return picat_is_structure(t) && strcmp(picat_get_struct_name(t), "regex_subject") == 0 &&
+    picat_get_struct_arity(t) == 1;
+}
+
+static regex_subject_t* regex_find_subject(TERM t, char* who) {
+  if (regex_is_subject(t)) {
+    int id = picat_get_integer(picat_get_arg(1, t));
+    for (regex_subject_t* s = regex_subjects[(unsigned)id % REGEX_SUBJECT_BUCKETS]; s != NULL; s = s->next) {
+      if (s->id == id) {
+        return s;
+      }
+    }
+  }
+  fprintf(stderr,"%s: not a subject (or the subject has been freed)\n", who);
+  return NULL;
+}
 
-  char* subject_s = picat_string_to_cstring(subject_p);
-  // printf("subject_s: %s subject_len: %ld\n", subject_s, strlen(subject_s));
-  
-  size_t subject_size = strlen(subject_s);  
+/*
+  The bytes (and *size) of the subject t, a string or a subject.
+  *buffer is the converted string, to be freed by the caller (NULL for
+  a subject), and *options is PCRE2_NO_UTF_CHECK for a valid UTF-8
+  subject (else 0). Returns NULL (with an error message) if t is a
+  subject that doesn't exist (or has been freed).
+*/
+static char* regex_get_subject(TERM t, size_t* size, char** buffer, uint32_t* options, char* who) {
+  *options = 0;
+  if (regex_is_subject(t)) {
+    *buffer = NULL;
+    regex_subject_t* s = regex_find_subject(t, who);
+    if (s == NULL) {
+      *size = 0;
+      return NULL;
+    }
+    *size = s->length;
+    *options = s->utf_valid ? PCRE2_NO_UTF_CHECK : 0;
+    return s->data;
+  }
+  *buffer = regex_get_cstring(t, size);
+  return *buffer;
+}
+
+// The subject data (length bytes, which it owns) with its line index
+static regex_subject_t* regex_subject_new(char* data, size_t length) {
+  regex_subject_t* s = calloc(1, sizeof(regex_subject_t));
+  s->data = data;
+  s->length = length;
+  s->utf_valid = regex_utf8_valid((const unsigned char*)data, length);
+  size_t alloc = 64;
+  s->lines = malloc(alloc * sizeof(size_t));
+  s->lines[s->num_lines++] = 0;
+  for (const char* p = data; (p = memchr(p, '\n', data + length - p)) != NULL; ) {
+    p++;
+    if (s->num_lines == alloc) {
+      alloc *= 2;
+      s->lines = realloc(s->lines, alloc * sizeof(size_t));
+    }
+    s->lines[s->num_lines++] = p - data;
+  }
+  return s;
+}
+
+static void regex_subject_delete(regex_subject_t* s) {
+  free(s->data);
+  free(s->lines);
+  free(s->codes);
+  free(s->code_offsets);
+  free(s);
+}
+
+// The code points of the subject s
+static uint32_t* regex_subject_codes(regex_subject_t* s, size_t* size) {
+  if (s->codes == NULL) {
+    s->codes = malloc((s->length+1) * sizeof(uint32_t));
+    const unsigned char* p = (const unsigned char*)s->data;
+    const unsigned char* end = p + s->length;
+    while (p < end) {
+      int len;
+      s->codes[s->num_codes++] = regex_utf8_decode(p, end, &len);
+      p += len;
+    }
+  }
+  *size = s->num_codes;
+  return s->codes;
+}
 
-  uint32_t match_options = 0; 
+/*
+  The code point offset of the byte offset offset (at the start of a
+  character): the offset of the last map entry plus the characters
+  after it.
+*/
+static size_t regex_subject_code_offset(regex_subject_t* s, size_t offset) {
+  if (s->code_offsets == NULL) {
+    size_t n = s->length / REGEX_SUBJECT_STEP + 1;
+    s->code_offsets = malloc(n * sizeof(size_t));
+    size_t codes = 0;
+    for (size_t i = 0; i < s->length; i++) {
+      if (i % REGEX_SUBJECT_STEP == 0) {
+        s->code_offsets[i / REGEX_SUBJECT_STEP] = codes;
+      }
+      codes += ((unsigned char)s->data[i] & 0xc0) != 0x80;
+    }
+    if (s->length % REGEX_SUBJECT_STEP == 0) {
+      s->code_offsets[s->length / REGEX_SUBJECT_STEP] = codes;
+    }
+  }
+  size_t codes = s->code_offsets[offset / REGEX_SUBJECT_STEP];
+  for (size_t i = offset - offset % REGEX_SUBJECT_STEP; i < offset; i++) {
+    codes += ((unsigned char)s->data[i] & 0xc0) != 0x80;
+  }
+  return codes;
+}
 
-  // pcre2_match_data *match_data;
-  uint32_t ovecsize = 1024;
+/*
+  regex_subject/2: regex_subject(String,Subject)
+*/
+int regex_subject() {
+  TERM string_p = picat_get_call_arg(1,2);
+  TERM subject_p = picat_get_call_arg(2,2);
 
-  int ret = PICAT_FALSE;
+  size_t size;
+  char* data = regex_get_cstring(string_p, &size);
+  regex_subject_t* s = regex_subject_new(data, size);
+  s->id = regex_subject_next_id++;
+  regex_subject_t** bucket = &regex_subjects[(unsigned)s->id % REGEX_SUBJECT_BUCKETS];
+  s->next = *bucket;
+  *bucket = s;
 
-  pcre2_match_data *match_data = pcre2_match_data_create(ovecsize, NULL);
-  int rc = pcre2_match(re, subject_s, subject_size, 0, match_options, match_data, NULL);
-  
-  if(rc == 0) {
-    fprintf(stderr,"offset vector too small: %d",rc);
-    
-  } else if(rc > 0) {
+  TERM subject = picat_build_structure("regex_subject",1);
+  picat_unify(picat_get_arg(1,subject), picat_build_integer(s->id));
+  return picat_unify(subject_p, subject);
 
-    ret = PICAT_TRUE;
-    
-  } else if (rc < 0) {
+} // regex_subject
 
-    // No match
-    ; 
+/*
+  regex_subject_free/1: regex_subject_free(Subject)
+*/
+int regex_subject_free() {
+  TERM subject_p = picat_get_call_arg(1,1);
+
+  regex_subject_t* s = regex_find_subject(subject_p, "regex_subject_free");
+  if (s == NULL) {
+    return PICAT_FALSE;
   }
+  for (regex_subject_t** p = &regex_subjects[(unsigned)s->id % REGEX_SUBJECT_BUCKETS]; *p != NULL; p = &(*p)->next) {
+    if (*p == s) {
+      *p = s->next;
+      break;
+    }
+  }
+  regex_subject_delete(s);
 
-  pcre2_match_data_free(match_data);
+  return PICAT_TRUE;
 
-  free(subject_s);
-  
-  return ret;
+} // regex_subject_free
 
-} // regex_match
- 
 
 /*
-  regex_match_capture/2: regex_capture(Subject,Capture)
-  Matches the previous compiled pattern.
+  Code point matching with the 32-bit library (libpcre2-32).
+
+  A Picat string is a list of code points, so with the 8-bit library a
+  non-ASCII string is encoded as UTF-8 for the match and the captures
+  are decoded again. A pattern that starts with (*UTF) is instead
+  compiled with the 32-bit library by regex/2, regex_capture/3,4 and
+  regex_find_matches/4,5: the code points of the subject are copied
+  directly to a uint32_t buffer, and the offsets of the captures are
+  the positions in the Picat string.
+
+  The pattern has its own cache entry (width 32), which is not saved
+  by regex_cache_save/1, and its matches are not memoized.
+  The other predicates use the 8-bit library (in UTF-8 mode) for a
+  (*UTF) pattern.
+*/
+static int regex_is_utf32(const char* pattern, size_t pattern_size) {
+  return pattern_size >= 6 && memcmp(pattern, "(*UTF)", 6) == 0;
+}
 
-  Capture is a list of captures:
-  * Capture[1] is the full captured string
-  * Capture[i] i>1, is the i-1 capture
+/*
+  The code points of the Picat string t (a list of characters or
+  codes) in a (malloc:ed) buffer of *size code points.
+*/
+static uint32_t* regex_get_codes(TERM t, size_t* size) {
+  REGEX_PROBE(convert_start);
+  uint64_t t0 = regex_ticks();
+  size_t n = 0, max = 64;
+  uint32_t* codes = malloc(max * sizeof(uint32_t));
+  for (; picat_is_list(t); t = picat_get_cdr(t)) {
+    if (n == max) {
+      max *= 2;
+      codes = realloc(codes, max * sizeof(uint32_t));
+    }
+    TERM c = picat_get_car(t);
+    if (picat_is_integer(c)) {
+      codes[n++] = (uint32_t)picat_get_integer(c);
+    } else {
+      const unsigned char* name = (const unsigned char*)picat_get_atom_name(c);
+      int len;
+      codes[n++] = name[0] < 128 ? name[0] : regex_utf8_decode(name, name + strlen((char*)name), &len);
+    }
+  }
+  *size = n;
+  regex_stats_t* stats = regex_stats_get();
+  stats->bytes_in += n * sizeof(uint32_t);
+  stats->convert_ticks += regex_ticks() - t0;
+  REGEX_PROBE(convert_end, n * sizeof(uint32_t));
+  return codes;
+}
 
+/*
+  The same as regex_cache_lookup() for the 32-bit library. The entry
+  is keyed by the (UTF-8) pattern, which is decoded only when it's
+  compiled.
 */
-int regex_match_capture() {
-  
-  TERM subject_p = picat_get_call_arg(1,2); /* Subject string */
-  TERM capture_p = picat_get_call_arg(2,2); /* output argument: Captures */
-  
-  char* subject_s = picat_string_to_cstring(subject_p);
-  // printf("subject_s: %s subject_len: %ld\n", subject_s,strlen(subject_s));
-  
-  size_t subject_size = strlen(subject_s);  
+static regex_cache_entry* regex_cache_lookup_32(char* pattern, size_t pattern_size, uint32_t options, char* who) {
+  regex_stats_t* stats = regex_stats_get();
+  uint64_t h = regex_hash(pattern, pattern_size, options);
+  for (regex_cache_entry* e = regex_cache[h % REGEX_CACHE_BUCKETS]; e != NULL; e = e->next) {
+    if (e->hash == h && e->width == 32 && e->options == options && e->pattern_size == pattern_size &&
+        memcmp(e->pattern, pattern, pattern_size) == 0) {
+      stats->cache_hits++;
+      return e;
+    }
+  }
+  stats->cache_misses++;
 
-  uint32_t match_options = 0; 
-  uint32_t ovecsize = 1024;
+  int limited;
+  if (!regex_redos_check(pattern, pattern_size, &limited, who)) {
+    return NULL;
+  }
+  uint32_t* codes = malloc((pattern_size+1) * sizeof(uint32_t));
+  size_t n = 0;
+  const unsigned char* p = (const unsigned char*)pattern;
+  const unsigned char* end = p + pattern_size;
+  while (p < end) {
+    int len;
+    codes[n++] = regex_utf8_decode(p, end, &len);
+    p += len;
+  }
 
-  TERM ret_list = picat_build_list();
-  TERM car = picat_get_car(ret_list);
-  TERM cdr = picat_get_cdr(ret_list);
+  int errcode;
+  PCRE2_SIZE erroffset;
+  REGEX_PROBE(compile_start, pattern_size);
+  uint64_t t0 = regex_ticks();
+  pcre2_code_32* re32 = pcre2_compile_32((PCRE2_SPTR32)codes, n, options, &errcode, &erroffset, NULL);
+  stats->compile_ticks += regex_ticks() - t0;
+  stats->compiles++;
+  free(codes);
+  if (re32 == NULL) {
+    REGEX_PROBE(compile_end, 0, pattern_size, errcode);
+    PCRE2_UCHAR buffer[256];
+    pcre2_get_error_message(errcode, buffer, sizeof(buffer));
+    fprintf(stderr,"%s: PCRE2 compilation failed at offset %d: %s\n", who, (int)erroffset, buffer);
+    return NULL;
+  }
 
-  int ret = PICAT_FALSE;
+  regex_cache_entry* e = regex_cache_insert(pattern, pattern_size, options, NULL);
+  e->width = 32;
+  e->re32 = re32;
+  e->limited = limited;
+  REGEX_PROBE(compile_end, e->id, pattern_size, 0);
+  return e;
+}
 
-  pcre2_match_data *match_data = pcre2_match_data_create(ovecsize, NULL);
-  int rc = pcre2_match(re, subject_s, subject_size, 0, match_options, match_data, NULL);
-  if(rc == 0) {
-    fprintf(stderr,"offset vector too small: %d",rc);
-    
-  } else if(rc > 0) {
-    
-    PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
-    PCRE2_SIZE i;
-    for(int i = 0; i < rc; i++) {
-      PCRE2_SPTR start = subject_s + ovector[2*i];
-      PCRE2_SIZE slen = ovector[2*i+1] - ovector[2*i];
-      // printf( "%2d: %.*s\n", i, (int)slen, (char *)start );
-
-      if (i < rc-1) {
-        // All but last captures
-        picat_unify(car,cstring_to_picat((char*) start, slen));         
-        TERM temp = picat_build_list();
-        
-        picat_unify(cdr, temp);
-        car = picat_get_car(temp);
-        cdr = picat_get_cdr(temp);
-        
-      } else {
-        // Last capture
-        picat_unify(car,cstring_to_picat((char *)start, slen));
-      }
-    }
+/*
+  pcre2_match_32 with statistics.
+*/
+static int regex_pcre2_match_32(regex_cache_entry* entry, PCRE2_SPTR32 subject, PCRE2_SIZE length,
+                                PCRE2_SIZE start_offset, uint32_t options, pcre2_match_data_32* match_data) {
+  regex_stats_t* stats = regex_stats_get();
+  REGEX_PROBE(match_start, entry->id, length);
+  uint64_t t0 = regex_ticks();
+  int rc = pcre2_match_32(entry->re32, subject, length, start_offset, options, match_data,
+                          entry->limited ? regex_redos_context_32 : NULL);
+  regex_record_match(stats, entry, length, regex_ticks() - t0, rc < 0);
+  REGEX_PROBE(match_end, entry->id, length, rc);
+  return rc;
+}
 
-    ret = PICAT_TRUE;
-    
-  } else if (rc < 0) {
+/*
+  regex/2, regex_capture/3,4 and regex_find_matches/4,5 for a (*UTF)
+  pattern. Finds at most num_to_find (0: all) matches of the pattern
+  in the subject. If output_p is not NULL it's unified with the result
+  in the format format: the captures of the first match if captures
+  is 1, otherwise the matches (see regex_result_add_match()).
+  The empty matches are handled as in regex_find_matches_term().
+*/
+static int regex_find_32(char* pattern_s, size_t pattern_size, TERM subject_p, int num_to_find, int captures,
+                         TERM output_p, int format, char* who) {
+  regex_cache_entry* entry = regex_cache_lookup_32(pattern_s, pattern_size, 0, who);
+  if (entry == NULL) {
+    if (captures) {
+      picat_unify(output_p, regex_build_container(NULL, 0, format, who));
+    }
+    return PICAT_FALSE;
+  }
 
-    // No match
-    ; 
+  size_t length;
+  uint32_t* subject;
+  uint32_t* buffer = NULL;
+  uint32_t subject_options = 0;
+  if (regex_is_subject(subject_p)) {
+    regex_subject_t* s = regex_find_subject(subject_p, who);
+    if (s == NULL) {
+      return PICAT_FALSE;
+    }
+    subject = regex_subject_codes(s, &length);
+    subject_options = s->utf_valid ? PCRE2_NO_UTF_CHECK : 0;
+  } else {
+    subject = buffer = regex_get_codes(subject_p, &length);
+  }
+  uint32_t newline;
+  (void)pcre2_pattern_info_32(entry->re32, PCRE2_INFO_NEWLINE, &newline);
+  int crlf_is_newline = newline == PCRE2_NEWLINE_ANY || newline == PCRE2_NEWLINE_CRLF ||
+    newline == PCRE2_NEWLINE_ANYCRLF;
+
+  pcre2_match_data_32* match_data = pcre2_match_data_create_from_pattern_32(entry->re32, NULL);
+  PCRE2_SIZE* ovector = pcre2_get_ovector_pointer_32(match_data);
+  regex_result matches;
+  regex_result_init_32(&matches, subject);
+  int num_matches = 0;
+  int ok = 1;
+  PCRE2_SIZE start_offset = 0;
+  uint32_t options = 0;
+  for (;;) {
+    int rc = regex_pcre2_match_32(entry, subject, length, start_offset, options | subject_options, match_data);
+    if (rc == PCRE2_ERROR_NOMATCH) {
+      if (options == 0) {
+        break;
+      }
+      // No non-empty match where the empty match was: advance one character
+      // (two at a CRLF) and continue.
+      start_offset++;
+      if (crlf_is_newline && start_offset < length &&
+          subject[start_offset-1] == '\r' && subject[start_offset] == '\n') {
+        start_offset++;
+      }
+      options = 0;
+      continue;
+    }
+    if (rc < 0) {
+      fprintf(stderr, "%s: matching error %d\n", who, rc);
+      ok = 0;
+      break;
+    }
+    if (ovector[0] > ovector[1]) {
+      printf("\\K was used in an assertion to set the match start after its end.\n"
+             "Run abandoned\n");
+      ok = 0;
+      break;
+    }
+    if (captures) {
+      regex_result_add(&matches, ovector, 0, rc, 0);
+    } else {
+      regex_result_add_match(&matches, ovector, rc);
+    }
+    num_matches++;
+    if (num_to_find != 0 && num_matches >= num_to_find) {
+      break;
+    }
+    options = 0;
+    if (ovector[0] == ovector[1]) {
+      if (ovector[0] == length) {
+        break;
+      }
+      options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
+      start_offset = ovector[1];
+    } else {
+      // \K in a lookbehind may end the match where it started
+      PCRE2_SIZE startchar = pcre2_get_startchar_32(match_data);
+      start_offset = ovector[1];
+      if (start_offset <= startchar) {
+        if (startchar >= length) {
+          break;
+        }
+        start_offset = startchar + 1;
+      }
+    }
   }
+  pcre2_match_data_free_32(match_data);
 
-  pcre2_match_data_free(match_data);
-  // pcre2_code_free(re);
-  
-  picat_unify(cdr, picat_build_nil()); // add tail []
-  picat_unify(ret_list, capture_p); // output
+  int ret = ok && num_matches > 0 ? PICAT_TRUE : PICAT_FALSE;
+  if (output_p != (TERM)NULL && (ret == PICAT_TRUE || captures)) {
+    TERM output;
+    if (regex_result_build(&matches, format, who, &output)) {
+      picat_unify(output_p, output);
+    } else {
+      ret = PICAT_FALSE;
+    }
+  }
+  regex_result_free(&matches);
+  free(buffer);
 
-  free(subject_s);
-  
   return ret;
+}
 
-} // regex_match_capture
 
+/*
+  Memo of match results.
+
+  When the same patterns are matched against the same subjects again
+  and again (e.g. a Wordle solver that re-filters the word list after
+  each guess) the result of a match can be remembered instead of
+  calling pcre2_match. The memo is off by default, regex_memo/1 sets
+  its size (the max number of remembered results).
+
+  The memo is a direct-mapped table, i.e. a new result replaces the
+  result in its slot, keyed by a 64-bit hash of the pattern's id (in
+  the pattern cache) and the subject. The subject is stored in the
+  slot as well, so a hash collision never gives a wrong result.
+  A slot has the result of pcre2_match (matched or not) and, if it's
+  not more than REGEX_MEMO_MAX_CAPTURES, the offsets of the captures
+  as 16 bit integers.
+
+  Only subjects of at most REGEX_MEMO_MAX_SUBJECT bytes are memoized:
+  for longer subjects the hashing and comparing cost too much compared
+  to the match. The options of regex_memo_match() (PCRE2_NO_UTF_CHECK
+  for a prepared subject) don't change the result.
+*/
+#define REGEX_MEMO_MAX_SUBJECT 256
+#define REGEX_MEMO_MAX_CAPTURES 16
+#define REGEX_MEMO_UNSET 0xFFFF // PCRE2_UNSET (a group that didn't match)
+
+typedef struct {
+  uint64_t hash;
+  uint32_t id;         // the pattern's id, 0 for an empty slot
+  uint32_t length;     // the subject's length
+  int rc;              // > 0: match (the number of captures), < 0: no match
+  int has_offsets;     // the offsets of the rc captures are stored
+  uint16_t* data;      // the 2*rc offsets (if has_offsets) and then the subject
+} regex_memo_slot;
+
+static regex_memo_slot* regex_memo_table = NULL;
+static size_t regex_memo_size = 0;  // 0: the memo is off
+static size_t regex_memo_count = 0; // number of used slots
+static PCRE2_SIZE regex_memo_ovector[2*REGEX_MEMO_MAX_CAPTURES];
+
+// wyhash style multiply-mix
+static inline uint64_t regex_memo_mix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static uint64_t regex_memo_hash(uint32_t id, const char* s, size_t len) {
+  uint64_t h = regex_memo_mix(id ^ 0xa0761d6478bd642fULL, len ^ 0xe7037ed1a0b428dbULL);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, s + i, 8);
+    h = regex_memo_mix(w ^ 0x8ebc6af09c88c6e3ULL, h ^ 0x589965cc75374cc3ULL);
+  }
+  if (i < len) {
+    uint64_t w = 0;
+    memcpy(&w, s + i, len - i);
+    h = regex_memo_mix(w ^ 0x8ebc6af09c88c6e3ULL, h ^ 0x1d8e4e27c47d124fULL);
+  }
+  return regex_memo_mix(h, 0xa0761d6478bd642fULL);
+}
+
+static void regex_memo_clear(void) {
+  for (size_t i = 0; i < regex_memo_size; i++) {
+    free(regex_memo_table[i].data);
+  }
+  free(regex_memo_table);
+  regex_memo_table = NULL;
+  regex_memo_size = 0;
+  regex_memo_count = 0;
+}
 
 /*
-  Replace(Pattern,Replacement,String,Result)
-  Replace all occurrences of Pattern with Replacement in String
+  pcre2_match of the whole subject (from offset 0, no match options)
+  via the memo.
+  If ovector is not NULL the offsets of the captures are needed and
+  *ovector is set to them (from match_data or from the memo). With
+  ovector == NULL only the result (match or not) is used, and a match
+  with a too small ovector (rc == 0) is returned as rc == 1.
+*/
+static int regex_memo_match(regex_cache_entry* entry, const char* subject, size_t length, uint32_t options,
+                            pcre2_match_data* match_data, PCRE2_SIZE** ovector) {
+  if (regex_memo_size == 0 || length > REGEX_MEMO_MAX_SUBJECT) {
+    int rc = regex_pcre2_match(entry, (PCRE2_SPTR)subject, length, 0, options, match_data);
+    if (ovector != NULL) {
+      *ovector = pcre2_get_ovector_pointer(match_data);
+    } else if (rc == 0) {
+      rc = 1;
+    }
+    return rc;
+  }
 
-  This is adapted from 
-  https://stackoverflow.com/questions/73800119/replace-all-matches-in-pcre2-substitute-in-c
+  regex_stats_t* stats = regex_stats_get();
+  uint64_t h = regex_memo_hash(entry->id, subject, length);
+  regex_memo_slot* slot = &regex_memo_table[h % regex_memo_size];
+  if (slot->id == entry->id && slot->hash == h && slot->length == length &&
+      (ovector == NULL || slot->rc < 0 || slot->has_offsets)) {
+    int n = slot->has_offsets ? 2*slot->rc : 0;
+    if (memcmp(slot->data + n, subject, length) == 0) {
+      stats->memo_hits++;
+      if (ovector != NULL) {
+        for (int i = 0; i < n; i++) {
+          regex_memo_ovector[i] = slot->data[i] == REGEX_MEMO_UNSET ? PCRE2_UNSET : slot->data[i];
+        }
+        *ovector = regex_memo_ovector;
+      }
+      return slot->rc;
+    }
+  }
+  stats->memo_misses++;
+
+  int rc = regex_pcre2_match(entry, (PCRE2_SPTR)subject, length, 0, options, match_data);
+  PCRE2_SIZE* ov = pcre2_get_ovector_pointer(match_data);
+  if (rc >= 0 || rc == PCRE2_ERROR_NOMATCH) {
+    // rc == 0 (the ovector of match_data is too small for the captures,
+    // e.g. the 1 pair of regex_count/2) is stored as a match without
+    // offsets, so a later caller that needs the captures matches again
+    int has_offsets = rc > 0 && rc <= REGEX_MEMO_MAX_CAPTURES;
+    int n = has_offsets ? 2*rc : 0;
+    if (slot->id == 0) {
+      regex_memo_count++;
+    }
+    free(slot->data);
+    slot->data = malloc(n * sizeof(uint16_t) + length + 1);
+    for (int i = 0; i < n; i++) {
+      slot->data[i] = ov[i] == PCRE2_UNSET ? REGEX_MEMO_UNSET : (uint16_t)ov[i];
+    }
+    memcpy(slot->data + n, subject, length);
+    slot->hash = h;
+    slot->id = entry->id;
+    slot->length = length;
+    slot->rc = rc == 0 ? 1 : rc;
+    slot->has_offsets = has_offsets;
+  }
+  if (ovector != NULL) {
+    *ovector = ov;
+  } else if (rc == 0) {
+    rc = 1;
+  }
+  return rc;
+}
 
- */
-int regex_replace() {
+/*
+  regex_memo/1: regex_memo(Size)
+  Turns on the memo of match results with (at most) Size results,
+  or turns it off if Size is 0. The memo is always cleared.
+  See regex_memo/1 in regex.pi.
+*/
+int regex_memo() {
+  TERM size_p = picat_get_call_arg(1,1);
+  if (!picat_is_integer(size_p) || picat_get_integer(size_p) < 0) {
+    fprintf(stderr, "regex_memo: Size should be a non-negative integer\n");
+    return PICAT_FALSE;
+  }
+  size_t size = (size_t)picat_get_integer(size_p);
+  regex_memo_clear();
+  if (size > 0) {
+    regex_memo_table = calloc(size, sizeof(regex_memo_slot));
+    if (regex_memo_table == NULL) {
+      fprintf(stderr, "regex_memo: out of memory\n");
+      return PICAT_FALSE;
+    }
+    regex_memo_size = size;
+  }
 
-  TERM pattern_p = picat_get_call_arg(1,4);  
-  TERM replacement_p = picat_get_call_arg(2,4);
-  TERM subject_p = picat_get_call_arg(3,4);
-  TERM result_p = picat_get_call_arg(4,4);
+  return PICAT_TRUE;
 
- 
-  char* pattern_s = picat_string_to_cstring(pattern_p);
-  char* replacement_s = picat_string_to_cstring(replacement_p);
-  char* subject_s = picat_string_to_cstring(subject_p);
-  
-  int output_size_int = strlen(subject_s);
- 
-  size_t subject_length = strlen((char *)subject_s);
-  size_t replacement_length = strlen((char *)replacement_s);
- 
-  int errornumber;
-  PCRE2_SIZE erroroffset;
-  long signed int compile_options = PCRE2_ZERO_TERMINATED;
-  pcre2_code *re = pcre2_compile(pattern_s, compile_options, 0, &errornumber, &erroroffset, NULL);
-  if (re == NULL) {
-    PCRE2_UCHAR buffer[256];
-    pcre2_get_error_message(errornumber, buffer, sizeof(buffer));
-    printf("PCRE2 compilation failed at offset %d: %s\n", (int)erroroffset, buffer);
+} // regex_memo
 
-    free(pattern_s);
-    free(replacement_s);  
-    free(subject_s);
 
-    return PICAT_FALSE;
+/*
+  regex_stats/1: regex_stats(Stats)
+  Stats is a list of Key=Value with the (summed) statistics of all threads.
+  Times are in ns.
+
+  See regex_stats/0 in regex.pi which returns a map.
+*/
+static TERM regex_key_value(char* key, uint64_t value) {
+  TERM kv = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, kv), picat_build_atom(key));
+  picat_unify(picat_get_arg(2, kv), picat_build_integer((BPLONG)value));
+  return kv;
+}
+
+int regex_stats() {
+  TERM stats_p = picat_get_call_arg(1,1);
+
+  regex_stats_t sum;
+  memset(&sum, 0, sizeof(sum));
+  regex_stats_get(); // ensure that the calibration is done
+  pthread_mutex_lock(&regex_stats_lock);
+  for (regex_stats_t* s = regex_all_stats; s != NULL; s = s->next) {
+    sum.compiles += s->compiles;
+    sum.cache_hits += s->cache_hits;
+    sum.cache_misses += s->cache_misses;
+    sum.matches += s->matches;
+    sum.match_failures += s->match_failures;
+    sum.bytes_in += s->bytes_in;
+    sum.bytes_out += s->bytes_out;
+    sum.convert_ticks += s->convert_ticks;
+    sum.compile_ticks += s->compile_ticks;
+    sum.match_ticks += s->match_ticks;
+    sum.build_ticks += s->build_ticks;
+    sum.memo_hits += s->memo_hits;
+    sum.memo_misses += s->memo_misses;
+    sum.length_rejects += s->length_rejects;
+  }
+  pthread_mutex_unlock(&regex_stats_lock);
+  double ns_per_tick = regex_ns_per_tick();
+
+  TERM kvs[] = {
+    regex_key_value("compiles", sum.compiles),
+    regex_key_value("cache_hits", sum.cache_hits),
+    regex_key_value("cache_misses", sum.cache_misses),
+    regex_key_value("cache_size", regex_cache_count),
+    regex_key_value("matches", sum.matches),
+    regex_key_value("match_failures", sum.match_failures),
+    regex_key_value("bytes_in", sum.bytes_in),
+    regex_key_value("bytes_out", sum.bytes_out),
+    regex_key_value("convert_ns", (uint64_t)(sum.convert_ticks * ns_per_tick)),
+    regex_key_value("compile_ns", (uint64_t)(sum.compile_ticks * ns_per_tick)),
+    regex_key_value("match_ns", (uint64_t)(sum.match_ticks * ns_per_tick)),
+    regex_key_value("build_ns", (uint64_t)(sum.build_ticks * ns_per_tick)),
+    regex_key_value("memo_hits", sum.memo_hits),
+    regex_key_value("memo_misses", sum.memo_misses),
+    regex_key_value("memo_size", regex_memo_count),
+    regex_key_value("length_rejects", sum.length_rejects)
+  };
+  int n = sizeof(kvs)/sizeof(kvs[0]);
+  TERM list = picat_build_nil();
+  for (int i = n-1; i >= 0; i--) {
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), kvs[i]);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
   }
 
-  // The initial output size might not be enough so we
-  // might have to increase the output buffer.
-  int output_mult = 1; // times the original output_size
-  while (1) {
-    int output_size_to_use = output_size_int*output_mult;
-    // PCRE2_UCHAR output[output_size_to_use];
-    PCRE2_UCHAR *output;
-    output = malloc(output_size_to_use * sizeof(PCRE2_UCHAR));
-    strcpy(output,"");
+  return picat_unify(stats_p, list);
 
-    PCRE2_SIZE outlen = output_size_to_use; // sizeof(output) / sizeof(PCRE2_UCHAR);
-    // Note: pcre2_substitute adjusts the outlen.
-    int rc = pcre2_substitute(re, subject_s, subject_length, 0,
-                              PCRE2_SUBSTITUTE_OVERFLOW_LENGTH | PCRE2_SUBSTITUTE_GLOBAL,
-                              NULL, NULL,
-                              replacement_s, replacement_length, output, &outlen);
-    
-    if (rc == PCRE2_ERROR_NOMEMORY) {
-      // Increase the size of the output buffer and check again.
-      output_mult *= 2;
-      free(output);
-      // printf("output_mult: %d new size: %d\n",output_mult, output_size_to_use);
-      
-    } else if(rc < 0) {
-      // Some error
-      PCRE2_UCHAR error_buffer[256];
-      pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
-      printf("PCRE2 substitute error (rc:%d): %s\n", (int)rc, error_buffer);
-      
-      free(pattern_s);
-      free(replacement_s);  
-      free(subject_s);
-      free(output);
-      
-      return PICAT_FALSE;
-      
-    } else {
+} // regex_stats
 
-      picat_unify(result_p,cstring_to_picat((char *)output, strlen(output)));  
-      
-      free(pattern_s);
-      free(replacement_s);  
-      free(subject_s);
-      free(output);
-      
-      return PICAT_TRUE;
-    }
 
+/*
+  regex_stats_reset/0
+  Resets the statistics of all threads.
+*/
+int regex_stats_reset() {
+  pthread_mutex_lock(&regex_stats_lock);
+  for (regex_stats_t* s = regex_all_stats; s != NULL; s = s->next) {
+    regex_stats_t* next = s->next;
+    memset(s, 0, sizeof(regex_stats_t));
+    s->next = next;
   }
+  pthread_mutex_unlock(&regex_stats_lock);
 
-  return PICAT_FALSE;
-  
-} // regex_replace
+  return PICAT_TRUE;
 
+} // regex_stats_reset
 
-int regex_replace_first() {
 
-  TERM pattern_p = picat_get_call_arg(1,4);  
-  TERM replacement_p = picat_get_call_arg(2,4);
-  TERM subject_p = picat_get_call_arg(3,4);
-  TERM result_p = picat_get_call_arg(4,4);
+/*
+  The latency statistics of a cache entry as a list of Key=Value.
+  rewritten is 1 if the entry was compiled from the rewritten pattern
+  (see regex_optimize/1), else 0. histogram is a list of
+  UpperNs=Count for the non-empty buckets, where UpperNs is the
+  (approximate) upper bound of the bucket in ns.
+*/
+static TERM regex_entry_stats(regex_cache_entry* e, double ns_per_tick) {
+  TERM hist = picat_build_nil();
+  for (int b = REGEX_HISTOGRAM_BUCKETS-1; b >= 0; b--) {
+    if (e->histogram[b] > 0) {
+      TERM cons = picat_build_list();
+      TERM kv = picat_build_structure("=", 2);
+      picat_unify(picat_get_arg(1, kv), picat_build_integer((BPLONG)((double)(2ULL << b) * ns_per_tick)));
+      picat_unify(picat_get_arg(2, kv), picat_build_integer((BPLONG)e->histogram[b]));
+      picat_unify(picat_get_car(cons), kv);
+      picat_unify(picat_get_cdr(cons), hist);
+      hist = cons;
+    }
+  }
+  TERM hist_kv = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, hist_kv), picat_build_atom("histogram"));
+  picat_unify(picat_get_arg(2, hist_kv), hist);
+
+  TERM kvs[] = {
+    regex_key_value("id", e->id),
+    regex_key_value("calls", e->calls),
+    regex_key_value("failures", e->failures),
+    regex_key_value("total_ns", (uint64_t)(e->total_ticks * ns_per_tick)),
+    regex_key_value("max_ns", (uint64_t)(e->max_ticks * ns_per_tick)),
+    regex_key_value("mean_ns", e->calls > 0 ? (uint64_t)(e->total_ticks * ns_per_tick / e->calls) : 0),
+    regex_key_value("rewritten", e->rewritten),
+    hist_kv
+  };
+  int n = sizeof(kvs)/sizeof(kvs[0]);
+  TERM list = picat_build_nil();
+  for (int i = n-1; i >= 0; i--) {
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), kvs[i]);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
+  }
+  return list;
+}
 
- 
-  char* pattern_s = picat_string_to_cstring(pattern_p);
-  char* replacement_s = picat_string_to_cstring(replacement_p);
-  char* subject_s = picat_string_to_cstring(subject_p);
-  
-  int output_size_int = strlen(subject_s);
- 
-  size_t subject_length = strlen((char *)subject_s);
-  size_t replacement_length = strlen((char *)replacement_s);
- 
-  int errornumber;
-  PCRE2_SIZE erroroffset;
-  long signed int compile_options = PCRE2_ZERO_TERMINATED;
-  pcre2_code *re = pcre2_compile(pattern_s, compile_options, 0, &errornumber, &erroroffset, NULL);
-  if (re == NULL) {
-    PCRE2_UCHAR buffer[256];
-    pcre2_get_error_message(errornumber, buffer, sizeof(buffer));
-    printf("PCRE2 compilation failed at offset %d: %s\n", (int)erroroffset, buffer);
 
-    free(pattern_s);
-    free(replacement_s);  
-    free(subject_s);
+/*
+  A pattern can have several cache entries: one per compile options
+  (e.g. REGEX_NO_CAPTURES of the optimizer, see regex_no_captures())
+  and per code unit width (see regex_cache_lookup_32()). The
+  statistics of a pattern are the sum of all its entries, and the id
+  is the id of its first entry.
+*/
+static void regex_entry_stats_add(regex_cache_entry* sum, regex_cache_entry* e) {
+  if (sum->pattern == NULL) {
+    sum->pattern = e->pattern;
+    sum->pattern_size = e->pattern_size;
+  }
+  if (sum->id == 0 || e->id < sum->id) {
+    sum->id = e->id;
+  }
+  sum->rewritten |= e->rewritten;
+  sum->calls += e->calls;
+  sum->failures += e->failures;
+  sum->total_ticks += e->total_ticks;
+  if (e->max_ticks > sum->max_ticks) {
+    sum->max_ticks = e->max_ticks;
+  }
+  for (int b = 0; b < REGEX_HISTOGRAM_BUCKETS; b++) {
+    sum->histogram[b] += e->histogram[b];
+  }
+}
 
+/*
+  regex_pattern_stats/2: regex_pattern_stats(Pattern,Stats)
+  Stats is the latency statistics (a list of Key=Value) of the
+  cached pattern Pattern (all its entries). Fails if Pattern is not
+  in the cache.
+*/
+int regex_pattern_stats() {
+  TERM pattern_p = picat_get_call_arg(1,2);
+  TERM stats_p = picat_get_call_arg(2,2);
+
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry sum;
+  memset(&sum, 0, sizeof(sum));
+  for (int b = 0; b < REGEX_CACHE_BUCKETS; b++) {
+    for (regex_cache_entry* e = regex_cache[b]; e != NULL; e = e->next) {
+      if (e->pattern_size == pattern_size && memcmp(e->pattern, pattern_s, pattern_size) == 0) {
+        regex_entry_stats_add(&sum, e);
+      }
+    }
+  }
+  free(pattern_s);
+  if (sum.id == 0) {
     return PICAT_FALSE;
   }
+  regex_stats_get();
+  return picat_unify(stats_p, regex_entry_stats(&sum, regex_ns_per_tick()));
 
-  // The initial output size might not be enough so we
-  // might have to increase the output buffer.
-  int output_mult = 1; // times the original output_size
-  while (1) {
-    int output_size_to_use = output_size_int*output_mult;
-    // PCRE2_UCHAR output[output_size_to_use];
-    PCRE2_UCHAR *output;
-    output = malloc(output_size_to_use * sizeof(PCRE2_UCHAR));
-    strcpy(output,"");
+} // regex_pattern_stats
 
-    PCRE2_SIZE outlen = output_size_to_use; // sizeof(output) / sizeof(PCRE2_UCHAR);
-    // Note: pcre2_substitute adjusts the outlen.
-    int rc = pcre2_substitute(re, subject_s, subject_length, 0,
-                              PCRE2_SUBSTITUTE_OVERFLOW_LENGTH,
-                              NULL, NULL,
-                              replacement_s, replacement_length, output, &outlen);
-    
-    if (rc == PCRE2_ERROR_NOMEMORY) {
-      // Increase the size of the output buffer and check again.
-      output_mult *= 2;
-      free(output);
-      // printf("output_mult: %d new size: %d\n",output_mult, output_size_to_use);
-      
-    } else if(rc < 0) {
-      // Some error
-      PCRE2_UCHAR error_buffer[256];
-      pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
-      printf("PCRE2 substitute error (rc:%d): %s\n", (int)rc, error_buffer);
-      
-      free(pattern_s);
-      free(replacement_s);  
-      free(subject_s);
-      free(output);
-      
-      return PICAT_FALSE;
-      
-    } else {
 
-      picat_unify(result_p,cstring_to_picat((char *)output, strlen(output)));  
-      
-      free(pattern_s);
-      free(replacement_s);  
-      free(subject_s);
-      free(output);
-      
-      return PICAT_TRUE;
+static int regex_cmp_entry_pattern(const void* a, const void* b) {
+  regex_cache_entry* ea = *(regex_cache_entry**)a;
+  regex_cache_entry* eb = *(regex_cache_entry**)b;
+  size_t n = ea->pattern_size < eb->pattern_size ? ea->pattern_size : eb->pattern_size;
+  int c = memcmp(ea->pattern, eb->pattern, n);
+  if (c != 0) {
+    return c;
+  }
+  return ea->pattern_size < eb->pattern_size ? -1 : ea->pattern_size > eb->pattern_size ? 1 : 0;
+}
+
+static int regex_cmp_total_ticks(const void* a, const void* b) {
+  uint64_t ta = ((regex_cache_entry*)a)->total_ticks;
+  uint64_t tb = ((regex_cache_entry*)b)->total_ticks;
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+/*
+  regex_top_patterns/2: regex_top_patterns(N,Top)
+  Top is a list of [Pattern,Stats] for the N cached patterns with
+  the largest total match time, slowest first. The entries of a
+  pattern are summed as in regex_pattern_stats/2.
+*/
+int regex_top_patterns() {
+  TERM n_p = picat_get_call_arg(1,2);
+  TERM top_p = picat_get_call_arg(2,2);
+  if (!picat_is_integer(n_p) || picat_get_integer(n_p) < 0) {
+    fprintf(stderr, "regex_top_patterns: N should be a non-negative integer\n");
+    return PICAT_FALSE;
+  }
+  long n = picat_get_integer(n_p);
+
+  // Sort the entries by pattern, and sum each run of the same pattern
+  regex_cache_entry** entries = malloc((regex_cache_count+1) * sizeof(regex_cache_entry*));
+  regex_cache_entry* sums = calloc(regex_cache_count+1, sizeof(regex_cache_entry));
+  size_t count = 0;
+  for (int b = 0; b < REGEX_CACHE_BUCKETS; b++) {
+    for (regex_cache_entry* e = regex_cache[b]; e != NULL; e = e->next) {
+      entries[count++] = e;
+    }
+  }
+  qsort(entries, count, sizeof(regex_cache_entry*), regex_cmp_entry_pattern);
+  size_t num_sums = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i == 0 || regex_cmp_entry_pattern(&entries[i-1], &entries[i]) != 0) {
+      num_sums++;
     }
+    regex_entry_stats_add(&sums[num_sums-1], entries[i]);
+  }
+  qsort(sums, num_sums, sizeof(regex_cache_entry), regex_cmp_total_ticks);
+  if ((size_t)n > num_sums) {
+    n = num_sums;
+  }
 
+  regex_stats_get();
+  double ns_per_tick = regex_ns_per_tick();
+  TERM list = picat_build_nil();
+  for (long i = n-1; i >= 0; i--) {
+    TERM pair = picat_build_list();
+    TERM pair2 = picat_build_list();
+    picat_unify(picat_get_car(pair), cstring_to_picat(sums[i].pattern, sums[i].pattern_size));
+    picat_unify(picat_get_cdr(pair), pair2);
+    picat_unify(picat_get_car(pair2), regex_entry_stats(&sums[i], ns_per_tick));
+    picat_unify(picat_get_cdr(pair2), picat_build_nil());
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), pair);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
   }
+  free(entries);
+  free(sums);
 
-  return PICAT_FALSE;
-  
-} // regex_replace_first
+  return picat_unify(top_p, list);
 
+} // regex_top_patterns
 
-/* 
-   This is borrowed from PCRE2 distribution's src/pcre2demo.c
-   Most is verbatim from the program (including comments), 
-   with some small changes.
-   
+
+/*
+  regex_slow_log/2: regex_slow_log(File,ThresholdNs)
+  Appends all matches that take more than ThresholdNs ns to File.
+  ThresholdNs =< 0 turns the slow log off.
 */
-int regex_find_matches() {
-  
-  pcre2_code *re;
-  // PCRE2_SPTR pattern;     /* PCRE2_SPTR is a pointer to unsigned code units of */
-  char* pattern;     /* PCRE2_SPTR is a pointer to unsigned code units of */  
-  // PCRE2_SPTR subject;     /* the appropriate width (in this case, 8 bits). */
-  char* subject;     /* the appropriate width (in this case, 8 bits). */  
-  PCRE2_SPTR name_table;
-  
-  int crlf_is_newline;
-  int errornumber; 
-  // The number of occurrences to find: 0 indicates to find all.
-  int num_to_find = 0; 
-  int i;
-  int rc;
-  int utf8;
-  
-  uint32_t option_bits;
-  uint32_t namecount;
-  uint32_t name_entry_size;
-  uint32_t newline;
-  
-  PCRE2_SIZE erroroffset;
-  PCRE2_SIZE *ovector;
-  PCRE2_SIZE subject_length;
-  
-  pcre2_match_data *match_data;
+int regex_slow_log() {
+  TERM file_p = picat_get_call_arg(1,2);
+  TERM threshold_p = picat_get_call_arg(2,2);
+  long threshold_ns = picat_get_integer(threshold_p);
+
+  pthread_mutex_lock(&regex_slow_lock);
+  if (regex_slow_file != NULL) {
+    fclose(regex_slow_file);
+    regex_slow_file = NULL;
+  }
+  regex_slow_ticks = 0;
+  pthread_mutex_unlock(&regex_slow_lock);
+  if (threshold_ns <= 0) {
+    return PICAT_TRUE;
+  }
 
-  TERM pattern_p     = picat_get_call_arg(1,4);   // The pattern
-  TERM subject_p     = picat_get_call_arg(2,4);   // Subject string
-  TERM num_to_find_p = picat_get_call_arg(3,4); // Number of matches to find
-  TERM output_p      = picat_get_call_arg(4,4);    // Output
-  
-  pattern = picat_string_to_cstring(pattern_p);
-  // printf("pattern: %s\n", pattern);
-  subject = picat_string_to_cstring(subject_p);
-  num_to_find = picat_get_integer(num_to_find_p);
-  // printf("num_to_find: %d\n",num_to_find);
-  
-  // The list to return
-  TERM ret_list = (TERM)NULL;
-  TERM ret_list_tail;
-  TERM cons;
-  TERM picat_match;
-  TERM picat_match_tail;
-  
-  // Number of found matches.
-  int num_matches = 0;
-  
-  /* Pattern and subject are char arguments, so they can be straightforwardly
-     cast to PCRE2_SPTR because we are working in 8-bit code units. The subject
-     length is cast to PCRE2_SIZE for completeness, though PCRE2_SIZE is in fact
-     defined to be size_t. */
-  subject_length = (PCRE2_SIZE)strlen((char *)subject);
-  
-  
-  /*************************************************************************
-   * Now we are going to compile the regular expression pattern, and handle *
-   * any errors that are detected.                                          *
-   *************************************************************************/  
-  re = pcre2_compile(
-                     pattern,               /* the pattern */
-                     PCRE2_ZERO_TERMINATED, /* indicates pattern is zero-terminated */
-                     0,                     /* default options */
-                     &errornumber,          /* for error number */
-                     &erroroffset,          /* for error offset */
-                     NULL);                 /* use default compile context */
-  
-  /* Compilation failed: print the error message and exit. */
-  if (re == NULL) {
-    PCRE2_UCHAR buffer[256];
-    pcre2_get_error_message(errornumber, buffer, sizeof(buffer));
-    printf("PCRE2 compilation failed at offset %d: %s\n", (int)erroroffset,
-           buffer);
+  char* file_s = picat_string_to_cstring(file_p);
+  FILE* fp = fopen(file_s, "a");
+  if (fp == NULL) {
+    fprintf(stderr,"regex_slow_log: cannot open %s\n", file_s);
+    free(file_s);
     return PICAT_FALSE;
   }
-    
-  /*************************************************************************
-   * If the compilation succeeded, we call PCRE2 again, in order to do a    *
-   * pattern match against the subject string. This does just ONE match. If *
-   * further matching is needed, it will be done below. Before running the  *
-   * match we must set up a match_data block for holding the result. Using  *
-   * pcre2_match_data_create_from_pattern() ensures that the block is       *
-   * exactly the right size for the number of capturing parentheses in the  *
-   * pattern. If you need to know the actual size of a match_data block as  *
-   * a number of bytes, you can find it like this:                          *
-   *                                                                        *
-   * PCRE2_SIZE match_data_size = pcre2_get_match_data_size(match_data);    *
-   *************************************************************************/
-  match_data = pcre2_match_data_create_from_pattern(re, NULL);
-  
-  /* Now run the match. */
-  rc = pcre2_match(
-                   re,                   /* the compiled pattern */
-                   subject,              /* the subject string */
-                   subject_length,       /* the length of the subject */
-                   0,                    /* start at offset 0 in the subject */
-                   0,                    /* default options */
-                   match_data,           /* block for storing the result */
-                   NULL);                /* use default match context */
-  
-  /* Matching failed: handle error cases */
-  // printf("RC: %d\n",rc);
-  if (rc < 0) { 
-    switch(rc) {
-      // case PCRE2_ERROR_NOMATCH: printf("No match\n"); break;
-      case PCRE2_ERROR_NOMATCH: break;        
-        /*
-          Handle other special cases if you like
-        */
-      default: printf("Matching error %d\n", rc); break;
+  free(file_s);
+
+  regex_stats_get();
+  double ns_per_tick = regex_ns_per_tick();
+  pthread_mutex_lock(&regex_slow_lock);
+  regex_slow_file = fp;
+  regex_slow_ns_per_tick = ns_per_tick;
+  regex_slow_ticks = (uint64_t)(threshold_ns / ns_per_tick);
+  if (regex_slow_ticks == 0) {
+    regex_slow_ticks = 1;
+  }
+  pthread_mutex_unlock(&regex_slow_lock);
+
+  return PICAT_TRUE;
+
+} // regex_slow_log
+
+
+/*
+  Saving and loading the pattern cache.
+
+  regex_cache_save/1 writes all the cached patterns to a file
+  with pcre2_serialize_encode, and regex_cache_load/1 reads them
+  back with pcre2_serialize_decode. Loading is much faster than
+  compiling the patterns again, e.g. for the large alternations
+  from make_regex.
+
+  The file format (all numbers in native byte order):
+    header     regex_cache_file_header
+    index      count x regex_cache_file_pattern
+    patterns   the pattern strings
+    data       the serialized patterns (at data_offset, 8 byte aligned)
+
+  The serialized patterns can only be used with the same PCRE2
+  version and configuration (code unit width, newline, link size,
+  Unicode support) and the same byte order, so these are recorded
+  in the header and checked when loading. The character tables are
+  included in the serialized data by pcre2_serialize_encode. (The
+  patterns are compiled with PCRE2's built-in tables, which are
+  given by the PCRE2 version.)
+  The checksum is a FNV-1a hash of everything after the header.
+
+  The file is mmap:ed when loading.
+*/
+#define REGEX_CACHE_FILE_MAGIC "PICATRX"
+#define REGEX_CACHE_FILE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t byte_order;       // 0x01020304
+  uint32_t code_unit_width;
+  uint32_t newline;
+  uint32_t link_size;
+  uint32_t unicode;
+  char pcre2_version[32];
+  uint64_t count;            // number of patterns
+  uint64_t size;             // number of bytes after the header
+  uint64_t data_offset;      // offset of the serialized data
+  uint64_t data_size;
+  uint64_t checksum;
+} regex_cache_file_header;
+
+typedef struct {
+  uint64_t pattern_offset;   // offset of the pattern string
+  uint64_t pattern_size;
+  uint32_t options;
+  uint32_t flags;            // REGEX_CACHE_FILE_REWRITTEN
+} regex_cache_file_pattern;
+
+#define REGEX_CACHE_FILE_REWRITTEN 1 // compiled from the rewritten pattern (see regex_optimize/1)
+
+static void regex_cache_file_config(regex_cache_file_header* h) {
+  memset(h, 0, sizeof(regex_cache_file_header));
+  memcpy(h->magic, REGEX_CACHE_FILE_MAGIC, sizeof(REGEX_CACHE_FILE_MAGIC));
+  h->format_version = REGEX_CACHE_FILE_VERSION;
+  h->byte_order = 0x01020304;
+  h->code_unit_width = PCRE2_CODE_UNIT_WIDTH;
+  pcre2_config(PCRE2_CONFIG_NEWLINE, &h->newline);
+  pcre2_config(PCRE2_CONFIG_LINKSIZE, &h->link_size);
+  pcre2_config(PCRE2_CONFIG_UNICODE, &h->unicode);
+  pcre2_config(PCRE2_CONFIG_VERSION, h->pcre2_version);
+}
+
+/*
+  Checks that the index, the pattern strings and the serialized data
+  of a cache file (of file_size bytes, with a valid header) are inside
+  the file, and the number of serialized patterns. Returns an error
+  message, or NULL if it's ok.
+*/
+static char* regex_cache_file_check(uint8_t* map, uint64_t file_size) {
+  regex_cache_file_header* h = (regex_cache_file_header*)map;
+  uint64_t index_start = sizeof(regex_cache_file_header);
+  if (h->count > (file_size - index_start) / sizeof(regex_cache_file_pattern)) {
+    return "corrupt index";
+  }
+  uint64_t patterns_start = index_start + h->count * sizeof(regex_cache_file_pattern);
+  if (h->count > 0 &&
+      (h->data_offset < patterns_start || h->data_offset > file_size ||
+       h->data_size > file_size - h->data_offset ||
+       h->data_size < 4 * sizeof(uint32_t))) { // the header of pcre2_serialize_encode's data
+    return "corrupt serialized data";
+  }
+  regex_cache_file_pattern* index = (regex_cache_file_pattern*)(map + index_start);
+  for (uint64_t i = 0; i < h->count; i++) {
+    if (index[i].pattern_offset < patterns_start || index[i].pattern_offset > h->data_offset ||
+        index[i].pattern_size > h->data_offset - index[i].pattern_offset ||
+        (index[i].flags & ~REGEX_CACHE_FILE_REWRITTEN) != 0) {
+      return "corrupt index";
     }
-    pcre2_match_data_free(match_data);   /* Release memory used for the match */
-    pcre2_code_free(re);                 /*   data and the compiled pattern. */
-    free(subject);
+  }
+  if (h->count > 0 && pcre2_serialize_get_number_of_codes(map + h->data_offset) != (int32_t)h->count) {
+    return "corrupt serialized data";
+  }
+  return NULL;
+}
+
+/*
+  regex_cache_save/1: regex_cache_save(File)
+  Saves all the cached patterns to File.
+*/
+int regex_cache_save() {
+  TERM file_p = picat_get_call_arg(1,1);
+
+  regex_cache_entry** entries = malloc((regex_cache_count+1) * sizeof(regex_cache_entry*));
+  const pcre2_code** codes = malloc((regex_cache_count+1) * sizeof(pcre2_code*));
+  size_t count = 0;
+  size_t patterns_size = 0;
+  for (int b = 0; b < REGEX_CACHE_BUCKETS; b++) {
+    for (regex_cache_entry* e = regex_cache[b]; e != NULL; e = e->next) {
+      if (e->width != 8) {
+        continue; // only the 8-bit patterns are saved
+      }
+      entries[count] = e;
+      codes[count] = e->re;
+      patterns_size += e->pattern_size;
+      count++;
+    }
+  }
+
+  uint8_t* data = NULL;
+  PCRE2_SIZE data_size = 0;
+  if (count > 0) {
+    int rc = pcre2_serialize_encode(codes, (int32_t)count, &data, &data_size, NULL);
+    if (rc < 0) {
+      PCRE2_UCHAR buffer[256];
+      pcre2_get_error_message(rc, buffer, sizeof(buffer));
+      fprintf(stderr,"regex_cache_save: %s\n", buffer);
+      free(entries);
+      free(codes);
+      return PICAT_FALSE;
+    }
+  }
+
+  regex_cache_file_header h;
+  regex_cache_file_config(&h);
+  size_t index_size = count * sizeof(regex_cache_file_pattern);
+  size_t data_offset = sizeof(h) + index_size + patterns_size;
+  data_offset = (data_offset + 7) & ~(size_t)7;
+  h.count = count;
+  h.data_offset = data_offset;
+  h.data_size = data_size;
+  h.size = data_offset + data_size - sizeof(h);
+
+  // The file is built in memory, so the checksum can be computed
+  // before writing it.
+  uint8_t* buf = calloc(1, h.size + 1);
+  regex_cache_file_pattern* index = (regex_cache_file_pattern*)buf;
+  size_t offset = sizeof(h) + index_size;
+  for (size_t i = 0; i < count; i++) {
+    index[i].pattern_offset = offset;
+    index[i].pattern_size = entries[i]->pattern_size;
+    index[i].options = entries[i]->options;
+    index[i].flags = entries[i]->rewritten ? REGEX_CACHE_FILE_REWRITTEN : 0;
+    memcpy(buf + offset - sizeof(h), entries[i]->pattern, entries[i]->pattern_size);
+    offset += entries[i]->pattern_size;
+  }
+  if (data_size > 0) {
+    memcpy(buf + data_offset - sizeof(h), data, data_size);
+    pcre2_serialize_free(data);
+  }
+  h.checksum = regex_hash((char*)buf, h.size, 0);
+  free(entries);
+  free(codes);
+
+  // Write to a temporary file and rename it, so a reader never sees
+  // a half written file.
+  char* file_s = picat_string_to_cstring(file_p);
+  char* tmp_s = malloc(strlen(file_s) + 5);
+  sprintf(tmp_s, "%s.tmp", file_s);
+  FILE* fp = fopen(tmp_s, "wb");
+  int ok = fp != NULL &&
+           fwrite(&h, sizeof(h), 1, fp) == 1 &&
+           (h.size == 0 || fwrite(buf, h.size, 1, fp) == 1);
+  if (fp != NULL && fclose(fp) != 0) {
+    ok = 0;
+  }
+  if (ok && rename(tmp_s, file_s) != 0) {
+    ok = 0;
+  }
+  if (!ok) {
+    fprintf(stderr,"regex_cache_save: cannot write %s\n", file_s);
+    remove(tmp_s);
+  }
+  free(buf);
+  free(tmp_s);
+  free(file_s);
+
+  return ok ? PICAT_TRUE : PICAT_FALSE;
+
+} // regex_cache_save
+
+
+/*
+  regex_cache_load/1: regex_cache_load(File)
+  Loads the patterns saved by regex_cache_save/1 into the cache.
+  Patterns that already are in the cache are kept. The loaded
+  patterns are checked as the compiled ones (see regex_redos_mode/1),
+  i.e. a pattern that is refused is not loaded.
+  Fails if the file is not a valid cache file (nothing is loaded then),
+  or if it was saved by another PCRE2 version/configuration.
+*/
+int regex_cache_load() {
+  TERM file_p = picat_get_call_arg(1,1);
+  char* file_s = picat_string_to_cstring(file_p);
+
+  int fd = open(file_s, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr,"regex_cache_load: cannot open %s\n", file_s);
+    if (fd >= 0) close(fd);
+    free(file_s);
     return PICAT_FALSE;
   }
-  
-  /* Match succeeded. Get a pointer to the output vector, where string offsets
-     are stored. */
-  ovector = pcre2_get_ovector_pointer(match_data);
-  // printf("Match succeeded at offset %d\n", (int)ovector[0]);
-  
-  
-  /*************************************************************************
-   * We have found the first match within the subject string. If the output *
-   * vector wasn't big enough, say so. Then output any substrings that were *
-   * captured.                                                              *
-   *************************************************************************/
-  
-  /* The output vector wasn't big enough. This should not happen, because we used
-     pcre2_match_data_create_from_pattern() above. */
-  if (rc == 0) {
-    printf("ovector was not big enough for all the captured substrings\n");
+  if ((size_t)st.st_size < sizeof(regex_cache_file_header)) {
+    fprintf(stderr,"regex_cache_load: %s is not a regex cache file\n", file_s);
+    close(fd);
+    free(file_s);
+    return PICAT_FALSE;
   }
-  
-  /* Since release 10.38 PCRE2 has locked out the use of \K in lookaround
-     assertions. However, there is an option to re-enable the old behaviour. If that
-     is set, it is possible to run patterns such as /(?=.\K)/ that use \K in an
-     assertion to set the start of a match later than its end. In this demonstration
-     program, we show how to detect this case, but it shouldn't arise because the
-     option is never set. */
-  if (ovector[0] > ovector[1]) {
-    printf("\\K was used in an assertion to set the match start after its end.\n"
-             "From end to start the match was: %.*s\n", (int)(ovector[0] - ovector[1]),
-           (char *)(subject + ovector[1]));
-    printf("Run abandoned\n");
-    pcre2_match_data_free(match_data);
-    pcre2_code_free(re);
-    free(subject);
+  uint8_t* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr,"regex_cache_load: cannot mmap %s\n", file_s);
+    free(file_s);
     return PICAT_FALSE;
   }
 
-  // printf("First loop RC: %d\n",rc);
+  regex_cache_file_header* h = (regex_cache_file_header*)map;
+  regex_cache_file_header config;
+  regex_cache_file_config(&config);
+  char* error = NULL;
+  if (memcmp(h->magic, config.magic, sizeof(h->magic)) != 0 ||
+      h->size != (uint64_t)st.st_size - sizeof(regex_cache_file_header)) {
+    error = "not a regex cache file";
+  } else if (h->format_version != config.format_version || h->byte_order != config.byte_order) {
+    error = "unsupported file format version or byte order";
+  } else if (h->code_unit_width != config.code_unit_width || h->newline != config.newline ||
+             h->link_size != config.link_size || h->unicode != config.unicode ||
+             strncmp(h->pcre2_version, config.pcre2_version, sizeof(h->pcre2_version)) != 0) {
+    error = "saved by another PCRE2 version or configuration";
+  } else if (regex_hash((char*)(map + sizeof(regex_cache_file_header)), h->size, 0) != h->checksum) {
+    error = "wrong checksum";
+  } else {
+    error = regex_cache_file_check(map, (uint64_t)st.st_size);
+  }
+  if (error != NULL) {
+    fprintf(stderr,"regex_cache_load: %s: %s (%s)\n", file_s, error, h->pcre2_version);
+    munmap(map, st.st_size);
+    free(file_s);
+    return PICAT_FALSE;
+  }
 
-  // This is the first match
-  picat_match = (TERM)NULL;
-  
-  /* Show substrings stored in the output vector by number. Obviously, in a real
-     application you might want to do things other than print them. */
-  // Note: i = 0 is the complete string from first match postition to the last
-  // but this is not needed here if there are capture group(s), and we start at i = 1.
-  // In the case of no capture group (rc==1) then we get that complete string (i = 0)
-  int ix_from = 1;
-  int ix_to = rc-1;
-  if (rc == 1) {
-    // No capture group.
-    ix_from = 0;
-    ix_to = 0;
-  }
-  // printf("rc: %d ix_from: %d ix_to: %d\n", rc, ix_from,ix_to);
-  for (i = ix_from; i <= ix_to; i++) {
-    PCRE2_SPTR substring_start = subject + ovector[2*i];
-    PCRE2_SIZE substring_length = ovector[2*i+1] - ovector[2*i];
-    // printf("%2d: %.*s\n", i, (int)substring_length, (char *)substring_start);
-
-    char matched[substring_length];
-    strncpy(matched,substring_start,substring_length);
-    matched[substring_length] = '\0';
-    // printf("adding (first loop): %s len: %ld\n",matched, substring_length);    
-
-    // We only increment car/cdr after the first match.
-    cons = picat_build_list();
-    if (rc > 2) {
-      // More than one capture group
-      picat_unify(picat_get_car(cons), cstring_to_picat((char*) matched, (int)substring_length));
+  int ok = 1;
+  if (h->count > 0) {
+    pcre2_code** codes = malloc(h->count * sizeof(pcre2_code*));
+    int rc = pcre2_serialize_decode(codes, (int32_t)h->count, map + h->data_offset, NULL);
+    if (rc < 0) {
+      PCRE2_UCHAR buffer[256];
+      pcre2_get_error_message(rc, buffer, sizeof(buffer));
+      fprintf(stderr,"regex_cache_load: %s: %s\n", file_s, buffer);
+      ok = 0;
     } else {
-      // No or one capture group
-      picat_unify(cons, cstring_to_picat((char*) matched, (int)substring_length));      
-    }
-    if (picat_match == (TERM)NULL) {
-      picat_match = cons;
-    } else {
-      picat_unify(picat_match_tail, cons);
+      regex_cache_file_pattern* index = (regex_cache_file_pattern*)(map + sizeof(regex_cache_file_header));
+      // The cache is cleared (if needed) before the patterns are
+      // inserted, so regex_cache_insert() doesn't clear it in the
+      // middle of the load; the patterns that don't fit are skipped.
+      // A pattern that was rewritten by the optimizer is skipped when
+      // the optimizer is off (it's compiled as it is when it's used).
+      if (regex_cache_count + h->count > REGEX_CACHE_SIZE) {
+        regex_cache_clear();
+      }
+      for (uint64_t i = 0; i < h->count; i++) {
+        char* pattern = (char*)(map + index[i].pattern_offset);
+        int limited;
+        int rewritten = (index[i].flags & REGEX_CACHE_FILE_REWRITTEN) != 0;
+        if (regex_cache_count >= REGEX_CACHE_SIZE || (rewritten && !regex_optimizing) ||
+            regex_cache_find(pattern, index[i].pattern_size, index[i].options) != NULL ||
+            !regex_redos_check(pattern, index[i].pattern_size, &limited, "regex_cache_load")) {
+          pcre2_code_free(codes[i]);
+        } else {
+          regex_cache_add(pattern, index[i].pattern_size, index[i].options, codes[i], limited, rewritten);
+        }
+      }
     }
-    picat_match_tail = picat_get_cdr(cons);
-
+    free(codes);
   }
+  munmap(map, st.st_size);
+  free(file_s);
 
-  picat_unify(picat_match_tail, picat_build_nil()); // close first match
+  return ok ? PICAT_TRUE : PICAT_FALSE;
 
-  
-  cons = picat_build_list();
-  picat_unify(picat_get_car(cons), picat_match); // place firs match in ret_list
-  if (ret_list == (TERM)NULL){
-    ret_list = cons;
-  } else{
-    picat_unify(ret_list_tail, cons);
+} // regex_cache_load
+
+
+/*
+  regex/2:  regex(Pattern,String)
+  true if the regular expression pattern matches the string string
+
+*/
+int regex() {
+   
+  TERM pattern_p = picat_get_call_arg(1,2); /* Regex */
+  TERM subject_p = picat_get_call_arg(2,2); /* Subject string */
+
+  size_t pattern_size, subject_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  if (regex_is_utf32(pattern_s, pattern_size)) {
+    int ret = regex_find_32(pattern_s, pattern_size, subject_p, 1, 0, (TERM)NULL, 0, "regex");
+    free(pattern_s);
+    return ret;
+  }
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, "regex");
+  if (subject_s == NULL) {
+    free(pattern_s);
+    return PICAT_FALSE;
   }
-  ret_list_tail = picat_get_cdr(cons);
 
-  num_matches++;
-  
-  /**************************************************************************
-   * That concludes the basic part of this demonstration program. We have    *
-   * compiled a pattern, and performed a single match. The code that follows *
-   * shows first how to access named substrings, and then how to code for    *
-   * repeated matches on the same subject.                                   *
-   **************************************************************************/
+  int ret = PICAT_FALSE; // Return value to Picat
   
-  /* See if there are any named substrings, and if so, show them by name. First
-     we have to extract the count of named parentheses from the pattern. */
-  (void)pcre2_pattern_info(
-                           re,                   /* the compiled pattern */
-                           PCRE2_INFO_NAMECOUNT, /* get the number of named substrings */
-                           &namecount);          /* where to put the answer */
-
-  // hakank: We don't care about named substrings
-  if (0) {
-    if (namecount == 0) {
-      // printf("No named substrings\n");
+  uint32_t compile_options = regex_no_captures();
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, compile_options, "regex");
+  if (entry == NULL) {
+    free(pattern_s);
+    free(subject_buf);
     
-    } else {
-      PCRE2_SPTR tabptr;
-      // printf("Named substrings\n");
+    return ret;
+  }
+
+  // pcre2_match
+  uint32_t ovecsize = 1024;
+  pcre2_match_data* match_data = pcre2_match_data_create(ovecsize, NULL);
+  int rc = regex_memo_match(entry, subject_s, subject_size, subject_options, match_data, NULL);
+  if(rc == 0) {
+    fprintf(stderr,"offset vector too small: %d\n",rc);
     
-      /* Before we can access the substrings, we must extract the table for
-         translating names to numbers, and the size of each entry in the table. */
+  } else if(rc > 0) {
+
+    // It's a match
+    ret = PICAT_TRUE;
     
-      (void)pcre2_pattern_info(
-                               re,                       /* the compiled pattern */
-                               PCRE2_INFO_NAMETABLE,     /* address of the table */
-                               &name_table);             /* where to put the answer */
+  } else if (rc < 0) {
+
+    // No match
+    ; 
+  }
+
+  pcre2_match_data_free(match_data);
+  
+  if (pattern_s != NULL) {
+    free(pattern_s);
+  }
+
+  if (subject_s != NULL) {
+    free(subject_buf);
+  }
+
+  return ret;
+  
+} // regex
+
+
+
+/*
+  regex_capture/3: regex_capture(Pattern,Subject,Capture)
+  True if Subject matches Pattern.
+
+  Capture is a list of captures:
+  * Capture[1] is the full captured string
+  * Capture[i] i>1, is the i-1 capture
+
+  regex_capture_format/4: regex_capture_format(Pattern,Subject,Format,Capture)
+  is the same with the result format Format (see regex_get_format()).
+*/
+static int regex_capture_term(TERM pattern_p, TERM subject_p, TERM capture_p, int format, char* who) {
+
+  size_t pattern_size, subject_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  if (regex_is_utf32(pattern_s, pattern_size)) {
+    int ret = regex_find_32(pattern_s, pattern_size, subject_p, 1, 1, capture_p, format, who);
+    free(pattern_s);
+    return ret;
+  }
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, who);
+  if (subject_s == NULL) {
+    free(pattern_s);
+    return PICAT_FALSE;
+  }
+
+  uint32_t compile_options = 0; 
+
+  // pcre2_match_data *match_data;
+  uint32_t ovecsize = 1024;
+
+  int ret = PICAT_FALSE;
+
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, compile_options, who);
+  if (entry == NULL) {
+    picat_unify(capture_p, regex_build_container(NULL, 0, format, who)); // output
+
+    free(pattern_s);
+    free(subject_buf);
+
+    return ret;
+  }
+
+  pcre2_match_data *match_data = pcre2_match_data_create(ovecsize, NULL);
+  PCRE2_SIZE* ovector;
+  int rc = regex_memo_match(entry, subject_s, subject_size, subject_options, match_data, &ovector);
+
+  regex_result captures;
+  regex_result_init(&captures, subject_s);
+  
+  if(rc == 0) {
+    fprintf(stderr,"offset vector too small: %d",rc);
     
-      (void)pcre2_pattern_info(
-                               re,                       /* the compiled pattern */
-                               PCRE2_INFO_NAMEENTRYSIZE, /* size of each entry in the table */
-                               &name_entry_size);        /* where to put the answer */
+  } else if(rc > 0) {
     
-      /* Now we can scan the table and, for each entry, print the number, the name,
-         and the substring itself. In the 8-bit library the number is held in two
-         bytes, most significant first. */    
-      tabptr = name_table;
-      for (i = 0; i < namecount; i++) {
-        int n = (tabptr[0] << 8) | tabptr[1];
-        /* printf("(%d) %*s: %.*s\n", n, name_entry_size - 3, tabptr + 2, */
-        /*        (int)(ovector[2*n+1] - ovector[2*n]), subject + ovector[2*n]); */
-      
-        tabptr += name_entry_size;
+    // the captures are built directly from the subject, see regex_result_build()
+    regex_result_add(&captures, ovector, 0, rc, 0);
+    ret = PICAT_TRUE;
+    
+  } else if (rc < 0) {
+
+    // No match
+    ; 
+  }
+
+  pcre2_match_data_free(match_data);
+
+  TERM capture;
+  if (regex_result_build(&captures, format, who, &capture)) {
+    picat_unify(capture_p, capture); // output
+  } else {
+    ret = PICAT_FALSE;
+  }
+
+  regex_result_free(&captures);
+  free(pattern_s);
+  free(subject_buf);
+  
+  return ret;
+
+} // regex_capture_term
+
+int regex_capture() {
+  
+  TERM pattern_p = picat_get_call_arg(1,3); /* Regex */
+  TERM subject_p = picat_get_call_arg(2,3); /* Subject string */
+  TERM capture_p = picat_get_call_arg(3,3); /* output argument: Captures */    
+
+  return regex_capture_term(pattern_p, subject_p, capture_p, REGEX_FORMAT_STRING, "regex_capture");
+
+} // regex_capture
+
+int regex_capture_format() {
+  
+  TERM pattern_p = picat_get_call_arg(1,4); /* Regex */
+  TERM subject_p = picat_get_call_arg(2,4); /* Subject string */
+  TERM format_p  = picat_get_call_arg(3,4); /* Result format */
+  TERM capture_p = picat_get_call_arg(4,4); /* output argument: Captures */    
+
+  int format;
+  if (!regex_get_format(format_p, "regex_capture_format", &format)) {
+    return PICAT_FALSE;
+  }
+  return regex_capture_term(pattern_p, subject_p, capture_p, format, "regex_capture_format");
+
+} // regex_capture_format
+
+
+/*
+
+  Compiles a regex regex_compile(Pattern).
+
+  Note: re is a GLOBAL variable, thus it will only hold one pattern.
+  Be careful.
+
+  The pattern is taken from the pattern cache, and its cache entry
+  is pinned as long as it's the current pattern.
+
+  To be used with regex_match/1 and regex_match_capture/2
+
+ */
+
+regex_cache_entry* compiled_entry = NULL;
+pcre2_code* re;
+// char* pattern_s;
+int regex_compile() {
+   
+  TERM pattern_p = picat_get_call_arg(1,1); /* Regex */
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  
+  uint32_t options = 0;
+
+  // Unpin the pattern from previous run
+  if (compiled_entry != NULL) {
+    compiled_entry->pinned--;
+  }
+  
+  compiled_entry = regex_cache_lookup(pattern_s, pattern_size, options, "regex_compile");
+  if (compiled_entry == NULL) {
+    re = NULL;
+
+    free(pattern_s);
+
+    return PICAT_FALSE;
+  }
+  compiled_entry->pinned++;
+  re = compiled_entry->re;
+
+  free(pattern_s);
+  
+  return PICAT_TRUE;
+
+} // regex_compile
+
+
+
+/*
+  regex_match/2: regex_capture(Subject)
+
+  Matches the previous compiled pattern.
+
+*/
+int regex_match() {
+
+  if (re == NULL) {
+    fprintf(stderr,"regex_match: No defined pattern!");
+    return PICAT_FALSE;
+  }
+  
+  TERM subject_p = picat_get_call_arg(1,1); /* Subject string */
+
+  size_t subject_size;
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, "regex_match");
+  if (subject_s == NULL) {
+    return PICAT_FALSE;
+  }
+  // printf("subject_s: %s subject_len: %ld\n", subject_s, strlen(subject_s));
+
+  // pcre2_match_data *match_data;
+  uint32_t ovecsize = 1024;
+
+  int ret = PICAT_FALSE;
+
+  pcre2_match_data *match_data = pcre2_match_data_create(ovecsize, NULL);
+  int rc = regex_memo_match(compiled_entry, subject_s, subject_size, subject_options, match_data, NULL);
+  
+  if(rc == 0) {
+    fprintf(stderr,"offset vector too small: %d",rc);
+    
+  } else if(rc > 0) {
+
+    ret = PICAT_TRUE;
+    
+  } else if (rc < 0) {
+
+    // No match
+    ; 
+  }
+
+  pcre2_match_data_free(match_data);
+
+  free(subject_buf);
+  
+  return ret;
+
+} // regex_match
+ 
+
+/*
+  regex_match_capture/2: regex_capture(Subject,Capture)
+  Matches the previous compiled pattern.
+
+  Capture is a list of captures:
+  * Capture[1] is the full captured string
+  * Capture[i] i>1, is the i-1 capture
+
+*/
+int regex_match_capture() {
+  
+  TERM subject_p = picat_get_call_arg(1,2); /* Subject string */
+  TERM capture_p = picat_get_call_arg(2,2); /* output argument: Captures */
+  
+  if (re == NULL) {
+    fprintf(stderr,"regex_match_capture: No defined pattern!");
+    return PICAT_FALSE;
+  }
+
+  size_t subject_size;
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, "regex_match_capture");
+  if (subject_s == NULL) {
+    return PICAT_FALSE;
+  }
+  // printf("subject_s: %s subject_len: %ld\n", subject_s,strlen(subject_s));
+
+  uint32_t ovecsize = 1024;
+
+  regex_result captures;
+  regex_result_init(&captures, subject_s);
+
+  int ret = PICAT_FALSE;
+
+  pcre2_match_data *match_data = pcre2_match_data_create(ovecsize, NULL);
+  PCRE2_SIZE* ovector;
+  int rc = regex_memo_match(compiled_entry, subject_s, subject_size, subject_options, match_data, &ovector);
+  if(rc == 0) {
+    fprintf(stderr,"offset vector too small: %d",rc);
+    
+  } else if(rc > 0) {
+    
+    regex_result_add(&captures, ovector, 0, rc, 0);
+    ret = PICAT_TRUE;
+    
+  } else if (rc < 0) {
+
+    // No match
+    ; 
+  }
+
+  pcre2_match_data_free(match_data);
+  // pcre2_code_free(re);
+  
+  TERM capture;
+  if (regex_result_build(&captures, REGEX_FORMAT_STRING, "regex_match_capture", &capture)) {
+    picat_unify(capture, capture_p); // output
+  } else {
+    ret = PICAT_FALSE;
+  }
+
+  regex_result_free(&captures);
+  free(subject_buf);
+  
+  return ret;
+
+} // regex_match_capture
+
+
+/*
+  Replace(Pattern,Replacement,String,Result)
+  Replace all occurrences of Pattern with Replacement in String
+
+  This is adapted from 
+  https://stackoverflow.com/questions/73800119/replace-all-matches-in-pcre2-substitute-in-c
+
+ */
+int regex_replace() {
+
+  TERM pattern_p = picat_get_call_arg(1,4);  
+  TERM replacement_p = picat_get_call_arg(2,4);
+  TERM subject_p = picat_get_call_arg(3,4);
+  TERM result_p = picat_get_call_arg(4,4);
+
+ 
+  size_t pattern_length, replacement_length, subject_length;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_length);
+  char* replacement_s = regex_get_cstring(replacement_p, &replacement_length);
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_length, &subject_buf, &subject_options, "regex_replace");
+  if (subject_s == NULL) {
+    free(pattern_s);
+    free(replacement_s);
+    return PICAT_FALSE;
+  }
+  
+  int output_size_int = subject_length + 1; // + 1 for the terminating zero (the subject may be empty)
+ 
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_length, 0, "regex_replace");
+  if (entry == NULL) {
+    free(pattern_s);
+    free(replacement_s);  
+    free(subject_buf);
+
+    return PICAT_FALSE;
+  }
+
+  // The initial output size might not be enough so we
+  // might have to increase the output buffer.
+  int output_mult = 1; // times the original output_size
+  while (1) {
+    int output_size_to_use = output_size_int*output_mult;
+    // PCRE2_UCHAR output[output_size_to_use];
+    PCRE2_UCHAR *output;
+    output = malloc(output_size_to_use * sizeof(PCRE2_UCHAR));
+    strcpy(output,"");
+
+    PCRE2_SIZE outlen = output_size_to_use; // sizeof(output) / sizeof(PCRE2_UCHAR);
+    // Note: pcre2_substitute adjusts the outlen.
+    int rc = regex_pcre2_substitute(entry, subject_s, subject_length,
+                                    PCRE2_SUBSTITUTE_OVERFLOW_LENGTH | PCRE2_SUBSTITUTE_GLOBAL | subject_options,
+                                    replacement_s, replacement_length, output, &outlen);
+    
+    if (rc == PCRE2_ERROR_NOMEMORY) {
+      // Increase the size of the output buffer and check again.
+      output_mult *= 2;
+      free(output);
+      // printf("output_mult: %d new size: %d\n",output_mult, output_size_to_use);
+      
+    } else if(rc < 0) {
+      // Some error
+      PCRE2_UCHAR error_buffer[256];
+      pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
+      printf("PCRE2 substitute error (rc:%d): %s\n", (int)rc, error_buffer);
+      
+      free(pattern_s);
+      free(replacement_s);  
+      free(subject_buf);
+      free(output);
+      
+      return PICAT_FALSE;
+      
+    } else {
+
+      REGEX_PROBE(build_start);
+      uint64_t t0 = regex_ticks();
+      picat_unify(result_p,regex_build_string((char *)output, outlen));
+      REGEX_STAT(build_ticks) += regex_ticks() - t0;
+      REGEX_PROBE(build_end, outlen, 1);
+      
+      free(pattern_s);
+      free(replacement_s);  
+      free(subject_buf);
+      free(output);
+      
+      return PICAT_TRUE;
+    }
+
+  }
+
+  return PICAT_FALSE;
+  
+} // regex_replace
+
+
+int regex_replace_first() {
+
+  TERM pattern_p = picat_get_call_arg(1,4);  
+  TERM replacement_p = picat_get_call_arg(2,4);
+  TERM subject_p = picat_get_call_arg(3,4);
+  TERM result_p = picat_get_call_arg(4,4);
+
+ 
+  size_t pattern_length, replacement_length, subject_length;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_length);
+  char* replacement_s = regex_get_cstring(replacement_p, &replacement_length);
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_length, &subject_buf, &subject_options, "regex_replace_first");
+  if (subject_s == NULL) {
+    free(pattern_s);
+    free(replacement_s);
+    return PICAT_FALSE;
+  }
+  
+  int output_size_int = subject_length + 1; // + 1 for the terminating zero (the subject may be empty)
+ 
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_length, 0, "regex_replace_first");
+  if (entry == NULL) {
+    free(pattern_s);
+    free(replacement_s);  
+    free(subject_buf);
+
+    return PICAT_FALSE;
+  }
+
+  // The initial output size might not be enough so we
+  // might have to increase the output buffer.
+  int output_mult = 1; // times the original output_size
+  while (1) {
+    int output_size_to_use = output_size_int*output_mult;
+    // PCRE2_UCHAR output[output_size_to_use];
+    PCRE2_UCHAR *output;
+    output = malloc(output_size_to_use * sizeof(PCRE2_UCHAR));
+    strcpy(output,"");
+
+    PCRE2_SIZE outlen = output_size_to_use; // sizeof(output) / sizeof(PCRE2_UCHAR);
+    // Note: pcre2_substitute adjusts the outlen.
+    int rc = regex_pcre2_substitute(entry, subject_s, subject_length,
+                                    PCRE2_SUBSTITUTE_OVERFLOW_LENGTH | subject_options,
+                                    replacement_s, replacement_length, output, &outlen);
+    
+    if (rc == PCRE2_ERROR_NOMEMORY) {
+      // Increase the size of the output buffer and check again.
+      output_mult *= 2;
+      free(output);
+      // printf("output_mult: %d new size: %d\n",output_mult, output_size_to_use);
+      
+    } else if(rc < 0) {
+      // Some error
+      PCRE2_UCHAR error_buffer[256];
+      pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
+      printf("PCRE2 substitute error (rc:%d): %s\n", (int)rc, error_buffer);
+      
+      free(pattern_s);
+      free(replacement_s);  
+      free(subject_buf);
+      free(output);
+      
+      return PICAT_FALSE;
+      
+    } else {
+
+      REGEX_PROBE(build_start);
+      uint64_t t0 = regex_ticks();
+      picat_unify(result_p,regex_build_string((char *)output, outlen));
+      REGEX_STAT(build_ticks) += regex_ticks() - t0;
+      REGEX_PROBE(build_end, outlen, 1);
+      
+      free(pattern_s);
+      free(replacement_s);  
+      free(subject_buf);
+      free(output);
+      
+      return PICAT_TRUE;
+    }
+
+  }
+
+  return PICAT_FALSE;
+  
+} // regex_replace_first
+
+
+/*
+  regex_sed/5: regex_sed(Pattern,Replacement,InFile,OutFile,Count)
+
+  Replaces all the matches of Pattern in the file InFile with
+  Replacement (as regex_replace/4) and writes the result to the file
+  OutFile. Count is the number of replacements.
+
+  The whole file is one subject, i.e. the result is the same as
+  regex_replace/4 on the contents of InFile (a pattern can match
+  across lines, ^ and $ are the start and end of the file unless (?m)
+  is used). But the file is not converted to a Picat string: it's
+  mmap:ed and read sequentially, the text between the matches is
+  written directly from it, and each replacement is expanded (with
+  pcre2_substitute on the match) into a small buffer. The output is
+  written with a buffer of REGEX_SED_BUFFER bytes, so the memory used
+  doesn't depend on the size of the file. The UTF-8 of the file is
+  checked once, by the first match of a (*UTF) pattern; the later
+  matches and substitutions use PCRE2_NO_UTF_CHECK, since checking the
+  whole file on each match would make the time O(size * matches).
+
+  The output is written to OutFile.tmp, which is renamed to OutFile
+  when everything has been written (as in regex_cache_save/1), so
+  OutFile is left as it was if matching or writing fails.
+*/
+#define REGEX_SED_BUFFER (1 << 20)
+
+int regex_sed() {
+  TERM pattern_p     = picat_get_call_arg(1,5);
+  TERM replacement_p = picat_get_call_arg(2,5);
+  TERM in_file_p     = picat_get_call_arg(3,5);
+  TERM out_file_p    = picat_get_call_arg(4,5);
+  TERM count_p       = picat_get_call_arg(5,5);
+
+  size_t pattern_size, replacement_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_sed");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+
+  char* in_file = picat_string_to_cstring(in_file_p);
+  char* out_file = picat_string_to_cstring(out_file_p);
+  int fd = open(in_file, O_RDONLY);
+  struct stat in_st, out_st;
+  if (fd < 0 || fstat(fd, &in_st) != 0) {
+    fprintf(stderr, "regex_sed: can't open %s\n", in_file);
+    if (fd >= 0) {
+      close(fd);
+    }
+    free(in_file);
+    free(out_file);
+    return PICAT_FALSE;
+  }
+  if (stat(out_file, &out_st) == 0 && out_st.st_dev == in_st.st_dev && out_st.st_ino == in_st.st_ino) {
+    fprintf(stderr, "regex_sed: %s is both the input and the output file\n", in_file);
+    close(fd);
+    free(in_file);
+    free(out_file);
+    return PICAT_FALSE;
+  }
+  size_t size = (size_t)in_st.st_size;
+  const char* subject = "";
+  if (size > 0) {
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      fprintf(stderr, "regex_sed: can't read %s\n", in_file);
+      close(fd);
+      free(in_file);
+      free(out_file);
+      return PICAT_FALSE;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    subject = data;
+  }
+  close(fd);
+  char* tmp_file = malloc(strlen(out_file) + 5);
+  sprintf(tmp_file, "%s.tmp", out_file);
+  FILE* out = fopen(tmp_file, "wb");
+  if (out == NULL) {
+    fprintf(stderr, "regex_sed: can't open %s\n", tmp_file);
+    if (size > 0) {
+      munmap((void*)subject, size);
+    }
+    free(in_file);
+    free(out_file);
+    free(tmp_file);
+    return PICAT_FALSE;
+  }
+  setvbuf(out, NULL, _IOFBF, REGEX_SED_BUFFER);
+
+  uint32_t option_bits, newline;
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_ALLOPTIONS, &option_bits);
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_NEWLINE, &newline);
+  int utf8 = (option_bits & PCRE2_UTF) != 0;
+  int crlf_is_newline = newline == PCRE2_NEWLINE_ANY || newline == PCRE2_NEWLINE_CRLF ||
+    newline == PCRE2_NEWLINE_ANYCRLF;
+
+  char* replacement_s = regex_get_cstring(replacement_p, &replacement_size);
+  PCRE2_SIZE buffer_size = 256;
+  PCRE2_UCHAR* buffer = malloc(buffer_size);
+  pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(entry->re, NULL);
+  PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
+  size_t written = 0; // the subject is written up to here
+  size_t offset = 0;
+  uint32_t options = 0;
+  uint32_t utf_check = 0; // PCRE2_NO_UTF_CHECK when the first match has checked the file
+  BPLONG count = 0;
+  int ok = 1;
+  // The same loop as pcre2_substitute with PCRE2_SUBSTITUTE_GLOBAL: after an
+  // empty match, try a non-empty match at the same place, then move on one character.
+  while (offset <= size) {
+    int rc = regex_pcre2_match(entry, (PCRE2_SPTR)subject, size, offset, options | utf_check, match_data);
+    if (rc >= 0 || rc == PCRE2_ERROR_NOMATCH) {
+      utf_check = PCRE2_NO_UTF_CHECK;
+    }
+    if (rc == PCRE2_ERROR_NOMATCH) {
+      if (options == 0) {
+        break;
+      }
+      offset++;
+      if (crlf_is_newline && offset < size && subject[offset-1] == '\r' && subject[offset] == '\n') {
+        offset++;
+      } else if (utf8) {
+        while (offset < size && (subject[offset] & 0xc0) == 0x80) {
+          offset++;
+        }
+      }
+      options = 0;
+      continue;
+    }
+    if (rc < 0 || ovector[0] > ovector[1]) {
+      fprintf(stderr, "regex_sed: matching error %d\n", rc);
+      ok = 0;
+      break;
+    }
+    PCRE2_SIZE outlen = buffer_size;
+    rc = pcre2_substitute(entry->re, (PCRE2_SPTR)subject, size, 0,
+                          PCRE2_SUBSTITUTE_MATCHED | PCRE2_SUBSTITUTE_REPLACEMENT_ONLY | PCRE2_SUBSTITUTE_OVERFLOW_LENGTH |
+                          PCRE2_NO_UTF_CHECK,
+                          match_data, NULL, (PCRE2_SPTR)replacement_s, replacement_size, buffer, &outlen);
+    if (rc == PCRE2_ERROR_NOMEMORY) {
+      buffer_size = outlen;
+      buffer = realloc(buffer, buffer_size);
+      outlen = buffer_size;
+      rc = pcre2_substitute(entry->re, (PCRE2_SPTR)subject, size, 0,
+                            PCRE2_SUBSTITUTE_MATCHED | PCRE2_SUBSTITUTE_REPLACEMENT_ONLY | PCRE2_NO_UTF_CHECK,
+                            match_data, NULL, (PCRE2_SPTR)replacement_s, replacement_size, buffer, &outlen);
+    }
+    if (rc < 0) {
+      PCRE2_UCHAR error_buffer[256];
+      pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
+      fprintf(stderr, "regex_sed: substitute error (rc:%d): %s\n", rc, error_buffer);
+      ok = 0;
+      break;
+    }
+    fwrite(subject + written, 1, ovector[0] - written, out);
+    fwrite(buffer, 1, outlen, out);
+    if (ferror(out)) {
+      break;
+    }
+    written = ovector[1];
+    count++;
+    offset = ovector[1];
+    options = ovector[0] == ovector[1] ? PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED : 0;
+  }
+  if (ok) {
+    fwrite(subject + written, 1, size - written, out);
+    if (ferror(out)) {
+      ok = 0;
+    }
+    if (fclose(out) != 0 || !ok || rename(tmp_file, out_file) != 0) {
+      fprintf(stderr, "regex_sed: can't write %s\n", out_file);
+      ok = 0;
+    }
+  } else {
+    fclose(out);
+  }
+  if (!ok) {
+    remove(tmp_file);
+  }
+
+  pcre2_match_data_free(match_data);
+  free(buffer);
+  free(replacement_s);
+  if (size > 0) {
+    munmap((void*)subject, size);
+  }
+  free(in_file);
+  free(out_file);
+  free(tmp_file);
+
+  return ok && picat_unify(count_p, picat_build_integer(count));
+
+} // regex_sed
+
+
+/* 
+   This is borrowed from PCRE2 distribution's src/pcre2demo.c
+   Most is verbatim from the program (including comments), 
+   with some small changes.
+
+   regex_find_matches/4: regex_find_matches(Pattern,Subject,Num,Matches)
+   regex_find_matches_format/5: regex_find_matches_format(Pattern,Subject,Num,Format,Matches)
+   The matches are built in the result format Format (see regex_get_format()).
+   
+*/
+static int regex_find_matches_term(TERM pattern_p, TERM subject_p, TERM num_to_find_p, TERM output_p,
+                                   int format, char* who) {
+  
+  pcre2_code *re;
+  // PCRE2_SPTR pattern;     /* PCRE2_SPTR is a pointer to unsigned code units of */
+  char* pattern;     /* PCRE2_SPTR is a pointer to unsigned code units of */  
+  // PCRE2_SPTR subject;     /* the appropriate width (in this case, 8 bits). */
+  char* subject;     /* the appropriate width (in this case, 8 bits). */  
+  PCRE2_SPTR name_table;
+  
+  int crlf_is_newline;
+  // The number of occurrences to find: 0 indicates to find all.
+  int num_to_find = 0; 
+  int i;
+  int rc;
+  int utf8;
+  
+  uint32_t option_bits;
+  uint32_t namecount;
+  uint32_t name_entry_size;
+  uint32_t newline;
+  
+  PCRE2_SIZE *ovector;
+  PCRE2_SIZE subject_length;
+  
+  pcre2_match_data *match_data;
+
+  size_t pattern_length;
+  pattern = regex_get_cstring(pattern_p, &pattern_length);
+  // printf("pattern: %s\n", pattern);
+  num_to_find = picat_get_integer(num_to_find_p);
+  if (regex_is_utf32(pattern, pattern_length)) {
+    int ret = regex_find_32(pattern, pattern_length, subject_p, num_to_find, 0, output_p, format, who);
+    free(pattern);
+    return ret;
+  }
+  char* subject_buf;
+  uint32_t subject_options;
+  subject = regex_get_subject(subject_p, &subject_length, &subject_buf, &subject_options, who);
+  if (subject == NULL) {
+    free(pattern);
+    return PICAT_FALSE;
+  }
+  // printf("num_to_find: %d\n",num_to_find);
+  
+  // The matches (as slices of the subject, built when all are found)
+  regex_result matches;
+  
+  // Number of found matches.
+  int num_matches = 0;
+  
+  /* Pattern and subject are char arguments, so they can be straightforwardly
+     cast to PCRE2_SPTR because we are working in 8-bit code units. The subject
+     length is cast to PCRE2_SIZE for completeness, though PCRE2_SIZE is in fact
+     defined to be size_t. */
+  
+  
+  /*************************************************************************
+   * Now we are going to compile the regular expression pattern (or get it  *
+   * from the pattern cache), and handle any errors that are detected.      *
+   *************************************************************************/  
+  regex_cache_entry* entry = regex_cache_lookup(pattern, pattern_length, 0, who);
+  free(pattern);
+  
+  /* Compilation failed: the error message is printed by regex_cache_lookup. */
+  if (entry == NULL) {
+    free(subject_buf);
+    return PICAT_FALSE;
+  }
+  re = entry->re;
+    
+  /*************************************************************************
+   * If the compilation succeeded, we call PCRE2 again, in order to do a    *
+   * pattern match against the subject string. This does just ONE match. If *
+   * further matching is needed, it will be done below. Before running the  *
+   * match we must set up a match_data block for holding the result. Using  *
+   * pcre2_match_data_create_from_pattern() ensures that the block is       *
+   * exactly the right size for the number of capturing parentheses in the  *
+   * pattern. If you need to know the actual size of a match_data block as  *
+   * a number of bytes, you can find it like this:                          *
+   *                                                                        *
+   * PCRE2_SIZE match_data_size = pcre2_get_match_data_size(match_data);    *
+   *************************************************************************/
+  match_data = pcre2_match_data_create_from_pattern(re, NULL);
+  
+  /* Now run the match. */
+  rc = regex_pcre2_match(
+                   entry,                /* the compiled pattern */
+                   subject,              /* the subject string */
+                   subject_length,       /* the length of the subject */
+                   0,                    /* start at offset 0 in the subject */
+                   subject_options,      /* PCRE2_NO_UTF_CHECK for a valid subject */
+                   match_data);          /* block for storing the result */
+  
+  /* Matching failed: handle error cases */
+  // printf("RC: %d\n",rc);
+  if (rc < 0) { 
+    switch(rc) {
+      // case PCRE2_ERROR_NOMATCH: printf("No match\n"); break;
+      case PCRE2_ERROR_NOMATCH: break;        
+        /*
+          Handle other special cases if you like
+        */
+      default: printf("Matching error %d\n", rc); break;
+    }
+    pcre2_match_data_free(match_data);   /* Release memory used for the match */
+    free(subject_buf);
+    return PICAT_FALSE;
+  }
+  
+  /* Match succeeded. Get a pointer to the output vector, where string offsets
+     are stored. */
+  ovector = pcre2_get_ovector_pointer(match_data);
+  // printf("Match succeeded at offset %d\n", (int)ovector[0]);
+  
+  
+  /*************************************************************************
+   * We have found the first match within the subject string. If the output *
+   * vector wasn't big enough, say so. Then output any substrings that were *
+   * captured.                                                              *
+   *************************************************************************/
+  
+  /* The output vector wasn't big enough. This should not happen, because we used
+     pcre2_match_data_create_from_pattern() above. */
+  if (rc == 0) {
+    printf("ovector was not big enough for all the captured substrings\n");
+  }
+  
+  /* Since release 10.38 PCRE2 has locked out the use of \K in lookaround
+     assertions. However, there is an option to re-enable the old behaviour. If that
+     is set, it is possible to run patterns such as /(?=.\K)/ that use \K in an
+     assertion to set the start of a match later than its end. In this demonstration
+     program, we show how to detect this case, but it shouldn't arise because the
+     option is never set. */
+  if (ovector[0] > ovector[1]) {
+    printf("\\K was used in an assertion to set the match start after its end.\n"
+             "From end to start the match was: %.*s\n", (int)(ovector[0] - ovector[1]),
+           (char *)(subject + ovector[1]));
+    printf("Run abandoned\n");
+    pcre2_match_data_free(match_data);
+    free(subject_buf);
+    return PICAT_FALSE;
+  }
+
+  // printf("First loop RC: %d\n",rc);
+
+  // This is the first match
+  /* Show substrings stored in the output vector by number. Obviously, in a real
+     application you might want to do things other than print them. */
+  // Note: i = 0 is the complete string from first match postition to the last
+  // but this is not needed here if there are capture group(s), see regex_result_add_match().
+  regex_result_init(&matches, subject);
+  regex_result_add_match(&matches, ovector, rc);
+  num_matches++;
+  
+  /**************************************************************************
+   * That concludes the basic part of this demonstration program. We have    *
+   * compiled a pattern, and performed a single match. The code that follows *
+   * shows first how to access named substrings, and then how to code for    *
+   * repeated matches on the same subject.                                   *
+   **************************************************************************/
+  
+  /* See if there are any named substrings, and if so, show them by name. First
+     we have to extract the count of named parentheses from the pattern. */
+  (void)pcre2_pattern_info(
+                           re,                   /* the compiled pattern */
+                           PCRE2_INFO_NAMECOUNT, /* get the number of named substrings */
+                           &namecount);          /* where to put the answer */
+
+  // hakank: We don't care about named substrings
+  if (0) {
+    if (namecount == 0) {
+      // printf("No named substrings\n");
+    
+    } else {
+      PCRE2_SPTR tabptr;
+      // printf("Named substrings\n");
+    
+      /* Before we can access the substrings, we must extract the table for
+         translating names to numbers, and the size of each entry in the table. */
+    
+      (void)pcre2_pattern_info(
+                               re,                       /* the compiled pattern */
+                               PCRE2_INFO_NAMETABLE,     /* address of the table */
+                               &name_table);             /* where to put the answer */
+    
+      (void)pcre2_pattern_info(
+                               re,                       /* the compiled pattern */
+                               PCRE2_INFO_NAMEENTRYSIZE, /* size of each entry in the table */
+                               &name_entry_size);        /* where to put the answer */
+    
+      /* Now we can scan the table and, for each entry, print the number, the name,
+         and the substring itself. In the 8-bit library the number is held in two
+         bytes, most significant first. */    
+      tabptr = name_table;
+      for (i = 0; i < namecount; i++) {
+        /* int n = (tabptr[0] << 8) | tabptr[1]; */
+        /* printf("(%d) %*s: %.*s\n", n, name_entry_size - 3, tabptr + 2, */
+        /*        (int)(ovector[2*n+1] - ovector[2*n]), subject + ovector[2*n]); */
+      
+        tabptr += name_entry_size;
+      }
+    }
+  }
+  
+  /*************************************************************************
+   * If the "-g" option was given on the command line, we want to continue  *
+   * to search for additional matches in the subject string, in a similar   *
+   * way to the /g option in Perl. This turns out to be trickier than you   *
+   * might think because of the possibility of matching an empty string.    *
+   * What happens is as follows:                                            *
+   *                                                                        *
+   * If the previous match was NOT for an empty string, we can just start   *
+   * the next match at the end of the previous one.                         *
+   *                                                                        *
+   * If the previous match WAS for an empty string, we can't do that, as it *
+   * would lead to an infinite loop. Instead, a call of pcre2_match() is    *
+   * made with the PCRE2_NOTEMPTY_ATSTART and PCRE2_ANCHORED flags set. The *
+   * first of these tells PCRE2 that an empty string at the start of the    *
+   * subject is not a valid match; other possibilities must be tried. The   *
+   * second flag restricts PCRE2 to one match attempt at the initial string *
+   * position. If this match succeeds, an alternative to the empty string   *
+   * match has been found, and we can print it and proceed round the loop,  *
+   * advancing by the length of whatever was found. If this match does not  *
+   * succeed, we still stay in the loop, advancing by just one character.   *
+   * In UTF-8 mode, which can be set by (*UTF) in the pattern, this may be  *
+   * more than one byte.                                                    *
+   *                                                                        *
+   * However, there is a complication concerned with newlines. When the     *
+   * newline convention is such that CRLF is a valid newline, we must       *
+   * advance by two characters rather than one. The newline convention can  *
+   * be set in the regex by (*CR), etc.; if not, we must find the default.  *
+   *************************************************************************/
+  
+  int find_more = 1; 
+  if (num_to_find == 0 || num_to_find > 1) {
+
+   /* Before running the loop, check for UTF-8 and whether CRLF is a valid newline
+      sequence. First, find the options with which the regex was compiled and extract
+      the UTF state. */
+   (void)pcre2_pattern_info(re, PCRE2_INFO_ALLOPTIONS, &option_bits);
+   utf8 = (option_bits & PCRE2_UTF) != 0;
+  
+   /* Now find the newline convention and see whether CRLF is a valid newline
+      sequence. */ 
+   (void)pcre2_pattern_info(re, PCRE2_INFO_NEWLINE, &newline);
+   crlf_is_newline = newline == PCRE2_NEWLINE_ANY ||
+     newline == PCRE2_NEWLINE_CRLF ||
+     newline == PCRE2_NEWLINE_ANYCRLF;
+  
+   /* Loop for second and subsequent matches */
+   for (;;) {
+     // printf("find_more: %d\n", find_more);
+     if (!find_more) {
+       break;
+     }
+     uint32_t options = 0;                   /* Normally no options */
+     PCRE2_SIZE start_offset = ovector[1];   /* Start at end of previous match */
+    
+     /* If the previous match was for an empty string, we are finished if we are
+        at the end of the subject. Otherwise, arrange to run another match at the
+        same point to see if a non-empty match can be found. */      
+     if (ovector[0] == ovector[1]) {
+       if (ovector[0] == subject_length) break;
+       options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
+     } else {
+
+       /* If the previous match was not an empty string, there is one tricky case to
+          consider. If a pattern contains \K within a lookbehind assertion at the
+          start, the end of the matched string can be at the offset where the match
+          started. Without special action, this leads to a loop that keeps on matching
+          the same substring. We must detect this case and arrange to move the start on
+          by one character. The pcre2_get_startchar() function returns the starting
+          offset that was passed to pcre2_match(). */      
+       PCRE2_SIZE startchar = pcre2_get_startchar(match_data);
+       if (start_offset <= startchar) {
+         if (startchar >= subject_length) break;   /* Reached end of subject.   */
+         start_offset = startchar + 1;             /* Advance by one character. */
+         if (utf8) {                                /* If UTF-8, it may be more  */
+           /*   than one code unit.     */
+           for (; start_offset < subject_length; start_offset++)
+             if ((subject[start_offset] & 0xc0) != 0x80) break;
+         }
+       }
+     }
+    
+     /* Run the next matching operation */
+     rc = regex_pcre2_match(
+                      entry,                /* the compiled pattern */
+                      subject,              /* the subject string */
+                      subject_length,       /* the length of the subject */
+                      start_offset,         /* starting offset in the subject */
+                      options | subject_options, /* options */
+                      match_data);          /* block for storing the result */
+    
+     /* This time, a result of NOMATCH isn't an error. If the value in "options"
+        is zero, it just means we have found all possible matches, so the loop ends.
+        Otherwise, it means we have failed to find a non-empty-string match at a
+        point where there was a previous empty-string match. In this case, we do what
+        Perl does: advance the matching position by one character, and continue. We
+        do this by setting the "end of previous match" offset, because that is picked
+        up at the top of the loop as the point at which to start again.
+       
+        There are two complications: (a) When CRLF is a valid newline sequence, and
+        the current position is just before it, advance by an extra byte. (b)
+        Otherwise we must ensure that we skip an entire UTF character if we are in
+        UTF mode. */
+     if (rc == PCRE2_ERROR_NOMATCH) {
+       if (options == 0) break;                    /* All matches found */
+       ovector[1] = start_offset + 1;              /* Advance one code unit */
+       if (crlf_is_newline &&                      /* If CRLF is a newline & */
+           start_offset < subject_length - 1 &&    /* we are at CRLF, */
+           subject[start_offset] == '\r' &&
+           subject[start_offset + 1] == '\n')
+         ovector[1] += 1;                          /* Advance by one more. */
+       else if (utf8)                              /* Otherwise, ensure we */
+         {                                         /* advance a whole UTF-8 */
+           while (ovector[1] < subject_length)       /* character. */
+             {
+               if ((subject[ovector[1]] & 0xc0) != 0x80) break;
+               ovector[1] += 1;
+             }
+         }
+       continue;    /* Go round the loop again */
+     }
+      
+     /* Other matching errors are not recoverable. */      
+     if (rc < 0) {
+       printf("Matching error %d\n", rc);
+       pcre2_match_data_free(match_data);
+       regex_result_free(&matches);
+       free(subject_buf);
+       return PICAT_FALSE;
+     }
+      
+     /* Match succeeded */
+     // printf("\nMatch succeeded again at offset %d\n", (int)ovector[0]);
+      
+     /* The match succeeded, but the output vector wasn't big enough. This
+        should not happen. */
+     if (rc == 0) {
+       printf("ovector was not big enough for all the captured substrings\n");
+     }
+      
+     /* We must guard against patterns such as /(?=.\K)/ that use \K in an
+        assertion to set the start of a match later than its end. In this
+        demonstration program, we just detect this case and give up. */      
+     if (ovector[0] > ovector[1]) {
+       printf("\\K was used in an assertion to set the match start after its end.\n"
+              "From end to start the match was: %.*s\n", (int)(ovector[0] - ovector[1]),
+              (char *)(subject + ovector[1]));
+       printf("Run abandoned\n");
+       pcre2_match_data_free(match_data);
+       regex_result_free(&matches);
+       free(subject_buf);
+       return PICAT_FALSE;
+     }
+     
+     // printf("Next loop rc2: %d\n", rc);
+     /* As before, show substrings stored in the output vector by number, and then
+        also any named substrings. */
+     regex_result_add_match(&matches, ovector, rc);
+     num_matches++;
+     
+     if (num_to_find != 0 && num_matches >= num_to_find) {
+       find_more = 0;
+     }
+     
+     /*
+       // hakank: We don't care about named substrings
+       if (namecount == 0) {
+       // printf("No named substrings\n");
+       } else {
+       PCRE2_SPTR tabptr = name_table;
+       // printf("Named substrings\n");
+       for (i = 0; i < namecount; i++) {
+       int n = (tabptr[0] << 8) | tabptr[1];
+       // printf("(%d) %*s: %.*s\n", n, name_entry_size - 3, tabptr + 2,
+       //        (int)(ovector[2*n+1] - ovector[2*n]), subject + ovector[2*n]); 
+       tabptr += name_entry_size;
+       }
+       }
+     */
+
+   }      /* End of loop to find second and subsequent matches */
+
+ } 
+  // printf("\n");
+  pcre2_match_data_free(match_data);
+
+  // printf("num_matches: %d\n", num_matches);
+  TERM output;
+  int ok = regex_result_build(&matches, format, who, &output);
+  regex_result_free(&matches);
+  free(subject_buf);
+  if (!ok) {
+    return PICAT_FALSE;
+  }
+  picat_unify(output_p, output); // output
+  
+  return PICAT_TRUE;
+  
+
+} // regex_find_matches_term
+
+int regex_find_matches() {
+  TERM pattern_p     = picat_get_call_arg(1,4);   // The pattern
+  TERM subject_p     = picat_get_call_arg(2,4);   // Subject string
+  TERM num_to_find_p = picat_get_call_arg(3,4); // Number of matches to find
+  TERM output_p      = picat_get_call_arg(4,4);    // Output
+
+  return regex_find_matches_term(pattern_p, subject_p, num_to_find_p, output_p,
+                                 REGEX_FORMAT_STRING, "regex_find_matches");
+
+} // regex_find_all
+
+int regex_find_matches_format() {
+  TERM pattern_p     = picat_get_call_arg(1,5);   // The pattern
+  TERM subject_p     = picat_get_call_arg(2,5);   // Subject string
+  TERM num_to_find_p = picat_get_call_arg(3,5); // Number of matches to find
+  TERM format_p      = picat_get_call_arg(4,5); // Result format
+  TERM output_p      = picat_get_call_arg(5,5);    // Output
+
+  int format;
+  if (!regex_get_format(format_p, "regex_find_matches_format", &format)) {
+    return PICAT_FALSE;
+  }
+  return regex_find_matches_term(pattern_p, subject_p, num_to_find_p, output_p,
+                                 format, "regex_find_matches_format");
+
+} // regex_find_matches_format
+
+
+/*
+  regex_find_positions/3: regex_find_positions(Pattern,Subject,Positions)
+
+  Positions are the positions Line-Column (from 1, the column in
+  characters) of the start of the (non-empty) matches of Pattern in
+  Subject, a string or a subject (see regex_subject/2). The matches are
+  found as in regex_split/4. The line is found (by binary search) in
+  the subject's line index and the column with its code point map; a
+  string is made a temporary subject.
+*/
+int regex_find_positions() {
+  TERM pattern_p   = picat_get_call_arg(1,3);
+  TERM subject_p   = picat_get_call_arg(2,3);
+  TERM positions_p = picat_get_call_arg(3,3);
+
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_find_positions");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  regex_subject_t* s;
+  regex_subject_t* temp = NULL;
+  if (regex_is_subject(subject_p)) {
+    s = regex_find_subject(subject_p, "regex_find_positions");
+    if (s == NULL) {
+      return PICAT_FALSE;
+    }
+  } else {
+    size_t size;
+    char* data = regex_get_cstring(subject_p, &size);
+    s = temp = regex_subject_new(data, size);
+  }
+  uint32_t subject_options = s->utf_valid ? PCRE2_NO_UTF_CHECK : 0;
+  uint32_t option_bits;
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_ALLOPTIONS, &option_bits);
+  int utf8 = (option_bits & PCRE2_UTF) != 0;
+
+  size_t num_positions = 0, max_positions = 64;
+  TERM* positions = malloc(max_positions * sizeof(TERM));
+  pcre2_match_data* match_data = pcre2_match_data_create(1, NULL);
+  PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
+  size_t offset = 0;
+  size_t line = 0;
+  while (offset <= s->length) {
+    int rc = regex_pcre2_match(entry, (PCRE2_SPTR)s->data, s->length, offset, subject_options, match_data);
+    if (rc < 0) {
+      if (rc != PCRE2_ERROR_NOMATCH) {
+        fprintf(stderr, "regex_find_positions: matching error %d\n", rc);
+      }
+      break;
+    }
+    if (ovector[1] <= ovector[0]) {
+      offset = ovector[0] + 1;
+      while (utf8 && offset < s->length && (s->data[offset] & 0xc0) == 0x80) {
+        offset++;
+      }
+      continue;
+    }
+    // the last line starting at or before the match (the matches are in order)
+    size_t lo = line, hi = s->num_lines;
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (s->lines[mid] <= ovector[0]) lo = mid; else hi = mid;
+    }
+    line = lo;
+    size_t column = regex_subject_code_offset(s, ovector[0]) - regex_subject_code_offset(s, s->lines[line]);
+    if (num_positions == max_positions) {
+      max_positions *= 2;
+      positions = realloc(positions, max_positions * sizeof(TERM));
+    }
+    TERM position = picat_build_structure("-",2);
+    picat_unify(picat_get_arg(1,position), picat_build_integer((BPLONG)line+1));
+    picat_unify(picat_get_arg(2,position), picat_build_integer((BPLONG)column+1));
+    positions[num_positions++] = position;
+    offset = ovector[1];
+  }
+  pcre2_match_data_free(match_data);
+  if (temp != NULL) {
+    regex_subject_delete(temp);
+  }
+
+  TERM list = regex_build_container(positions, num_positions, REGEX_FORMAT_STRING, "regex_find_positions");
+  free(positions);
+
+  return list != (TERM)NULL && picat_unify(positions_p, list);
+
+} // regex_find_positions
+
+
+/*
+  Typed captures (regex_capture_typed/4, regex_extract_typed/4)
+
+  The captures are converted in C, directly from the subject, by a
+  list of types: the i'th type is for capture group i (for a pattern
+  without capture groups: the match), and the groups after the last
+  type are ignored. The types are
+   - int:   an integer (an optional sign and decimal digits)
+   - float: a float (as strtod(), e.g. 3.14, -1e5 or 42)
+   - string, atom, codes: as the result formats (regex_get_format())
+   - skip:  the capture is not in the result
+  A match with a capture that is not a number (for int/float), e.g.
+  an unset group, is not converted.
+*/
+#define REGEX_TYPE_INT   8
+#define REGEX_TYPE_FLOAT 9
+#define REGEX_TYPE_SKIP  10
+#define REGEX_NUMBER_WORDS 4 // heap words of a float or a big integer
+
+typedef struct regex_typed_field {
+  int type;
+  PCRE2_SIZE start, end;
+  BPLONG i;
+  double f;
+} regex_typed_field;
+
+/*
+  Reads the list of types types_p for the pattern of entry into
+  *types (malloc:ed) and *num_types. Returns 0 (with an error message)
+  if it's not a list of types or if there are more types than groups.
+*/
+static int regex_get_types(TERM types_p, regex_cache_entry* entry, int** types, int* num_types, char* who) {
+  uint32_t groups;
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_CAPTURECOUNT, &groups);
+  int n = 0;
+  for (TERM t = types_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    n++;
+  }
+  *types = malloc((n+1) * sizeof(int));
+  *num_types = n;
+  int i = 0;
+  int ok = picat_is_list(types_p) || picat_is_nil(types_p);
+  for (TERM t = types_p; ok && picat_is_list(t); t = picat_get_cdr(t)) {
+    TERM type = picat_get_car(t);
+    char* name = picat_is_atom(type) ? picat_get_atom_name(type) : "";
+    int format = REGEX_FORMAT_STRING;
+    if (strcmp(name, "int") == 0) {
+      (*types)[i++] = REGEX_TYPE_INT;
+    } else if (strcmp(name, "float") == 0) {
+      (*types)[i++] = REGEX_TYPE_FLOAT;
+    } else if (strcmp(name, "skip") == 0) {
+      (*types)[i++] = REGEX_TYPE_SKIP;
+    } else if (strcmp(name, "list") != 0 && strcmp(name, "array") != 0 && regex_format_atom(type, &format)) {
+      (*types)[i++] = format;
+    } else {
+      ok = 0;
+    }
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: Types should be a list of int, float, string, atom, codes or skip\n", who);
+  } else if (n > (groups == 0 ? 1 : (int)groups)) {
+    fprintf(stderr, "%s: %d types but the pattern has %u capture groups\n", who, n, groups);
+    ok = 0;
+  }
+  if (!ok) {
+    free(*types);
+  }
+  return ok;
+}
+
+// Converts the len bytes in s to an int or a float
+static int regex_parse_number(const char* s, size_t len, int type, BPLONG* i, double* f) {
+  char buf[64];
+  char* copy = len < sizeof(buf) ? buf : malloc(len+1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  // strtoll/strtod also skip white space and read inf, nan etc
+  const char* p = copy + (copy[0] == '-' || copy[0] == '+');
+  int ok = (*p >= '0' && *p <= '9') || (type == REGEX_TYPE_FLOAT && *p == '.');
+  if (ok) {
+    char* end;
+    errno = 0;
+    if (type == REGEX_TYPE_INT) {
+      *i = strtoll(copy, &end, 10);
+    } else {
+      *f = strtod(copy, &end);
+    }
+    ok = errno == 0 && end == copy + len;
+  }
+  if (copy != buf) {
+    free(copy);
+  }
+  return ok;
+}
+
+/*
+  Converts the n slices in bounds (start and end offsets into subject;
+  the slices after them are unset) by the types to fields. Returns the
+  number of fields, or -1 if a number can't be converted.
+*/
+static int regex_typed_convert(const char* subject, const PCRE2_SIZE* bounds, int n,
+                               const int* types, int num_types, regex_typed_field* fields) {
+  int k = 0;
+  for (int i = 0; i < num_types; i++) {
+    if (types[i] == REGEX_TYPE_SKIP) {
+      continue;
+    }
+    regex_typed_field* field = &fields[k++];
+    field->type = types[i];
+    field->start = field->end = 0;
+    if (i < n && bounds[2*i] != PCRE2_UNSET) {
+      field->start = bounds[2*i];
+      field->end = bounds[2*i+1];
+    }
+    if ((types[i] == REGEX_TYPE_INT || types[i] == REGEX_TYPE_FLOAT) &&
+        !regex_parse_number(subject + field->start, field->end - field->start, types[i], &field->i, &field->f)) {
+      return -1;
+    }
+  }
+  return k;
+}
+
+// The heap words of the n fields
+static size_t regex_typed_words(const regex_typed_field* fields, int n) {
+  size_t words = 0;
+  for (int i = 0; i < n; i++) {
+    if (fields[i].type == REGEX_TYPE_INT || fields[i].type == REGEX_TYPE_FLOAT) {
+      words += REGEX_NUMBER_WORDS;
+    } else {
+      words += regex_value_words(fields[i].end - fields[i].start, fields[i].type);
+    }
+  }
+  return words;
+}
+
+// Writes the field as a value
+static TERM regex_typed_value(const char* subject, const regex_typed_field* field) {
+  if (field->type == REGEX_TYPE_INT) {
+    return picat_build_integer(field->i);
+  }
+  if (field->type == REGEX_TYPE_FLOAT) {
+    return picat_build_float(field->f);
+  }
+  return regex_write_value(subject + field->start, field->end - field->start, field->type);
+}
+
+/*
+  regex_capture_typed/4: regex_capture_typed(Pattern,Subject,Types,Values)
+
+  Values are the captures of the first match of Pattern in Subject (a
+  string or a subject) converted by Types (see above), in a list.
+  Fails if there's no match or a capture can't be converted.
+*/
+int regex_capture_typed() {
+  TERM pattern_p = picat_get_call_arg(1,4);
+  TERM subject_p = picat_get_call_arg(2,4);
+  TERM types_p   = picat_get_call_arg(3,4);
+  TERM values_p  = picat_get_call_arg(4,4);
+
+  size_t pattern_size, subject_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_capture_typed");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  int* types;
+  int num_types;
+  if (!regex_get_types(types_p, entry, &types, &num_types, "regex_capture_typed")) {
+    return PICAT_FALSE;
+  }
+  uint32_t groups;
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_CAPTURECOUNT, &groups);
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, "regex_capture_typed");
+  if (subject_s == NULL) {
+    free(types);
+    return PICAT_FALSE;
+  }
+
+  pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(entry->re, NULL);
+  int rc = regex_pcre2_match(entry, (PCRE2_SPTR)subject_s, subject_size, 0, subject_options, match_data);
+  regex_typed_field* fields = malloc((num_types+1) * sizeof(regex_typed_field));
+  int n = -1;
+  if (rc >= 0) {
+    PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
+    n = groups == 0 ? regex_typed_convert(subject_s, ovector, 1, types, num_types, fields) :
+      regex_typed_convert(subject_s, ovector + 2, groups, types, num_types, fields);
+  } else if (rc != PCRE2_ERROR_NOMATCH) {
+    fprintf(stderr, "regex_capture_typed: matching error %d\n", rc);
+  }
+  pcre2_match_data_free(match_data);
+  free(types);
+
+  int ok = n >= 0 && regex_heap_reserve(regex_container_words(n, REGEX_FORMAT_STRING) +
+                                        regex_typed_words(fields, n), "regex_capture_typed");
+  TERM values = (TERM)NULL;
+  if (ok) {
+    BPLONG_PTR slots;
+    int stride;
+    values = regex_write_container(n, REGEX_FORMAT_STRING, &slots, &stride);
+    for (int i = 0; i < n; i++) {
+      slots[i*stride] = regex_typed_value(subject_s, &fields[i]);
+    }
+  }
+  free(fields);
+  free(subject_buf);
+
+  return ok && picat_unify(values_p, values);
+
+} // regex_capture_typed
+
+
+/*
+  Pattern information (regex_info/2) and length filtering.
+
+  The lengths of a cached pattern are computed the first time they're
+  needed and kept in the cache entry:
+  - min_length: PCRE2_INFO_MINLENGTH, a lower bound of the length (in
+    characters) of a matching string, i.e. a subject with fewer bytes
+    can't match.
+  - max_subject: for a pattern which is anchored at both ends (^...$
+    without a top-level |) and supported by regex_dfa.c, the length
+    of the longest string of the pattern's DFA (+ 1 for the newline
+    that $ may match before). A longer subject can't match. -1 for
+    other patterns.
+  The batch predicates (regex_filter_all/3, regex_count/3,
+  regex_extract_file/4, regex_extract_typed/4, regex_index_search/3)
+  reject the subjects with regex_length_reject() before calling
+  pcre2_match.
+*/
+/*
+  The DFA of a cached pattern (see regex_dfa.h), which is built the
+  first time it's needed and then kept in the cache entry.
+  This is for the predicates that need the automaton of the pattern
+  instead of PCRE2's matching (e.g. regex_generate/3).
+  The DFA accepts exactly the strings of the pattern (REGEX_DFA_FULL).
+  Returns NULL (with an error message if who is not NULL) if the
+  pattern is not supported.
+*/
+#ifndef REGEX_DFA_MAX_STATES
+#define REGEX_DFA_MAX_STATES 20000
+#endif
+
+static regex_dfa* regex_entry_dfa(regex_cache_entry* entry, char* who) {
+  if (entry->dfa == NULL && (!entry->no_dfa || who != NULL)) {
+    const char* error;
+    int erroffset;
+    entry->dfa = regex_dfa_compile(entry->pattern, entry->pattern_size, REGEX_DFA_FULL,
+                                   REGEX_DFA_MAX_STATES, &error, &erroffset);
+    if (entry->dfa == NULL) {
+      entry->no_dfa = 1;
+      if (who != NULL) {
+        fprintf(stderr,"%s: %s at offset %d\n", who, error, erroffset);
+      }
+    }
+  }
+  return entry->dfa;
+}
+
+// The pattern ends with $ (not escaped or in a class) and has no | outside groups.
+static int regex_pattern_end_anchored(const char* p, size_t n) {
+  int depth = 0, in_class = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (p[i] == '\\') {
+      if (++i == n) {
+        return 0;
+      }
+    } else if (in_class) {
+      in_class = p[i] != ']';
+    } else if (p[i] == '[') {
+      in_class = 1;
+      if (i+1 < n && p[i+1] == '^') {
+        i++;
+      }
+      if (i+1 < n && p[i+1] == ']') {
+        i++;
+      }
+    } else if (p[i] == '(') {
+      depth++;
+    } else if (p[i] == ')') {
+      depth--;
+    } else if (p[i] == '|' && depth == 0) {
+      return 0;
+    } else if (p[i] == '$' && i == n-1) {
+      return depth == 0;
+    }
+  }
+  return 0;
+}
+
+static void regex_entry_lengths(regex_cache_entry* entry) {
+  if (entry->lengths_known) {
+    return;
+  }
+  uint32_t min_length = 0, options = 0;
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_MINLENGTH, &min_length);
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_ALLOPTIONS, &options);
+  entry->min_length = min_length;
+  entry->max_subject = -1;
+  if ((options & PCRE2_ANCHORED) && regex_pattern_end_anchored(entry->pattern, entry->pattern_size)) {
+    regex_dfa* dfa = regex_entry_dfa(entry, NULL);
+    long max_length = dfa == NULL ? -1 : regex_dfa_max_length(dfa);
+    entry->max_subject = max_length < 0 ? -1 : max_length + 1;
+  }
+  entry->lengths_known = 1;
+}
+
+/*
+  True if a subject of length bytes can't match the pattern.
+  (regex_entry_lengths(entry) must have been called.)
+*/
+static inline int regex_length_reject(regex_cache_entry* entry, size_t length) {
+  if (length < entry->min_length || (entry->max_subject >= 0 && length > (size_t)entry->max_subject)) {
+    REGEX_STAT(length_rejects)++;
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+  regex_info/2: regex_info(Pattern,Info)
+
+  Info is a list of Key=Value with information about the compiled
+  pattern:
+  - min_length:         PCRE2_INFO_MINLENGTH
+  - max_length:         the length (in bytes) of the longest matching
+                        string, from the pattern's DFA; -1 if it's
+                        unbounded or the pattern is not supported by
+                        regex_dfa.c
+  - captures:           PCRE2_INFO_CAPTURECOUNT
+  - names:              the named groups, a list of Name=Number
+  - first_code_unit:    the first code unit of any match, -1 if not known
+  - required_code_unit: a code unit that must be in any match, -1 if none
+  - size:               PCRE2_INFO_SIZE (bytes)
+  - rewritten:          1 if the cached pattern (that the other keys
+                        describe) was compiled from the optimized
+                        pattern, else 0
+  - optimized:          the pattern as rewritten by the optimizer (see
+                        regex_optimize/1), the pattern itself if there's
+                        nothing to rewrite
+  - rewrites:           the rewrites, a list of {Kind,Offset,Original,
+                        Rewritten} where Original is the part of the
+                        pattern at the byte offset Offset, and Kind is
+                        one of prefix_factoring, alternation_to_class,
+                        redundant_group, possessive, atomic_group and
+                        capture_elimination
+  - optimized_nocapture, rewrites_nocapture: the same for the
+                        predicates that don't read the captures
+                        (e.g. regex/2)
+  The optimized patterns are shown also when the optimizer is off
+  (then rewritten is 0).
+  See regex_info/1 in regex.pi which returns a map.
+*/
+static const char* regex_rewrite_kinds[] = {
+  "prefix_factoring", "alternation_to_class", "redundant_group",
+  "possessive", "atomic_group", "capture_elimination"
+};
+
+// The optimized=Pattern and rewrites=Rewrites of regex_info/2 (with the keys optimized_key etc)
+static void regex_info_rewrites(char* pattern, size_t pattern_size, int flags,
+                                char* optimized_key, char* rewrites_key, TERM* optimized_kv, TERM* rewrites_kv) {
+  regex_rewrite* rewrites;
+  int num_rewrites;
+  char* optimized = regex_dfa_rewrite(pattern, (int)pattern_size, flags, &rewrites, &num_rewrites);
+  TERM list = picat_build_nil();
+  for (int i = num_rewrites-1; i >= 0; i--) {
+    regex_rewrite* r = &rewrites[i];
+    TERM rewrite = picat_build_array(4);
+    picat_unify(picat_get_arg(1, rewrite), picat_build_atom((char*)regex_rewrite_kinds[r->kind]));
+    picat_unify(picat_get_arg(2, rewrite), picat_build_integer(r->start));
+    picat_unify(picat_get_arg(3, rewrite), regex_build_string(pattern + r->start, r->end - r->start));
+    picat_unify(picat_get_arg(4, rewrite), regex_build_string(r->text, strlen(r->text)));
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), rewrite);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
+  }
+  *optimized_kv = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, *optimized_kv), picat_build_atom(optimized_key));
+  picat_unify(picat_get_arg(2, *optimized_kv), optimized == NULL ? regex_build_string(pattern, pattern_size) :
+              regex_build_string(optimized, strlen(optimized)));
+  *rewrites_kv = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, *rewrites_kv), picat_build_atom(rewrites_key));
+  picat_unify(picat_get_arg(2, *rewrites_kv), list);
+  free(optimized);
+  regex_rewrites_free(rewrites, num_rewrites);
+}
+
+int regex_info() {
+  TERM pattern_p = picat_get_call_arg(1,2);
+  TERM info_p = picat_get_call_arg(2,2);
+
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_info");
+  if (entry == NULL) {
+    free(pattern_s);
+    return PICAT_FALSE;
+  }
+  TERM optimized_kv, rewrites_kv, optimized_nocapture_kv, rewrites_nocapture_kv;
+  regex_info_rewrites(pattern_s, pattern_size, 0, "optimized", "rewrites", &optimized_kv, &rewrites_kv);
+  regex_info_rewrites(pattern_s, pattern_size, REGEX_REWRITE_NO_CAPTURES, "optimized_nocapture",
+                      "rewrites_nocapture", &optimized_nocapture_kv, &rewrites_nocapture_kv);
+  free(pattern_s);
+  pcre2_code* re = entry->re;
+  uint32_t min_length = 0, captures = 0, first_type = 0, first = 0, last_type = 0, last = 0;
+  uint32_t name_count = 0, name_entry_size = 0;
+  size_t size = 0;
+  PCRE2_SPTR name_table = NULL;
+  (void)pcre2_pattern_info(re, PCRE2_INFO_MINLENGTH, &min_length);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &captures);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODETYPE, &first_type);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODEUNIT, &first);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_LASTCODETYPE, &last_type);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_LASTCODEUNIT, &last);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_SIZE, &size);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_NAMECOUNT, &name_count);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_NAMEENTRYSIZE, &name_entry_size);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_NAMETABLE, &name_table);
+  regex_dfa* dfa = regex_entry_dfa(entry, NULL);
+  long max_length = dfa == NULL ? -1 : regex_dfa_max_length(dfa);
+
+  // the name table: the group number (2 bytes) and the name (zero terminated)
+  TERM names = picat_build_nil();
+  for (int i = (int)name_count-1; i >= 0; i--) {
+    PCRE2_SPTR tabptr = name_table + (size_t)i*name_entry_size;
+    TERM kv = regex_key_value((char*)tabptr + 2, (tabptr[0] << 8) | tabptr[1]);
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), kv);
+    picat_unify(picat_get_cdr(cons), names);
+    names = cons;
+  }
+  TERM names_kv = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, names_kv), picat_build_atom("names"));
+  picat_unify(picat_get_arg(2, names_kv), names);
+
+  TERM kvs[] = {
+    regex_key_value("min_length", min_length),
+    regex_key_value("max_length", (uint64_t)max_length),
+    regex_key_value("captures", captures),
+    names_kv,
+    regex_key_value("first_code_unit", first_type == 1 ? first : (uint64_t)-1),
+    regex_key_value("required_code_unit", last_type == 1 ? last : (uint64_t)-1),
+    regex_key_value("size", size),
+    regex_key_value("rewritten", entry->rewritten),
+    optimized_kv,
+    rewrites_kv,
+    optimized_nocapture_kv,
+    rewrites_nocapture_kv
+  };
+  int n = sizeof(kvs)/sizeof(kvs[0]);
+  TERM list = picat_build_nil();
+  for (int i = n-1; i >= 0; i--) {
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), kvs[i]);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
+  }
+
+  return picat_unify(info_p, list);
+
+} // regex_info
+
+
+/*
+  regex_profile/3: regex_profile(Pattern,Subject,Report)
+
+  Profiles the match of Pattern in Subject (a string or a subject).
+  The pattern is compiled (not cached) with PCRE2_AUTO_CALLOUT, so
+  pcre2_match calls regex_profile_callout() before each item of the
+  pattern, and the callouts are counted per pattern offset. Report is
+  a list of Key=Value:
+  - result:     the result of pcre2_match: > 0 for a match, -1 for
+                no match, -47 if the match limit was reached etc
+  - steps:      the number of callouts (items tried)
+  - backtracks: the number of callouts after a backtrack
+                (PCRE2_CALLOUT_BACKTRACK)
+  - starts:     the number of start positions tried
+                (PCRE2_CALLOUT_STARTMATCH)
+  - heat:       the heat map, a list of {Offset,Item,Steps,Backtracks}
+                for each offset (in bytes, from 0) of the pattern that
+                was reached, in pattern order. Item is the pattern item
+                at Offset, e.g. "\\d+" or "(".
+  The start-up optimizations of pcre2_match are kept, so these are
+  the steps of the real match (e.g. a subject without the required
+  code unit of the pattern has no steps).
+  See regex_profile/2 in regex.pi which returns a map.
+*/
+typedef struct regex_profile_t {
+  uint64_t* steps;         // per pattern offset
+  uint64_t* backtracks;
+  uint32_t* item_lengths;
+  uint64_t total_steps;
+  uint64_t total_backtracks;
+  uint64_t starts;
+} regex_profile_t;
+
+static int regex_profile_callout(pcre2_callout_block* block, void* data) {
+  regex_profile_t* profile = data;
+  size_t offset = block->pattern_position;
+  profile->steps[offset]++;
+  profile->item_lengths[offset] = (uint32_t)block->next_item_length;
+  profile->total_steps++;
+  if (block->callout_flags & PCRE2_CALLOUT_BACKTRACK) {
+    profile->backtracks[offset]++;
+    profile->total_backtracks++;
+  }
+  if (block->callout_flags & PCRE2_CALLOUT_STARTMATCH) {
+    profile->starts++;
+  }
+  return 0;
+}
+
+int regex_profile() {
+  TERM pattern_p = picat_get_call_arg(1,3);
+  TERM subject_p = picat_get_call_arg(2,3);
+  TERM report_p  = picat_get_call_arg(3,3);
+
+  size_t pattern_size, subject_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  int errcode;
+  PCRE2_SIZE erroffset;
+  pcre2_code* re = pcre2_compile((PCRE2_SPTR)pattern_s, pattern_size, PCRE2_AUTO_CALLOUT, &errcode, &erroffset, NULL);
+  if (re == NULL) {
+    PCRE2_UCHAR buffer[256];
+    pcre2_get_error_message(errcode, buffer, sizeof(buffer));
+    fprintf(stderr,"regex_profile: PCRE2 compilation failed at offset %d: %s\n", (int)erroffset, buffer);
+    free(pattern_s);
+    return PICAT_FALSE;
+  }
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, "regex_profile");
+  if (subject_s == NULL) {
+    pcre2_code_free(re);
+    free(pattern_s);
+    return PICAT_FALSE;
+  }
+
+  regex_profile_t profile = { NULL, NULL, NULL, 0, 0, 0 };
+  profile.steps = calloc(pattern_size+1, sizeof(uint64_t));
+  profile.backtracks = calloc(pattern_size+1, sizeof(uint64_t));
+  profile.item_lengths = calloc(pattern_size+1, sizeof(uint32_t));
+  pcre2_match_context* mcontext = pcre2_match_context_create(NULL);
+  pcre2_set_callout(mcontext, regex_profile_callout, &profile);
+  pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(re, NULL);
+  int rc = pcre2_match(re, (PCRE2_SPTR)subject_s, subject_size, 0, subject_options, match_data, mcontext);
+  pcre2_match_data_free(match_data);
+  pcre2_match_context_free(mcontext);
+  pcre2_code_free(re);
+  free(subject_buf);
+
+  // the heat map, built from the end
+  TERM heat = picat_build_nil();
+  for (size_t i = pattern_size+1; i-- > 0; ) {
+    if (profile.steps[i] == 0) {
+      continue;
+    }
+    size_t len = profile.item_lengths[i];
+    if (len > pattern_size - i) {
+      len = pattern_size - i;
+    }
+    TERM entry = picat_build_array(4);
+    picat_unify(picat_get_arg(1, entry), picat_build_integer((BPLONG)i));
+    picat_unify(picat_get_arg(2, entry), regex_build_string(pattern_s + i, len));
+    picat_unify(picat_get_arg(3, entry), picat_build_integer((BPLONG)profile.steps[i]));
+    picat_unify(picat_get_arg(4, entry), picat_build_integer((BPLONG)profile.backtracks[i]));
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), entry);
+    picat_unify(picat_get_cdr(cons), heat);
+    heat = cons;
+  }
+  free(profile.steps);
+  free(profile.backtracks);
+  free(profile.item_lengths);
+  free(pattern_s);
+  TERM heat_kv = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, heat_kv), picat_build_atom("heat"));
+  picat_unify(picat_get_arg(2, heat_kv), heat);
+
+  TERM kvs[] = {
+    regex_key_value("result", (uint64_t)(int64_t)rc),
+    regex_key_value("steps", profile.total_steps),
+    regex_key_value("backtracks", profile.total_backtracks),
+    regex_key_value("starts", profile.starts),
+    heat_kv
+  };
+  int n = sizeof(kvs)/sizeof(kvs[0]);
+  TERM list = picat_build_nil();
+  for (int i = n-1; i >= 0; i--) {
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), kvs[i]);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
+  }
+
+  return picat_unify(report_p, list);
+
+} // regex_profile
+
+
+/*
+  regex_analyze/2: regex_analyze(Pattern,Report)
+
+  The static ReDoS analysis of Pattern (see regex_dfa_redos() in
+  regex_dfa.c): how long a backtracking match can take on a subject
+  that doesn't match, without matching anything. Report is a list of
+  Key=Value:
+  - complexity: linear, polynomial, exponential, or unknown if the
+                pattern can't be analyzed (then error=Message and
+                offset=Offset are added)
+  - degree:     the degree of a polynomial (2 is quadratic), 1 for
+                linear and 0 for exponential and unknown
+  - findings:   a list of {Kind,Offset,Item,Complexity} where Item is
+                the part of the pattern (at the byte offset Offset)
+                and Kind is one of
+                  nested_quantifier        (a+)+
+                  ambiguous_alternation    (\d+|\w+)*
+                  ambiguous_repeat         (a|aa)*
+                  overlapping_quantifiers  \d+\d+  (polynomial)
+                  unanchored_quantifier    \s+$    (polynomial)
+                Complexity is exponential or the degree.
+  See regex_analyze/1 in regex.pi which returns a map.
+*/
+static const char* regex_redos_kinds[] = {
+  "nested_quantifier", "ambiguous_alternation", "ambiguous_repeat",
+  "overlapping_quantifiers", "unanchored_quantifier"
+};
+static const char* regex_redos_classes[] = { "unknown", "linear", "polynomial", "exponential" };
+
+int regex_analyze() {
+  TERM pattern_p = picat_get_call_arg(1,2);
+  TERM report_p  = picat_get_call_arg(2,2);
+
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_redos r;
+  regex_dfa_redos(pattern_s, (int)pattern_size, &r);
+
+  TERM findings = picat_build_nil();
+  for (int i = r.num_findings-1; i >= 0; i--) {
+    regex_redos_finding* f = &r.findings[i];
+    TERM finding = picat_build_array(4);
+    picat_unify(picat_get_arg(1, finding), picat_build_atom((char*)regex_redos_kinds[f->kind]));
+    picat_unify(picat_get_arg(2, finding), picat_build_integer(f->start));
+    picat_unify(picat_get_arg(3, finding), regex_build_string(pattern_s + f->start, f->end - f->start));
+    picat_unify(picat_get_arg(4, finding), f->complexity == REGEX_REDOS_EXPONENTIAL ?
+                picat_build_atom("exponential") : picat_build_integer(f->degree));
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), finding);
+    picat_unify(picat_get_cdr(cons), findings);
+    findings = cons;
+  }
+  TERM kvs[5];
+  int n = 0;
+  kvs[n] = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, kvs[n]), picat_build_atom("complexity"));
+  picat_unify(picat_get_arg(2, kvs[n]), picat_build_atom((char*)regex_redos_classes[r.complexity]));
+  n++;
+  kvs[n++] = regex_key_value("degree", r.degree);
+  kvs[n] = picat_build_structure("=", 2);
+  picat_unify(picat_get_arg(1, kvs[n]), picat_build_atom("findings"));
+  picat_unify(picat_get_arg(2, kvs[n]), findings);
+  n++;
+  if (r.complexity == REGEX_REDOS_UNKNOWN) {
+    kvs[n] = picat_build_structure("=", 2);
+    picat_unify(picat_get_arg(1, kvs[n]), picat_build_atom("error"));
+    picat_unify(picat_get_arg(2, kvs[n]), regex_build_string((char*)r.error, strlen(r.error)));
+    n++;
+    kvs[n++] = regex_key_value("offset", r.erroffset);
+  }
+  regex_redos_free(&r);
+  free(pattern_s);
+
+  TERM list = picat_build_nil();
+  for (int i = n-1; i >= 0; i--) {
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), kvs[i]);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
+  }
+
+  return picat_unify(report_p, list);
+
+} // regex_analyze
+
+
+/*
+  regex_redos_mode/1: regex_redos_mode(Mode)
+
+  Sets the ReDoS mode (see regex_redos_check()) of the patterns that
+  are compiled from now on. Mode is
+  - off:    (the default) the patterns are not analyzed
+  - refuse: a dangerous pattern is not compiled: the predicate that
+            uses it (e.g. regex_compile/1) fails with an error message
+  - limit:  a dangerous pattern is matched with the match limit
+            REGEX_REDOS_MATCH_LIMIT, i.e. a catastrophic match fails
+  The cache (except the pinned pattern) is cleared, so the patterns
+  that are already compiled are analyzed again when they are used.
+*/
+int regex_redos_mode() {
+  TERM mode_p = picat_get_call_arg(1,1);
+
+  char* name = picat_is_atom(mode_p) ? picat_get_atom_name(mode_p) : "";
+  int mode;
+  if (strcmp(name, "off") == 0) {
+    mode = REGEX_REDOS_OFF;
+  } else if (strcmp(name, "refuse") == 0) {
+    mode = REGEX_REDOS_REFUSE;
+  } else if (strcmp(name, "limit") == 0) {
+    mode = REGEX_REDOS_LIMIT;
+  } else {
+    fprintf(stderr,"regex_redos_mode: the mode must be off, refuse or limit\n");
+    return PICAT_FALSE;
+  }
+  if (mode == REGEX_REDOS_LIMIT && regex_redos_context == NULL) {
+    regex_redos_context = pcre2_match_context_create(NULL);
+    pcre2_set_match_limit(regex_redos_context, REGEX_REDOS_MATCH_LIMIT);
+    regex_redos_context_32 = pcre2_match_context_create_32(NULL);
+    pcre2_set_match_limit_32(regex_redos_context_32, REGEX_REDOS_MATCH_LIMIT);
+  }
+  regex_redos_setting = mode;
+  regex_cache_clear();
+
+  return PICAT_TRUE;
+
+} // regex_redos_mode
+
+
+/*
+  regex_optimize/1: regex_optimize(Mode)
+
+  Turns the pattern optimizer (see regex_optimize_compile()) on or off
+  for the patterns that are compiled from now on. Mode is on or off
+  (the default). The optimizer rewrites a pattern before it's compiled
+  (see regex_dfa_rewrite() in regex_dfa.c), e.g. (?:abc|abd)x+ to
+  ab[cd]x+, and the rewrites are shown by regex_info/1. The cache
+  (except the pinned pattern) is cleared.
+*/
+int regex_optimize() {
+  TERM mode_p = picat_get_call_arg(1,1);
+
+  char* name = picat_is_atom(mode_p) ? picat_get_atom_name(mode_p) : "";
+  if (strcmp(name, "on") == 0) {
+    regex_optimizing = 1;
+  } else if (strcmp(name, "off") == 0) {
+    regex_optimizing = 0;
+  } else {
+    fprintf(stderr,"regex_optimize: the mode must be on or off\n");
+    return PICAT_FALSE;
+  }
+  regex_cache_clear();
+
+  return PICAT_TRUE;
+
+} // regex_optimize
+
+
+/*
+  regex_split/4: regex_split(Pattern,Subject,Format,Parts)
+
+  Parts are the parts of Subject between the matches of Pattern,
+  in the result format Format (see regex_get_format()).
+  The captures of Pattern are not included in Parts, and an empty
+  match doesn't split the subject: as in regex_sed/3, a non-empty
+  match at the same place is tried next (so x?? splits "axb" at the
+  x), and then the search moves on one character (a CRLF newline or
+  a UTF-8 character). All the parts are kept, i.e. there are empty
+  parts for a match at the start/end of Subject and for adjacent
+  matches.
+*/
+int regex_split() {
+  TERM pattern_p = picat_get_call_arg(1,4);
+  TERM subject_p = picat_get_call_arg(2,4);
+  TERM format_p  = picat_get_call_arg(3,4);
+  TERM parts_p   = picat_get_call_arg(4,4);
+
+  int format;
+  if (!regex_get_format(format_p, "regex_split", &format)) {
+    return PICAT_FALSE;
+  }
+
+  size_t pattern_size, subject_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, regex_no_captures(), "regex_split");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, "regex_split");
+  if (subject_s == NULL) {
+    return PICAT_FALSE;
+  }
+  uint32_t option_bits, newline;
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_ALLOPTIONS, &option_bits);
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_NEWLINE, &newline);
+  int utf8 = (option_bits & PCRE2_UTF) != 0;
+  int crlf_is_newline = newline == PCRE2_NEWLINE_ANY || newline == PCRE2_NEWLINE_CRLF ||
+    newline == PCRE2_NEWLINE_ANYCRLF;
+
+  regex_result parts;
+  regex_result_init(&parts, subject_s);
+  pcre2_match_data* match_data = pcre2_match_data_create(1, NULL);
+  PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
+  size_t start = 0;
+  size_t offset = 0;
+  uint32_t options = 0;
+  while (offset <= subject_size) {
+    int rc = regex_pcre2_match(entry, (PCRE2_SPTR)subject_s, subject_size, offset, options | subject_options,
+                               match_data);
+    if (rc >= 0 && ovector[1] > ovector[0]) {
+      regex_result_add_slice(&parts, start, ovector[0]);
+      start = offset = ovector[1];
+      options = 0;
+      continue;
+    }
+    if (rc >= 0 && ovector[1] == ovector[0]) {
+      // an empty match: try a non-empty match at the same place
+      offset = ovector[0];
+      options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
+      continue;
+    }
+    if (rc >= 0) {
+      // \K in an assertion: move on from the start of the match
+      offset = ovector[0];
+    } else if (rc != PCRE2_ERROR_NOMATCH || options == 0) {
+      if (rc != PCRE2_ERROR_NOMATCH) {
+        fprintf(stderr, "regex_split: matching error %d\n", rc);
+      }
+      break;
+    }
+    // no non-empty match after the empty match: move on one character
+    offset++;
+    if (crlf_is_newline && offset < subject_size && subject_s[offset-1] == '\r' && subject_s[offset] == '\n') {
+      offset++;
+    } else if (utf8) {
+      while (offset < subject_size && (subject_s[offset] & 0xc0) == 0x80) {
+        offset++;
+      }
+    }
+    options = 0;
+  }
+  pcre2_match_data_free(match_data);
+  regex_result_add_slice(&parts, start, subject_size);
+
+  TERM result;
+  int ok = regex_result_build(&parts, format, "regex_split", &result);
+  regex_result_free(&parts);
+  free(subject_buf);
+
+  return ok && picat_unify(parts_p, result);
+
+} // regex_split
+
+/*
+  Corpora (regex_corpus_load/1)
+
+  A corpus is a list of strings, or the lines of a file, converted to C
+  once: the strings are in one byte arena (for a file the mmap:ed file
+  itself, the lines without the newlines), with the start and the
+  length of each string in two arrays. regex_filter_all/2,
+  regex_count/2, regex_extract_file/2,3 and regex_index_build/1 accept
+  a corpus instead of a list of strings (or a file), so a word list
+  that is filtered again and again is not walked and converted each
+  time. A corpus is not changed after it's loaded, so the threads of
+  the pool can read it.
+
+  The corpus is referred to from Picat as $regex_corpus(Id).
+*/
+typedef struct regex_corpus {
+  int id;
+  size_t num_strings;
+  char* data;          // the arena
+  size_t data_size;
+  int mapped;          // data is the mmap:ed file
+  size_t* starts;      // string i is data[starts[i]..starts[i]+lengths[i]-1]
+  uint32_t* lengths;
+  struct regex_corpus* next;
+} regex_corpus;
+
+static regex_corpus* regex_corpora = NULL;
+static int regex_corpus_next_id = 1;
+
+static int regex_is_corpus(TERM t) {
+  return picat_is_structure(t) && strcmp(picat_get_struct_name(t), "regex_corpus") == 0 &&
+    picat_get_struct_arity(t) == 1;
+}
+
+static regex_corpus* regex_get_corpus(TERM corpus_p, char* who) {
+  if (regex_is_corpus(corpus_p)) {
+    int id = picat_get_integer(picat_get_arg(1, corpus_p));
+    for (regex_corpus* c = regex_corpora; c != NULL; c = c->next) {
+      if (c->id == id) {
+        return c;
+      }
+    }
+  }
+  fprintf(stderr,"%s: not a corpus (or the corpus has been freed)\n", who);
+  return NULL;
+}
+
+static void regex_corpus_add(regex_corpus* c, size_t start, size_t length, size_t* alloc) {
+  if (c->num_strings == *alloc) {
+    *alloc *= 2;
+    c->starts = realloc(c->starts, *alloc * sizeof(size_t));
+    c->lengths = realloc(c->lengths, *alloc * sizeof(uint32_t));
+  }
+  c->starts[c->num_strings] = start;
+  c->lengths[c->num_strings++] = (uint32_t)length;
+}
+
+/*
+  regex_corpus_load/2: regex_corpus_load(FileOrList,Corpus)
+
+  FileOrList is a file name (a string) or a list of strings.
+*/
+int regex_corpus_load() {
+  TERM source_p = picat_get_call_arg(1,2);
+  TERM corpus_p = picat_get_call_arg(2,2);
+
+  regex_corpus* c = calloc(1, sizeof(regex_corpus));
+  size_t alloc = 1024;
+  c->starts = malloc(alloc * sizeof(size_t));
+  c->lengths = malloc(alloc * sizeof(uint32_t));
+  if (picat_is_list(source_p) && picat_is_atom(picat_get_car(source_p))) {
+    // a file: its lines
+    char* file = picat_string_to_cstring(source_p);
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      fprintf(stderr, "regex_corpus_load: can't open %s\n", file);
+      if (fd >= 0) {
+        close(fd);
+      }
+      free(file);
+      free(c->starts);
+      free(c->lengths);
+      free(c);
+      return PICAT_FALSE;
+    }
+    c->data_size = (size_t)st.st_size;
+    if (c->data_size > 0) {
+      void* m = mmap(NULL, c->data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m == MAP_FAILED) {
+        fprintf(stderr, "regex_corpus_load: can't read %s\n", file);
+        close(fd);
+        free(file);
+        free(c->starts);
+        free(c->lengths);
+        free(c);
+        return PICAT_FALSE;
+      }
+      c->data = m;
+      c->mapped = 1;
+    }
+    close(fd);
+    free(file);
+    size_t line = 0;
+    while (line < c->data_size) {
+      const char* nl = memchr(c->data + line, '\n', c->data_size - line);
+      size_t next = nl == NULL ? c->data_size : (size_t)(nl - c->data) + 1;
+      size_t end = nl == NULL ? c->data_size : next-1;
+      if (end > line && c->data[end-1] == '\r') {
+        end--;
+      }
+      regex_corpus_add(c, line, end - line, &alloc);
+      line = next;
+    }
+  } else {
+    size_t data_alloc = 65536;
+    c->data = malloc(data_alloc);
+    for (TERM t = source_p; picat_is_list(t); t = picat_get_cdr(t)) {
+      size_t size;
+      char* s = regex_get_cstring(picat_get_car(t), &size);
+      while (c->data_size + size > data_alloc) {
+        data_alloc *= 2;
+        c->data = realloc(c->data, data_alloc);
+      }
+      memcpy(c->data + c->data_size, s, size);
+      free(s);
+      regex_corpus_add(c, c->data_size, size, &alloc);
+      c->data_size += size;
+    }
+  }
+
+  c->id = regex_corpus_next_id++;
+  c->next = regex_corpora;
+  regex_corpora = c;
+
+  TERM corpus = picat_build_structure("regex_corpus",1);
+  picat_unify(picat_get_arg(1,corpus), picat_build_integer(c->id));
+  return picat_unify(corpus_p, corpus);
+
+} // regex_corpus_load
+
+/*
+  regex_corpus_free/1: regex_corpus_free(Corpus)
+*/
+int regex_corpus_free() {
+  TERM corpus_p = picat_get_call_arg(1,1);
+
+  regex_corpus* c = regex_get_corpus(corpus_p, "regex_corpus_free");
+  if (c == NULL) {
+    return PICAT_FALSE;
+  }
+  for (regex_corpus** p = &regex_corpora; *p != NULL; p = &(*p)->next) {
+    if (*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+  if (c->mapped) {
+    munmap(c->data, c->data_size);
+  } else {
+    free(c->data);
+  }
+  free(c->starts);
+  free(c->lengths);
+  free(c);
+
+  return PICAT_TRUE;
+
+} // regex_corpus_free
+
+
+/*
+  Thread pool.
+
+  The pool is started the first time it's used, with one thread less
+  than the number of processors (at most REGEX_POOL_MAX_THREADS): the
+  calling thread works as well. regex_pool_run(job, arg) runs job(arg)
+  on all the threads and waits until they all have returned, i.e. a
+  job divides the work itself (e.g. by taking the next chunk from a
+  shared counter). The jobs must not call the Picat API.
+*/
+#define REGEX_POOL_MAX_THREADS 64
+
+typedef struct regex_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  int num_threads;      // the pool's threads (excluding the caller)
+  int running;          // threads still running the current job
+  uint64_t generation;  // incremented for each job
+  void (*job)(void*);
+  void* arg;
+} regex_pool_t;
+
+static regex_pool_t regex_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                                   PTHREAD_COND_INITIALIZER, -1, 0, 0, NULL, NULL };
+
+static void* regex_pool_thread(void* unused) {
+  (void)unused;
+  // the signals (e.g. Ctrl-C) are handled by Picat's thread
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  uint64_t seen = 0;
+  pthread_mutex_lock(&regex_pool.lock);
+  for (;;) {
+    while (regex_pool.generation == seen) {
+      pthread_cond_wait(&regex_pool.work, &regex_pool.lock);
+    }
+    seen = regex_pool.generation;
+    void (*job)(void*) = regex_pool.job;
+    void* arg = regex_pool.arg;
+    pthread_mutex_unlock(&regex_pool.lock);
+    job(arg);
+    pthread_mutex_lock(&regex_pool.lock);
+    if (--regex_pool.running == 0) {
+      pthread_cond_signal(&regex_pool.done);
+    }
+  }
+  return NULL;
+}
+
+static void regex_pool_run(void (*job)(void*), void* arg) {
+  pthread_mutex_lock(&regex_pool.lock);
+  if (regex_pool.num_threads < 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    n = n < 1 ? 1 : n > REGEX_POOL_MAX_THREADS ? REGEX_POOL_MAX_THREADS : n;
+    regex_pool.num_threads = 0;
+    for (long i = 1; i < n; i++) {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, regex_pool_thread, NULL) != 0) {
+        break;
+      }
+      pthread_detach(thread);
+      regex_pool.num_threads++;
+    }
+  }
+  regex_pool.job = job;
+  regex_pool.arg = arg;
+  regex_pool.running = regex_pool.num_threads;
+  regex_pool.generation++;
+  pthread_cond_broadcast(&regex_pool.work);
+  pthread_mutex_unlock(&regex_pool.lock);
+
+  job(arg);
+
+  pthread_mutex_lock(&regex_pool.lock);
+  while (regex_pool.running > 0) {
+    pthread_cond_wait(&regex_pool.done, &regex_pool.lock);
+  }
+  pthread_mutex_unlock(&regex_pool.lock);
+}
+
+
+/*
+  regex_extract_file/4: regex_extract_file(Pattern,File,Format,Captures)
+
+  Captures are the captures of the lines in File that match Pattern
+  (in file order), in the result format Format (see
+  regex_get_format()). As for regex_find_matches/4, a capture is the
+  matched string if the pattern has no capture group, the capture if
+  it has one, otherwise the list/array of the captures. A line is
+  matched without its newline ("\n" or "\r\n"). File can also be a
+  corpus (see regex_corpus_load/2): then its strings are matched.
+
+  The file is mmap:ed and split into chunks (of about
+  REGEX_EXTRACT_CHUNK bytes) at newlines, and the chunks are matched
+  on the thread pool, each thread with its own match data. The
+  captures are collected as offsets into the file (a regex_result per
+  chunk), and the Picat terms are built when all the chunks are done.
+  A corpus is split into chunks of strings in the same way.
+*/
+#ifndef REGEX_EXTRACT_CHUNK
+#define REGEX_EXTRACT_CHUNK (4 << 20)
+#endif
+
+typedef struct regex_extract_chunk {
+  size_t start, end;     // bytes of the file, or strings of the corpus
+  regex_result captures;
+  size_t count;          // the number of matching lines/strings
+  int error;
+} regex_extract_chunk;
+
+typedef struct regex_extract_job {
+  regex_cache_entry* entry;
+  const char* data;
+  regex_corpus* corpus;  // or NULL for a file
+  int count_only;        // only count the matches (regex_count/2)
+  regex_extract_chunk* chunks;
+  size_t num_chunks;
+  size_t next_chunk; // the next chunk to match (shared by the threads)
+  int groups;        // for regex_extract_typed/4: all the capture groups, or -1
+} regex_extract_job;
+
+// Matches the line/string data[start..end-1]
+static void regex_extract_line(regex_extract_job* job, regex_extract_chunk* chunk, size_t start, size_t end,
+                               pcre2_match_data* match_data, PCRE2_SIZE* offsets) {
+  int rc = regex_length_reject(job->entry, end - start) ? PCRE2_ERROR_NOMATCH :
+    regex_pcre2_match(job->entry, (PCRE2_SPTR)job->data + start, end - start, 0, 0, match_data);
+  if (rc >= 0) {
+    chunk->count++;
+    if (!job->count_only) {
+      // the offsets in the line to offsets in the file
+      PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
+      int n = job->groups >= 0 ? job->groups+1 : rc == 0 ? 1 : rc;
+      for (int i = 0; i < 2*n; i++) {
+        offsets[i] = ovector[i] == PCRE2_UNSET ? PCRE2_UNSET : ovector[i] + start;
+      }
+      if (job->groups > 0) {
+        regex_result_add(&chunk->captures, offsets, 1, job->groups, 1);
+      } else if (job->groups == 0) {
+        regex_result_add(&chunk->captures, offsets, 0, 1, 1);
+      } else {
+        regex_result_add_match(&chunk->captures, offsets, rc);
+      }
+    }
+  } else if (rc != PCRE2_ERROR_NOMATCH) {
+    chunk->error = rc;
+  }
+}
+
+static void regex_extract_chunks(void* arg) {
+  regex_extract_job* job = arg;
+  pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(job->entry->re, NULL);
+  uint32_t ovecsize = pcre2_get_ovector_count(match_data);
+  PCRE2_SIZE* offsets = malloc(2 * ovecsize * sizeof(PCRE2_SIZE));
+  size_t c;
+  while ((c = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->num_chunks) {
+    regex_extract_chunk* chunk = &job->chunks[c];
+    if (job->corpus != NULL) {
+      for (size_t i = chunk->start; i < chunk->end; i++) {
+        size_t start = job->corpus->starts[i];
+        regex_extract_line(job, chunk, start, start + job->corpus->lengths[i], match_data, offsets);
+      }
+      continue;
+    }
+    size_t line = chunk->start;
+    while (line < chunk->end) {
+      const char* nl = memchr(job->data + line, '\n', chunk->end - line);
+      size_t next = nl == NULL ? chunk->end : (size_t)(nl - job->data) + 1;
+      size_t end = nl == NULL ? chunk->end : next-1;
+      if (end > line && job->data[end-1] == '\r') {
+        end--;
+      }
+      regex_extract_line(job, chunk, line, end, match_data, offsets);
+      line = next;
+    }
+  }
+  free(offsets);
+  pcre2_match_data_free(match_data);
+}
+
+/*
+  Splits the corpus c into chunks of about REGEX_EXTRACT_CHUNK bytes
+  and matches them (as above).
+*/
+static void regex_extract_corpus(regex_extract_job* job, regex_corpus* c) {
+  job->data = c->data;
+  job->corpus = c;
+  job->chunks = calloc(c->data_size / REGEX_EXTRACT_CHUNK + c->num_strings / REGEX_EXTRACT_CHUNK + 2,
+                       sizeof(regex_extract_chunk));
+  size_t i = 0;
+  while (i < c->num_strings) {
+    size_t first = i, bytes = 0;
+    while (i < c->num_strings && (i == first || bytes < REGEX_EXTRACT_CHUNK) && i - first < REGEX_EXTRACT_CHUNK) {
+      bytes += c->lengths[i++];
+    }
+    regex_extract_chunk* chunk = &job->chunks[job->num_chunks++];
+    chunk->start = first;
+    chunk->end = i;
+    regex_result_init(&chunk->captures, c->data);
+  }
+  if (job->num_chunks > 1) {
+    regex_pool_run(regex_extract_chunks, job);
+  } else {
+    regex_extract_chunks(job);
+  }
+}
+
+/*
+  The same for the file data (of size bytes): the chunks end after a
+  newline (or at the end of the file).
+*/
+static void regex_extract_data(regex_extract_job* job, const char* data, size_t size) {
+  job->data = data;
+  job->chunks = calloc(size / REGEX_EXTRACT_CHUNK + 1, sizeof(regex_extract_chunk));
+  size_t start = 0;
+  while (start < size) {
+    size_t end = start + REGEX_EXTRACT_CHUNK;
+    if (end >= size) {
+      end = size;
+    } else {
+      const char* nl = memchr(data + end, '\n', size - end);
+      end = nl == NULL ? size : (size_t)(nl - data) + 1;
+    }
+    regex_extract_chunk* chunk = &job->chunks[job->num_chunks++];
+    chunk->start = start;
+    chunk->end = end;
+    regex_result_init(&chunk->captures, data);
+    start = end;
+  }
+  if (job->num_chunks > 1) {
+    regex_pool_run(regex_extract_chunks, job);
+  } else {
+    regex_extract_chunks(job);
+  }
+}
+
+/*
+  mmaps the file file_p (*data, of *size bytes; NULL for an empty file).
+  Returns 0 if it can't be read.
+*/
+static int regex_map_file(TERM file_p, const char** data, size_t* size, char* who) {
+  char* file = picat_string_to_cstring(file_p);
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "%s: can't open %s\n", who, file);
+    if (fd >= 0) {
+      close(fd);
+    }
+    free(file);
+    return 0;
+  }
+  *size = (size_t)st.st_size;
+  *data = NULL;
+  if (*size > 0) {
+    void* m = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+      fprintf(stderr, "%s: can't read %s\n", who, file);
+      close(fd);
+      free(file);
+      return 0;
+    }
+    *data = m;
+  }
+  close(fd);
+  free(file);
+  return 1;
+}
+
+/*
+  Matches the lines of the file (or the strings of the corpus) file_p
+  (as above). *data is the file's data (*size bytes, to be munmap:ed
+  by the caller) or the corpus's. Returns 0 if the file can't be read.
+*/
+static int regex_extract_run(regex_extract_job* job, TERM file_p, const char** data, size_t* size, char* who) {
+  regex_corpus* corpus = NULL;
+  *data = NULL;
+  *size = 0;
+  if (regex_is_corpus(file_p)) {
+    corpus = regex_get_corpus(file_p, who);
+    if (corpus == NULL) {
+      return 0;
+    }
+    *data = corpus->data;
+  } else if (!regex_map_file(file_p, data, size, who)) {
+    return 0;
+  }
+
+  regex_entry_lengths(job->entry); // before the threads use it
+
+  // the entry is used by the threads of the pool
+  job->entry->pinned++;
+  if (corpus != NULL) {
+    regex_extract_corpus(job, corpus);
+  } else {
+    regex_extract_data(job, *data, *size);
+  }
+  job->entry->pinned--;
+  return 1;
+}
+
+int regex_extract_file() {
+  TERM pattern_p  = picat_get_call_arg(1,4);
+  TERM file_p     = picat_get_call_arg(2,4);
+  TERM format_p   = picat_get_call_arg(3,4);
+  TERM captures_p = picat_get_call_arg(4,4);
+
+  int format;
+  if (!regex_get_format(format_p, "regex_extract_file", &format)) {
+    return PICAT_FALSE;
+  }
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_extract_file");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+
+  const char* data;
+  size_t size;
+  regex_extract_job job = { entry, NULL, NULL, 0, NULL, 0, 0, -1 };
+  if (!regex_extract_run(&job, file_p, &data, &size, "regex_extract_file")) {
+    return PICAT_FALSE;
+  }
+
+  // merge the chunks' captures in file order
+  regex_result captures;
+  regex_result_init(&captures, data);
+  int ok = 1;
+  for (size_t c = 0; c < job.num_chunks; c++) {
+    regex_result* r = &job.chunks[c].captures;
+    if (job.chunks[c].error != 0) {
+      fprintf(stderr, "regex_extract_file: matching error %d\n", job.chunks[c].error);
+      ok = 0;
+    }
+    for (size_t i = 0, s = 0; i < r->num_items; i++) {
+      int n = r->sizes[i] == 0 ? 1 : r->sizes[i];
+      regex_result_add(&captures, r->bounds + 2*s, 0, n, r->sizes[i] != 0);
+      s += n;
+    }
+    regex_result_free(r);
+  }
+  free(job.chunks);
+
+  TERM result;
+  ok = ok && regex_result_build(&captures, format, "regex_extract_file", &result);
+  regex_result_free(&captures);
+  if (size > 0) {
+    munmap((void*)data, size);
+  }
+
+  return ok && picat_unify(captures_p, result);
+
+} // regex_extract_file
+
+/*
+  regex_extract_typed/4: regex_extract_typed(Pattern,File,Types,Tuples)
+
+  As regex_extract_file/4, but the captures of each matching line are
+  converted by Types (see regex_capture_typed/4) to a tuple, an array
+  {...}. A line with a capture that can't be converted is skipped.
+  The lines are matched on the thread pool and the captures are then
+  converted (from the file's bytes) when the tuples are built.
+*/
+int regex_extract_typed() {
+  TERM pattern_p = picat_get_call_arg(1,4);
+  TERM file_p    = picat_get_call_arg(2,4);
+  TERM types_p   = picat_get_call_arg(3,4);
+  TERM tuples_p  = picat_get_call_arg(4,4);
+
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_extract_typed");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  int* types;
+  int num_types;
+  if (!regex_get_types(types_p, entry, &types, &num_types, "regex_extract_typed")) {
+    return PICAT_FALSE;
+  }
+  uint32_t groups;
+  (void)pcre2_pattern_info(entry->re, PCRE2_INFO_CAPTURECOUNT, &groups);
+
+  const char* data;
+  size_t size;
+  regex_extract_job job = { entry, NULL, NULL, 0, NULL, 0, 0, (int)groups };
+  if (!regex_extract_run(&job, file_p, &data, &size, "regex_extract_typed")) {
+    free(types);
+    return PICAT_FALSE;
+  }
+
+  // convert the chunks' captures in file order
+  size_t num_items = 0;
+  for (size_t c = 0; c < job.num_chunks; c++) {
+    num_items += job.chunks[c].captures.num_items;
+  }
+  int num_fields = 0;
+  for (int i = 0; i < num_types; i++) {
+    num_fields += types[i] != REGEX_TYPE_SKIP;
+  }
+  regex_typed_field* fields = malloc((num_items * num_fields + 1) * sizeof(regex_typed_field));
+  size_t num_tuples = 0;
+  size_t words = 0;
+  int ok = 1;
+  for (size_t c = 0; c < job.num_chunks; c++) {
+    regex_result* r = &job.chunks[c].captures;
+    if (job.chunks[c].error != 0) {
+      fprintf(stderr, "regex_extract_typed: matching error %d\n", job.chunks[c].error);
+      ok = 0;
+    }
+    for (size_t i = 0, s = 0; i < r->num_items; i++) {
+      regex_typed_field* tuple = fields + num_tuples * num_fields;
+      if (regex_typed_convert(data, r->bounds + 2*s, r->sizes[i], types, num_types, tuple) >= 0) {
+        words += regex_container_words(num_fields, REGEX_FORMAT_ARRAY) + regex_typed_words(tuple, num_fields);
+        num_tuples++;
+      }
+      s += r->sizes[i];
+    }
+    regex_result_free(r);
+  }
+  free(job.chunks);
+  free(types);
+
+  TERM tuples = (TERM)NULL;
+  ok = ok && regex_heap_reserve(regex_container_words(num_tuples, REGEX_FORMAT_STRING) + words, "regex_extract_typed");
+  if (ok) {
+    BPLONG_PTR slots;
+    int stride;
+    tuples = regex_write_container(num_tuples, REGEX_FORMAT_STRING, &slots, &stride);
+    for (size_t t = 0; t < num_tuples; t++) {
+      BPLONG_PTR tuple_slots;
+      int tuple_stride;
+      TERM tuple = regex_write_container(num_fields, REGEX_FORMAT_ARRAY, &tuple_slots, &tuple_stride);
+      for (int i = 0; i < num_fields; i++) {
+        tuple_slots[i*tuple_stride] = regex_typed_value(data, &fields[t*num_fields + i]);
+      }
+      slots[t*stride] = tuple;
+    }
+  }
+  free(fields);
+  if (size > 0) {
+    munmap((void*)data, size);
+  }
+
+  return ok && picat_unify(tuples_p, tuples);
+
+} // regex_extract_typed
+
+/*
+  regex_count/3: regex_count(Pattern,Subjects,Count)
+
+  Count is the number of strings in Subjects (a list of strings or a
+  corpus) that match Pattern. A corpus is matched on the thread pool
+  (as regex_extract_file/4).
+*/
+int regex_count() {
+  TERM pattern_p  = picat_get_call_arg(1,3);
+  TERM subjects_p = picat_get_call_arg(2,3);
+  TERM count_p    = picat_get_call_arg(3,3);
+
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, regex_no_captures(), "regex_count");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  regex_entry_lengths(entry);
+
+  size_t count = 0;
+  int ok = 1;
+  if (regex_is_corpus(subjects_p)) {
+    regex_corpus* corpus = regex_get_corpus(subjects_p, "regex_count");
+    if (corpus == NULL) {
+      return PICAT_FALSE;
+    }
+    regex_extract_job job = { entry, NULL, NULL, 1, NULL, 0, 0, -1 };
+    regex_extract_corpus(&job, corpus);
+    for (size_t c = 0; c < job.num_chunks; c++) {
+      if (job.chunks[c].error != 0) {
+        fprintf(stderr, "regex_count: matching error %d\n", job.chunks[c].error);
+        ok = 0;
+      }
+      count += job.chunks[c].count;
+      regex_result_free(&job.chunks[c].captures);
+    }
+    free(job.chunks);
+  } else {
+    pcre2_match_data* match_data = pcre2_match_data_create(1, NULL);
+    for (TERM t = subjects_p; picat_is_list(t); t = picat_get_cdr(t)) {
+      size_t subject_size;
+      char* subject_s = regex_get_cstring(picat_get_car(t), &subject_size);
+      if (!regex_length_reject(entry, subject_size) &&
+          regex_memo_match(entry, subject_s, subject_size, 0, match_data, NULL) > 0) {
+        count++;
+      }
+      free(subject_s);
+    }
+    pcre2_match_data_free(match_data);
+  }
+
+  return ok && picat_unify(count_p, picat_build_integer((BPLONG)count));
+
+} // regex_count
+
+
+/*
+  regex_filter_all/3: regex_filter_all(Patterns,Subjects,Survivors)
+
+  Survivors are the subjects (in the same order) that match all the
+  patterns in Patterns. A pattern can be negated with not(Pattern),
+  i.e. the subject must not match Pattern. Subjects is a list of
+  strings or a corpus (see regex_corpus_load/2).
+
+  The patterns are tested in the order of the smallest expected cost
+  per rejection, i.e. mean time / rejection rate, so that cheap and
+  selective patterns are tested first, and the testing of a subject
+  stops at the first rejection. The rejection rates and times are
+  measured during the filtering and the patterns are reordered every
+  REGEX_FILTER_REORDER subjects. The initial order is from the
+  patterns' statistics in the pattern cache (if any).
+
+  See regex_filter_all/2 in regex.pi.
+*/
+#define REGEX_FILTER_REORDER 64
+#define REGEX_FILTER_PRIOR 8 // weight (in subjects) of the cached statistics
+
+typedef struct {
+  regex_cache_entry* entry;
+  int negate;
+  uint64_t tests;
+  uint64_t rejects;
+  uint64_t ticks;
+  double score;
+} regex_filter_t;
+
+// expected cost per rejection (with Laplace smoothing)
+static double regex_filter_score(regex_filter_t* f) {
+  double cost = (f->ticks + 1.0) / (f->tests + 1.0);
+  double reject_rate = (f->rejects + 1.0) / (f->tests + 2.0);
+  return cost / reject_rate;
+}
+
+static int regex_cmp_filter_score(const void* a, const void* b) {
+  double sa = ((regex_filter_t*)a)->score;
+  double sb = ((regex_filter_t*)b)->score;
+  return sa < sb ? -1 : sa > sb ? 1 : 0;
+}
+
+static void regex_filter_sort(regex_filter_t* filters, int n) {
+  for (int i = 0; i < n; i++) {
+    filters[i].score = regex_filter_score(&filters[i]);
+  }
+  qsort(filters, n, sizeof(regex_filter_t), regex_cmp_filter_score);
+}
+
+// True if the subject s (of len bytes) survives the n filters
+static int regex_filter_test(regex_filter_t* filters, int n, const char* s, size_t len,
+                             pcre2_match_data* match_data) {
+  for (int i = 0; i < n; i++) {
+    regex_filter_t* f = &filters[i];
+    uint64_t t0 = regex_ticks();
+    int matched = !regex_length_reject(f->entry, len) &&
+      regex_memo_match(f->entry, s, len, 0, match_data, NULL) > 0;
+    f->ticks += regex_ticks() - t0;
+    f->tests++;
+    if (matched == f->negate) {
+      f->rejects++;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Unpin the entries of the n filters
+static void regex_filters_unpin(regex_filter_t* filters, int n) {
+  for (int i = 0; i < n; i++) {
+    filters[i].entry->pinned--;
+  }
+}
+
+int regex_filter_all() {
+  TERM patterns_p = picat_get_call_arg(1,3);
+  TERM subjects_p = picat_get_call_arg(2,3);
+  TERM survivors_p = picat_get_call_arg(3,3);
+
+  regex_corpus* corpus = NULL;
+  if (regex_is_corpus(subjects_p)) {
+    corpus = regex_get_corpus(subjects_p, "regex_filter_all");
+    if (corpus == NULL) {
+      return PICAT_FALSE;
+    }
+  }
+  int n = 0;
+  for (TERM t = patterns_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    n++;
+  }
+  regex_filter_t* filters = calloc(n+1, sizeof(regex_filter_t));
+  int i = 0;
+  for (TERM t = patterns_p; picat_is_list(t); t = picat_get_cdr(t), i++) {
+    TERM pattern_p = picat_get_car(t);
+    if (picat_is_structure(pattern_p) && picat_get_struct_arity(pattern_p) == 1 &&
+        strcmp(picat_get_struct_name(pattern_p), "not") == 0) {
+      filters[i].negate = 1;
+      pattern_p = picat_get_arg(1, pattern_p);
+    }
+    size_t pattern_size;
+    char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+    filters[i].entry = regex_cache_lookup(pattern_s, pattern_size, regex_no_captures(),
+                                          "regex_filter_all");
+    free(pattern_s);
+    if (filters[i].entry == NULL) {
+      regex_filters_unpin(filters, i);
+      free(filters);
+      return PICAT_FALSE;
+    }
+    // the entries are kept while the other patterns are looked up,
+    // which can clear the cache
+    filters[i].entry->pinned++;
+    regex_cache_entry* e = filters[i].entry;
+    if (e->calls > 0) {
+      double fail_rate = (double)e->failures / e->calls;
+      filters[i].tests = REGEX_FILTER_PRIOR;
+      filters[i].rejects = (uint64_t)(REGEX_FILTER_PRIOR * (filters[i].negate ? 1.0 - fail_rate : fail_rate) + 0.5);
+      filters[i].ticks = REGEX_FILTER_PRIOR * (e->total_ticks / e->calls);
+    }
+  }
+  regex_filter_sort(filters, n);
+  for (i = 0; i < n; i++) {
+    regex_entry_lengths(filters[i].entry);
+  }
+
+  pcre2_match_data* match_data = pcre2_match_data_create(1, NULL);
+  if (corpus != NULL) {
+    // the survivors are built from the corpus' strings
+    regex_result result;
+    regex_result_init(&result, corpus->data);
+    for (size_t k = 0; k < corpus->num_strings; k++) {
+      size_t start = corpus->starts[k];
+      if (regex_filter_test(filters, n, corpus->data + start, corpus->lengths[k], match_data)) {
+        regex_result_add_slice(&result, start, start + corpus->lengths[k]);
+      }
+      if ((k+1) % REGEX_FILTER_REORDER == 0) {
+        regex_filter_sort(filters, n);
+      }
+    }
+    pcre2_match_data_free(match_data);
+    regex_filters_unpin(filters, n);
+    free(filters);
+    TERM list;
+    int ok = regex_result_build(&result, REGEX_FORMAT_STRING, "regex_filter_all", &list);
+    regex_result_free(&result);
+    return ok && picat_unify(survivors_p, list);
+  }
+
+  size_t num_survivors = 0, max_survivors = 1024;
+  TERM* survivors = malloc(max_survivors * sizeof(TERM));
+  uint64_t count = 0;
+  for (TERM t = subjects_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    TERM subject_p = picat_get_car(t);
+    size_t subject_size;
+    char* subject_s = regex_get_cstring(subject_p, &subject_size);
+    int survive = regex_filter_test(filters, n, subject_s, subject_size, match_data);
+    free(subject_s);
+    if (survive) {
+      if (num_survivors == max_survivors) {
+        max_survivors *= 2;
+        survivors = realloc(survivors, max_survivors * sizeof(TERM));
+      }
+      survivors[num_survivors++] = subject_p;
+    }
+    if (++count % REGEX_FILTER_REORDER == 0) {
+      regex_filter_sort(filters, n);
+    }
+  }
+  pcre2_match_data_free(match_data);
+  regex_filters_unpin(filters, n);
+  free(filters);
+
+  REGEX_PROBE(build_start);
+  uint64_t t0 = regex_ticks();
+  TERM list = regex_build_container(survivors, num_survivors, REGEX_FORMAT_STRING, "regex_filter_all");
+  free(survivors);
+  REGEX_STAT(build_ticks) += regex_ticks() - t0;
+  REGEX_PROBE(build_end, num_survivors, list != (TERM)NULL);
+
+  return list != (TERM)NULL && picat_unify(survivors_p, list);
+
+} // regex_filter_all
+
+
+/*
+  regex_generate/6: regex_generate(Pattern,Lengths,Alphabet,After,Max,Strings)
+
+  Strings are the strings of a length in Lengths (a sorted list of
+  integers) over the characters in Alphabet that match the pattern
+  (the whole string, as if the pattern was ^(?:Pattern)$).
+
+  The strings are generated in order of length and then in the order
+  of Alphabet, and each string is generated once. After is 0 (from
+  the first string) or the last string from a previous call; then
+  the strings after After are generated. At most Max strings are
+  generated (all if Max =< 0).
+
+  The generation is done on the pattern's DFA: live[k][s] is true if
+  a final state can be reached from state s in exactly k characters,
+  so the depth first search never enters a dead end.
+
+  See regex_generate/3,4 in regex.pi.
+*/
+/*
+  Grows the array *p of *alloc elements of size size by at least
+  more elements (doubling it). Returns 0 (and leaves *p as it is) if
+  the array can't be grown.
+*/
+static int regex_generate_grow(void** p, size_t* alloc, size_t size, size_t more) {
+  size_t n = *alloc;
+  while (n - *alloc < more) {
+    if (n > SIZE_MAX / 2 / size) {
+      return 0;
+    }
+    n *= 2;
+  }
+  void* q = realloc(*p, n * size);
+  if (q == NULL) {
+    return 0;
+  }
+  *p = q;
+  *alloc = n;
+  return 1;
+}
+
+static int regex_generate_check(TERM lengths_p, TERM alphabet_p, TERM after_p, TERM max_p) {
+  int ok = picat_is_list(lengths_p) || picat_is_nil(lengths_p);
+  for (TERM t = lengths_p; ok && picat_is_list(t); t = picat_get_cdr(t)) {
+    TERM len = picat_get_car(t);
+    ok = picat_is_integer(len) && picat_get_integer(len) >= 0 && picat_get_integer(len) < INT_MAX;
+  }
+  if (!ok) {
+    fprintf(stderr, "regex_generate: Lengths should be a list of non-negative integers\n");
+    return 0;
+  }
+  ok = picat_is_list(alphabet_p) || picat_is_nil(alphabet_p);
+  for (TERM t = alphabet_p; ok && picat_is_list(t); t = picat_get_cdr(t)) {
+    ok = picat_is_atom(picat_get_car(t));
+  }
+  if (!ok) {
+    fprintf(stderr, "regex_generate: Alphabet should be a list of characters\n");
+    return 0;
+  }
+  ok = picat_is_integer(after_p) ? picat_get_integer(after_p) == 0 : picat_is_list(after_p) || picat_is_nil(after_p);
+  for (TERM t = after_p; ok && picat_is_list(t); t = picat_get_cdr(t)) {
+    ok = picat_is_atom(picat_get_car(t));
+  }
+  if (!ok) {
+    fprintf(stderr, "regex_generate: After should be 0 or a string\n");
+    return 0;
+  }
+  if (!picat_is_integer(max_p)) {
+    fprintf(stderr, "regex_generate: Max should be an integer\n");
+    return 0;
+  }
+  return 1;
+}
+
+int regex_generate() {
+  TERM pattern_p = picat_get_call_arg(1,6);
+  TERM lengths_p = picat_get_call_arg(2,6);
+  TERM alphabet_p = picat_get_call_arg(3,6);
+  TERM after_p = picat_get_call_arg(4,6);
+  TERM max_p = picat_get_call_arg(5,6);
+  TERM strings_p = picat_get_call_arg(6,6);
+
+  if (!regex_generate_check(lengths_p, alphabet_p, after_p, max_p)) {
+    return PICAT_FALSE;
+  }
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_generate");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  regex_dfa* dfa = regex_entry_dfa(entry, "regex_generate");
+  if (dfa == NULL) {
+    return PICAT_FALSE;
+  }
+  int num_states = dfa->num_states;
+
+  // The alphabet (without duplicates): the characters and their UTF-8 bytes
+  int num_alpha = 0;
+  for (TERM t = alphabet_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    num_alpha++;
+  }
+  TERM* alpha = malloc((num_alpha+1) * sizeof(TERM));
+  char** alpha_s = malloc((num_alpha+1) * sizeof(char*));
+  num_alpha = 0;
+  for (TERM t = alphabet_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    TERM c = picat_get_car(t);
+    char* name = picat_get_atom_name(c);
+    int dup = 0;
+    for (int a = 0; a < num_alpha; a++) {
+      if (strcmp(alpha_s[a], name) == 0) dup = 1;
+    }
+    if (!dup) {
+      alpha[num_alpha] = c;
+      alpha_s[num_alpha++] = name;
+    }
+  }
+
+  int num_lengths = 0, max_length = 0;
+  for (TERM t = lengths_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    long len = picat_get_integer(picat_get_car(t));
+    if (len > max_length) max_length = len;
+    num_lengths++;
+  }
+
+  // The tables: live has max_length+1 rows of num_states, after, idx
+  // and st have (at most) max_length+2 elements
+  size_t depth = (size_t)max_length + 2;
+  int* after = NULL;
+  int* step = NULL;
+  unsigned char* live = NULL;
+  int* idx = NULL;
+  int* st = NULL;
+  if (depth <= SIZE_MAX / sizeof(int) && depth - 1 <= SIZE_MAX / num_states &&
+      (size_t)num_alpha <= (SIZE_MAX / sizeof(int) - 1) / num_states) {
+    after = malloc(depth * sizeof(int));
+    step = malloc(((size_t)num_states * num_alpha + 1) * sizeof(int));
+    live = malloc((depth - 1) * num_states);
+    idx = malloc(depth * sizeof(int));
+    st = malloc(depth * sizeof(int));
+  }
+  if (alpha == NULL || alpha_s == NULL || after == NULL || step == NULL || live == NULL || idx == NULL ||
+      st == NULL) {
+    fprintf(stderr, "regex_generate: out of memory (length %d, %d states)\n", max_length, num_states);
+    free(after);
+    free(step);
+    free(live);
+    free(idx);
+    free(st);
+    free(alpha);
+    free(alpha_s);
+    return PICAT_FALSE;
+  }
+
+  // The cursor
+  int after_length = -1;
+  if (!picat_is_integer(after_p)) {
+    after_length = 0;
+    for (TERM t = after_p; picat_is_list(t); t = picat_get_cdr(t)) {
+      char* name = picat_get_atom_name(picat_get_car(t));
+      int a = 0;
+      while (a < num_alpha && strcmp(alpha_s[a], name) != 0) a++;
+      if (a == num_alpha || after_length >= max_length) {
+        after_length = max_length + 1; // not a valid cursor: nothing after it
+        break;
+      }
+      after[after_length++] = a;
+    }
+  }
+  long max = picat_get_integer(max_p);
+
+  // step[s*num_alpha+a] is the state after character a from state s
+  for (int s = 0; s < num_states; s++) {
+    for (int a = 0; a < num_alpha; a++) {
+      int t = s;
+      for (unsigned char* p = (unsigned char*)alpha_s[a]; *p && t >= 0; p++) {
+        t = dfa->next[(size_t)t*256 + *p];
+      }
+      step[(size_t)s*num_alpha+a] = t;
+    }
+  }
+  for (int s = 0; s < num_states; s++) {
+    live[s] = dfa->final[s];
+  }
+  for (int k = 1; k <= max_length; k++) {
+    for (int s = 0; s < num_states; s++) {
+      int l = 0;
+      for (int a = 0; a < num_alpha && !l; a++) {
+        int t = step[(size_t)s*num_alpha+a];
+        l = t >= 0 && live[(size_t)(k-1)*num_states + t];
+      }
+      live[(size_t)k*num_states + s] = l;
+    }
+  }
+
+  // The strings are collected as the characters (the indexes in alpha)
+  // after each other, string k ends at ends[k]
+  size_t count = 0, alloc = 1024, num_chars = 0, chars_alloc = 4096;
+  size_t* ends = malloc(alloc * sizeof(size_t));
+  int* chars = malloc(chars_alloc * sizeof(int));
+  int ok = ends != NULL && chars != NULL;
+  uint64_t t0 = regex_ticks();
+  for (TERM t = lengths_p; ok && picat_is_list(t) && (max <= 0 || (long)count < max); t = picat_get_cdr(t)) {
+    int len = picat_get_integer(picat_get_car(t));
+    if (len < after_length || len < 0) {
+      continue;
+    }
+    st[0] = 0;
+    int d;
+    if (len == after_length) {
+      // resume after the cursor
+      for (d = 0; d < len; d++) {
+        idx[d] = after[d];
+        st[d+1] = step[(size_t)st[d]*num_alpha + idx[d]];
+        if (st[d+1] < 0) break;
+      }
+      if (d < len) {
+        continue; // not a valid cursor
+      }
+      d = len - 1;
+    } else {
+      if (len == 0) {
+        if (live[0]) {
+          if (count == alloc && !regex_generate_grow((void**)&ends, &alloc, sizeof(size_t), 1)) {
+            ok = 0;
+            break;
+          }
+          ends[count++] = num_chars;
+        }
+        continue;
+      }
+      if (!live[(size_t)len*num_states]) {
+        continue;
+      }
+      d = 0;
+      idx[0] = -1;
+    }
+    while (ok && d >= 0 && (max <= 0 || (long)count < max)) {
+      // the next character at depth d that can lead to a final state
+      int a = idx[d] + 1;
+      int next = -1;
+      for (; a < num_alpha; a++) {
+        next = step[(size_t)st[d]*num_alpha + a];
+        if (next >= 0 && live[(size_t)(len-d-1)*num_states + next]) break;
+      }
+      if (a == num_alpha) {
+        d--;
+        continue;
+      }
+      idx[d] = a;
+      st[d+1] = next;
+      if (d+1 < len) {
+        d++;
+        idx[d] = -1;
+        continue;
+      }
+      if ((count == alloc && !regex_generate_grow((void**)&ends, &alloc, sizeof(size_t), 1)) ||
+          (num_chars + len > chars_alloc &&
+           !regex_generate_grow((void**)&chars, &chars_alloc, sizeof(int), num_chars + len - chars_alloc))) {
+        ok = 0;
+        break;
+      }
+      memcpy(chars + num_chars, idx, len * sizeof(int));
+      num_chars += len;
+      ends[count++] = num_chars;
+    }
+  }
+
+  if (!ok) {
+    fprintf(stderr, "regex_generate: out of memory (%zu strings)\n", count);
+  }
+  // a list cell for each string and each character
+  ok = ok && regex_heap_reserve(2*count + 2*num_chars, "regex_generate");
+  TERM list = picat_build_nil();
+  for (size_t k = count; ok && k > 0; k--) {
+    TERM s = picat_build_nil();
+    for (size_t i = ends[k-1]; i > (k > 1 ? ends[k-2] : 0); i--) {
+      TERM cons = picat_build_list();
+      picat_unify(picat_get_car(cons), alpha[chars[i-1]]);
+      picat_unify(picat_get_cdr(cons), s);
+      s = cons;
+    }
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), s);
+    picat_unify(picat_get_cdr(cons), list);
+    list = cons;
+  }
+  REGEX_STAT(build_ticks) += regex_ticks() - t0;
+
+  free(ends);
+  free(chars);
+  free(idx);
+  free(st);
+  free(live);
+  free(step);
+  free(after);
+  free(alpha);
+  free(alpha_s);
+
+  return ok && picat_unify(strings_p, list);
+
+} // regex_generate
+
+
+/*
+  regex_automaton/2: regex_automaton(Pattern,Automaton)
+
+  Automaton is the minimized DFA of Pattern (which accepts exactly
+  the strings of the pattern, see regex_entry_dfa()) in the form
+  that the regular/6 constraint (in the cp and sat modules) uses:
+
+     $automaton(Q,S,M,Q0,F)
+
+  - Q: the number of states, numbered 1..Q
+  - S: the number of input symbols 1..S, where the symbols are the
+       bytes of the UTF-8 encoding of the string (the character code
+       for ASCII, two to four symbols for another character); S is
+       the largest byte that has a transition
+  - M: the transition matrix, a list of Q lists of S integers, where
+       M[I,C] is the next state from state I on the byte C, or 0 if
+       there is no such transition
+  - Q0: the start state (1)
+  - F: the list of accepting states
+
+  The code 0 (NUL) is not an input symbol.
+
+  See regex_constraint/2 in regex.pi.
+*/
+int regex_automaton() {
+  TERM pattern_p = picat_get_call_arg(1,2);
+  TERM automaton_p = picat_get_call_arg(2,2);
+
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_automaton");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  regex_dfa* dfa = regex_entry_dfa(entry, "regex_automaton");
+  if (dfa == NULL) {
+    return PICAT_FALSE;
+  }
+
+  uint64_t t0 = regex_ticks();
+  int num_states = dfa->num_states;
+  int num_symbols = 1;
+  for (int s = 0; s < num_states; s++) {
+    for (int c = 1; c < 256; c++) {
+      if (dfa->next[s*256+c] >= 0 && c > num_symbols) num_symbols = c;
+    }
+  }
+  // the matrix (and its rows), the list of accepting states and $automaton/5
+  size_t words = (size_t)num_states * (regex_container_words(num_symbols, REGEX_FORMAT_STRING) + 4) + 6;
+  if (!regex_heap_reserve(words, "regex_automaton")) {
+    return PICAT_FALSE;
+  }
+
+  TERM matrix = picat_build_nil();
+  TERM final = picat_build_nil();
+  for (int s = num_states-1; s >= 0; s--) {
+    TERM row = picat_build_nil();
+    for (int c = num_symbols; c >= 1; c--) {
+      TERM cons = picat_build_list();
+      picat_unify(picat_get_car(cons), picat_build_integer(dfa->next[s*256+c]+1));
+      picat_unify(picat_get_cdr(cons), row);
+      row = cons;
+    }
+    TERM cons = picat_build_list();
+    picat_unify(picat_get_car(cons), row);
+    picat_unify(picat_get_cdr(cons), matrix);
+    matrix = cons;
+    if (dfa->final[s]) {
+      cons = picat_build_list();
+      picat_unify(picat_get_car(cons), picat_build_integer(s+1));
+      picat_unify(picat_get_cdr(cons), final);
+      final = cons;
+    }
+  }
+
+  TERM automaton = picat_build_structure("automaton",5);
+  picat_unify(picat_get_arg(1,automaton), picat_build_integer(num_states));
+  picat_unify(picat_get_arg(2,automaton), picat_build_integer(num_symbols));
+  picat_unify(picat_get_arg(3,automaton), matrix);
+  picat_unify(picat_get_arg(4,automaton), picat_build_integer(1));
+  picat_unify(picat_get_arg(5,automaton), final);
+  REGEX_STAT(build_ticks) += regex_ticks() - t0;
+
+  return picat_unify(automaton_p, automaton);
+
+} // regex_automaton
+
+
+/*
+  regex_from_words/2: regex_from_words(Words,Pattern)
+
+  Pattern matches exactly the strings in the list Words (when anchored,
+  i.e. as ^(?:Pattern)$). The pattern is built from the minimal acyclic
+  DFA of the words (see regex_dfa_words() in regex_dfa.c), so both
+  common prefixes and common suffixes are shared.
+
+  The pattern is compiled and put in the cache, and the DFA of the words
+  is stored in the cache entry, so regex_fullmatch/2 with the pattern
+  uses the DFA directly (without parsing the pattern).
+
+  See make_regex2.pi for a Picat version (which shares prefixes only).
+*/
+int regex_from_words() {
+  TERM words_p = picat_get_call_arg(1,2);
+  TERM pattern_p = picat_get_call_arg(2,2);
+
+  int num_words = 0;
+  for (TERM t = words_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    num_words++;
+  }
+  char** words = malloc((num_words+1) * sizeof(char*));
+  int* sizes = malloc((num_words+1) * sizeof(int));
+  num_words = 0;
+  for (TERM t = words_p; picat_is_list(t); t = picat_get_cdr(t)) {
+    size_t size;
+    words[num_words] = regex_get_cstring(picat_get_car(t), &size);
+    sizes[num_words++] = size;
+  }
+
+  uint64_t t0 = regex_ticks();
+  regex_dfa* dfa;
+  char* pattern = regex_dfa_words((const char**)words, sizes, num_words, REGEX_DFA_MAX_STATES, &dfa);
+  REGEX_STAT(build_ticks) += regex_ticks() - t0;
+  for (int i = 0; i < num_words; i++) {
+    free(words[i]);
+  }
+  free(words);
+  free(sizes);
+
+  int ret = PICAT_FALSE;
+  regex_cache_entry* entry = regex_cache_lookup(pattern, strlen(pattern), 0, "regex_from_words");
+  if (entry != NULL) {
+    if (entry->dfa == NULL) {
+      entry->dfa = dfa;
+      dfa = NULL;
+    }
+    ret = picat_unify(pattern_p, regex_build_string(pattern, strlen(pattern)));
+  }
+  regex_dfa_free(dfa);
+  free(pattern);
+
+  return ret;
+
+} // regex_from_words
+
+
+/*
+  regex_fullmatch/2: regex_fullmatch(Pattern,Subject)
+
+  True if the whole Subject matches Pattern, i.e. the same as
+  regex("^(?:" ++ Pattern ++ ")$",Subject) (but $ doesn't match before
+  a final newline).
+
+  If the pattern is supported by regex_dfa.c the subject is matched
+  with the pattern's DFA (which is built once and cached, or is the
+  DFA from regex_from_words/1), otherwise with PCRE2 (PCRE2_ANCHORED |
+  PCRE2_ENDANCHORED).
+*/
+int regex_fullmatch() {
+  TERM pattern_p = picat_get_call_arg(1,2);
+  TERM subject_p = picat_get_call_arg(2,2);
+
+  size_t pattern_size, subject_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_fullmatch");
+  free(pattern_s);
+  if (entry == NULL) {
+    return PICAT_FALSE;
+  }
+  char* subject_buf;
+  uint32_t subject_options;
+  char* subject_s = regex_get_subject(subject_p, &subject_size, &subject_buf, &subject_options, "regex_fullmatch");
+  if (subject_s == NULL) {
+    return PICAT_FALSE;
+  }
+
+  int ret = PICAT_FALSE;
+  regex_dfa* dfa = regex_entry_dfa(entry, NULL);
+  if (dfa != NULL) {
+    regex_stats_t* stats = regex_stats_get();
+    REGEX_PROBE(match_start, entry->id, subject_size);
+    uint64_t t0 = regex_ticks();
+    int rc = regex_dfa_full_match(dfa, (const unsigned char*)subject_s, subject_size);
+    regex_record_match(stats, entry, subject_size, regex_ticks() - t0, !rc);
+    REGEX_PROBE(match_end, entry->id, subject_size, rc);
+    ret = rc ? PICAT_TRUE : PICAT_FALSE;
+  } else {
+    pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(entry->re, NULL);
+    int rc = regex_pcre2_match(entry, (PCRE2_SPTR)subject_s, subject_size, 0,
+                               PCRE2_ANCHORED | PCRE2_ENDANCHORED | subject_options, match_data);
+    pcre2_match_data_free(match_data);
+    ret = rc > 0 ? PICAT_TRUE : PICAT_FALSE;
+  }
+  free(subject_buf);
+
+  return ret;
+
+} // regex_fullmatch
+
+
+/*
+  Trigram indexes (regex_index_build/1 and regex_index_search/2)
+
+  An index contains a copy of the strings and, for each trigram
+  (3 consecutive bytes) in the strings, the sorted list of the numbers
+  of the strings that contain it (the posting list). The posting lists
+  are stored after each other in one byte array, as the differences
+  between consecutive numbers in a variable length code (7 bits per
+  byte, the high bit is set for all but the last byte).
+
+  The index is referred to from Picat as $regex_index(Id).
+*/
+typedef struct regex_index {
+  int id;
+  size_t num_strings;
+  char* data;              // the strings (after each other)
+  size_t* offsets;         // string i is data[offsets[i]..offsets[i+1]-1]
+  size_t num_trigrams;
+  uint32_t* trigrams;      // the trigrams (sorted)
+  size_t* postings;        // posting list k is bytes[postings[k]..postings[k+1]-1]
+  uint32_t* counts;        // the length of posting list k
+  unsigned char* bytes;
+  struct regex_index* next;
+} regex_index;
+
+static regex_index* regex_indexes = NULL;
+static int regex_index_next_id = 1;
+
+static regex_index* regex_get_index(TERM index_p, char* who) {
+  if (picat_is_structure(index_p) && strcmp(picat_get_struct_name(index_p), "regex_index") == 0 &&
+      picat_get_struct_arity(index_p) == 1) {
+    int id = picat_get_integer(picat_get_arg(1, index_p));
+    for (regex_index* ix = regex_indexes; ix != NULL; ix = ix->next) {
+      if (ix->id == id) {
+        return ix;
+      }
+    }
+  }
+  fprintf(stderr,"%s: not an index (or the index has been freed)\n", who);
+  return NULL;
+}
+
+static inline uint32_t regex_trigram(const unsigned char* p) {
+  return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static void regex_index_destroy(regex_index* ix) {
+  free(ix->data);
+  free(ix->offsets);
+  free(ix->trigrams);
+  free(ix->postings);
+  free(ix->counts);
+  free(ix->bytes);
+  free(ix);
+}
+
+/*
+  The trigrams of the strings while an index is built: an open
+  addressing (linear probing) hash table that is doubled when it is
+  3/4 full, so its size follows the number of distinct trigrams in
+  the strings (not the 2^24 possible ones).
+*/
+typedef struct {
+  uint32_t key;    // the trigram + 1 (0 for an empty slot)
+  uint32_t count;  // the number of strings with the trigram, then its number in the directory
+  uint32_t last;   // the last string (+1) with the trigram
+} regex_trigram_slot;
+
+typedef struct {
+  regex_trigram_slot* slots;
+  size_t size;     // a power of 2
+  size_t used;
+} regex_trigram_table;
+
+#define REGEX_TRIGRAM_TABLE_MIN 1024
+
+static inline size_t regex_trigram_home(uint32_t tri, size_t size) {
+  return (size_t)(((uint64_t)tri * 0x9E3779B97F4A7C15ull) >> 32) & (size - 1);
+}
+
+static int regex_trigram_table_init(regex_trigram_table* t, size_t size) {
+  t->slots = calloc(size, sizeof(regex_trigram_slot));
+  t->size = size;
+  t->used = 0;
+  return t->slots != NULL;
+}
+
+static int regex_trigram_table_grow(regex_trigram_table* t) {
+  regex_trigram_table bigger;
+  if (!regex_trigram_table_init(&bigger, 2 * t->size)) {
+    return 0;
+  }
+  for (size_t i = 0; i < t->size; i++) {
+    if (t->slots[i].key != 0) {
+      size_t j = regex_trigram_home(t->slots[i].key - 1, bigger.size);
+      while (bigger.slots[j].key != 0) j = (j + 1) & (bigger.size - 1);
+      bigger.slots[j] = t->slots[i];
+    }
+  }
+  bigger.used = t->used;
+  free(t->slots);
+  *t = bigger;
+  return 1;
+}
+
+/*
+  The slot of trigram tri, which is added if it isn't in the table
+  (NULL if the table couldn't be grown).
+*/
+static regex_trigram_slot* regex_trigram_find(regex_trigram_table* t, uint32_t tri) {
+  size_t i = regex_trigram_home(tri, t->size);
+  while (t->slots[i].key != 0) {
+    if (t->slots[i].key == tri + 1) {
+      return &t->slots[i];
+    }
+    i = (i + 1) & (t->size - 1);
+  }
+  if (4 * (t->used + 1) > 3 * t->size) {
+    if (!regex_trigram_table_grow(t)) {
+      return NULL;
+    }
+    return regex_trigram_find(t, tri);
+  }
+  t->used++;
+  t->slots[i].key = tri + 1;
+  return &t->slots[i];
+}
+
+static int regex_cmp_trigram_slot(const void* x, const void* y) {
+  const regex_trigram_slot* a = *(regex_trigram_slot* const*)x;
+  const regex_trigram_slot* b = *(regex_trigram_slot* const*)y;
+  return a->key < b->key ? -1 : a->key > b->key;
+}
+
+/*
+  The first pass: the trigrams of the strings and the number of
+  strings with each of them (*total is the sum).
+*/
+static int regex_index_count(regex_index* ix, regex_trigram_table* table, size_t* total) {
+  for (size_t i = 0; i < ix->num_strings; i++) {
+    const unsigned char* s = (const unsigned char*)ix->data + ix->offsets[i];
+    size_t len = ix->offsets[i+1] - ix->offsets[i];
+    for (size_t j = 0; j + 2 < len; j++) {
+      regex_trigram_slot* slot = regex_trigram_find(table, regex_trigram(s+j));
+      if (slot == NULL) {
+        return 0;
+      }
+      if (slot->last != i+1) {
+        slot->last = i+1;
+        slot->count++;
+        (*total)++;
+      }
+    }
+  }
+  return 1;
+}
+
+/*
+  The second pass: the directory of the index (the trigrams in order)
+  and the posting lists after each other (NULL if out of memory).
+*/
+static uint32_t* regex_index_ids(regex_index* ix, regex_trigram_table* table, size_t total) {
+  ix->num_trigrams = table->used;
+  regex_trigram_slot** dir = malloc((ix->num_trigrams+1) * sizeof(regex_trigram_slot*));
+  size_t* pos = malloc((ix->num_trigrams+1) * sizeof(size_t));
+  uint32_t* ids = malloc((total+1) * sizeof(uint32_t));
+  ix->trigrams = malloc((ix->num_trigrams+1) * sizeof(uint32_t));
+  ix->counts = malloc((ix->num_trigrams+1) * sizeof(uint32_t));
+  ix->postings = malloc((ix->num_trigrams+1) * sizeof(size_t));
+  if (dir == NULL || pos == NULL || ids == NULL || ix->trigrams == NULL || ix->counts == NULL || ix->postings == NULL) {
+    free(dir);
+    free(pos);
+    free(ids);
+    return NULL;
+  }
+  size_t k = 0, sum = 0;
+  for (size_t i = 0; i < table->size; i++) {
+    if (table->slots[i].key != 0) {
+      dir[k++] = &table->slots[i];
+    }
+  }
+  qsort(dir, ix->num_trigrams, sizeof(regex_trigram_slot*), regex_cmp_trigram_slot);
+  for (k = 0; k < ix->num_trigrams; k++) {
+    ix->trigrams[k] = dir[k]->key - 1;
+    ix->counts[k] = dir[k]->count;
+    pos[k] = sum;
+    sum += dir[k]->count;
+    dir[k]->count = k;
+    dir[k]->last = 0;
+  }
+  for (size_t i = 0; i < ix->num_strings; i++) {
+    const unsigned char* s = (const unsigned char*)ix->data + ix->offsets[i];
+    size_t len = ix->offsets[i+1] - ix->offsets[i];
+    for (size_t j = 0; j + 2 < len; j++) {
+      regex_trigram_slot* slot = regex_trigram_find(table, regex_trigram(s+j));
+      if (slot->last != i+1) {
+        slot->last = i+1;
+        ids[pos[slot->count]++] = i;
       }
     }
   }
-  
-  /*************************************************************************
-   * If the "-g" option was given on the command line, we want to continue  *
-   * to search for additional matches in the subject string, in a similar   *
-   * way to the /g option in Perl. This turns out to be trickier than you   *
-   * might think because of the possibility of matching an empty string.    *
-   * What happens is as follows:                                            *
-   *                                                                        *
-   * If the previous match was NOT for an empty string, we can just start   *
-   * the next match at the end of the previous one.                         *
-   *                                                                        *
-   * If the previous match WAS for an empty string, we can't do that, as it *
-   * would lead to an infinite loop. Instead, a call of pcre2_match() is    *
-   * made with the PCRE2_NOTEMPTY_ATSTART and PCRE2_ANCHORED flags set. The *
-   * first of these tells PCRE2 that an empty string at the start of the    *
-   * subject is not a valid match; other possibilities must be tried. The   *
-   * second flag restricts PCRE2 to one match attempt at the initial string *
-   * position. If this match succeeds, an alternative to the empty string   *
-   * match has been found, and we can print it and proceed round the loop,  *
-   * advancing by the length of whatever was found. If this match does not  *
-   * succeed, we still stay in the loop, advancing by just one character.   *
-   * In UTF-8 mode, which can be set by (*UTF) in the pattern, this may be  *
-   * more than one byte.                                                    *
-   *                                                                        *
-   * However, there is a complication concerned with newlines. When the     *
-   * newline convention is such that CRLF is a valid newline, we must       *
-   * advance by two characters rather than one. The newline convention can  *
-   * be set in the regex by (*CR), etc.; if not, we must find the default.  *
-   *************************************************************************/
-  
-  int find_more = 1; 
-  if (num_to_find == 0 || num_to_find > 1) {
+  free(dir);
+  free(pos);
+  return ids;
+}
 
-   /* Before running the loop, check for UTF-8 and whether CRLF is a valid newline
-      sequence. First, find the options with which the regex was compiled and extract
-      the UTF state. */
-   (void)pcre2_pattern_info(re, PCRE2_INFO_ALLOPTIONS, &option_bits);
-   utf8 = (option_bits & PCRE2_UTF) != 0;
-  
-   /* Now find the newline convention and see whether CRLF is a valid newline
-      sequence. */ 
-   (void)pcre2_pattern_info(re, PCRE2_INFO_NEWLINE, &newline);
-   crlf_is_newline = newline == PCRE2_NEWLINE_ANY ||
-     newline == PCRE2_NEWLINE_CRLF ||
-     newline == PCRE2_NEWLINE_ANYCRLF;
-  
-   /* Loop for second and subsequent matches */
-   for (;;) {
-     // printf("find_more: %d\n", find_more);
-     if (!find_more) {
-       break;
-     }
-     uint32_t options = 0;                   /* Normally no options */
-     PCRE2_SIZE start_offset = ovector[1];   /* Start at end of previous match */
-    
-     /* If the previous match was for an empty string, we are finished if we are
-        at the end of the subject. Otherwise, arrange to run another match at the
-        same point to see if a non-empty match can be found. */      
-     if (ovector[0] == ovector[1]) {
-       if (ovector[0] == subject_length) break;
-       options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
-     } else {
+/*
+  The posting lists in the variable length code.
+*/
+static int regex_index_compress(regex_index* ix, const uint32_t* ids, size_t total) {
+  size_t bytes_alloc = total + 16;
+  ix->bytes = malloc(bytes_alloc);
+  if (ix->bytes == NULL) {
+    return 0;
+  }
+  size_t n = 0, from = 0;
+  for (size_t k = 0; k < ix->num_trigrams; k++) {
+    ix->postings[k] = n;
+    uint32_t prev = 0;
+    for (size_t i = from; i < from + ix->counts[k]; i++) {
+      if (n + 5 > bytes_alloc) {
+        unsigned char* bytes = realloc(ix->bytes, 2 * bytes_alloc);
+        if (bytes == NULL) {
+          return 0;
+        }
+        ix->bytes = bytes;
+        bytes_alloc *= 2;
+      }
+      uint32_t d = ids[i] - prev;
+      prev = ids[i];
+      while (d >= 128) {
+        ix->bytes[n++] = (d & 127) | 128;
+        d >>= 7;
+      }
+      ix->bytes[n++] = d;
+    }
+    from += ix->counts[k];
+  }
+  ix->postings[ix->num_trigrams] = n;
+  ix->bytes = realloc(ix->bytes, n + 1);
+  return 1;
+}
 
-       /* If the previous match was not an empty string, there is one tricky case to
-          consider. If a pattern contains \K within a lookbehind assertion at the
-          start, the end of the matched string can be at the offset where the match
-          started. Without special action, this leads to a loop that keeps on matching
-          the same substring. We must detect this case and arrange to move the start on
-          by one character. The pcre2_get_startchar() function returns the starting
-          offset that was passed to pcre2_match(). */      
-       PCRE2_SIZE startchar = pcre2_get_startchar(match_data);
-       if (start_offset <= startchar) {
-         if (startchar >= subject_length) break;   /* Reached end of subject.   */
-         start_offset = startchar + 1;             /* Advance by one character. */
-         if (utf8) {                                /* If UTF-8, it may be more  */
-           /*   than one code unit.     */
-           for (; start_offset < subject_length; start_offset++)
-             if ((subject[start_offset] & 0xc0) != 0x80) break;
-         }
-       }
-     }
-    
-     /* Run the next matching operation */
-     rc = pcre2_match(
-                      re,                   /* the compiled pattern */
-                      subject,              /* the subject string */
-                      subject_length,       /* the length of the subject */
-                      start_offset,         /* starting offset in the subject */
-                      options,              /* options */
-                      match_data,           /* block for storing the result */
-                      NULL);                /* use default match context */
-    
-     /* This time, a result of NOMATCH isn't an error. If the value in "options"
-        is zero, it just means we have found all possible matches, so the loop ends.
-        Otherwise, it means we have failed to find a non-empty-string match at a
-        point where there was a previous empty-string match. In this case, we do what
-        Perl does: advance the matching position by one character, and continue. We
-        do this by setting the "end of previous match" offset, because that is picked
-        up at the top of the loop as the point at which to start again.
-       
-        There are two complications: (a) When CRLF is a valid newline sequence, and
-        the current position is just before it, advance by an extra byte. (b)
-        Otherwise we must ensure that we skip an entire UTF character if we are in
-        UTF mode. */
-     if (rc == PCRE2_ERROR_NOMATCH) {
-       if (options == 0) break;                    /* All matches found */
-       ovector[1] = start_offset + 1;              /* Advance one code unit */
-       if (crlf_is_newline &&                      /* If CRLF is a newline & */
-           start_offset < subject_length - 1 &&    /* we are at CRLF, */
-           subject[start_offset] == '\r' &&
-           subject[start_offset + 1] == '\n')
-         ovector[1] += 1;                          /* Advance by one more. */
-       else if (utf8)                              /* Otherwise, ensure we */
-         {                                         /* advance a whole UTF-8 */
-           while (ovector[1] < subject_length)       /* character. */
-             {
-               if ((subject[ovector[1]] & 0xc0) != 0x80) break;
-               ovector[1] += 1;
-             }
-         }
-       continue;    /* Go round the loop again */
-     }
-      
-     /* Other matching errors are not recoverable. */      
-     if (rc < 0) {
-       printf("Matching error %d\n", rc);
-       pcre2_match_data_free(match_data);
-       pcre2_code_free(re);
-       free(subject);
-       return PICAT_FALSE;
-     }
-      
-     /* Match succeeded */
-     // printf("\nMatch succeeded again at offset %d\n", (int)ovector[0]);
-      
-     /* The match succeeded, but the output vector wasn't big enough. This
-        should not happen. */
-     if (rc == 0) {
-       printf("ovector was not big enough for all the captured substrings\n");
-     }
-      
-     /* We must guard against patterns such as /(?=.\K)/ that use \K in an
-        assertion to set the start of a match later than its end. In this
-        demonstration program, we just detect this case and give up. */      
-     if (ovector[0] > ovector[1]) {
-       printf("\\K was used in an assertion to set the match start after its end.\n"
-              "From end to start the match was: %.*s\n", (int)(ovector[0] - ovector[1]),
-              (char *)(subject + ovector[1]));
-       printf("Run abandoned\n");
-       pcre2_match_data_free(match_data);
-       pcre2_code_free(re);
-       free(subject);
-       return PICAT_FALSE;
-     }
-     
-     // printf("Next loop rc2: %d\n", rc);
-     /* As before, show substrings stored in the output vector by number, and then
-        also any named substrings. */
-     picat_match = (TERM)NULL;
+/*
+  regex_index_build/2: regex_index_build(Strings,Index)
 
-     int ix_from = 1;
-     int ix_to = rc-1;
-     if (rc == 1) {
-       ix_from = 0;
-       ix_to = 0;
-     }
-     for (i = ix_from; i <= ix_to; i++) {
-       PCRE2_SPTR substring_start = subject + ovector[2*i];
-       size_t substring_length = ovector[2*i+1] - ovector[2*i];
-       // printf("i:%2d: %.*s\n", i, (int)substring_length, (char *)substring_start);
-
-       char matched[substring_length];
-       strncpy(matched,(char*)substring_start,(int)substring_length);
-       matched[substring_length] = '\0';
-       // printf("adding: %s len: %ld check: %ld (num_matches: %d)\n",matched, substring_length, strlen(matched),num_matches);
-
-       cons = picat_build_list();
-       if (rc > 2) {
-         // More than one capture groups
-         picat_unify(picat_get_car(cons), cstring_to_picat((char*) matched, (int)substring_length));
-       } else {
-         // no or one capture group
-         picat_unify(cons, cstring_to_picat((char*) matched, (int)substring_length));         
-       }
-       if (picat_match == (TERM)NULL){
-         picat_match = cons;
-       } else {
-         picat_unify(picat_match_tail, cons);
-       }
-       picat_match_tail = picat_get_cdr(cons);
-       
-     }
-     picat_unify(picat_match_tail, picat_build_nil());
+  Builds the trigram index of the list Strings (or of a corpus, see
+  regex_corpus_load/2). The posting lists
+  are built in two passes over the strings (counting and filling)
+  with a hash table of the trigrams that occur, and then compressed.
+*/
+int regex_index_build() {
+  TERM strings_p = picat_get_call_arg(1,2);
+  TERM index_p = picat_get_call_arg(2,2);
+
+  regex_corpus* corpus = NULL;
+  if (regex_is_corpus(strings_p)) {
+    corpus = regex_get_corpus(strings_p, "regex_index_build");
+    if (corpus == NULL) {
+      return PICAT_FALSE;
+    }
+  }
+  regex_index* ix = calloc(1, sizeof(regex_index));
+  size_t alloc = 1024, data_alloc = 65536;
+  ix->offsets = malloc(alloc * sizeof(size_t));
+  ix->data = malloc(data_alloc);
+  ix->offsets[0] = 0;
+  TERM t = strings_p;
+  for (;;) {
+    // the next string, from the corpus (not converted again) or the list
+    const char* s;
+    char* converted = NULL;
+    size_t size;
+    if (corpus != NULL) {
+      if (ix->num_strings == corpus->num_strings) {
+        break;
+      }
+      s = corpus->data + corpus->starts[ix->num_strings];
+      size = corpus->lengths[ix->num_strings];
+    } else {
+      if (!picat_is_list(t)) {
+        break;
+      }
+      s = converted = regex_get_cstring(picat_get_car(t), &size);
+      t = picat_get_cdr(t);
+    }
+    size_t end = ix->offsets[ix->num_strings];
+    while (end + size > data_alloc) {
+      data_alloc *= 2;
+      ix->data = realloc(ix->data, data_alloc);
+    }
+    memcpy(ix->data + end, s, size);
+    free(converted);
+    if (ix->num_strings + 1 == alloc) {
+      alloc *= 2;
+      ix->offsets = realloc(ix->offsets, alloc * sizeof(size_t));
+    }
+    ix->offsets[++ix->num_strings] = end + size;
+  }
 
+  uint64_t t0 = regex_ticks();
+  regex_trigram_table table;
+  size_t total = 0;
+  uint32_t* ids = NULL;
+  int ok = regex_trigram_table_init(&table, REGEX_TRIGRAM_TABLE_MIN) &&
+    regex_index_count(ix, &table, &total) &&
+    (ids = regex_index_ids(ix, &table, total)) != NULL;
+  free(table.slots);
+  ok = ok && regex_index_compress(ix, ids, total);
+  free(ids);
+  REGEX_STAT(build_ticks) += regex_ticks() - t0;
+  if (!ok) {
+    fprintf(stderr, "regex_index_build: out of memory\n");
+    regex_index_destroy(ix);
+    return PICAT_FALSE;
+  }
 
-     num_matches++;
-     
-     // increment the main ret_list
-     cons = picat_build_list();
-     picat_unify(picat_get_car(cons), picat_match); // place first match in ret_list
-     if (ret_list == (TERM)NULL) {
-       ret_list = ret_list_tail;
-     } else {
-       picat_unify(ret_list_tail, cons);
-     }
-     ret_list_tail = picat_get_cdr(cons);
-     
-     if (num_to_find != 0 && num_matches >= num_to_find) {
-       find_more = 0;
-     }
-     
-     /*
-       // hakank: We don't care about named substrings
-       if (namecount == 0) {
-       // printf("No named substrings\n");
-       } else {
-       PCRE2_SPTR tabptr = name_table;
-       // printf("Named substrings\n");
-       for (i = 0; i < namecount; i++) {
-       int n = (tabptr[0] << 8) | tabptr[1];
-       // printf("(%d) %*s: %.*s\n", n, name_entry_size - 3, tabptr + 2,
-       //        (int)(ovector[2*n+1] - ovector[2*n]), subject + ovector[2*n]); 
-       tabptr += name_entry_size;
-       }
-       }
-     */
+  ix->id = regex_index_next_id++;
+  ix->next = regex_indexes;
+  regex_indexes = ix;
 
-   }      /* End of loop to find second and subsequent matches */
+  TERM index = picat_build_structure("regex_index",1);
+  picat_unify(picat_get_arg(1,index), picat_build_integer(ix->id));
+  return picat_unify(index_p, index);
 
- } 
-  // printf("\n");
+} // regex_index_build
+
+
+/*
+  The string numbers of a query (all is set for REGEX_QUERY_ALL).
+*/
+typedef struct {
+  int all;
+  uint32_t* ids;
+  size_t count;
+} regex_id_list;
+
+static void regex_index_posting(regex_index* ix, uint32_t tri, regex_id_list* r) {
+  r->all = 0;
+  r->count = 0;
+  r->ids = NULL;
+  size_t lo = 0, hi = ix->num_trigrams;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (ix->trigrams[mid] < tri) lo = mid + 1; else hi = mid;
+  }
+  if (lo == ix->num_trigrams || ix->trigrams[lo] != tri) {
+    return;
+  }
+  r->ids = malloc((ix->counts[lo]+1) * sizeof(uint32_t));
+  const unsigned char* p = ix->bytes + ix->postings[lo];
+  uint32_t id = 0;
+  for (uint32_t i = 0; i < ix->counts[lo]; i++) {
+    uint32_t d = 0;
+    int shift = 0;
+    while (*p & 128) {
+      d |= (uint32_t)(*p++ & 127) << shift;
+      shift += 7;
+    }
+    d |= (uint32_t)*p++ << shift;
+    id += d;
+    r->ids[r->count++] = id;
+  }
+}
+
+static int regex_cmp_id_list(const void* x, const void* y) {
+  const regex_id_list* a = x;
+  const regex_id_list* b = y;
+  return a->count < b->count ? -1 : a->count > b->count;
+}
+
+static void regex_index_eval(regex_index* ix, regex_query* q, regex_id_list* r) {
+  if (q->op == REGEX_QUERY_ALL) {
+    r->all = 1;
+    r->ids = NULL;
+    r->count = 0;
+    return;
+  }
+  if (q->op == REGEX_QUERY_TRIGRAM) {
+    regex_index_posting(ix, q->trigram, r);
+    return;
+  }
+  regex_id_list* args = malloc(q->count * sizeof(regex_id_list));
+  for (int i = 0; i < q->count; i++) {
+    regex_index_eval(ix, q->args[i], &args[i]);
+  }
+  if (q->op == REGEX_QUERY_AND) {
+    // intersect, the shortest lists first (ALL is the longest)
+    for (int i = 0; i < q->count; i++) {
+      if (args[i].all) args[i].count = (size_t)-1;
+    }
+    qsort(args, q->count, sizeof(regex_id_list), regex_cmp_id_list);
+    *r = args[0];
+    for (int i = 1; i < q->count && !args[i].all; i++) {
+      size_t n = 0, j = 0;
+      for (size_t a = 0; a < r->count; a++) {
+        while (j < args[i].count && args[i].ids[j] < r->ids[a]) j++;
+        if (j < args[i].count && args[i].ids[j] == r->ids[a]) r->ids[n++] = r->ids[a];
+      }
+      r->count = n;
+      free(args[i].ids);
+    }
+    if (r->all) r->count = 0;
+  } else {
+    // union
+    r->all = 0;
+    r->count = 0;
+    r->ids = NULL;
+    for (int i = 0; i < q->count; i++) {
+      if (args[i].all) r->all = 1;
+    }
+    if (!r->all) {
+      regex_id_list u = { 0, NULL, 0 };
+      for (int i = 0; i < q->count; i++) {
+        uint32_t* m = malloc((u.count + args[i].count + 1) * sizeof(uint32_t));
+        size_t n = 0, a = 0, b = 0;
+        while (a < u.count || b < args[i].count) {
+          if (b == args[i].count || (a < u.count && u.ids[a] < args[i].ids[b])) {
+            m[n++] = u.ids[a++];
+          } else {
+            if (a < u.count && u.ids[a] == args[i].ids[b]) a++;
+            m[n++] = args[i].ids[b++];
+          }
+        }
+        free(u.ids);
+        u.ids = m;
+        u.count = n;
+      }
+      *r = u;
+    }
+    for (int i = 0; i < q->count; i++) {
+      free(args[i].ids);
+    }
+  }
+  free(args);
+}
+
+/*
+  regex_index_search/3: regex_index_search(Index,Pattern,Matches)
+
+  Matches are the strings in the index (in the same order) that match
+  Pattern (as regex/2). The trigram query of the pattern (see
+  regex_dfa_query()) selects the candidate strings from the posting
+  lists, and only these are matched with PCRE2.
+  For a pattern without required trigrams (e.g. "a.c", "[a-z]+" or a
+  pattern that is not supported by regex_dfa.c) all the strings are
+  candidates.
+*/
+int regex_index_search() {
+  TERM index_p = picat_get_call_arg(1,3);
+  TERM pattern_p = picat_get_call_arg(2,3);
+  TERM matches_p = picat_get_call_arg(3,3);
+
+  regex_index* ix = regex_get_index(index_p, "regex_index_search");
+  if (ix == NULL) {
+    return PICAT_FALSE;
+  }
+  size_t pattern_size;
+  char* pattern_s = regex_get_cstring(pattern_p, &pattern_size);
+  regex_cache_entry* entry = regex_cache_lookup(pattern_s, pattern_size, 0, "regex_index_search");
+  if (entry == NULL) {
+    free(pattern_s);
+    return PICAT_FALSE;
+  }
+  regex_query* q = regex_dfa_query(pattern_s, pattern_size);
+  free(pattern_s);
+  regex_entry_lengths(entry);
+  regex_id_list candidates;
+  regex_index_eval(ix, q, &candidates);
+  regex_query_free(q);
+  size_t num_candidates = candidates.all ? ix->num_strings : candidates.count;
+
+  uint32_t* matches = malloc((num_candidates+1) * sizeof(uint32_t));
+  size_t num_matches = 0;
+  pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(entry->re, NULL);
+  for (size_t c = 0; c < num_candidates; c++) {
+    uint32_t i = candidates.all ? c : candidates.ids[c];
+    if (regex_length_reject(entry, ix->offsets[i+1] - ix->offsets[i])) {
+      continue;
+    }
+    int rc = regex_pcre2_match(entry, (PCRE2_SPTR)ix->data + ix->offsets[i], ix->offsets[i+1] - ix->offsets[i],
+                               0, 0, match_data);
+    if (rc > 0) {
+      matches[num_matches++] = i;
+    }
+  }
   pcre2_match_data_free(match_data);
-  pcre2_code_free(re);
-  free(subject);
+  free(candidates.ids);
+
+  regex_result result;
+  regex_result_init(&result, ix->data);
+  for (size_t m = 0; m < num_matches; m++) {
+    uint32_t i = matches[m];
+    regex_result_add_slice(&result, ix->offsets[i], ix->offsets[i+1]);
+  }
+  free(matches);
+  TERM list;
+  int ok = regex_result_build(&result, REGEX_FORMAT_STRING, "regex_index_search", &list);
+  regex_result_free(&result);
+
+  return ok && picat_unify(matches_p, list);
+
+} // regex_index_search
+
+
+/*
+  regex_index_free/1: regex_index_free(Index)
+*/
+int regex_index_free() {
+  TERM index_p = picat_get_call_arg(1,1);
+
+  regex_index* ix = regex_get_index(index_p, "regex_index_free");
+  if (ix == NULL) {
+    return PICAT_FALSE;
+  }
+  for (regex_index** p = &regex_indexes; *p != NULL; p = &(*p)->next) {
+    if (*p == ix) {
+      *p = ix->next;
+      break;
+    }
+  }
+  regex_index_destroy(ix);
 
-  // printf("num_matches: %d\n", num_matches);
-  picat_unify(ret_list_tail, picat_build_nil()); // add tail []
-  picat_unify(ret_list, output_p); // output
-  
   return PICAT_TRUE;
-  
 
-} // regex_find_all
+} // regex_index_free
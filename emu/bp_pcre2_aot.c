@@ -0,0 +1,701 @@
+/*
+  Generated by regex_aot from regex_aot_patterns.txt. Don't edit.
+
+  See regex_aot.c for details.
+*/
+#ifndef REGEX_AOT_NO_CPREDS
+#include "picat.h"
+#include "picat_utilities.h"
+extern char* regex_get_cstring(TERM t, size_t* size); // bp_pcre2.c
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include "bp_pcre2_aot.h"
+
+
+/*
+  wordle_no_slat: ^[^slat]+$
+  2 DFA states
+*/
+int regex_aot_wordle_no_slat_match(const unsigned char* s, size_t n) {
+  size_t i = 0;
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 97: case 108: case 115 ... 116: return 0;
+  default: goto s1;
+  }
+ s1:
+  if (i == n || (i+1 == n && s[i] == '\n')) return 1;
+  switch (s[i++]) {
+  case 97: case 108: case 115 ... 116: return 0;
+  default: goto s1;
+  }
+} // regex_aot_wordle_no_slat_match
+
+#ifndef REGEX_AOT_NO_CPREDS
+int regex_aot_wordle_no_slat() {
+  TERM subject_p = picat_get_call_arg(1,1);
+  size_t size;
+  char* subject_s = regex_get_cstring(subject_p, &size);
+  int rc = regex_aot_wordle_no_slat_match((const unsigned char*)subject_s, size);
+  free(subject_s);
+  return rc ? PICAT_TRUE : PICAT_FALSE;
+} // regex_aot_wordle_no_slat
+#endif
+
+
+/*
+  wordle_n4: ...n.
+  6 DFA states
+*/
+int regex_aot_wordle_n4_match(const unsigned char* s, size_t n) {
+  size_t i = 0;
+ s0:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  default: goto s1;
+  }
+ s1:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  default: goto s2;
+  }
+ s2:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  default: goto s3;
+  }
+ s3:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 110: goto s4;
+  default: goto s3;
+  }
+ s4:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  default: goto s5;
+  }
+ s5:
+  return 1;
+} // regex_aot_wordle_n4_match
+
+#ifndef REGEX_AOT_NO_CPREDS
+int regex_aot_wordle_n4() {
+  TERM subject_p = picat_get_call_arg(1,1);
+  size_t size;
+  char* subject_s = regex_get_cstring(subject_p, &size);
+  int rc = regex_aot_wordle_n4_match((const unsigned char*)subject_s, size);
+  free(subject_s);
+  return rc ? PICAT_TRUE : PICAT_FALSE;
+} // regex_aot_wordle_n4
+#endif
+
+
+/*
+  log_error: ERROR
+  6 DFA states
+*/
+int regex_aot_log_error_match(const unsigned char* s, size_t n) {
+  size_t i = 0;
+ s0:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 69: goto s1;
+  default: goto s0;
+  }
+ s1:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 69: goto s1;
+  case 82: goto s2;
+  default: goto s0;
+  }
+ s2:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 69: goto s1;
+  case 82: goto s3;
+  default: goto s0;
+  }
+ s3:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 69: goto s1;
+  case 79: goto s4;
+  default: goto s0;
+  }
+ s4:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 69: goto s1;
+  case 82: goto s5;
+  default: goto s0;
+  }
+ s5:
+  return 1;
+} // regex_aot_log_error_match
+
+#ifndef REGEX_AOT_NO_CPREDS
+int regex_aot_log_error() {
+  TERM subject_p = picat_get_call_arg(1,1);
+  size_t size;
+  char* subject_s = regex_get_cstring(subject_p, &size);
+  int rc = regex_aot_log_error_match((const unsigned char*)subject_s, size);
+  free(subject_s);
+  return rc ? PICAT_TRUE : PICAT_FALSE;
+} // regex_aot_log_error
+#endif
+
+
+/*
+  log_slow: user=\w+ .*took=\d{4,}ms
+  23 DFA states
+*/
+int regex_aot_log_slow_match(const unsigned char* s, size_t n) {
+  size_t i = 0;
+ s0:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 117: goto s1;
+  default: goto s0;
+  }
+ s1:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 117: goto s1;
+  case 115: goto s2;
+  default: goto s0;
+  }
+ s2:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 117: goto s1;
+  case 101: goto s3;
+  default: goto s0;
+  }
+ s3:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 117: goto s1;
+  case 114: goto s4;
+  default: goto s0;
+  }
+ s4:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 117: goto s1;
+  case 61: goto s5;
+  default: goto s0;
+  }
+ s5:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: case 65 ... 90: case 95: case 97 ... 116: case 118 ... 122: goto s6;
+  case 117: goto s7;
+  default: goto s0;
+  }
+ s6:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: case 65 ... 90: case 95: case 97 ... 116: case 118 ... 122: goto s6;
+  case 117: goto s7;
+  case 32: goto s8;
+  default: goto s0;
+  }
+ s7:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: case 65 ... 90: case 95: case 97 ... 114: case 116: case 118 ... 122: goto s6;
+  case 117: goto s7;
+  case 32: goto s8;
+  case 115: goto s9;
+  default: goto s0;
+  }
+ s8:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  default: goto s8;
+  }
+ s9:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: case 65 ... 90: case 95: case 97 ... 100: case 102 ... 116: case 118 ... 122: goto s6;
+  case 117: goto s7;
+  case 32: goto s8;
+  case 101: goto s11;
+  default: goto s0;
+  }
+ s10:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 111: goto s12;
+  default: goto s8;
+  }
+ s11:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: case 65 ... 90: case 95: case 97 ... 113: case 115 ... 116: case 118 ... 122: goto s6;
+  case 117: goto s7;
+  case 32: goto s8;
+  case 114: goto s13;
+  default: goto s0;
+  }
+ s12:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 111: goto s14;
+  default: goto s8;
+  }
+ s13:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 61: goto s5;
+  case 48 ... 57: case 65 ... 90: case 95: case 97 ... 116: case 118 ... 122: goto s6;
+  case 117: goto s7;
+  case 32: goto s8;
+  default: goto s0;
+  }
+ s14:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 107: goto s15;
+  default: goto s8;
+  }
+ s15:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 61: goto s16;
+  default: goto s8;
+  }
+ s16:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 48 ... 57: goto s17;
+  default: goto s8;
+  }
+ s17:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 48 ... 57: goto s18;
+  default: goto s8;
+  }
+ s18:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 48 ... 57: goto s19;
+  default: goto s8;
+  }
+ s19:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 48 ... 57: goto s20;
+  default: goto s8;
+  }
+ s20:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 48 ... 57: goto s20;
+  case 109: goto s21;
+  default: goto s8;
+  }
+ s21:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 10: goto s0;
+  case 116: goto s10;
+  case 115: goto s22;
+  default: goto s8;
+  }
+ s22:
+  return 1;
+} // regex_aot_log_slow_match
+
+#ifndef REGEX_AOT_NO_CPREDS
+int regex_aot_log_slow() {
+  TERM subject_p = picat_get_call_arg(1,1);
+  size_t size;
+  char* subject_s = regex_get_cstring(subject_p, &size);
+  int rc = regex_aot_log_slow_match((const unsigned char*)subject_s, size);
+  free(subject_s);
+  return rc ? PICAT_TRUE : PICAT_FALSE;
+} // regex_aot_log_slow
+#endif
+
+
+/*
+  ip_address: \d+\.\d+\.\d+\.\d+
+  8 DFA states
+*/
+int regex_aot_ip_address_match(const unsigned char* s, size_t n) {
+  size_t i = 0;
+ s0:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: goto s1;
+  default: goto s0;
+  }
+ s1:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: goto s1;
+  case 46: goto s2;
+  default: goto s0;
+  }
+ s2:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: goto s3;
+  default: goto s0;
+  }
+ s3:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: goto s3;
+  case 46: goto s4;
+  default: goto s0;
+  }
+ s4:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: goto s5;
+  default: goto s0;
+  }
+ s5:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: goto s5;
+  case 46: goto s6;
+  default: goto s0;
+  }
+ s6:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 48 ... 57: goto s7;
+  default: goto s0;
+  }
+ s7:
+  return 1;
+} // regex_aot_ip_address_match
+
+#ifndef REGEX_AOT_NO_CPREDS
+int regex_aot_ip_address() {
+  TERM subject_p = picat_get_call_arg(1,1);
+  size_t size;
+  char* subject_s = regex_get_cstring(subject_p, &size);
+  int rc = regex_aot_ip_address_match((const unsigned char*)subject_s, size);
+  free(subject_s);
+  return rc ? PICAT_TRUE : PICAT_FALSE;
+} // regex_aot_ip_address
+#endif
+
+
+/*
+  kjellerstrand: k(je|ä)ll(er|ar)?(st|b)r?an?d
+  15 DFA states
+*/
+int regex_aot_kjellerstrand_match(const unsigned char* s, size_t n) {
+  size_t i = 0;
+ s0:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  default: goto s0;
+  }
+ s1:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 106: goto s2;
+  case 195: goto s3;
+  default: goto s0;
+  }
+ s2:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 101: goto s4;
+  default: goto s0;
+  }
+ s3:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 164: goto s4;
+  default: goto s0;
+  }
+ s4:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 108: goto s5;
+  default: goto s0;
+  }
+ s5:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 108: goto s6;
+  default: goto s0;
+  }
+ s6:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 97: case 101: goto s7;
+  case 98: goto s8;
+  case 115: goto s9;
+  default: goto s0;
+  }
+ s7:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 114: goto s10;
+  default: goto s0;
+  }
+ s8:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 97: goto s11;
+  case 114: goto s12;
+  default: goto s0;
+  }
+ s9:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 116: goto s8;
+  default: goto s0;
+  }
+ s10:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 98: goto s8;
+  case 115: goto s9;
+  default: goto s0;
+  }
+ s11:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 100: goto s13;
+  case 110: goto s14;
+  default: goto s0;
+  }
+ s12:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 97: goto s11;
+  default: goto s0;
+  }
+ s13:
+  return 1;
+ s14:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 107: goto s1;
+  case 100: goto s13;
+  default: goto s0;
+  }
+} // regex_aot_kjellerstrand_match
+
+#ifndef REGEX_AOT_NO_CPREDS
+int regex_aot_kjellerstrand() {
+  TERM subject_p = picat_get_call_arg(1,1);
+  size_t size;
+  char* subject_s = regex_get_cstring(subject_p, &size);
+  int rc = regex_aot_kjellerstrand_match((const unsigned char*)subject_s, size);
+  free(subject_s);
+  return rc ? PICAT_TRUE : PICAT_FALSE;
+} // regex_aot_kjellerstrand
+#endif
+
+
+/*
+  mankell: [hm][ea](nk|n|nn)(ing|ell|all) [hm][ea](nk|n|nn)(ing|ell|all)
+  20 DFA states
+*/
+int regex_aot_mankell_match(const unsigned char* s, size_t n) {
+  size_t i = 0;
+ s0:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  default: goto s0;
+  }
+ s1:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 97: case 101: goto s2;
+  default: goto s0;
+  }
+ s2:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 110: goto s3;
+  default: goto s0;
+  }
+ s3:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 97: case 101: goto s4;
+  case 105: goto s5;
+  case 107: case 110: goto s6;
+  default: goto s0;
+  }
+ s4:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 108: goto s7;
+  default: goto s0;
+  }
+ s5:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 110: goto s8;
+  default: goto s0;
+  }
+ s6:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 97: case 101: goto s4;
+  case 105: goto s5;
+  default: goto s0;
+  }
+ s7:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 108: goto s9;
+  default: goto s0;
+  }
+ s8:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 103: goto s9;
+  default: goto s0;
+  }
+ s9:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 32: goto s10;
+  default: goto s0;
+  }
+ s10:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s11;
+  default: goto s0;
+  }
+ s11:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 97: case 101: goto s12;
+  default: goto s0;
+  }
+ s12:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 110: goto s13;
+  default: goto s0;
+  }
+ s13:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 97: case 101: goto s14;
+  case 105: goto s15;
+  case 107: case 110: goto s16;
+  default: goto s0;
+  }
+ s14:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 108: goto s17;
+  default: goto s0;
+  }
+ s15:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 110: goto s18;
+  default: goto s0;
+  }
+ s16:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 97: case 101: goto s14;
+  case 105: goto s15;
+  default: goto s0;
+  }
+ s17:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 108: goto s19;
+  default: goto s0;
+  }
+ s18:
+  if (i == n) return 0;
+  switch (s[i++]) {
+  case 104: case 109: goto s1;
+  case 103: goto s19;
+  default: goto s0;
+  }
+ s19:
+  return 1;
+} // regex_aot_mankell_match
+
+#ifndef REGEX_AOT_NO_CPREDS
+int regex_aot_mankell() {
+  TERM subject_p = picat_get_call_arg(1,1);
+  size_t size;
+  char* subject_s = regex_get_cstring(subject_p, &size);
+  int rc = regex_aot_mankell_match((const unsigned char*)subject_s, size);
+  free(subject_s);
+  return rc ? PICAT_TRUE : PICAT_FALSE;
+} // regex_aot_mankell
+#endif
+
+
@@ -0,0 +1,39 @@
+/*
+  Generated by regex_aot from regex_aot_patterns.txt. Don't edit.
+
+  See regex_aot.c for details.
+*/
+#include <stddef.h>
+
+extern int regex_aot_wordle_no_slat_match(const unsigned char* s, size_t n);
+extern int regex_aot_wordle_no_slat();
+extern int regex_aot_wordle_n4_match(const unsigned char* s, size_t n);
+extern int regex_aot_wordle_n4();
+extern int regex_aot_log_error_match(const unsigned char* s, size_t n);
+extern int regex_aot_log_error();
+extern int regex_aot_log_slow_match(const unsigned char* s, size_t n);
+extern int regex_aot_log_slow();
+extern int regex_aot_ip_address_match(const unsigned char* s, size_t n);
+extern int regex_aot_ip_address();
+extern int regex_aot_kjellerstrand_match(const unsigned char* s, size_t n);
+extern int regex_aot_kjellerstrand();
+extern int regex_aot_mankell_match(const unsigned char* s, size_t n);
+extern int regex_aot_mankell();
+
+#define REGEX_AOT_CPREDS \
+    insert_cpred("regex_aot_wordle_no_slat",1,regex_aot_wordle_no_slat); \
+    insert_cpred("regex_aot_wordle_n4",1,regex_aot_wordle_n4); \
+    insert_cpred("regex_aot_log_error",1,regex_aot_log_error); \
+    insert_cpred("regex_aot_log_slow",1,regex_aot_log_slow); \
+    insert_cpred("regex_aot_ip_address",1,regex_aot_ip_address); \
+    insert_cpred("regex_aot_kjellerstrand",1,regex_aot_kjellerstrand); \
+    insert_cpred("regex_aot_mankell",1,regex_aot_mankell);
+
+#define REGEX_AOT_MATCHERS \
+    {"wordle_no_slat", "^[^slat]+$", regex_aot_wordle_no_slat_match}, \
+    {"wordle_n4", "...n.", regex_aot_wordle_n4_match}, \
+    {"log_error", "ERROR", regex_aot_log_error_match}, \
+    {"log_slow", "user=\\w+ .*took=\\d{4,}ms", regex_aot_log_slow_match}, \
+    {"ip_address", "\\d+\\.\\d+\\.\\d+\\.\\d+", regex_aot_ip_address_match}, \
+    {"kjellerstrand", "k(je|\303\244)ll(er|ar)?(st|b)r?an?d", regex_aot_kjellerstrand_match}, \
+    {"mankell", "[hm][ea](nk|n|nn)(ing|ell|all) [hm][ea](nk|n|nn)(ing|ell|all)", regex_aot_mankell_match},
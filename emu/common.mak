@@ -4,7 +4,7 @@ OBJ = dis.o init.o init_sym.o loader.o inst_inf.o main.o toam.o unify.o \
     delay.o clpfd.o clpfd_libs.o event.o toamprofile.o \
     kapi.o getline.o table.o gcstack.o gcheap.o gcqueue.o debug.o \
     expand_bp.o bigint.o sapi.o kissat_picat.o espresso_bp.o \
-	picat_utilities.o fann.o fann_cascade.o fann_error.o fann_io.o fann_train.o fann_train_data.o fann_interface.o bp_pcre2.o
+	picat_utilities.o fann.o fann_cascade.o fann_error.o fann_io.o fann_train.o fann_train_data.o fann_interface.o bp_pcre2.o bp_pcre2_aot.o regex_dfa.o
 
 ESPRESSO_FLAGS = -O3 -I. -Iespresso
 ESPRESSO_OBJ = black_white.o canonical.o cofactor.o cols.o compl.o contain.o cpu_time.o cubestr.o \
@@ -78,7 +78,7 @@ mic.o	: mic.c term.h basic.h bapi.h
 	$(CCC) $(CFLAGS) mic.c
 numbervars.o	: numbervars.c term.h basic.h bapi.h
 	$(CCC) $(CFLAGS) numbervars.c
-cpreds.o	: cpreds.c term.h basic.h bapi.h
+cpreds.o	: cpreds.c term.h basic.h bapi.h bp_pcre2_aot.h
 	$(CCC) $(CFLAGS) cpreds.c
 univ.o	: univ.c term.h basic.h bapi.h
 	$(CCC) $(CFLAGS) univ.c
@@ -402,5 +402,9 @@ fann_train_data.o : fann/src/fann_train_data.c
 	$(CCC) $(CFLAGS) -Ifann/src/include fann/src/fann_train_data.c
 fann_interface.o : fann/fann_interface.cpp
 	$(CPPC) $(CFLAGS) -Ifann/src/include fann/fann_interface.cpp
-bp_pcre2.o: bp_pcre2.c
+bp_pcre2.o: bp_pcre2.c regex_dfa.h
 	$(CCC) $(CFLAGS) bp_pcre2.c
+bp_pcre2_aot.o: bp_pcre2_aot.c bp_pcre2_aot.h
+	$(CCC) $(CFLAGS) bp_pcre2_aot.c
+regex_dfa.o: regex_dfa.c regex_dfa.h
+	$(CCC) $(CFLAGS) regex_dfa.c
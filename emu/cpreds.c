@@ -29,6 +29,41 @@ extern int regex_match_capture(); // hakank
 extern int regex_replace(); // hakank
 extern int regex_replace_first(); // hakank
 extern int regex_find_matches(); // hakank
+extern int regex_stats(); // hakank
+extern int regex_stats_reset(); // hakank
+extern int regex_pattern_stats(); // hakank
+extern int regex_top_patterns(); // hakank
+extern int regex_slow_log(); // hakank
+extern int regex_cache_save(); // hakank
+extern int regex_cache_load(); // hakank
+extern int regex_filter_all(); // hakank
+extern int regex_generate(); // hakank
+extern int regex_automaton(); // hakank
+extern int regex_from_words(); // hakank
+extern int regex_fullmatch(); // hakank
+extern int regex_index_build(); // hakank
+extern int regex_index_search(); // hakank
+extern int regex_index_free(); // hakank
+extern int regex_memo(); // hakank
+extern int regex_capture_format(); // hakank
+extern int regex_find_matches_format(); // hakank
+extern int regex_split(); // hakank
+extern int regex_sed(); // hakank
+extern int regex_extract_file(); // hakank
+extern int regex_info(); // hakank
+extern int regex_corpus_load(); // hakank
+extern int regex_corpus_free(); // hakank
+extern int regex_count(); // hakank
+extern int regex_subject(); // hakank
+extern int regex_subject_free(); // hakank
+extern int regex_find_positions(); // hakank
+extern int regex_capture_typed(); // hakank
+extern int regex_extract_typed(); // hakank
+extern int regex_profile(); // hakank
+extern int regex_analyze(); // hakank
+extern int regex_redos_mode(); // hakank
+extern int regex_optimize(); // hakank
+#include "bp_pcre2_aot.h" // hakank: ahead-of-time compiled patterns (regex_aot.c)
 
 
 
@@ -1200,6 +1235,41 @@ void Cboot() {
     insert_cpred("regex_replace",4,regex_replace);
     insert_cpred("regex_replace_first",4,regex_replace_first);   
     insert_cpred("regex_find_matches",4,regex_find_matches);   
+    insert_cpred("regex_stats",1,regex_stats);
+    insert_cpred("regex_stats_reset",0,regex_stats_reset);
+    insert_cpred("regex_pattern_stats",2,regex_pattern_stats);
+    insert_cpred("regex_top_patterns",2,regex_top_patterns);
+    insert_cpred("regex_slow_log",2,regex_slow_log);
+    insert_cpred("regex_cache_save",1,regex_cache_save);
+    insert_cpred("regex_cache_load",1,regex_cache_load);
+    insert_cpred("regex_filter_all",3,regex_filter_all);
+    insert_cpred("regex_generate",6,regex_generate);
+    insert_cpred("regex_automaton",2,regex_automaton);
+    insert_cpred("regex_from_words",2,regex_from_words);
+    insert_cpred("regex_fullmatch",2,regex_fullmatch);
+    insert_cpred("regex_index_build",2,regex_index_build);
+    insert_cpred("regex_index_search",3,regex_index_search);
+    insert_cpred("regex_index_free",1,regex_index_free);
+    insert_cpred("regex_memo",1,regex_memo);
+    insert_cpred("regex_capture_format",4,regex_capture_format);
+    insert_cpred("regex_find_matches_format",5,regex_find_matches_format);
+    insert_cpred("regex_split",4,regex_split);
+    insert_cpred("regex_sed",5,regex_sed);
+    insert_cpred("regex_extract_file",4,regex_extract_file);
+    insert_cpred("regex_info",2,regex_info);
+    insert_cpred("regex_corpus_load",2,regex_corpus_load);
+    insert_cpred("regex_corpus_free",1,regex_corpus_free);
+    insert_cpred("regex_count",3,regex_count);
+    insert_cpred("regex_subject",2,regex_subject);
+    insert_cpred("regex_subject_free",1,regex_subject_free);
+    insert_cpred("regex_find_positions",3,regex_find_positions);
+    insert_cpred("regex_capture_typed",4,regex_capture_typed);
+    insert_cpred("regex_extract_typed",4,regex_extract_typed);
+    insert_cpred("regex_profile",3,regex_profile);
+    insert_cpred("regex_analyze",2,regex_analyze);
+    insert_cpred("regex_redos_mode",1,regex_redos_mode);
+    insert_cpred("regex_optimize",1,regex_optimize);
+    REGEX_AOT_CPREDS
 
  
 }
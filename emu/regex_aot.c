@@ -0,0 +1,310 @@
+/*
+  Ahead-of-time compiler for regular expressions.
+
+  This is a generator (a standalone program, not a part of Picat) that
+  takes a list of hot, fixed patterns and generates C matcher functions
+  for them. The matchers are compiled into Picat as cpreds, so matching
+  these patterns has no interpretation overhead (and no PCRE2 call).
+
+  Usage:
+    $ gcc -O2 -o regex_aot regex_aot.c regex_dfa.c
+    $ ./regex_aot regex_aot_patterns.txt bp_pcre2_aot
+  which writes bp_pcre2_aot.c and bp_pcre2_aot.h (via .tmp files; if a
+  pattern can't be compiled the old files are left as they were).
+  (In emu/ there is a make target: "make -f Makefile.linux64_pcre2 aot".)
+
+  The patterns file has one pattern per line:
+    name pattern
+  where name is [a-z0-9_]+ and pattern is the rest of the line (after
+  one space). Empty lines and lines starting with % are ignored.
+
+  For each pattern name two functions are generated:
+    int regex_aot_name_match(const unsigned char* s, size_t n)
+        the matcher, true (1) if the pattern matches the n bytes in s
+    int regex_aot_name()
+        the cpred bp.regex_aot_name(Subject), same as regex(Pattern,Subject)
+  and bp_pcre2_aot.h defines REGEX_AOT_CPREDS which is used in cpreds.c
+  to insert the cpreds, and REGEX_AOT_MATCHERS, a table of
+  {name, pattern, matcher} for the differential test (regex_diff.c).
+  With -DREGEX_AOT_NO_CPREDS bp_pcre2_aot.c has only the matchers, so
+  it can be linked without Picat.
+
+  Only a subset of the PCRE2 syntax is supported (see regex_dfa.h).
+  Patterns outside the subset (backreferences, lookarounds, flags etc)
+  are reported as errors. They should be matched with regex/2 as usual.
+
+  The semantics is the same as regex/2 (PCRE2 without any flags), i.e.
+  the pattern is searched for anywhere in the subject, . doesn't match
+  newline, and $ also matches before a newline at the end of the subject.
+  Since the patterns are compiled without PCRE2_UTF, the matching is done
+  on the UTF-8 bytes.
+
+  The pattern is compiled to a minimized DFA by regex_dfa.c. Each DFA
+  state is generated as a label with a switch on the next byte, so the
+  matcher is just a sequence of jumps. For patterns without $ the matcher returns as
+  soon as a match is found.
+
+  Created by Hakan Kjellerstrand (hakank@gmail.com), http://hakank.org/
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "regex_dfa.h"
+
+#define REGEX_AOT_MAX_STATES 4096
+
+/*
+  Code generation
+*/
+static void gen_cases(FILE* out, int* next, int target, const char* action) {
+  int c = 0;
+  int any = 0;
+  while (c < 256) {
+    if (next[c] != target) { c++; continue; }
+    int from = c;
+    while (c < 256 && next[c] == target) c++;
+    fputs(any ? " " : "  ", out);
+    if (from == c-1) {
+      fprintf(out, "case %d:", from);
+    } else {
+      fprintf(out, "case %d ... %d:", from, c-1);
+    }
+    any = 1;
+  }
+  if (any) {
+    fprintf(out, " %s\n", action);
+  }
+}
+
+// s as a C string literal
+static void gen_c_string(FILE* out, const char* s) {
+  fputc('"', out);
+  for (const unsigned char* p = (const unsigned char*)s; *p; p++) {
+    if (*p == '"' || *p == '\\') {
+      fprintf(out, "\\%c", *p);
+    } else if (*p < 32 || *p >= 127) {
+      fprintf(out, "\\%03o", *p);
+    } else {
+      fputc(*p, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void gen_matcher(FILE* out, const char* name, const char* pattern, regex_dfa* dfa) {
+  int states = dfa->num_states;
+  // the states that are jumped to (to avoid unused labels)
+  int* used = calloc(states, sizeof(int));
+  for (int i = 0; i < states * 256; i++) {
+    if (dfa->next[i] >= 0) used[dfa->next[i]] = 1;
+  }
+
+  fprintf(out, "/*\n  %s: ", name);
+  for (const char* p = pattern; *p; p++) {
+    // don't end the comment
+    if (p[0] == '*' && p[1] == '/') fputs("*\\", out);
+    else fputc(*p, out);
+  }
+  fprintf(out, "\n  %d DFA states\n*/\n", states);
+  fprintf(out, "int regex_aot_%s_match(const unsigned char* s, size_t n) {\n", name);
+  fprintf(out, "  size_t i = 0;\n");
+  for (int k = 0; k < states; k++) {
+    if (used[k]) {
+      fprintf(out, " s%d:\n", k);
+    }
+    if (dfa->final[k] && !dfa->eol) {
+      fprintf(out, "  return 1;\n");
+      continue;
+    }
+    if (dfa->final[k]) {
+      fprintf(out, "  if (i == n || (i+1 == n && s[i] == '\\n')) return 1;\n");
+    } else {
+      fprintf(out, "  if (i == n) return 0;\n");
+    }
+    int* next = &dfa->next[k*256];
+    int counts[REGEX_AOT_MAX_STATES+1];
+    memset(counts, 0, (states+1) * sizeof(int));
+    for (int c = 0; c < 256; c++) {
+      counts[next[c]+1]++;
+    }
+    int dflt = -1;
+    for (int t = 0; t <= states; t++) {
+      if (counts[t] > counts[dflt+1]) dflt = t-1;
+    }
+    fprintf(out, "  switch (s[i++]) {\n");
+    for (int t = -1; t < states; t++) {
+      if (t == dflt) continue;
+      char action[32];
+      if (t < 0) {
+        sprintf(action, "return 0;");
+      } else {
+        sprintf(action, "goto s%d;", t);
+      }
+      gen_cases(out, next, t, action);
+    }
+    if (dflt < 0) {
+      fprintf(out, "  default: return 0;\n");
+    } else {
+      fprintf(out, "  default: goto s%d;\n", dflt);
+    }
+    fprintf(out, "  }\n");
+  }
+  fprintf(out, "} // regex_aot_%s_match\n\n", name);
+
+  fprintf(out, "#ifndef REGEX_AOT_NO_CPREDS\n");
+  fprintf(out, "int regex_aot_%s() {\n", name);
+  fprintf(out, "  TERM subject_p = picat_get_call_arg(1,1);\n");
+  fprintf(out, "  size_t size;\n");
+  fprintf(out, "  char* subject_s = regex_get_cstring(subject_p, &size);\n");
+  fprintf(out, "  int rc = regex_aot_%s_match((const unsigned char*)subject_s, size);\n", name);
+  fprintf(out, "  free(subject_s);\n");
+  fprintf(out, "  return rc ? PICAT_TRUE : PICAT_FALSE;\n");
+  fprintf(out, "} // regex_aot_%s\n", name);
+  fprintf(out, "#endif\n\n\n");
+
+  free(used);
+}
+
+/*
+  Compiles one pattern. Returns 0 on error.
+*/
+static int compile(FILE* out, const char* name, const char* pattern) {
+  const char* error;
+  int erroffset;
+  regex_dfa* dfa = regex_dfa_compile(pattern, strlen(pattern), REGEX_DFA_SEARCH, REGEX_AOT_MAX_STATES,
+                                     &error, &erroffset);
+  if (dfa == NULL) {
+    fprintf(stderr, "regex_aot: %s: %s at offset %d: %s\n", name, error, erroffset, pattern);
+    return 0;
+  }
+  gen_matcher(out, name, pattern, dfa);
+  regex_dfa_free(dfa);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: regex_aot PatternsFile OutBase\n");
+    return 1;
+  }
+  FILE* in = fopen(argv[1], "r");
+  if (in == NULL) {
+    fprintf(stderr, "regex_aot: cannot open %s\n", argv[1]);
+    return 1;
+  }
+  // The files are written to OutBase.c.tmp and OutBase.h.tmp, which are
+  // renamed when all the patterns are compiled, so an error doesn't
+  // leave a broken (or half written) matcher file.
+  char* c_file = malloc(strlen(argv[2]) + 3);
+  char* h_file = malloc(strlen(argv[2]) + 3);
+  char* c_tmp = malloc(strlen(argv[2]) + 7);
+  char* h_tmp = malloc(strlen(argv[2]) + 7);
+  sprintf(c_file, "%s.c", argv[2]);
+  sprintf(h_file, "%s.h", argv[2]);
+  sprintf(c_tmp, "%s.c.tmp", argv[2]);
+  sprintf(h_tmp, "%s.h.tmp", argv[2]);
+  FILE* c_out = fopen(c_tmp, "w");
+  FILE* h_out = fopen(h_tmp, "w");
+  if (c_out == NULL || h_out == NULL) {
+    fprintf(stderr, "regex_aot: cannot write %s/%s\n", c_tmp, h_tmp);
+    if (c_out != NULL) {
+      fclose(c_out);
+      remove(c_tmp);
+    }
+    if (h_out != NULL) {
+      fclose(h_out);
+      remove(h_tmp);
+    }
+    fclose(in);
+    return 1;
+  }
+
+  const char* base = strrchr(h_file, '/') ? strrchr(h_file, '/') + 1 : h_file;
+  fprintf(c_out, "/*\n  Generated by regex_aot from %s. Don't edit.\n\n", argv[1]);
+  fprintf(c_out, "  See regex_aot.c for details.\n*/\n");
+  fprintf(c_out, "#ifndef REGEX_AOT_NO_CPREDS\n");
+  fprintf(c_out, "#include \"picat.h\"\n#include \"picat_utilities.h\"\n");
+  fprintf(c_out, "extern char* regex_get_cstring(TERM t, size_t* size); // bp_pcre2.c\n#endif\n");
+  fprintf(c_out, "#include <string.h>\n#include <stdlib.h>\n#include \"%s\"\n\n\n", base);
+  fprintf(h_out, "/*\n  Generated by regex_aot from %s. Don't edit.\n\n", argv[1]);
+  fprintf(h_out, "  See regex_aot.c for details.\n*/\n");
+  fprintf(h_out, "#include <stddef.h>\n\n");
+
+  char line[65536];
+  int errors = 0;
+  int count = 0;
+  char** names = NULL;
+  char** patterns = NULL;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+    if (len == 0 || line[0] == '%') continue;
+    char* sp = strchr(line, ' ');
+    if (sp == NULL) {
+      fprintf(stderr, "regex_aot: missing pattern: %s\n", line);
+      errors++;
+      continue;
+    }
+    *sp = '\0';
+    char* name = line;
+    char* pattern = sp + 1;
+    int ok = 1;
+    for (char* p = name; *p; p++) {
+      if (!((*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9') || *p == '_')) ok = 0;
+    }
+    if (!ok) {
+      fprintf(stderr, "regex_aot: bad name (should be [a-z0-9_]+): %s\n", name);
+      errors++;
+      continue;
+    }
+    if (!compile(c_out, name, pattern)) {
+      errors++;
+      continue;
+    }
+    names = realloc(names, (count+1) * sizeof(char*));
+    patterns = realloc(patterns, (count+1) * sizeof(char*));
+    names[count] = strdup(name);
+    patterns[count++] = strdup(pattern);
+  }
+  fclose(in);
+
+  for (int i = 0; i < count; i++) {
+    fprintf(h_out, "extern int regex_aot_%s_match(const unsigned char* s, size_t n);\n", names[i]);
+    fprintf(h_out, "extern int regex_aot_%s();\n", names[i]);
+  }
+  fprintf(h_out, "\n#define REGEX_AOT_CPREDS");
+  for (int i = 0; i < count; i++) {
+    fprintf(h_out, " \\\n    insert_cpred(\"regex_aot_%s\",1,regex_aot_%s);", names[i], names[i]);
+  }
+  fprintf(h_out, "\n");
+  fprintf(h_out, "\n#define REGEX_AOT_MATCHERS");
+  for (int i = 0; i < count; i++) {
+    fprintf(h_out, " \\\n    {\"%s\", ", names[i]);
+    gen_c_string(h_out, patterns[i]);
+    fprintf(h_out, ", regex_aot_%s_match},", names[i]);
+  }
+  fprintf(h_out, "\n");
+  if (ferror(c_out) || ferror(h_out)) {
+    fprintf(stderr, "regex_aot: cannot write %s/%s\n", c_tmp, h_tmp);
+    errors++;
+  }
+  int c_rc = fclose(c_out);
+  int h_rc = fclose(h_out);
+  if (c_rc != 0 || h_rc != 0) {
+    fprintf(stderr, "regex_aot: cannot write %s/%s\n", c_tmp, h_tmp);
+    errors++;
+  }
+  if (errors == 0 && (rename(c_tmp, c_file) != 0 || rename(h_tmp, h_file) != 0)) {
+    fprintf(stderr, "regex_aot: cannot rename %s/%s\n", c_tmp, h_tmp);
+    errors++;
+  }
+  if (errors) {
+    // OutBase.c and OutBase.h are left as they were
+    remove(c_tmp);
+    remove(h_tmp);
+  }
+
+  return errors ? 1 : 0;
+
+} // main
@@ -0,0 +1,2634 @@
+/*
+  Regular expressions to DFA. See regex_dfa.h.
+
+  The pattern is parsed to an AST, which is compiled to a NFA
+  (Thompson's construction), which is converted to a DFA (subset
+  construction) which is then minimized (Moore's algorithm).
+
+  Created by Hakan Kjellerstrand (hakank@gmail.com), http://hakank.org/
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "regex_dfa.h"
+
+#define REGEX_DFA_MAX_REPEAT 1000
+#define REGEX_DFA_MAX_NFA 1000000
+#define REGEX_DFA_BUCKETS 8192
+
+/*
+  Byte sets
+*/
+typedef struct {
+  uint8_t bits[32];
+} byteset;
+
+static void set_add(byteset* s, int c) { s->bits[c >> 3] |= 1 << (c & 7); }
+static int set_has(const byteset* s, int c) { return (s->bits[c >> 3] >> (c & 7)) & 1; }
+static void set_range(byteset* s, int from, int to) { for (int c = from; c <= to; c++) set_add(s, c); }
+static void set_union(byteset* s, const byteset* t) { for (int i = 0; i < 32; i++) s->bits[i] |= t->bits[i]; }
+static void set_negate(byteset* s) { for (int i = 0; i < 32; i++) s->bits[i] = ~s->bits[i]; }
+
+// N_LOOK (lookarounds) and N_ATOMIC ((?>...)) are only parsed for the
+// ReDoS analysis (regex_builder.lenient), N_GROUP for the rewriter
+// (regex_builder.groups)
+enum { N_EMPTY, N_SET, N_CAT, N_ALT, N_REPEAT, N_BOL, N_EOL, N_LOOK, N_ATOMIC, N_GROUP };
+
+typedef struct node {
+  int type;
+  byteset set;       // N_SET
+  struct node* a;    // N_CAT, N_ALT, N_REPEAT, N_LOOK, N_ATOMIC, N_GROUP
+  struct node* b;    // N_CAT, N_ALT
+  int min, max;      // N_REPEAT, max = -1 is unbounded
+  int possessive;    // N_REPEAT: x*+ etc
+  int lazy;          // N_REPEAT: x*? etc
+  int capture;       // N_GROUP: (...) rather than (?:...)
+  int start, end;    // the offsets of the item in the pattern
+  char* text;        // the text of an item made by the rewriter (malloc:ed)
+  struct node* all;  // all the nodes (for freeing)
+} node;
+
+/*
+  The NFA. A state has either a byte set transition (set >= 0) to out,
+  or up to two epsilon transitions.
+*/
+typedef struct {
+  int set;
+  int out;
+  int e1, e2;
+} nfa_state;
+
+typedef struct {
+  int* states;       // the NFA states (sorted)
+  int count;
+  int final;
+  int* next;         // 256 transitions, -1 is the dead state
+} dfa_state;
+
+/*
+  The state of a compilation.
+*/
+typedef struct {
+  const char* pat;   // the pattern being parsed
+  int len;
+  int pos;
+  const char* error;
+  node* nodes;
+  int lenient;       // parse the full syntax (approximately), for the ReDoS analysis
+  int groups;        // keep the groups as N_GROUP nodes, for the rewriter
+
+  nfa_state* nfa;
+  int nfa_count, nfa_alloc;
+  byteset* sets;
+  int set_count, set_alloc;
+
+  dfa_state* dfa;
+  int dfa_count, max_states;
+  int bucket[REGEX_DFA_BUCKETS];   // hash table of the DFA states
+  int* chain;
+  int* mark;         // mark[i] == gen if NFA state i is in the current set
+  int gen;
+  int* stack;
+} regex_builder;
+
+/*
+  The parser
+*/
+static int peek(regex_builder* b) {
+  return b->pos < b->len ? (unsigned char)b->pat[b->pos] : -1;
+}
+
+static int peek2(regex_builder* b) {
+  return b->pos+1 < b->len ? (unsigned char)b->pat[b->pos+1] : -1;
+}
+
+static int next_char(regex_builder* b) {
+  return b->pos < b->len ? (unsigned char)b->pat[b->pos++] : -1;
+}
+
+static node* new_node(regex_builder* b, int type, node* x, node* y) {
+  node* n = calloc(1, sizeof(node));
+  n->type = type;
+  n->a = x;
+  n->b = y;
+  n->all = b->nodes;
+  b->nodes = n;
+  return n;
+}
+
+static node* fail(regex_builder* b, const char* msg) {
+  if (b->error == NULL) {
+    b->error = msg;
+  }
+  return new_node(b, N_EMPTY, NULL, NULL);
+}
+
+// \d \w \s and their negations, 0 if c is not one of these
+static int class_escape(int c, byteset* s) {
+  memset(s, 0, sizeof(byteset));
+  switch (c) {
+  case 'd': case 'D':
+    set_range(s, '0', '9');
+    break;
+  case 'w': case 'W':
+    set_range(s, '0', '9'); set_range(s, 'A', 'Z'); set_range(s, 'a', 'z'); set_add(s, '_');
+    break;
+  case 's': case 'S':
+    set_add(s, ' '); set_range(s, '\t', '\r'); // \t \n \v \f \r
+    break;
+  default:
+    return 0;
+  }
+  if (c == 'D' || c == 'W' || c == 'S') {
+    set_negate(s);
+  }
+  return 1;
+}
+
+// A single escaped character, -1 if it's not supported
+static int char_escape(int c) {
+  switch (c) {
+  case 'n': return '\n';
+  case 't': return '\t';
+  case 'r': return '\r';
+  case 'f': return '\f';
+  case 'e': return 27;
+  case 'a': return 7;
+  }
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c < 0) {
+    return -1;
+  }
+  return c;
+}
+
+static node* parse_alt(regex_builder* b);
+
+// Skips a {...} or <...> argument (of \p, \k, \g etc)
+static void skip_argument(regex_builder* b) {
+  int close = peek(b) == '{' ? '}' : peek(b) == '<' ? '>' : peek(b) == '\'' ? '\'' : -1;
+  if (close < 0) {
+    return;
+  }
+  while (peek(b) >= 0 && next_char(b) != close) ;
+}
+
+// \xhh or \x{h...}; a code point above 255 is any non-ASCII byte
+static void hex_escape(regex_builder* b, byteset* s) {
+  int v = 0;
+  int braces = peek(b) == '{';
+  if (braces) {
+    b->pos++;
+  }
+  for (int i = 0; braces || i < 2; i++) {
+    int c = peek(b);
+    int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+      c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (d < 0) {
+      break;
+    }
+    v = v < 0x110000 ? v * 16 + d : v;
+    b->pos++;
+  }
+  if (braces && peek(b) == '}') {
+    b->pos++;
+  }
+  if (v < 256) {
+    set_add(s, v);
+  } else {
+    set_range(s, 0x80, 0xff);
+  }
+}
+
+/*
+  The escapes that are only parsed for the ReDoS analysis (c is the
+  character after \): anchors and \b are N_BOL/N_EOL/N_EMPTY, a
+  backreference or a Unicode property is any byte. Returns 0 if c is
+  not one of these.
+*/
+static int lenient_escape(regex_builder* b, int c, node* n) {
+  switch (c) {
+  case 'A': case 'G':
+    n->type = N_BOL;
+    return 1;
+  case 'z': case 'Z':
+    n->type = N_EOL;
+    return 1;
+  case 'b': case 'B': case 'K':
+    n->type = N_EMPTY;
+    return 1;
+  case 'x':
+    hex_escape(b, &n->set);
+    return 1;
+  case 'k': case 'g':
+    skip_argument(b);
+    while (peek(b) == '-' || (peek(b) >= '0' && peek(b) <= '9')) {
+      b->pos++; // \g1 \g-1
+    }
+    set_range(&n->set, 0, 255);
+    return 1;
+  case 'p': case 'P':
+    if (peek(b) == '{') {
+      skip_argument(b);
+    } else {
+      b->pos++; // \pL
+    }
+    set_range(&n->set, 0, 255);
+    return 1;
+  case 'X': case 'C': case 'R': case 'N': case 'h': case 'H': case 'v': case 'V':
+    set_range(&n->set, 0, 255);
+    return 1;
+  }
+  if (c >= '1' && c <= '9') {
+    while (peek(b) >= '0' && peek(b) <= '9') {
+      b->pos++;
+    }
+    set_range(&n->set, 0, 255);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+  The (?...) groups for the ReDoS analysis (b->pos is at the ?): named
+  groups, lookarounds (N_LOOK), atomic groups (N_ATOMIC), inline
+  options and (?P=name) backreferences.
+*/
+static node* parse_special_group(regex_builder* b) {
+  b->pos++; // ?
+  int c = next_char(b);
+  int type = N_EMPTY; // a plain group
+  if (c == '=' || c == '!') {
+    type = N_LOOK;
+  } else if (c == '<' && (peek(b) == '=' || peek(b) == '!')) {
+    b->pos++;
+    type = N_LOOK;
+  } else if (c == '>') {
+    type = N_ATOMIC;
+  } else if (c == 'P' && (peek(b) == '=' || peek(b) == '>')) {
+    while (peek(b) >= 0 && next_char(b) != ')') ;
+    node* n = new_node(b, N_SET, NULL, NULL);
+    set_range(&n->set, 0, 255);
+    return n;
+  } else if (c == '<' || c == '\'' || c == 'P') {
+    int close = c == '\'' ? '\'' : '>';
+    while (peek(b) >= 0 && next_char(b) != close) ;
+  } else {
+    // inline options: (?i) (?i-s) or (?i:...)
+    b->pos--;
+    while ((peek(b) >= 'a' && peek(b) <= 'z') || (peek(b) >= 'A' && peek(b) <= 'Z') || peek(b) == '-' || peek(b) == '^') {
+      if (next_char(b) == 'x') {
+        return fail(b, "(?x) is not supported");
+      }
+    }
+    if (peek(b) == ')') {
+      b->pos++;
+      return new_node(b, N_EMPTY, NULL, NULL);
+    }
+    if (peek(b) != ':') {
+      return fail(b, "unsupported group");
+    }
+    b->pos++;
+  }
+  node* n = parse_alt(b);
+  if (peek(b) != ')') {
+    return fail(b, "missing )");
+  }
+  b->pos++;
+  return type == N_EMPTY ? n : new_node(b, type, n, NULL);
+}
+
+static node* parse_class(regex_builder* b) {
+  node* n = new_node(b, N_SET, NULL, NULL);
+  int negate = 0;
+  if (peek(b) == '^') {
+    negate = 1;
+    b->pos++;
+  }
+  int first = 1;
+  while (peek(b) != ']' || first) {
+    first = 0;
+    int c = next_char(b);
+    if (c < 0) {
+      return fail(b, "missing ]");
+    }
+    if (c == '[' && peek(b) == ':') {
+      if (!b->lenient) {
+        return fail(b, "POSIX classes are not supported");
+      }
+      while (peek(b) >= 0 && !(next_char(b) == ':' && peek(b) == ']')) ;
+      b->pos++;
+      set_range(&n->set, 0, 255);
+      continue;
+    }
+    if (c == '\\') {
+      byteset esc;
+      int e = next_char(b);
+      if (class_escape(e, &esc)) {
+        set_union(&n->set, &esc);
+        continue;
+      }
+      if (b->lenient && (e == 'x' || e == 'p' || e == 'P' || e == 'h' || e == 'v')) {
+        if (e == 'x') {
+          hex_escape(b, &n->set);
+        } else {
+          if (e == 'p' || e == 'P') {
+            if (peek(b) == '{') skip_argument(b); else b->pos++;
+          }
+          set_range(&n->set, 0, 255);
+        }
+        continue;
+      }
+      c = e == 'b' ? 8 : char_escape(e);
+      if (c < 0) {
+        return fail(b, "unsupported escape in character class");
+      }
+    }
+    if (peek(b) == '-' && peek2(b) != ']' && peek2(b) >= 0) {
+      b->pos++;
+      int to = next_char(b);
+      if (to == '\\') {
+        to = char_escape(next_char(b));
+        if (to < 0) {
+          return fail(b, "unsupported range in character class");
+        }
+      }
+      if (to < c) {
+        return fail(b, "range out of order in character class");
+      }
+      set_range(&n->set, c, to);
+    } else {
+      set_add(&n->set, c);
+    }
+  }
+  b->pos++; // ]
+  if (negate) {
+    set_negate(&n->set);
+  }
+  return n;
+}
+
+static node* parse_atom(regex_builder* b) {
+  int c = next_char(b);
+  node* n;
+  byteset esc;
+  int capture = 1;
+  switch (c) {
+  case '(':
+    if (peek(b) == '*' && b->lenient) {
+      // a verb, e.g. (*UTF)
+      while (peek(b) >= 0 && next_char(b) != ')') ;
+      return new_node(b, N_EMPTY, NULL, NULL);
+    }
+    if (peek(b) == '?') {
+      if (peek2(b) != ':') {
+        if (b->lenient) {
+          return parse_special_group(b);
+        }
+        return fail(b, "only (?:...) groups are supported");
+      }
+      b->pos += 2;
+      capture = 0;
+    }
+    n = parse_alt(b);
+    if (peek(b) != ')') {
+      return fail(b, "missing )");
+    }
+    b->pos++;
+    if (b->groups) {
+      n = new_node(b, N_GROUP, n, NULL);
+      n->capture = capture;
+    }
+    return n;
+  case '[':
+    return parse_class(b);
+  case '.':
+    n = new_node(b, N_SET, NULL, NULL);
+    set_range(&n->set, 0, 255);
+    n->set.bits['\n' >> 3] &= ~(1 << ('\n' & 7));
+    return n;
+  case '^':
+    return new_node(b, N_BOL, NULL, NULL);
+  case '$':
+    return new_node(b, N_EOL, NULL, NULL);
+  case '\\':
+    c = next_char(b);
+    n = new_node(b, N_SET, NULL, NULL);
+    if (class_escape(c, &esc)) {
+      n->set = esc;
+      return n;
+    }
+    if (b->lenient && lenient_escape(b, c, n)) {
+      return n;
+    }
+    c = char_escape(c);
+    if (c < 0) {
+      return fail(b, "unsupported escape");
+    }
+    set_add(&n->set, c);
+    return n;
+  case '*': case '+': case '?':
+    return fail(b, "quantifier does not follow a repeatable item");
+  case ')':
+    return fail(b, "unmatched )");
+  default:
+    n = new_node(b, N_SET, NULL, NULL);
+    set_add(&n->set, c);
+    return n;
+  }
+}
+
+static int parse_number(regex_builder* b, int* p) {
+  int n = 0;
+  while (*p < b->len && b->pat[*p] >= '0' && b->pat[*p] <= '9') {
+    n = n * 10 + (b->pat[(*p)++] - '0');
+    if (n > REGEX_DFA_MAX_REPEAT) n = REGEX_DFA_MAX_REPEAT + 1;
+  }
+  return n;
+}
+
+static int is_digit_at(regex_builder* b, int p) {
+  return p < b->len && b->pat[p] >= '0' && b->pat[p] <= '9';
+}
+
+// {n} {n,} {n,m}; returns 0 (and doesn't move) if it's not a quantifier,
+// in which case { is a literal.
+static int parse_braces(regex_builder* b, int* min, int* max) {
+  int p = b->pos + 1;
+  if (!is_digit_at(b, p)) {
+    return 0;
+  }
+  *min = parse_number(b, &p);
+  *max = *min;
+  if (p < b->len && b->pat[p] == ',') {
+    p++;
+    if (p < b->len && b->pat[p] == '}') {
+      *max = -1;
+    } else {
+      if (!is_digit_at(b, p)) {
+        return 0;
+      }
+      *max = parse_number(b, &p);
+    }
+  }
+  if (p >= b->len || b->pat[p] != '}') {
+    return 0;
+  }
+  b->pos = p + 1;
+  return 1;
+}
+
+static node* parse_repeat(regex_builder* b) {
+  int start = b->pos;
+  node* n = parse_atom(b);
+  n->start = start;
+  n->end = b->pos;
+  for (;;) {
+    int min, max;
+    int possessive = 0, lazy = 0;
+    int c = peek(b);
+    if (c == '*') { min = 0; max = -1; b->pos++; }
+    else if (c == '+') { min = 1; max = -1; b->pos++; }
+    else if (c == '?') { min = 0; max = 1; b->pos++; }
+    else if (c == '{' && parse_braces(b, &min, &max)) {
+      if (min > REGEX_DFA_MAX_REPEAT || max > REGEX_DFA_MAX_REPEAT) {
+        return fail(b, "too large repetition count");
+      }
+      if (max >= 0 && max < min) {
+        return fail(b, "numbers out of order in {} quantifier");
+      }
+    }
+    else break;
+    if (n->type == N_BOL || n->type == N_EOL) {
+      return fail(b, "quantifier does not follow a repeatable item");
+    }
+    if (peek(b) == '?') {
+      b->pos++; // lazy: matches the same strings
+      lazy = 1;
+    } else if (peek(b) == '+') {
+      if (!b->lenient) {
+        return fail(b, "possessive quantifiers are not supported");
+      }
+      b->pos++;
+      possessive = 1;
+    }
+    node* r = new_node(b, N_REPEAT, n, NULL);
+    r->min = min;
+    r->max = max;
+    r->possessive = possessive;
+    r->lazy = lazy;
+    r->start = start;
+    r->end = b->pos;
+    n = r;
+  }
+  return n;
+}
+
+static node* parse_cat(regex_builder* b) {
+  node* n = new_node(b, N_EMPTY, NULL, NULL);
+  while (peek(b) >= 0 && peek(b) != '|' && peek(b) != ')' && b->error == NULL) {
+    n = new_node(b, N_CAT, n, parse_repeat(b));
+  }
+  return n;
+}
+
+static node* parse_alt(regex_builder* b) {
+  node* n = parse_cat(b);
+  while (peek(b) == '|' && b->error == NULL) {
+    b->pos++;
+    n = new_node(b, N_ALT, n, parse_cat(b));
+  }
+  return n;
+}
+
+/*
+  Removes ^ at the start and $ at the end of the top level
+  concatenation. Any other ^ or $ is an error (found when building
+  the NFA).
+*/
+static node* strip_anchors(node* n, int* bol, int* eol) {
+  *bol = 0;
+  *eol = 0;
+  if (n->type != N_CAT) {
+    return n;
+  }
+  if (n->b->type == N_EOL) {
+    *eol = 1;
+    n = n->a;
+  }
+  // The first item is the leftmost leaf of the N_CAT chain
+  node* first = n;
+  node* parent = NULL;
+  while (first->type == N_CAT && first->a->type == N_CAT) {
+    parent = first;
+    first = first->a;
+  }
+  if (first->type == N_CAT && first->b->type == N_BOL && first->a->type == N_EMPTY) {
+    *bol = 1;
+    if (parent == NULL) {
+      n = first->a;
+    } else {
+      parent->a = first->a;
+    }
+  }
+  return n;
+}
+
+/*
+  The NFA (Thompson's construction)
+*/
+static int new_state(regex_builder* b) {
+  if (b->nfa_count == b->nfa_alloc) {
+    b->nfa_alloc = b->nfa_alloc ? 2*b->nfa_alloc : 1024;
+    b->nfa = realloc(b->nfa, b->nfa_alloc * sizeof(nfa_state));
+  }
+  if (b->nfa_count >= REGEX_DFA_MAX_NFA && b->error == NULL) {
+    b->error = "pattern too large";
+  }
+  nfa_state* s = &b->nfa[b->nfa_count];
+  s->set = -1;
+  s->out = s->e1 = s->e2 = -1;
+  return b->nfa_count++;
+}
+
+static int new_set(regex_builder* b, const byteset* s) {
+  for (int i = 0; i < b->set_count; i++) {
+    if (memcmp(&b->sets[i], s, sizeof(byteset)) == 0) {
+      return i;
+    }
+  }
+  if (b->set_count == b->set_alloc) {
+    b->set_alloc = b->set_alloc ? 2*b->set_alloc : 64;
+    b->sets = realloc(b->sets, b->set_alloc * sizeof(byteset));
+  }
+  b->sets[b->set_count] = *s;
+  return b->set_count++;
+}
+
+// Builds the fragment for n; returns the start state and sets *end to
+// the (unconnected) end state.
+static int build(regex_builder* b, node* n, int* end) {
+  int s, f, x, xf, y, yf;
+  if (b->error != NULL) {
+    s = new_state(b);
+    *end = s;
+    return s;
+  }
+  switch (n->type) {
+  case N_EMPTY:
+    s = new_state(b);
+    *end = s;
+    return s;
+  case N_SET:
+    s = new_state(b);
+    f = new_state(b);
+    b->nfa[s].set = new_set(b, &n->set);
+    b->nfa[s].out = f;
+    *end = f;
+    return s;
+  case N_CAT:
+    x = build(b, n->a, &xf);
+    y = build(b, n->b, &yf);
+    b->nfa[xf].e1 = y;
+    *end = yf;
+    return x;
+  case N_ATOMIC:
+    return build(b, n->a, end); // the same strings
+  case N_ALT:
+    s = new_state(b);
+    f = new_state(b);
+    x = build(b, n->a, &xf);
+    y = build(b, n->b, &yf);
+    b->nfa[s].e1 = x;
+    b->nfa[s].e2 = y;
+    b->nfa[xf].e1 = f;
+    b->nfa[yf].e1 = f;
+    *end = f;
+    return s;
+  case N_REPEAT:
+    // a{min,max} = a a ... a (a (a ...)?)? and a{min,} = a a ... a a*
+    s = f = new_state(b);
+    for (int i = 0; i < n->min; i++) {
+      x = build(b, n->a, &xf);
+      b->nfa[f].e1 = x;
+      f = xf;
+    }
+    if (n->max < 0) {
+      int loop = new_state(b);
+      int out = new_state(b);
+      x = build(b, n->a, &xf);
+      b->nfa[f].e1 = loop;
+      b->nfa[loop].e1 = x;
+      b->nfa[loop].e2 = out;
+      b->nfa[xf].e1 = loop;
+      f = out;
+    } else if (n->max > n->min) {
+      int out = new_state(b);
+      for (int i = n->min; i < n->max; i++) {
+        int opt = new_state(b);
+        x = build(b, n->a, &xf);
+        b->nfa[f].e1 = opt;
+        b->nfa[opt].e1 = x;
+        b->nfa[opt].e2 = out;
+        f = xf;
+      }
+      b->nfa[f].e1 = out;
+      f = out;
+    }
+    *end = f;
+    return s;
+  default:
+    b->error = "^ and $ are only supported at the start and end of the pattern";
+    s = new_state(b);
+    *end = s;
+    return s;
+  }
+}
+
+/*
+  Subset construction
+*/
+static void closure_add(regex_builder* b, int s, int* set, int* count) {
+  int sp = 0;
+  b->stack[sp++] = s;
+  while (sp > 0) {
+    s = b->stack[--sp];
+    if (s < 0 || b->mark[s] == b->gen) continue;
+    b->mark[s] = b->gen;
+    set[(*count)++] = s;
+    b->stack[sp++] = b->nfa[s].e1;
+    b->stack[sp++] = b->nfa[s].e2;
+  }
+}
+
+static int cmp_int(const void* x, const void* y) {
+  return *(const int*)x - *(const int*)y;
+}
+
+static uint32_t hash_ints(const int* a, int count) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < count; i++) {
+    h = (h ^ (uint32_t)a[i]) * 16777619u;
+  }
+  return h;
+}
+
+static int dfa_find_or_add(regex_builder* b, int* set, int count, int final_state) {
+  qsort(set, count, sizeof(int), cmp_int);
+  uint32_t h = hash_ints(set, count) % REGEX_DFA_BUCKETS;
+  for (int i = b->bucket[h]; i >= 0; i = b->chain[i]) {
+    if (b->dfa[i].count == count && memcmp(b->dfa[i].states, set, count * sizeof(int)) == 0) {
+      return i;
+    }
+  }
+  if (b->dfa_count >= b->max_states) {
+    b->error = "too many DFA states";
+    return -1;
+  }
+  b->dfa = realloc(b->dfa, (b->dfa_count+1) * sizeof(dfa_state));
+  b->chain = realloc(b->chain, (b->dfa_count+1) * sizeof(int));
+  b->chain[b->dfa_count] = b->bucket[h];
+  b->bucket[h] = b->dfa_count;
+  dfa_state* d = &b->dfa[b->dfa_count];
+  d->states = malloc(count * sizeof(int) + 1);
+  memcpy(d->states, set, count * sizeof(int));
+  d->count = count;
+  d->final = 0;
+  for (int i = 0; i < count; i++) {
+    if (set[i] == final_state) d->final = 1;
+  }
+  d->next = malloc(256 * sizeof(int));
+  for (int c = 0; c < 256; c++) d->next[c] = -1;
+  return b->dfa_count++;
+}
+
+/*
+  If unanchored, the start state is added to each DFA state (i.e. the
+  DFA is for .*R). If absorbing, the final states have no transitions.
+*/
+static void build_dfa(regex_builder* b, int start, int final_state, int unanchored, int absorbing) {
+  b->mark = calloc(b->nfa_count, sizeof(int));
+  b->stack = malloc((2 * b->nfa_count + 16) * sizeof(int));
+  int* set = malloc((b->nfa_count + 1) * sizeof(int));
+  int count = 0;
+  memset(b->bucket, -1, sizeof(b->bucket));
+  b->gen++;
+  closure_add(b, start, set, &count);
+  dfa_find_or_add(b, set, count, final_state);
+  for (int d = 0; d < b->dfa_count && b->error == NULL; d++) {
+    if (b->dfa[d].final && absorbing) {
+      continue;
+    }
+    for (int c = 0; c < 256 && b->error == NULL; c++) {
+      count = 0;
+      b->gen++;
+      for (int i = 0; i < b->dfa[d].count; i++) {
+        nfa_state* s = &b->nfa[b->dfa[d].states[i]];
+        if (s->set >= 0 && set_has(&b->sets[s->set], c)) {
+          closure_add(b, s->out, set, &count);
+        }
+      }
+      if (unanchored) {
+        closure_add(b, start, set, &count);
+      }
+      if (count > 0) {
+        int next = dfa_find_or_add(b, set, count, final_state); // this may move b->dfa
+        b->dfa[d].next[c] = next;
+      }
+    }
+  }
+  free(set);
+}
+
+/*
+  Minimization (Moore's algorithm): the states are split by the final
+  flag, then repeatedly by the classes of their transitions until
+  nothing changes. Returns the number of classes; cls[i] is the class
+  of state i.
+*/
+static int minimize(regex_builder* b, int* cls) {
+  int n = b->dfa_count;
+  int classes = 0;
+  int* sig = malloc((size_t)n * 257 * sizeof(int)); // the class and the classes of the transitions
+  int* sig_owner = malloc(n * sizeof(int));
+  int* chain = malloc(n * sizeof(int));
+  int* new_cls = malloc(n * sizeof(int));
+  for (int i = 0; i < n; i++) cls[i] = b->dfa[i].final;
+  for (;;) {
+    int new_classes = 0;
+    memset(b->bucket, -1, sizeof(b->bucket));
+    for (int i = 0; i < n; i++) {
+      int* si = &sig[(size_t)i*257];
+      si[0] = cls[i];
+      for (int c = 0; c < 256; c++) {
+        si[c+1] = b->dfa[i].next[c] < 0 ? -1 : cls[b->dfa[i].next[c]];
+      }
+      uint32_t h = hash_ints(si, 257) % REGEX_DFA_BUCKETS;
+      int found = -1;
+      for (int j = b->bucket[h]; j >= 0; j = chain[j]) {
+        if (memcmp(&sig[(size_t)sig_owner[j]*257], si, 257 * sizeof(int)) == 0) {
+          found = j;
+          break;
+        }
+      }
+      if (found < 0) {
+        found = new_classes++;
+        sig_owner[found] = i;
+        chain[found] = b->bucket[h];
+        b->bucket[h] = found;
+      }
+      new_cls[i] = found;
+    }
+    memcpy(cls, new_cls, n * sizeof(int));
+    if (new_classes == classes) break;
+    classes = new_classes;
+  }
+  free(sig);
+  free(sig_owner);
+  free(chain);
+  free(new_cls);
+  return classes;
+}
+
+static void builder_free(regex_builder* b) {
+  while (b->nodes != NULL) {
+    node* n = b->nodes;
+    b->nodes = n->all;
+    free(n->text);
+    free(n);
+  }
+  for (int i = 0; i < b->dfa_count; i++) {
+    free(b->dfa[i].states);
+    free(b->dfa[i].next);
+  }
+  free(b->dfa);
+  free(b->chain);
+  free(b->nfa);
+  free(b->sets);
+  free(b->mark);
+  free(b->stack);
+  free(b);
+}
+
+regex_dfa* regex_dfa_compile(const char* pattern, int pattern_size, int mode, int max_states,
+                             const char** error, int* erroffset) {
+  regex_builder* b = calloc(1, sizeof(regex_builder));
+  b->pat = pattern;
+  b->len = pattern_size;
+  b->max_states = max_states;
+
+  node* n = parse_alt(b);
+  if (b->error == NULL && b->pos < b->len) {
+    b->error = "unmatched )";
+  }
+  int bol, eol;
+  n = strip_anchors(n, &bol, &eol);
+  int end = 0;
+  int start = build(b, n, &end);
+  if (b->error == NULL) {
+    if (mode == REGEX_DFA_FULL) {
+      build_dfa(b, start, end, 0, 0);
+    } else {
+      build_dfa(b, start, end, !bol, !eol);
+    }
+  }
+  if (b->error != NULL) {
+    *error = b->error;
+    *erroffset = b->pos;
+    builder_free(b);
+    return NULL;
+  }
+
+  int* cls = malloc(b->dfa_count * sizeof(int));
+  int classes = minimize(b, cls);
+  regex_dfa* dfa = malloc(sizeof(regex_dfa));
+  dfa->num_states = classes;
+  dfa->next = malloc((size_t)classes * 256 * sizeof(int));
+  dfa->final = calloc(classes, 1);
+  dfa->eol = eol;
+  // The start state (0) is in class 0 since the classes are numbered
+  // in the order of the DFA states.
+  for (int i = b->dfa_count-1; i >= 0; i--) {
+    int k = cls[i];
+    dfa->final[k] = b->dfa[i].final;
+    for (int c = 0; c < 256; c++) {
+      dfa->next[(size_t)k*256+c] = b->dfa[i].next[c] < 0 ? -1 : cls[b->dfa[i].next[c]];
+    }
+  }
+  free(cls);
+  builder_free(b);
+
+  return dfa;
+}
+
+void regex_dfa_free(regex_dfa* dfa) {
+  if (dfa != NULL) {
+    free(dfa->next);
+    free(dfa->final);
+    free(dfa);
+  }
+}
+
+
+
+/*
+  Word sets
+
+  The minimal acyclic DFA of a set of words is built incrementally
+  from the sorted words (Daciuk et al, "Incremental construction of
+  minimal acyclic finite-state automata", 2000): the states of the
+  previous word that are not on the path of the next word are final,
+  so they are replaced by an equivalent state in the register (if
+  any), bottom up. This shares both the prefixes and the suffixes.
+
+  The labels of the word DFA are code points (the words are decoded
+  from UTF-8) so a multibyte character is never split in the pattern.
+  A byte b which is not valid UTF-8 is the label WORD_RAW+b.
+*/
+#define WORD_RAW 0x200000
+
+typedef struct {
+  int final;
+  int count, cap;
+  int* labels;     // in increasing order
+  int* targets;
+  int chain;       // the register's hash chain
+  int groups;      // the number of groups (-1 if not computed), see word_groups()
+  char** atoms;
+  int* group_targets;
+} word_state;
+
+typedef struct {
+  word_state* states;
+  int count, cap;
+  int* bucket;
+  int num_buckets;
+} word_dfa;
+
+typedef struct {
+  int* labels;
+  int len;
+} word;
+
+static int utf8_encode(int c, unsigned char* buf) {
+  if (c >= WORD_RAW) { buf[0] = c - WORD_RAW; return 1; }
+  if (c < 0x80) { buf[0] = c; return 1; }
+  if (c < 0x800) { buf[0] = 0xC0 | (c >> 6); buf[1] = 0x80 | (c & 0x3F); return 2; }
+  if (c < 0x10000) {
+    buf[0] = 0xE0 | (c >> 12); buf[1] = 0x80 | ((c >> 6) & 0x3F); buf[2] = 0x80 | (c & 0x3F);
+    return 3;
+  }
+  buf[0] = 0xF0 | (c >> 18); buf[1] = 0x80 | ((c >> 12) & 0x3F);
+  buf[2] = 0x80 | ((c >> 6) & 0x3F); buf[3] = 0x80 | (c & 0x3F);
+  return 4;
+}
+
+// The code point of the UTF-8 character at s (of n bytes); *size is its length
+static int utf8_decode(const unsigned char* s, int n, int* size) {
+  int c = s[0];
+  int k = c < 0x80 ? 0 : c < 0xC2 ? -1 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : c < 0xF5 ? 3 : -1;
+  *size = 1;
+  if (k == 0) return c;
+  if (k < 0 || k >= n) return WORD_RAW + c;
+  int cp = c & (0x3F >> k);
+  for (int i = 1; i <= k; i++) {
+    if ((s[i] & 0xC0) != 0x80) return WORD_RAW + c;
+    cp = (cp << 6) | (s[i] & 0x3F);
+  }
+  unsigned char buf[4];
+  if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF) || utf8_encode(cp, buf) != k+1) {
+    return WORD_RAW + c; // overlong or not a character
+  }
+  *size = k+1;
+  return cp;
+}
+
+static int word_new_state(word_dfa* w) {
+  if (w->count == w->cap) {
+    w->cap = w->cap ? 2 * w->cap : 1024;
+    w->states = realloc(w->states, w->cap * sizeof(word_state));
+  }
+  memset(&w->states[w->count], 0, sizeof(word_state));
+  w->states[w->count].chain = -1;
+  w->states[w->count].groups = -1;
+  return w->count++;
+}
+
+static void word_add_edge(word_dfa* w, int s, int c, int t) {
+  word_state* ws = &w->states[s];
+  if (ws->count == ws->cap) {
+    ws->cap = ws->cap ? 2 * ws->cap : 2;
+    ws->labels = realloc(ws->labels, ws->cap * sizeof(int));
+    ws->targets = realloc(ws->targets, ws->cap * sizeof(int));
+  }
+  ws->labels[ws->count] = c;
+  ws->targets[ws->count++] = t;
+}
+
+static uint32_t word_hash(const word_state* ws) {
+  uint32_t h = hash_ints(ws->targets, ws->count) ^ (uint32_t)ws->final;
+  return (h ^ hash_ints(ws->labels, ws->count)) * 16777619u;
+}
+
+static int word_equal(const word_state* a, const word_state* b) {
+  return a->final == b->final && a->count == b->count &&
+    memcmp(a->labels, b->labels, a->count * sizeof(int)) == 0 &&
+    memcmp(a->targets, b->targets, a->count * sizeof(int)) == 0;
+}
+
+/*
+  Replaces (or registers) the states path[to], path[to-1], ... path[from+1],
+  each of which is the last child of the previous state in path.
+*/
+static void word_replace_or_register(word_dfa* w, int* path, int from, int to) {
+  for (int i = to; i > from; i--) {
+    word_state* child = &w->states[path[i]];
+    uint32_t h = word_hash(child) % w->num_buckets;
+    int q;
+    for (q = w->bucket[h]; q >= 0; q = w->states[q].chain) {
+      if (word_equal(&w->states[q], child)) break;
+    }
+    if (q >= 0) {
+      word_state* parent = &w->states[path[i-1]];
+      parent->targets[parent->count-1] = q;
+      free(child->labels);
+      free(child->targets);
+      child->labels = NULL;
+      child->targets = NULL;
+      child->count = child->cap = 0;
+    } else {
+      child->chain = w->bucket[h];
+      w->bucket[h] = path[i];
+    }
+  }
+}
+
+static int cmp_word(const void* x, const void* y) {
+  const word* a = x;
+  const word* b = y;
+  for (int i = 0; i < a->len && i < b->len; i++) {
+    if (a->labels[i] != b->labels[i]) return a->labels[i] < b->labels[i] ? -1 : 1;
+  }
+  return a->len - b->len;
+}
+
+/*
+  Growable strings for the pattern.
+*/
+typedef struct {
+  char* s;
+  size_t len, cap;
+} strbuf;
+
+static void sb_add(strbuf* sb, const char* s, size_t len) {
+  if (sb->len + len + 1 > sb->cap) {
+    sb->cap = 2 * (sb->len + len + 1) + 16;
+    sb->s = realloc(sb->s, sb->cap);
+  }
+  memcpy(sb->s + sb->len, s, len);
+  sb->len += len;
+  sb->s[sb->len] = '\0';
+}
+
+static void sb_add_str(strbuf* sb, const char* s) {
+  sb_add(sb, s, strlen(s));
+}
+
+static void sb_add_char(strbuf* sb, int c, int in_class) {
+  const char* special = in_class ? "\\]^-[" : "\\^$.|?*+()[]{}";
+  unsigned char buf[5] = { '\\' };
+  if (c < 0x80 && strchr(special, c) != NULL) {
+    buf[1] = c;
+    sb_add(sb, (char*)buf, 2);
+  } else {
+    sb_add(sb, (char*)buf+1, utf8_encode(c, buf+1));
+  }
+}
+
+/*
+  The atom (a character, a character class or a group of alternative
+  characters) for the n labels cs (in increasing order). A character
+  class only contains ASCII characters since a multibyte character in
+  a class would be several bytes without PCRE2_UTF.
+*/
+static char* word_atom(const int* cs, int n) {
+  strbuf sb = { NULL, 0, 0 };
+  int ascii = 0;
+  while (ascii < n && cs[ascii] < 0x80) ascii++;
+  int items = (ascii > 0) + (n - ascii);
+  if (items > 1) sb_add_str(&sb, "(?:");
+  if (ascii == 1) {
+    sb_add_char(&sb, cs[0], 0);
+  } else if (ascii > 1) {
+    sb_add_str(&sb, "[");
+    for (int i = 0; i < ascii; ) {
+      int j = i;
+      while (j+1 < ascii && cs[j+1] == cs[j]+1) j++;
+      sb_add_char(&sb, cs[i], 1);
+      if (j - i >= 2) {
+        sb_add_str(&sb, "-");
+        sb_add_char(&sb, cs[j], 1);
+      } else {
+        for (int k = i+1; k <= j; k++) sb_add_char(&sb, cs[k], 1);
+      }
+      i = j+1;
+    }
+    sb_add_str(&sb, "]");
+  }
+  for (int i = ascii; i < n; i++) {
+    if (i > 0) sb_add_str(&sb, "|");
+    sb_add_char(&sb, cs[i], 0);
+  }
+  if (items > 1) sb_add_str(&sb, ")");
+  return sb.s;
+}
+
+/*
+  The groups of state s: the edges to the same target are joined to
+  an atom.
+*/
+static int word_groups(word_dfa* w, int s) {
+  word_state* ws = &w->states[s];
+  if (ws->groups >= 0) {
+    return ws->groups;
+  }
+  ws->atoms = malloc((ws->count + 1) * sizeof(char*));
+  ws->group_targets = malloc((ws->count + 1) * sizeof(int));
+  ws->groups = 0;
+  int* cs = malloc((ws->count + 1) * sizeof(int));
+  char* done = calloc(ws->count + 1, 1);
+  for (int i = 0; i < ws->count; i++) {
+    if (done[i]) continue;
+    int n = 0;
+    for (int j = i; j < ws->count; j++) {
+      if (ws->targets[j] == ws->targets[i]) {
+        cs[n++] = ws->labels[j];
+        done[j] = 1;
+      }
+    }
+    ws->atoms[ws->groups] = word_atom(cs, n);
+    ws->group_targets[ws->groups++] = ws->targets[i];
+  }
+  free(cs);
+  free(done);
+  return ws->groups;
+}
+
+// The length of the first atom in the pattern x
+static size_t atom_length(const char* x) {
+  size_t i = 0;
+  int depth = 0;
+  do {
+    if (x[i] == '\\') {
+      i += 2;
+    } else if (x[i] == '[') {
+      for (i++; x[i] != ']'; i++) {
+        if (x[i] == '\\') i++;
+      }
+      i++;
+    } else {
+      if (x[i] == '(') depth++;
+      if (x[i] == ')') depth--;
+      i++;
+    }
+  } while (depth > 0 && x[i] != '\0');
+  return i;
+}
+
+// x? (with a group if x is not a single atom; a multibyte character is several atoms)
+static void sb_add_optional(strbuf* sb, const char* x) {
+  int atom = x[0] != '\0' && (unsigned char)x[0] < 0x80 && atom_length(x) == strlen(x);
+  if (!atom) sb_add_str(sb, "(?:");
+  sb_add_str(sb, x);
+  sb_add_str(sb, atom ? "?" : ")?");
+}
+
+/*
+  The pattern of the language of state s (memoized in pats).
+
+  From each group of s the chain of states with a single group (and
+  which are not final) is followed, which gives a sequence of atoms
+  and an end state. The sequences with the same end state are joined
+  as (?:prefix1|prefix2|...)common_suffix and followed by the pattern
+  of the end state, e.g. "r?an?d" instead of "(?:a(?:d|nd)|ra(?:d|nd))".
+  The parts (one per end state) are alternatives, and if s is final
+  they are optional.
+*/
+static const char* word_pattern(word_dfa* w, int s, char** pats) {
+  if (pats[s] != NULL) {
+    return pats[s];
+  }
+  int groups = word_groups(w, s);
+  int* ends = malloc((groups + 1) * sizeof(int));
+  int* lens = malloc((groups + 1) * sizeof(int));
+  char*** seqs = malloc((groups + 1) * sizeof(char**));
+  for (int g = 0; g < groups; g++) {
+    int cap = 4;
+    seqs[g] = malloc(cap * sizeof(char*));
+    seqs[g][0] = w->states[s].atoms[g];
+    lens[g] = 1;
+    int cur = w->states[s].group_targets[g];
+    while (!w->states[cur].final && word_groups(w, cur) == 1) {
+      if (lens[g] == cap) {
+        cap *= 2;
+        seqs[g] = realloc(seqs[g], cap * sizeof(char*));
+      }
+      seqs[g][lens[g]++] = w->states[cur].atoms[0];
+      cur = w->states[cur].group_targets[0];
+    }
+    ends[g] = cur;
+  }
+
+  strbuf sb = { NULL, 0, 0 };
+  sb_add_str(&sb, "");
+  int parts = 0;
+  char* done = calloc(groups + 1, 1);
+  for (int g = 0; g < groups; g++) {
+    if (done[g]) continue;
+    int end = ends[g];
+    const char* rest = word_pattern(w, end, pats);
+    // the common suffix of the sequences to end
+    int members = 0;
+    int min_len = lens[g];
+    for (int h = g; h < groups; h++) {
+      if (ends[h] == end) {
+        members++;
+        if (lens[h] < min_len) min_len = lens[h];
+      }
+    }
+    int suffix = 0;
+    if (members > 1) {
+      for (; suffix < min_len; suffix++) {
+        const char* a = seqs[g][lens[g]-1-suffix];
+        int same = 1;
+        for (int h = g+1; h < groups && same; h++) {
+          if (ends[h] == end) same = strcmp(a, seqs[h][lens[h]-1-suffix]) == 0;
+        }
+        if (!same) break;
+      }
+    }
+    // the prefixes
+    strbuf pre = { NULL, 0, 0 };
+    sb_add_str(&pre, "");
+    int empty = 0, nonempty = 0;
+    for (int h = g; h < groups; h++) {
+      if (ends[h] != end) continue;
+      done[h] = 1;
+      int n = lens[h] - suffix;
+      if (n == 0) {
+        empty = 1;
+        continue;
+      }
+      if (nonempty++ > 0) sb_add_str(&pre, "|");
+      for (int i = 0; i < n; i++) sb_add_str(&pre, seqs[h][i]);
+    }
+    if (parts++ > 0) sb_add_str(&sb, "|");
+    if (nonempty > 1 && !empty && suffix == 0 && rest[0] == '\0') {
+      // nothing follows the prefixes: they are alternatives of s
+      sb_add_str(&sb, pre.s);
+      parts += nonempty - 1;
+    } else if (nonempty > 1) {
+      sb_add_str(&sb, "(?:");
+      sb_add_str(&sb, pre.s);
+      sb_add_str(&sb, empty ? ")?" : ")");
+    } else if (nonempty == 1 && empty) {
+      sb_add_optional(&sb, pre.s);
+    } else {
+      sb_add_str(&sb, pre.s);
+    }
+    free(pre.s);
+    for (int i = lens[g]-suffix; i < lens[g]; i++) sb_add_str(&sb, seqs[g][i]);
+    sb_add_str(&sb, rest);
+  }
+  free(done);
+
+  if (w->states[s].final && parts > 0) {
+    strbuf g = { NULL, 0, 0 };
+    if (parts > 1) {
+      sb_add_str(&g, "(?:");
+      sb_add_str(&g, sb.s);
+      sb_add_str(&g, ")?");
+    } else {
+      sb_add_optional(&g, sb.s);
+    }
+    free(sb.s);
+    sb = g;
+  } else if (parts > 1) {
+    strbuf g = { NULL, 0, 0 };
+    sb_add_str(&g, "(?:");
+    sb_add_str(&g, sb.s);
+    sb_add_str(&g, ")");
+    free(sb.s);
+    sb = g;
+  }
+
+  for (int g = 0; g < groups; g++) free(seqs[g]);
+  free(seqs);
+  free(lens);
+  free(ends);
+  pats[s] = sb.s;
+  return sb.s;
+}
+
+// Numbers the states reachable from s in depth first order
+static void word_number(word_dfa* w, int s, int* num, int* order, int* count) {
+  num[s] = (*count)++;
+  order[num[s]] = s;
+  for (int i = 0; i < w->states[s].count; i++) {
+    if (num[w->states[s].targets[i]] < 0) {
+      word_number(w, w->states[s].targets[i], num, order, count);
+    }
+  }
+}
+
+/*
+  The byte DFA of the word DFA. The multibyte labels get intermediate
+  states (shared by the labels with the same first bytes).
+  Returns NULL if there are more than max_states states (or if an
+  invalid UTF-8 byte is the first byte of a character at the same
+  state, which would need a merged state).
+*/
+static regex_dfa* word_byte_dfa(word_dfa* w, int max_states) {
+  int* num = malloc(w->count * sizeof(int));
+  int* order = malloc(w->count * sizeof(int));
+  for (int s = 0; s < w->count; s++) num[s] = -1;
+  int count = 0;
+  word_number(w, 0, num, order, &count);
+  int word_states = count;
+  int cap = count + 16;
+  regex_dfa* dfa = NULL;
+  if (count <= max_states) {
+    dfa = malloc(sizeof(regex_dfa));
+    dfa->next = malloc((size_t)cap * 256 * sizeof(int));
+    dfa->final = calloc(cap, 1);
+    dfa->eol = 0;
+    memset(dfa->next, -1, (size_t)count * 256 * sizeof(int));
+    for (int k = 0; k < word_states && dfa != NULL; k++) {
+      word_state* ws = &w->states[order[k]];
+      dfa->final[k] = ws->final;
+      for (int i = 0; i < ws->count; i++) {
+        unsigned char b[4];
+        int n = utf8_encode(ws->labels[i], b);
+        int cur = k;
+        for (int j = 0; j < n-1; j++) {
+          int* next = &dfa->next[(size_t)cur*256 + b[j]];
+          if (*next >= 0 && *next < word_states) {
+            // an invalid UTF-8 byte and a character with the same first byte
+            regex_dfa_free(dfa);
+            dfa = NULL;
+            break;
+          }
+          if (*next < 0) {
+            if (count == max_states) {
+              regex_dfa_free(dfa);
+              dfa = NULL;
+              break;
+            }
+            if (count == cap) {
+              cap *= 2;
+              dfa->next = realloc(dfa->next, (size_t)cap * 256 * sizeof(int));
+              dfa->final = realloc(dfa->final, cap);
+              next = &dfa->next[(size_t)cur*256 + b[j]];
+            }
+            memset(&dfa->next[(size_t)count*256], -1, 256 * sizeof(int));
+            dfa->final[count] = 0;
+            *next = count++;
+          }
+          cur = *next;
+        }
+        if (dfa == NULL) break;
+        if (dfa->next[(size_t)cur*256 + b[n-1]] >= 0) {
+          regex_dfa_free(dfa);
+          dfa = NULL;
+          break;
+        }
+        dfa->next[(size_t)cur*256 + b[n-1]] = num[ws->targets[i]];
+      }
+    }
+    if (dfa != NULL) dfa->num_states = count;
+  }
+  free(num);
+  free(order);
+  return dfa;
+}
+
+char* regex_dfa_words(const char** words, const int* sizes, int num_words, int max_states, regex_dfa** dfa) {
+  // decode the words
+  word* ws = malloc((num_words+1) * sizeof(word));
+  size_t total = 0;
+  int max_len = 0;
+  for (int i = 0; i < num_words; i++) {
+    total += sizes[i];
+    if (sizes[i] > max_len) max_len = sizes[i];
+  }
+  int* labels = malloc((total+1) * sizeof(int));
+  size_t pos = 0;
+  for (int i = 0; i < num_words; i++) {
+    const unsigned char* s = (const unsigned char*)words[i];
+    ws[i].labels = &labels[pos];
+    ws[i].len = 0;
+    for (int j = 0; j < sizes[i]; ) {
+      int size;
+      labels[pos++] = utf8_decode(s+j, sizes[i]-j, &size);
+      ws[i].len++;
+      j += size;
+    }
+  }
+  qsort(ws, num_words, sizeof(word), cmp_word);
+
+  word_dfa w = { NULL, 0, 0, NULL, 0 };
+  w.num_buckets = 1024;
+  while (w.num_buckets < num_words) w.num_buckets *= 2;
+  w.bucket = malloc(w.num_buckets * sizeof(int));
+  memset(w.bucket, -1, w.num_buckets * sizeof(int));
+  int* path = malloc((max_len+1) * sizeof(int));
+  path[0] = word_new_state(&w);
+  int prev = -1;
+  for (int i = 0; i < num_words; i++) {
+    int len = ws[i].len;
+    int prev_len = prev < 0 ? 0 : ws[prev].len;
+    int p = 0;
+    while (p < len && p < prev_len && ws[i].labels[p] == ws[prev].labels[p]) p++;
+    if (prev >= 0 && p == len && len == prev_len) {
+      continue; // a duplicate
+    }
+    word_replace_or_register(&w, path, p, prev_len);
+    for (int k = p; k < len; k++) {
+      int t = word_new_state(&w);
+      word_add_edge(&w, path[k], ws[i].labels[k], t);
+      path[k+1] = t;
+    }
+    w.states[path[len]].final = 1;
+    prev = i;
+  }
+  word_replace_or_register(&w, path, 0, prev < 0 ? 0 : ws[prev].len);
+
+  char** pats = calloc(w.count, sizeof(char*));
+  char* pattern;
+  if (w.states[0].count == 0 && !w.states[0].final) {
+    pattern = strdup("(?!)"); // no words
+  } else {
+    pattern = strdup(word_pattern(&w, 0, pats));
+  }
+  *dfa = word_byte_dfa(&w, max_states);
+
+  for (int s = 0; s < w.count; s++) {
+    word_state* st = &w.states[s];
+    for (int g = 0; g < st->groups; g++) free(st->atoms[g]);
+    free(st->atoms);
+    free(st->group_targets);
+    free(st->labels);
+    free(st->targets);
+    free(pats[s]);
+  }
+  free(pats);
+  free(w.states);
+  free(w.bucket);
+  free(path);
+  free(labels);
+  free(ws);
+
+  return pattern;
+}
+
+int regex_dfa_full_match(const regex_dfa* dfa, const unsigned char* s, size_t n) {
+  int state = 0;
+  for (size_t i = 0; i < n; i++) {
+    state = dfa->next[(size_t)state*256 + s[i]];
+    if (state < 0) return 0;
+  }
+  return dfa->final[state];
+}
+
+/*
+  The length of the longest string accepted by the DFA (REGEX_DFA_FULL),
+  or -1 if there is no longest string (a cycle that can reach a final
+  state) or no string at all.
+  Only the live states (that can reach a final state) are used, and
+  the longest path from the start state is computed over them in
+  topological order (Kahn's algorithm, which also finds the cycles).
+*/
+long regex_dfa_max_length(const regex_dfa* dfa) {
+  int n = dfa->num_states;
+  unsigned char* live = malloc(n);
+  for (int s = 0; s < n; s++) {
+    live[s] = dfa->final[s];
+  }
+  for (int changed = 1; changed; ) {
+    changed = 0;
+    for (int s = 0; s < n; s++) {
+      for (int c = 0; c < 256 && !live[s]; c++) {
+        int t = dfa->next[(size_t)s*256 + c];
+        if (t >= 0 && live[t]) {
+          live[s] = 1;
+          changed = 1;
+        }
+      }
+    }
+  }
+  long result = -1;
+  if (live[0]) {
+    int* indegree = calloc(n, sizeof(int));
+    long* longest = malloc(n * sizeof(long));
+    int* queue = malloc(n * sizeof(int));
+    for (int s = 0; s < n; s++) {
+      longest[s] = -1;
+      for (int c = 0; live[s] && c < 256; c++) {
+        int t = dfa->next[(size_t)s*256 + c];
+        if (t >= 0 && live[t]) {
+          indegree[t]++;
+        }
+      }
+    }
+    int head = 0, tail = 0, num_live = 0;
+    for (int s = 0; s < n; s++) {
+      num_live += live[s];
+      if (live[s] && indegree[s] == 0) {
+        queue[tail++] = s;
+      }
+    }
+    longest[0] = 0;
+    while (head < tail) {
+      int s = queue[head++];
+      if (longest[s] >= 0 && dfa->final[s] && longest[s] > result) {
+        result = longest[s];
+      }
+      for (int c = 0; c < 256; c++) {
+        int t = dfa->next[(size_t)s*256 + c];
+        if (t >= 0 && live[t]) {
+          if (longest[s] >= 0 && longest[s] + 1 > longest[t]) {
+            longest[t] = longest[s] + 1;
+          }
+          if (--indegree[t] == 0) {
+            queue[tail++] = t;
+          }
+        }
+      }
+    }
+    if (tail < num_live) {
+      result = -1; // a cycle
+    }
+    free(indegree);
+    free(longest);
+    free(queue);
+  }
+  free(live);
+  return result;
+}
+
+
+/*
+  Trigram queries
+
+  The query of a pattern is computed from its AST (as in Russ Cox's
+  "Regular Expression Matching with a Trigram Index", simplified):
+  each node has either the exact set of (short) strings it matches,
+  or a query that the strings it matches must satisfy. When an exact
+  set gets too large it is converted to a query: the OR of the AND of
+  the trigrams of each string.
+*/
+#define REGEX_QUERY_MAX_EXACT 64
+#define REGEX_QUERY_MAX_CLASS 8
+
+typedef struct {
+  int count;         // -1: not known
+  char** s;
+  int* len;
+} exact_set;
+
+static regex_query* query_new(int op) {
+  regex_query* q = calloc(1, sizeof(regex_query));
+  q->op = op;
+  return q;
+}
+
+void regex_query_free(regex_query* q) {
+  if (q != NULL) {
+    for (int i = 0; i < q->count; i++) regex_query_free(q->args[i]);
+    free(q->args);
+    free(q);
+  }
+}
+
+static void query_add(regex_query* q, regex_query* arg) {
+  q->args = realloc(q->args, (q->count + 1) * sizeof(regex_query*));
+  q->args[q->count++] = arg;
+}
+
+/*
+  AND/OR of x and y (which are consumed), simplified: ALL is dropped
+  from an AND, and an OR with ALL is ALL.
+*/
+static regex_query* query_op(int op, regex_query* x, regex_query* y) {
+  if (op == REGEX_QUERY_AND) {
+    if (x->op == REGEX_QUERY_ALL) { regex_query_free(x); return y; }
+    if (y->op == REGEX_QUERY_ALL) { regex_query_free(y); return x; }
+  } else {
+    if (x->op == REGEX_QUERY_ALL) { regex_query_free(y); return x; }
+    if (y->op == REGEX_QUERY_ALL) { regex_query_free(x); return y; }
+  }
+  regex_query* q = query_new(op);
+  regex_query* xy[2] = { x, y };
+  for (int i = 0; i < 2; i++) {
+    if (xy[i]->op == op) {
+      // flatten
+      for (int j = 0; j < xy[i]->count; j++) query_add(q, xy[i]->args[j]);
+      xy[i]->count = 0;
+      regex_query_free(xy[i]);
+    } else {
+      query_add(q, xy[i]);
+    }
+  }
+  return q;
+}
+
+static void exact_free(exact_set* e) {
+  for (int i = 0; i < e->count; i++) free(e->s[i]);
+  free(e->s);
+  free(e->len);
+  e->count = -1;
+  e->s = NULL;
+  e->len = NULL;
+}
+
+static void exact_add(exact_set* e, const char* s, int len) {
+  for (int i = 0; i < e->count; i++) {
+    if (e->len[i] == len && memcmp(e->s[i], s, len) == 0) return;
+  }
+  e->s = realloc(e->s, (e->count + 1) * sizeof(char*));
+  e->len = realloc(e->len, (e->count + 1) * sizeof(int));
+  e->s[e->count] = malloc(len + 1);
+  memcpy(e->s[e->count], s, len);
+  e->len[e->count++] = len;
+}
+
+// The query of an exact set (which is freed)
+static regex_query* exact_query(exact_set* e) {
+  regex_query* q = NULL;
+  for (int i = 0; i < e->count; i++) {
+    regex_query* a = query_new(REGEX_QUERY_ALL);
+    for (int j = 0; j + 2 < e->len[i]; j++) {
+      regex_query* t = query_new(REGEX_QUERY_TRIGRAM);
+      const unsigned char* p = (const unsigned char*)e->s[i] + j;
+      t->trigram = (p[0] << 16) | (p[1] << 8) | p[2];
+      a = query_op(REGEX_QUERY_AND, a, t);
+    }
+    q = q == NULL ? a : query_op(REGEX_QUERY_OR, q, a);
+  }
+  exact_free(e);
+  return q == NULL ? query_new(REGEX_QUERY_ALL) : q;
+}
+
+// The concatenation of the exact sets x and y (in x), false if it's too large
+static int exact_cat(exact_set* x, exact_set* y) {
+  if (x->count < 0 || y->count < 0 || x->count * y->count > REGEX_QUERY_MAX_EXACT) {
+    return 0;
+  }
+  exact_set r = { 0, NULL, NULL };
+  for (int i = 0; i < x->count; i++) {
+    for (int j = 0; j < y->count; j++) {
+      char* s = malloc(x->len[i] + y->len[j] + 1);
+      memcpy(s, x->s[i], x->len[i]);
+      memcpy(s + x->len[i], y->s[j], y->len[j]);
+      exact_add(&r, s, x->len[i] + y->len[j]);
+      free(s);
+    }
+  }
+  exact_free(x);
+  *x = r;
+  return 1;
+}
+
+static void query_info(node* n, exact_set* exact, regex_query** q) {
+  exact->count = 0;
+  exact->s = NULL;
+  exact->len = NULL;
+  *q = NULL;
+  switch (n->type) {
+  case N_EMPTY:
+  case N_BOL:
+  case N_EOL:
+    exact_add(exact, "", 0);
+    return;
+  case N_SET: {
+    int count = 0;
+    for (int c = 0; c < 256; c++) count += set_has(&n->set, c);
+    if (count > REGEX_QUERY_MAX_CLASS) {
+      exact->count = -1;
+      *q = query_new(REGEX_QUERY_ALL);
+      return;
+    }
+    for (int c = 0; c < 256; c++) {
+      if (set_has(&n->set, c)) {
+        char s = c;
+        exact_add(exact, &s, 1);
+      }
+    }
+    return;
+  }
+  case N_CAT:
+  case N_ALT: {
+    exact_set ea, eb;
+    regex_query *qa, *qb;
+    query_info(n->a, &ea, &qa);
+    query_info(n->b, &eb, &qb);
+    if (n->type == N_CAT && exact_cat(&ea, &eb)) {
+      *exact = ea;
+      exact_free(&eb);
+      return;
+    }
+    if (n->type == N_ALT && ea.count >= 0 && eb.count >= 0 && ea.count + eb.count <= REGEX_QUERY_MAX_EXACT) {
+      for (int i = 0; i < eb.count; i++) exact_add(&ea, eb.s[i], eb.len[i]);
+      *exact = ea;
+      exact_free(&eb);
+      return;
+    }
+    if (ea.count >= 0) qa = exact_query(&ea);
+    if (eb.count >= 0) qb = exact_query(&eb);
+    exact->count = -1;
+    *q = query_op(n->type == N_CAT ? REGEX_QUERY_AND : REGEX_QUERY_OR, qa, qb);
+    return;
+  }
+  case N_REPEAT: {
+    exact_set ea;
+    regex_query* qa;
+    query_info(n->a, &ea, &qa);
+    if (ea.count >= 0 && n->max >= 0 && n->max <= 4) {
+      // x{min,max}: the union of x^k for k in min..max
+      exact_set r = { 0, NULL, NULL };
+      exact_set power = { 0, NULL, NULL };
+      exact_add(&power, "", 0);
+      int ok = 1;
+      for (int k = 0; k <= n->max && ok; k++) {
+        if (k >= n->min) {
+          for (int i = 0; i < power.count; i++) exact_add(&r, power.s[i], power.len[i]);
+          ok = r.count <= REGEX_QUERY_MAX_EXACT;
+        }
+        if (k < n->max && ok) {
+          exact_set copy = { 0, NULL, NULL };
+          for (int i = 0; i < ea.count; i++) exact_add(&copy, ea.s[i], ea.len[i]);
+          ok = exact_cat(&power, &copy);
+          exact_free(&copy);
+        }
+      }
+      exact_free(&power);
+      if (ok) {
+        exact_free(&ea);
+        *exact = r;
+        return;
+      }
+      exact_free(&r);
+    }
+    exact->count = -1;
+    if (n->min == 0) {
+      // x* etc: no condition
+      if (ea.count >= 0) exact_free(&ea); else regex_query_free(qa);
+      *q = query_new(REGEX_QUERY_ALL);
+    } else {
+      // x+ etc: at least one x
+      *q = ea.count >= 0 ? exact_query(&ea) : qa;
+    }
+    return;
+  }
+  }
+}
+
+regex_query* regex_dfa_query(const char* pattern, int pattern_size) {
+  regex_builder* b = calloc(1, sizeof(regex_builder));
+  b->pat = pattern;
+  b->len = pattern_size;
+  node* n = parse_alt(b);
+  if (b->error == NULL && b->pos < b->len) {
+    b->error = "unmatched )";
+  }
+  regex_query* q;
+  if (b->error != NULL) {
+    q = query_new(REGEX_QUERY_ALL);
+  } else {
+    exact_set exact;
+    query_info(n, &exact, &q);
+    if (exact.count >= 0) q = exact_query(&exact);
+  }
+  builder_free(b);
+  return q;
+}
+
+/*
+  The ReDoS analysis. The pattern is parsed leniently (see
+  parse_special_group()) and the AST is searched for what makes a
+  backtracking matcher slow on a subject that doesn't match:
+   - an unbounded repeat X* (X+, X{n,}) where X is ambiguous: two
+     alternatives of X match the same string, or a string is matched
+     both by one X and by several X's, e.g. (a|ab|b)* and (a+)+. PCRE2
+     tries all the ways to split the subject: exponential time. This
+     is decided on the DFAs of X and XX+ (their intersection) when they
+     can be built, otherwise by the bytes that X can start and end with.
+   - a sequence of unbounded repeats that can match the same bytes and
+     are separated only by optional items or items that the repeats
+     match too, e.g. \d+\d+ or .*a.*: each repeat is a factor n, i.e.
+     one degree of the polynomial. A top level sequence that starts
+     with such a repeat and isn't anchored is one degree more, since
+     it's retried at each start position (\s+$ is quadratic).
+  The possessive repeats and the atomic groups are not backtracked into.
+*/
+#define REDOS_MAX_STATES 1000
+
+typedef struct {
+  node** items;
+  int count, alloc;
+} node_list;
+
+static void node_list_add(node_list* l, node* n) {
+  if (l->count == l->alloc) {
+    l->alloc = l->alloc ? 2 * l->alloc : 16;
+    l->items = realloc(l->items, l->alloc * sizeof(node*));
+  }
+  l->items[l->count++] = n;
+}
+
+// The items of a concatenation (type N_CAT) or the alternatives (N_ALT)
+static void flatten(node* n, int type, node_list* l) {
+  if (n->type == type) {
+    flatten(n->a, type, l);
+    flatten(n->b, type, l);
+  } else if (n->type != N_EMPTY || type == N_ALT) {
+    node_list_add(l, n);
+  }
+}
+
+static int set_is_empty(const byteset* s) {
+  for (int i = 0; i < 32; i++) {
+    if (s->bits[i]) return 0;
+  }
+  return 1;
+}
+
+static void set_intersect(byteset* s, const byteset* t) {
+  for (int i = 0; i < 32; i++) s->bits[i] &= t->bits[i];
+}
+
+static int set_subset(const byteset* s, const byteset* t) {
+  for (int i = 0; i < 32; i++) {
+    if (s->bits[i] & ~t->bits[i]) return 0;
+  }
+  return 1;
+}
+
+static int is_unbounded(node* n) {
+  return n->type == N_REPEAT && n->max < 0 && !n->possessive;
+}
+
+// zero width items that can fail
+static int is_assertion(node* n) {
+  return n->type == N_BOL || n->type == N_EOL || n->type == N_LOOK;
+}
+
+static int nullable(node* n) {
+  switch (n->type) {
+  case N_SET:    return 0;
+  case N_CAT:    return nullable(n->a) && nullable(n->b);
+  case N_ALT:    return nullable(n->a) || nullable(n->b);
+  case N_REPEAT: return n->min == 0 || nullable(n->a);
+  case N_ATOMIC: case N_GROUP: return nullable(n->a);
+  default:       return 1;
+  }
+}
+
+// The bytes that a match of n can start with (or end with, if last)
+static void edge_bytes(node* n, int last, byteset* s) {
+  switch (n->type) {
+  case N_SET:
+    set_union(s, &n->set);
+    break;
+  case N_CAT: {
+    node* x = last ? n->b : n->a;
+    node* y = last ? n->a : n->b;
+    edge_bytes(x, last, s);
+    if (nullable(x)) edge_bytes(y, last, s);
+    break;
+  }
+  case N_ALT:
+    edge_bytes(n->a, last, s);
+    edge_bytes(n->b, last, s);
+    break;
+  case N_REPEAT: case N_ATOMIC: case N_GROUP:
+    edge_bytes(n->a, last, s);
+    break;
+  }
+}
+
+// All the bytes that a match of n can contain
+static void all_bytes(node* n, byteset* s) {
+  switch (n->type) {
+  case N_SET:
+    set_union(s, &n->set);
+    break;
+  case N_CAT: case N_ALT:
+    all_bytes(n->a, s);
+    all_bytes(n->b, s);
+    break;
+  case N_REPEAT: case N_ATOMIC: case N_GROUP:
+    all_bytes(n->a, s);
+    break;
+  }
+}
+
+// True if n contains something that the DFA can't represent or that
+// limits the backtracking (assertions, atomic groups, possessive repeats)
+static int has_special(node* n) {
+  switch (n->type) {
+  case N_CAT: case N_ALT:
+    return has_special(n->a) || has_special(n->b);
+  case N_REPEAT:
+    return n->possessive || has_special(n->a);
+  case N_SET: case N_EMPTY:
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+// An unbounded repeat in n (not in an atomic group) that can match the
+// bytes in s, or NULL
+static node* overlapping_repeat(node* n, const byteset* s) {
+  node* q;
+  switch (n->type) {
+  case N_CAT: case N_ALT:
+    q = overlapping_repeat(n->a, s);
+    return q != NULL ? q : overlapping_repeat(n->b, s);
+  case N_REPEAT:
+    if (is_unbounded(n)) {
+      byteset c = {0};
+      all_bytes(n->a, &c);
+      set_intersect(&c, s);
+      if (!set_is_empty(&c)) return n;
+    }
+    return n->possessive ? NULL : overlapping_repeat(n->a, s);
+  default:
+    return NULL;
+  }
+}
+
+// The DFA (REGEX_DFA_FULL) of n in a new builder, NULL if it's too large
+static regex_builder* node_dfa(node* n) {
+  regex_builder* d = calloc(1, sizeof(regex_builder));
+  d->max_states = REDOS_MAX_STATES;
+  int end = 0;
+  int start = build(d, n, &end);
+  if (d->error == NULL) {
+    build_dfa(d, start, end, 0, 0);
+  }
+  if (d->error != NULL) {
+    builder_free(d);
+    return NULL;
+  }
+  return d;
+}
+
+// 1 if x and y match a common non-empty string, 0 if not, -1 if the
+// DFAs are too large
+static int languages_overlap(node* x, node* y) {
+  regex_builder* dx = node_dfa(x);
+  regex_builder* dy = dx != NULL ? node_dfa(y) : NULL;
+  if (dy == NULL) {
+    if (dx != NULL) builder_free(dx);
+    return -1;
+  }
+  // breadth first search of the product automaton from the pairs
+  // after the first byte
+  int ny = dy->dfa_count;
+  size_t pairs = (size_t)dx->dfa_count * ny;
+  unsigned char* seen = calloc(pairs, 1);
+  int* queue = malloc(pairs * sizeof(int));
+  int head = 0, tail = 0, found = 0;
+  for (int c = 0; c < 256; c++) {
+    int i = dx->dfa[0].next[c], j = dy->dfa[0].next[c];
+    if (i >= 0 && j >= 0 && !seen[(size_t)i*ny+j]) {
+      seen[(size_t)i*ny+j] = 1;
+      queue[tail++] = i*ny+j;
+    }
+  }
+  while (head < tail && !found) {
+    int i = queue[head] / ny, j = queue[head] % ny;
+    head++;
+    if (dx->dfa[i].final && dy->dfa[j].final) {
+      found = 1;
+      break;
+    }
+    for (int c = 0; c < 256; c++) {
+      int i2 = dx->dfa[i].next[c], j2 = dy->dfa[j].next[c];
+      if (i2 >= 0 && j2 >= 0 && !seen[(size_t)i2*ny+j2]) {
+        seen[(size_t)i2*ny+j2] = 1;
+        queue[tail++] = i2*ny+j2;
+      }
+    }
+  }
+  free(seen);
+  free(queue);
+  builder_free(dx);
+  builder_free(dy);
+  return found;
+}
+
+static void add_finding(regex_redos* r, int kind, int degree, int start, int end) {
+  r->findings = realloc(r->findings, (r->num_findings+1) * sizeof(regex_redos_finding));
+  regex_redos_finding* f = &r->findings[r->num_findings++];
+  f->kind = kind;
+  f->complexity = degree > 0 ? REGEX_REDOS_POLYNOMIAL : REGEX_REDOS_EXPONENTIAL;
+  f->degree = degree;
+  f->start = start;
+  f->end = end;
+}
+
+// The exponential case: r is an unbounded repeat
+static void analyze_repeat(regex_builder* b, node* r, regex_redos* res) {
+  node* x = r->a;
+  if (x->type == N_ATOMIC) {
+    return;
+  }
+  int exact = !has_special(x);
+  if (exact && x->type == N_ALT) {
+    node_list alts = {0};
+    int o = 0;
+    flatten(x, N_ALT, &alts);
+    for (int i = 0; i < alts.count && o == 0; i++) {
+      for (int j = i+1; j < alts.count && o == 0; j++) {
+        o = languages_overlap(alts.items[i], alts.items[j]);
+      }
+    }
+    free(alts.items);
+    if (o > 0) {
+      add_finding(res, REGEX_REDOS_AMBIGUOUS_ALTERNATION, 0, r->start, r->end);
+      return;
+    }
+    exact = o == 0;
+  }
+  if (exact) {
+    // X and XX+
+    node* more = new_node(b, N_REPEAT, x, NULL);
+    more->min = 1;
+    more->max = -1;
+    int o = languages_overlap(x, new_node(b, N_CAT, x, more));
+    if (o >= 0) {
+      if (o > 0) {
+        byteset all;
+        memset(&all, 0xff, sizeof(all));
+        add_finding(res, overlapping_repeat(x, &all) != NULL ? REGEX_REDOS_NESTED_QUANTIFIER : REGEX_REDOS_AMBIGUOUS_REPEAT,
+                    0, r->start, r->end);
+      }
+      return;
+    }
+  }
+  // approximately: an inner repeat that can take the bytes where two
+  // iterations meet
+  byteset first = {0}, last = {0};
+  edge_bytes(x, 0, &first);
+  edge_bytes(x, 1, &last);
+  set_intersect(&first, &last);
+  if (!set_is_empty(&first) && overlapping_repeat(x, &first) != NULL) {
+    add_finding(res, REGEX_REDOS_NESTED_QUANTIFIER, 0, r->start, r->end);
+  }
+}
+
+// The polynomial case: the unbounded repeats in the sequence of items
+static void analyze_sequence(node_list* l, int top, regex_redos* res) {
+  int n = l->count;
+  int* degree = calloc(n+1, sizeof(int));
+  int* from = malloc((n+1) * sizeof(int));
+  int can_fail = 0; // an item after i can fail
+  int leading = top && (n == 0 || l->items[0]->type != N_BOL);
+  int best = -1;
+  for (int i = 0; i < n; i++) {
+    node* x = l->items[i];
+    if (is_unbounded(x)) {
+      degree[i] = leading ? 2 : 1;
+      from[i] = i;
+      byteset xb = {0};
+      all_bytes(x->a, &xb);
+      for (int j = i-1; j >= 0; j--) {
+        node* y = l->items[j];
+        if (degree[j] > 0 && degree[j] + 1 > degree[i]) {
+          byteset both = {0};
+          all_bytes(y->a, &both);
+          set_intersect(&both, &xb);
+          int between = !set_is_empty(&both);
+          for (int k = j+1; k < i && between; k++) {
+            node* z = l->items[k];
+            byteset zb = {0};
+            all_bytes(z, &zb);
+            between = is_assertion(z) ? 0 : nullable(z) || set_subset(&zb, &both);
+          }
+          if (between) {
+            degree[i] = degree[j] + 1;
+            from[i] = from[j];
+          }
+        }
+      }
+    }
+    if (!nullable(x) || is_assertion(x)) {
+      leading = 0;
+    }
+  }
+  for (int i = n-1; i >= 0; i--) {
+    if (degree[i] >= 2 && (can_fail || !top) && (best < 0 || degree[i] > degree[best])) {
+      best = i;
+    }
+    if (!nullable(l->items[i]) || is_assertion(l->items[i])) {
+      can_fail = 1;
+    }
+  }
+  for (int i = 0; i < res->num_findings && best >= 0; i++) {
+    regex_redos_finding* f = &res->findings[i];
+    if (f->complexity == REGEX_REDOS_EXPONENTIAL && f->start == l->items[best]->start && f->end == l->items[best]->end) {
+      best = -1; // reported as exponential
+    }
+  }
+  if (best >= 0) {
+    add_finding(res, from[best] == best ? REGEX_REDOS_UNANCHORED_QUANTIFIER : REGEX_REDOS_OVERLAPPING_QUANTIFIERS,
+                degree[best], l->items[from[best]]->start, l->items[best]->end);
+  }
+  free(degree);
+  free(from);
+}
+
+/*
+  fails is true if what comes after n can fail. An exponential repeat
+  needs that: without it the first way the repeat matches is a match,
+  e.g. (a+)+ alone, and nothing is backtracked. The contents of
+  lookarounds and atomic groups are never backtracked into, so what
+  comes after them can't fail.
+*/
+static void analyze(regex_builder* b, node* n, int top, int fails, regex_redos* res) {
+  if (n->type == N_ALT) {
+    analyze(b, n->a, top, fails, res);
+    analyze(b, n->b, top, fails, res);
+    return;
+  }
+  node_list l = {0};
+  flatten(n, N_CAT, &l);
+  // suffix_fails[i]: what comes after item i can fail
+  int* suffix_fails = malloc((l.count+1) * sizeof(int));
+  for (int i = l.count-1; i >= 0; i--) {
+    suffix_fails[i] = fails;
+    fails = fails || !nullable(l.items[i]) || is_assertion(l.items[i]);
+  }
+  for (int i = 0; i < l.count; i++) {
+    if (is_unbounded(l.items[i]) && suffix_fails[i]) {
+      analyze_repeat(b, l.items[i], res);
+    }
+  }
+  analyze_sequence(&l, top, res);
+  for (int i = 0; i < l.count; i++) {
+    node* x = l.items[i];
+    if (x->type == N_ALT) {
+      analyze(b, x, 0, suffix_fails[i], res);
+    } else if (x->type == N_REPEAT) {
+      // another iteration can fail if it's needed
+      analyze(b, x->a, 0, suffix_fails[i] || x->min > 1, res);
+    } else if (x->type == N_LOOK || x->type == N_ATOMIC) {
+      analyze(b, x->a, 0, 0, res);
+    }
+  }
+  free(suffix_fails);
+  free(l.items);
+}
+
+void regex_dfa_redos(const char* pattern, int pattern_size, regex_redos* res) {
+  memset(res, 0, sizeof(regex_redos));
+  regex_builder* b = calloc(1, sizeof(regex_builder));
+  b->pat = pattern;
+  b->len = pattern_size;
+  b->lenient = 1;
+  node* n = parse_alt(b);
+  if (b->error == NULL && b->pos < b->len) {
+    b->error = "unmatched )";
+  }
+  if (b->error != NULL) {
+    res->complexity = REGEX_REDOS_UNKNOWN;
+    res->error = b->error;
+    res->erroffset = b->pos;
+    builder_free(b);
+    return;
+  }
+  analyze(b, n, 1, 0, res);
+  res->complexity = REGEX_REDOS_LINEAR;
+  res->degree = 1;
+  for (int i = 0; i < res->num_findings; i++) {
+    regex_redos_finding* f = &res->findings[i];
+    if (f->complexity == REGEX_REDOS_EXPONENTIAL) {
+      res->complexity = REGEX_REDOS_EXPONENTIAL;
+      res->degree = 0;
+    } else if (res->complexity != REGEX_REDOS_EXPONENTIAL && f->degree > res->degree) {
+      res->complexity = REGEX_REDOS_POLYNOMIAL;
+      res->degree = f->degree;
+    }
+  }
+  builder_free(b);
+}
+
+void regex_redos_free(regex_redos* res) {
+  free(res->findings);
+  res->findings = NULL;
+  res->num_findings = 0;
+}
+
+/*
+  The rewriter (regex_dfa_rewrite()). The pattern is parsed with the
+  groups (regex_builder.groups), the AST is rewritten bottom up and
+  written back. The atoms are copied from the pattern (\d, [a-z], \.
+  etc are kept as they are), so only the rewritten parts are new.
+  Only the supported syntax (see regex_dfa.h) is rewritten: a pattern
+  with backreferences, lookarounds etc is left as it is, which is
+  why the groups can be renumbered (REGEX_REWRITE_NO_CAPTURES).
+*/
+typedef struct {
+  regex_builder* b;
+  int flags;
+  regex_rewrite* rewrites;
+  node** nodes;      // the node of each rewrite (its text is written at the end)
+  int count;
+} rewriter;
+
+static void rewrite_add(rewriter* w, int kind, int start, int end, node* n) {
+  w->rewrites = realloc(w->rewrites, (w->count+1) * sizeof(regex_rewrite));
+  w->nodes = realloc(w->nodes, (w->count+1) * sizeof(node*));
+  w->rewrites[w->count].kind = kind;
+  w->rewrites[w->count].start = start;
+  w->rewrites[w->count].end = end;
+  w->rewrites[w->count].text = NULL;
+  w->nodes[w->count++] = n;
+}
+
+// The part of the pattern that n was parsed from
+static void span(node* n, int* start, int* end) {
+  if (n->type == N_EMPTY) {
+    return;
+  }
+  if (n->type == N_CAT || n->type == N_ALT) {
+    span(n->a, start, end);
+    span(n->b, start, end);
+    return;
+  }
+  if (n->start < *start) *start = n->start;
+  if (n->end > *end) *end = n->end;
+}
+
+static void emit(regex_builder* b, node* n, strbuf* sb) {
+  char q[32];
+  switch (n->type) {
+  case N_EMPTY:
+    break;
+  case N_CAT:
+    emit(b, n->a, sb);
+    emit(b, n->b, sb);
+    break;
+  case N_ALT:
+    emit(b, n->a, sb);
+    sb_add_str(sb, "|");
+    emit(b, n->b, sb);
+    break;
+  case N_GROUP: case N_ATOMIC:
+    sb_add_str(sb, n->type == N_ATOMIC ? "(?>" : n->capture ? "(" : "(?:");
+    emit(b, n->a, sb);
+    sb_add_str(sb, ")");
+    break;
+  case N_REPEAT:
+    emit(b, n->a, sb);
+    if (n->max < 0) {
+      if (n->min <= 1) snprintf(q, sizeof(q), "%s", n->min == 0 ? "*" : "+");
+      else snprintf(q, sizeof(q), "{%d,}", n->min);
+    } else if (n->min == 0 && n->max == 1) {
+      snprintf(q, sizeof(q), "?");
+    } else if (n->min == n->max) {
+      snprintf(q, sizeof(q), "{%d}", n->min);
+    } else {
+      snprintf(q, sizeof(q), "{%d,%d}", n->min, n->max);
+    }
+    sb_add_str(sb, q);
+    if (n->lazy) sb_add_str(sb, "?");
+    if (n->possessive) sb_add_str(sb, "+");
+    break;
+  default:
+    if (n->text != NULL) {
+      sb_add_str(sb, n->text);
+    } else {
+      sb_add(sb, b->pat + n->start, n->end - n->start);
+    }
+  }
+}
+
+// The single byte (ASCII) literal that the alternative n starts with, or -1
+static int first_literal(regex_builder* b, node* n) {
+  node_list l = {0};
+  flatten(n, N_CAT, &l);
+  int c = -1;
+  if (l.count > 0 && l.items[0]->type == N_SET && l.items[0]->text == NULL) {
+    node* x = l.items[0];
+    for (int i = 0; i < 0x80; i++) {
+      if (set_has(&x->set, i)) {
+        c = c < 0 ? i : -2;
+      }
+    }
+    byteset one = {0};
+    if (c >= 0) set_add(&one, c);
+    if (c < 0 || memcmp(&one, &x->set, sizeof(byteset)) != 0 || b->pat[x->start] == '.') {
+      c = -1;
+    }
+  }
+  free(l.items);
+  return c;
+}
+
+static node* chain(regex_builder* b, node_list* l, int from, int type) {
+  if (from >= l->count) {
+    return new_node(b, N_EMPTY, NULL, NULL);
+  }
+  node* n = l->items[from];
+  for (int i = from+1; i < l->count; i++) {
+    n = new_node(b, type, n, l->items[i]);
+  }
+  return n;
+}
+
+/*
+  The text of an alternative n inside a character class, or NULL if
+  it's not a single character or (non negated) class: a, \., \d,
+  [a-z] etc.
+*/
+static char* class_item(regex_builder* b, node* n, strbuf* sb) {
+  node_list l = {0};
+  flatten(n, N_CAT, &l);
+  node* x = l.count == 1 ? l.items[0] : NULL;
+  free(l.items);
+  if (x == NULL || x->type != N_SET) {
+    return NULL;
+  }
+  const char* t = x->text != NULL ? x->text : b->pat + x->start;
+  int len = x->text != NULL ? (int)strlen(x->text) : x->end - x->start;
+  if (t[0] == '.' && len == 1) {
+    return NULL; // depends on PCRE2_DOTALL
+  }
+  if (t[0] == '[') {
+    // the inside of the class, unless it starts or ends with something
+    // that would change meaning in another class
+    if (len < 3 || t[1] == '^' || t[1] == ']' || t[1] == '-' || t[len-2] == '-') {
+      return NULL;
+    }
+    sb_add(sb, t+1, len-2);
+  } else if (len == 1 && strchr("\\]^-[", t[0]) != NULL) {
+    sb_add_str(sb, "\\");
+    sb_add(sb, t, 1);
+  } else {
+    sb_add(sb, t, len);
+  }
+  return sb->s;
+}
+
+static node* rewrite(rewriter* w, node* n);
+static node* rewrite_alternatives(rewriter* w, node_list* alts, const int* spans);
+
+/*
+  Prefix factoring of the k (>= 2) adjacent alternatives alts, which
+  start with the same literal: (abc|abd) -> ab(?:c|d). spans are the
+  start and end offsets of the alternatives (before they were
+  rewritten), or NULL.
+*/
+static node* factor(rewriter* w, node** alts, const int* spans, int k) {
+  regex_builder* b = w->b;
+  node_list* items = calloc(k, sizeof(node_list));
+  for (int i = 0; i < k; i++) {
+    flatten(alts[i], N_CAT, &items[i]);
+  }
+  int p = 0;
+  for (;;) {
+    int c = -1, same = 1;
+    for (int i = 0; i < k && same; i++) {
+      int ci = p < items[i].count ? first_literal(b, items[i].items[p]) : -1;
+      same = ci >= 0 && (i == 0 || ci == c);
+      c = ci;
+    }
+    if (!same) break;
+    p++;
+  }
+  int start = b->len, end = -1;
+  node_list rests = {0};
+  for (int i = 0; i < k; i++) {
+    span(alts[i], &start, &end);
+    node_list_add(&rests, chain(b, &items[i], p, N_CAT));
+  }
+  if (spans != NULL) {
+    start = spans[0];
+    end = spans[2*k-1];
+  }
+  int count = w->count;
+  node* inner = rewrite_alternatives(w, &rests, NULL);
+  w->count = count; // the rewrites of the rests are a part of this one
+  if (inner->type != N_SET) {
+    int s = b->len, e = -1;
+    span(inner, &s, &e);
+    inner = new_node(b, N_GROUP, inner, NULL);
+    inner->start = s;
+    inner->end = e;
+  }
+  node_list prefix = {0};
+  for (int i = 0; i < p; i++) {
+    node_list_add(&prefix, items[0].items[i]);
+  }
+  node_list_add(&prefix, inner);
+  node* n = chain(b, &prefix, 0, N_CAT);
+  rewrite_add(w, REGEX_REWRITE_PREFIX_FACTORING, start, end, n);
+  for (int i = 0; i < k; i++) {
+    free(items[i].items);
+  }
+  free(items);
+  free(rests.items);
+  free(prefix.items);
+  return n;
+}
+
+// The (rewritten) alternatives: prefix factoring, then a class if they
+// are all single characters. spans as for factor().
+static node* rewrite_alternatives(rewriter* w, node_list* alts, const int* spans) {
+  regex_builder* b = w->b;
+  node_list out = {0};
+  for (int i = 0; i < alts->count; ) {
+    int c = first_literal(b, alts->items[i]);
+    int j = i+1;
+    while (j < alts->count && c >= 0 && first_literal(b, alts->items[j]) == c) j++;
+    node_list_add(&out, j - i >= 2 ? factor(w, alts->items + i, spans ? spans + 2*i : NULL, j - i) : alts->items[i]);
+    i = j;
+  }
+  node* n;
+  strbuf sb = { NULL, 0, 0 };
+  sb_add_str(&sb, "[");
+  int is_class = out.count >= 2;
+  for (int i = 0; i < out.count && is_class; i++) {
+    is_class = class_item(b, out.items[i], &sb) != NULL;
+  }
+  if (is_class) {
+    sb_add_str(&sb, "]");
+    n = new_node(b, N_SET, NULL, NULL);
+    n->start = b->len;
+    n->end = -1;
+    for (int i = 0; i < out.count; i++) {
+      byteset s = {0};
+      edge_bytes(out.items[i], 0, &s);
+      set_union(&n->set, &s);
+      span(out.items[i], &n->start, &n->end);
+    }
+    if (spans != NULL) {
+      n->start = spans[0];
+      n->end = spans[2*alts->count-1];
+    }
+    n->text = sb.s;
+    rewrite_add(w, REGEX_REWRITE_ALTERNATION_TO_CLASS, n->start, n->end, n);
+  } else {
+    free(sb.s);
+    n = chain(b, &out, 0, N_ALT);
+  }
+  free(out.items);
+  return n;
+}
+
+// A non-capturing group without alternatives
+static int is_plain_group(node* n) {
+  return n->type == N_GROUP && !n->capture && n->a->type != N_ALT;
+}
+
+/*
+  x+ -> x++ if x is a single character (class) and the next item can't
+  start with x: backtracking into x+ can't give a match.
+*/
+static void possessify(rewriter* w, node* x, node* y) {
+  if (x->type != N_REPEAT || x->lazy || x->possessive || x->min == x->max || x->a->type != N_SET || nullable(y)) {
+    return;
+  }
+  byteset first = {0};
+  edge_bytes(y, 0, &first);
+  set_intersect(&first, &x->a->set);
+  if (set_is_empty(&first)) {
+    x->possessive = 1;
+    rewrite_add(w, REGEX_REWRITE_POSSESSIVE, x->start, x->end, x);
+  }
+}
+
+/*
+  (?:...) -> (?>...) if the alternatives are fixed strings (of single
+  characters/classes) that start with different characters: only one
+  of them can match, in only one way, so backtracking into the group
+  can't give a match.
+*/
+static void atomize(rewriter* w, node* g) {
+  node_list alts = {0};
+  flatten(g->a, N_ALT, &alts);
+  byteset seen = {0};
+  int ok = alts.count >= 2;
+  for (int i = 0; i < alts.count && ok; i++) {
+    node_list l = {0};
+    flatten(alts.items[i], N_CAT, &l);
+    ok = l.count > 0;
+    for (int j = 0; j < l.count && ok; j++) {
+      ok = l.items[j]->type == N_SET;
+    }
+    if (ok) {
+      byteset both = l.items[0]->set;
+      set_intersect(&both, &seen);
+      ok = set_is_empty(&both);
+      set_union(&seen, &l.items[0]->set);
+    }
+    free(l.items);
+  }
+  free(alts.items);
+  if (ok) {
+    g->type = N_ATOMIC;
+    rewrite_add(w, REGEX_REWRITE_ATOMIC_GROUP, g->start, g->end, g);
+  }
+}
+
+static node* rewrite(rewriter* w, node* n) {
+  regex_builder* b = w->b;
+  node_list l = {0};
+  switch (n->type) {
+  case N_CAT: {
+    node_list out = {0};
+    flatten(n, N_CAT, &l);
+    for (int i = 0; i < l.count; i++) {
+      node* x = rewrite(w, l.items[i]);
+      if (is_plain_group(x)) {
+        // (?:ab)c -> abc
+        rewrite_add(w, REGEX_REWRITE_REDUNDANT_GROUP, x->start, x->end, x->a);
+        flatten(x->a, N_CAT, &out);
+      } else {
+        node_list_add(&out, x);
+      }
+    }
+    for (int i = 0; i+1 < out.count; i++) {
+      possessify(w, out.items[i], out.items[i+1]);
+    }
+    n = chain(b, &out, 0, N_CAT);
+    free(out.items);
+    break;
+  }
+  case N_ALT: {
+    flatten(n, N_ALT, &l);
+    int* spans = malloc(2 * l.count * sizeof(int));
+    for (int i = 0; i < l.count; i++) {
+      spans[2*i] = b->len;
+      spans[2*i+1] = -1;
+      span(l.items[i], &spans[2*i], &spans[2*i+1]);
+      l.items[i] = rewrite(w, l.items[i]);
+    }
+    n = rewrite_alternatives(w, &l, spans);
+    free(spans);
+    break;
+  }
+  case N_GROUP:
+    n->a = rewrite(w, n->a);
+    if (n->capture && (w->flags & REGEX_REWRITE_NO_CAPTURES)) {
+      n->capture = 0;
+      rewrite_add(w, REGEX_REWRITE_CAPTURE_ELIMINATION, n->start, n->end, n);
+    }
+    if (!n->capture && n->a->type == N_ALT) {
+      atomize(w, n);
+    }
+    break;
+  case N_REPEAT:
+    n->a = rewrite(w, n->a);
+    if (is_plain_group(n->a)) {
+      // (?:a)+ -> a+
+      flatten(n->a->a, N_CAT, &l);
+      if (l.count == 1 && l.items[0]->type == N_SET) {
+        rewrite_add(w, REGEX_REWRITE_REDUNDANT_GROUP, n->a->start, n->a->end, l.items[0]);
+        n->a = l.items[0];
+      }
+    }
+    break;
+  }
+  free(l.items);
+  return n;
+}
+
+char* regex_dfa_rewrite(const char* pattern, int pattern_size, int flags, regex_rewrite** rewrites, int* num_rewrites) {
+  *rewrites = NULL;
+  *num_rewrites = 0;
+  regex_builder* b = calloc(1, sizeof(regex_builder));
+  b->pat = pattern;
+  b->len = pattern_size;
+  b->groups = 1;
+  node* n = parse_alt(b);
+  if (b->error == NULL && b->pos < b->len) {
+    b->error = "unmatched )";
+  }
+  if (b->error != NULL) {
+    builder_free(b);
+    return NULL;
+  }
+  rewriter w = { b, flags, NULL, NULL, 0 };
+  n = rewrite(&w, n);
+  char* result = NULL;
+  if (w.count > 0) {
+    strbuf sb = { NULL, 0, 0 };
+    sb_add(&sb, "", 0);
+    emit(b, n, &sb);
+    result = sb.s;
+    for (int i = 0; i < w.count; i++) {
+      strbuf t = { NULL, 0, 0 };
+      sb_add(&t, "", 0);
+      emit(b, w.nodes[i], &t);
+      w.rewrites[i].text = t.s;
+    }
+  }
+  free(w.nodes);
+  *rewrites = w.rewrites;
+  *num_rewrites = w.count;
+  builder_free(b);
+  return result;
+}
+
+void regex_rewrites_free(regex_rewrite* rewrites, int num_rewrites) {
+  for (int i = 0; i < num_rewrites; i++) {
+    free(rewrites[i].text);
+  }
+  free(rewrites);
+}
@@ -0,0 +1,186 @@
+/*
+  Regular expressions to DFA.
+
+  This is used by the ahead-of-time compiler (regex_aot.c) and by the
+  regex predicates that need an automaton instead of PCRE2 (see
+  regex_generate/3 in bp_pcre2.c). It also builds the (minimal) DFA and
+  a pattern of a list of words (regex_from_words/1), the trigram
+  query of a pattern (regex_index_search/2), the ReDoS analysis
+  (regex_analyze/1) and the pattern rewriter (regex_optimize/1).
+
+  Only a subset of the PCRE2 syntax is supported (roughly what
+  regex_generating_strings_v3.pi parses):
+   - literals, escaped characters (\. \\ \n \t etc), .
+   - character classes [abc] [^a-z] and \d \w \s \D \W \S
+   - groups (...) and (?:...), alternation |
+   - repetition * + ? {n} {n,} {n,m} (and the lazy variants *? etc,
+     which match the same strings)
+   - ^ at the start and $ at the end of the pattern
+  Other patterns (backreferences, lookarounds, possessive quantifiers,
+  flags, \b etc) give an error, except in the ReDoS analysis
+  (regex_dfa_redos()), which parses them approximately.
+
+  The automaton works on bytes, i.e. it's the same as PCRE2 without
+  PCRE2_UTF on the UTF-8 bytes.
+
+  Created by Hakan Kjellerstrand (hakank@gmail.com), http://hakank.org/
+
+*/
+#ifndef REGEX_DFA_H
+#define REGEX_DFA_H
+
+/*
+  The modes:
+  - REGEX_DFA_SEARCH: the semantics of regex/2: the pattern is
+    searched for anywhere in the subject (unless it starts with ^),
+    and if the pattern doesn't end with $ the final states are
+    absorbing, i.e. a match is found as soon as a final state is
+    reached (the transitions from a final state are not computed).
+  - REGEX_DFA_FULL: the automaton accepts exactly the strings of the
+    pattern's language (^ at the start and $ at the end are ignored).
+*/
+#define REGEX_DFA_SEARCH 0
+#define REGEX_DFA_FULL   1
+
+typedef struct regex_dfa {
+  int num_states;        // state 0 is the start state
+  int* next;             // next[s*256+c], -1 if no match is possible
+  unsigned char* final;  // final[s] is 1 for the final states
+  int eol;               // the pattern ends with $ (REGEX_DFA_SEARCH)
+} regex_dfa;
+
+/*
+  Compiles pattern (of pattern_size bytes) to a minimized DFA with at
+  most max_states states. Returns NULL on error, with *error and
+  *erroffset set.
+*/
+regex_dfa* regex_dfa_compile(const char* pattern, int pattern_size, int mode, int max_states,
+                             const char** error, int* erroffset);
+
+void regex_dfa_free(regex_dfa* dfa);
+
+/*
+  True if the DFA (REGEX_DFA_FULL) accepts the n bytes in s.
+*/
+int regex_dfa_full_match(const regex_dfa* dfa, const unsigned char* s, size_t n);
+
+/*
+  The length (in bytes) of the longest string accepted by the DFA
+  (REGEX_DFA_FULL), or -1 if it's unbounded.
+*/
+long regex_dfa_max_length(const regex_dfa* dfa);
+
+/*
+  Builds the minimal acyclic DFA of the words (sizes[i] is the length
+  of words[i]; the words don't have to be sorted or unique) and
+  returns a pattern (malloc:ed) that matches exactly the words,
+  e.g. "(?:a(?:nd|t)|do|i[ns]|o[fr])" for and, at, do, in, is, of, or.
+  *dfa is the DFA (as for REGEX_DFA_FULL), or NULL if it has more than
+  max_states states.
+*/
+char* regex_dfa_words(const char** words, const int* sizes, int num_words, int max_states, regex_dfa** dfa);
+
+/*
+  Trigram queries (for regex_index_search/2): a necessary condition for
+  a string to match the pattern, as an AND/OR tree of the trigrams that
+  the string must contain. A trigram is the 3 bytes b0 b1 b2 as
+  (b0 << 16) | (b1 << 8) | b2.
+*/
+#define REGEX_QUERY_ALL     0  // no condition
+#define REGEX_QUERY_TRIGRAM 1
+#define REGEX_QUERY_AND     2
+#define REGEX_QUERY_OR      3
+
+typedef struct regex_query {
+  int op;
+  int trigram;                // REGEX_QUERY_TRIGRAM
+  int count;                  // REGEX_QUERY_AND, REGEX_QUERY_OR
+  struct regex_query** args;
+} regex_query;
+
+/*
+  The query of pattern. For a pattern which is not supported (see
+  above) the query is REGEX_QUERY_ALL.
+*/
+regex_query* regex_dfa_query(const char* pattern, int pattern_size);
+
+void regex_query_free(regex_query* q);
+
+/*
+  The ReDoS analysis (for regex_analyze/1): the worst case time of a
+  backtracking match of the pattern (as a function of the subject's
+  length) and the parts of the pattern that cause it.
+*/
+#define REGEX_REDOS_UNKNOWN     0  // the pattern couldn't be parsed
+#define REGEX_REDOS_LINEAR      1
+#define REGEX_REDOS_POLYNOMIAL  2
+#define REGEX_REDOS_EXPONENTIAL 3
+
+// The kinds of findings
+#define REGEX_REDOS_NESTED_QUANTIFIER      0  // (a+)+
+#define REGEX_REDOS_AMBIGUOUS_ALTERNATION  1  // (a|ab|b)*
+#define REGEX_REDOS_AMBIGUOUS_REPEAT       2  // (a|aa)*
+#define REGEX_REDOS_OVERLAPPING_QUANTIFIERS 3 // \d+\d+, .*a.*
+#define REGEX_REDOS_UNANCHORED_QUANTIFIER  4  // \s+$
+
+typedef struct regex_redos_finding {
+  int kind;
+  int complexity;    // REGEX_REDOS_EXPONENTIAL or REGEX_REDOS_POLYNOMIAL
+  int degree;        // REGEX_REDOS_POLYNOMIAL
+  int start, end;    // the offending part of the pattern (byte offsets)
+} regex_redos_finding;
+
+typedef struct regex_redos {
+  int complexity;
+  int degree;        // 1 for linear, 0 for exponential and unknown
+  int num_findings;
+  regex_redos_finding* findings;
+  const char* error; // REGEX_REDOS_UNKNOWN
+  int erroffset;
+} regex_redos;
+
+/*
+  Analyzes pattern (of pattern_size bytes). This is a static, and
+  conservative, analysis: a finding means that some subject can take
+  that long, not that PCRE2's optimizations (e.g. the required
+  character check) don't avoid it. An exponential repeat must be
+  followed by something that can fail, e.g. (a+)+b or (a+)+$, since
+  otherwise the first way it matches is a match: (a+)+ is linear.
+*/
+void regex_dfa_redos(const char* pattern, int pattern_size, regex_redos* res);
+
+void regex_redos_free(regex_redos* res);
+
+/*
+  The pattern rewriter (for regex_optimize/1): semantics-preserving
+  rewrites of a pattern (with the default compile options) before it's
+  compiled. Only the supported syntax (see above) is rewritten.
+*/
+#define REGEX_REWRITE_NO_CAPTURES 1  // the captures are not read: (...) may be (?:...)
+
+// The kinds of rewrites
+#define REGEX_REWRITE_PREFIX_FACTORING     0  // (abc|abd) -> ab[cd]
+#define REGEX_REWRITE_ALTERNATION_TO_CLASS 1  // (?:a|b|\d) -> [ab\d]
+#define REGEX_REWRITE_REDUNDANT_GROUP      2  // (?:ab)c -> abc, (?:a)+ -> a+
+#define REGEX_REWRITE_POSSESSIVE           3  // \d+\. -> \d++\.
+#define REGEX_REWRITE_ATOMIC_GROUP         4  // (?:Mon|Tue)day -> (?>Mon|Tue)day
+#define REGEX_REWRITE_CAPTURE_ELIMINATION  5  // (a+)b -> (?:a+)b
+
+typedef struct regex_rewrite {
+  int kind;
+  int start, end;    // the rewritten part of the pattern (byte offsets)
+  char* text;        // what it was rewritten to
+} regex_rewrite;
+
+/*
+  Returns the rewritten pattern (malloc:ed), or NULL if there's
+  nothing to rewrite (or the pattern is not supported). *rewrites
+  (*num_rewrites of them, free with regex_rewrites_free()) are the
+  rewrites that were made.
+*/
+char* regex_dfa_rewrite(const char* pattern, int pattern_size, int flags,
+                        regex_rewrite** rewrites, int* num_rewrites);
+
+void regex_rewrites_free(regex_rewrite* rewrites, int num_rewrites);
+
+#endif
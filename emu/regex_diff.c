@@ -0,0 +1,957 @@
+/*
+  Differential test of the matching engines.
+
+  This is a standalone program (like regex_aot.c, not a part of Picat)
+  that matches a corpus of patterns and subjects with all the engines
+  that the regex module uses, reports every subject where an engine
+  doesn't agree with PCRE2's interpreter, and the time per engine.
+
+  Usage:
+    $ gcc -O2 -DREGEX_AOT_NO_CPREDS -o regex_diff regex_diff.c regex_dfa.c bp_pcre2_aot.c -lpcre2-8 -lpcre2-32
+    $ ./regex_diff [-s Seed] [-n Generated] [-v] File ...
+  (In emu/ there is a make target: "make -f Makefile.linux64_pcre2 difftest".)
+  The exit status is 1 if there is a mismatch.
+
+  The files are:
+  - Picat programs (*.pi): the patterns and subjects are taken from
+    the calls with string literals, e.g. regex("^(ho)\\1+$","hohohoho"),
+    regex_find_all(Pattern,Subject...) and
+    regex_replace(Pattern,Replacement,Subject...), and the patterns
+    assigned to a variable named *Regex or *Pattern, e.g.
+    Regex = "(?x)...".
+  - corpus files: a line "p Pattern" starts a new pattern and the
+    lines "s Subject" are subjects of the pattern. Empty lines and
+    lines starting with % are ignored.
+  The patterns of the ahead-of-time compiled matchers (bp_pcre2_aot.h)
+  are always tested.
+
+  For each pattern, Generated (default 50) subjects are generated with
+  the random seed Seed (default 1):
+  - strings of the pattern (random walks in its DFA), some of them
+    with a random prefix and suffix
+  - mutations of the subjects (a character inserted, deleted or
+    replaced)
+  - random strings of the characters in the pattern and the subjects
+
+  The engines (each compared with "pcre2", i.e. pcre2_match without JIT):
+  - pcre2_jit: JIT compiled pattern (if PCRE2 has JIT support):
+               the result and the offsets of all the captures
+  - pcre2_dfa: pcre2_dfa_match (the patterns it supports): match or
+               not and the start of the match
+  - dfa:       regex_dfa.c (REGEX_DFA_SEARCH, as for the AOT matchers)
+  - dfa_full:  regex_dfa.c (REGEX_DFA_FULL, as for regex_fullmatch/2),
+               compared with pcre2_match with PCRE2_ANCHORED and
+               PCRE2_ENDANCHORED
+  - aot:       the AOT matchers in bp_pcre2_aot.c
+  - rewrite:   the pattern rewritten by regex_dfa_rewrite() (as with
+               regex_optimize(on)): the result and the offsets of all
+               the captures
+  - rewrite_nc: the pattern rewritten with REGEX_REWRITE_NO_CAPTURES
+               (as for regex/2, regex_count/2 etc): match or not and
+               the offsets of the match
+  - pcre2_32:  the 32-bit library (as for a (*UTF) pattern) on the code
+               points of the subjects, compared with pcre2_match with
+               PCRE2_UTF (the subjects that are valid UTF-8): the
+               result and the offsets of all the captures (as bytes)
+
+  With -v the time per subject of each engine is shown for each pattern.
+
+  Created by Hakan Kjellerstrand (hakank@gmail.com), http://hakank.org/
+
+*/
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <pcre2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include "regex_dfa.h"
+#include "bp_pcre2_aot.h"
+
+#define DIFF_MAX_STATES 4096
+#define DIFF_MAX_PAIRS 32    // the capture offsets that are compared
+#define DIFF_MAX_SHOWN 10    // mismatches shown per engine
+#define DIFF_WORKSPACE 1000  // for pcre2_dfa_match
+
+typedef struct {
+  char* s;
+  size_t len;
+} diff_string;
+
+typedef struct {
+  diff_string pattern;
+  diff_string* subjects;
+  int num_subjects;
+  int max_subjects;
+} diff_pattern;
+
+static diff_pattern* patterns = NULL;
+static int num_patterns = 0;
+
+typedef struct {
+  const char* name;
+  const char* pattern;
+  int (*match)(const unsigned char* s, size_t n);
+} diff_aot;
+
+static diff_aot aot_matchers[] = { REGEX_AOT_MATCHERS };
+
+enum { E_PCRE2, E_JIT, E_PCRE2_DFA, E_DFA, E_DFA_FULL, E_AOT, E_REWRITE, E_REWRITE_NC, E_PCRE2_32, NUM_ENGINES };
+static const char* engine_names[NUM_ENGINES] = { "pcre2", "pcre2_jit", "pcre2_dfa", "dfa", "dfa_full", "aot",
+                                                 "rewrite", "rewrite_nc", "pcre2_32" };
+
+typedef struct {
+  uint64_t patterns;
+  uint64_t subjects;
+  uint64_t mismatches;
+  uint64_t ns;
+} diff_engine;
+
+static diff_engine engines[NUM_ENGINES];
+static int verbose = 0;
+
+static uint64_t diff_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t diff_seed = 1;
+
+// xorshift64*
+static uint32_t diff_rand(void) {
+  diff_seed ^= diff_seed >> 12;
+  diff_seed ^= diff_seed << 25;
+  diff_seed ^= diff_seed >> 27;
+  return (uint32_t)((diff_seed * 2685821657736338717ULL) >> 32);
+}
+
+
+/*
+  The corpus
+*/
+static diff_pattern* add_pattern(const char* s, size_t len) {
+  for (int i = 0; i < num_patterns; i++) {
+    if (patterns[i].pattern.len == len && memcmp(patterns[i].pattern.s, s, len) == 0) {
+      return &patterns[i];
+    }
+  }
+  patterns = realloc(patterns, (num_patterns+1) * sizeof(diff_pattern));
+  diff_pattern* p = &patterns[num_patterns++];
+  memset(p, 0, sizeof(diff_pattern));
+  p->pattern.s = malloc(len+1);
+  memcpy(p->pattern.s, s, len);
+  p->pattern.s[len] = '\0';
+  p->pattern.len = len;
+  return p;
+}
+
+static void add_subject(diff_pattern* p, const char* s, size_t len) {
+  for (int i = 0; i < p->num_subjects; i++) {
+    if (p->subjects[i].len == len && memcmp(p->subjects[i].s, s, len) == 0) {
+      return;
+    }
+  }
+  if (p->num_subjects == p->max_subjects) {
+    p->max_subjects = p->max_subjects ? 2*p->max_subjects : 16;
+    p->subjects = realloc(p->subjects, p->max_subjects * sizeof(diff_string));
+  }
+  diff_string* d = &p->subjects[p->num_subjects++];
+  d->s = malloc(len+1);
+  memcpy(d->s, s, len);
+  d->s[len] = '\0';
+  d->len = len;
+}
+
+static char* read_file(const char* file, size_t* len) {
+  FILE* in = fopen(file, "rb");
+  if (in == NULL) {
+    return NULL;
+  }
+  fseek(in, 0, SEEK_END);
+  *len = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  char* s = malloc(*len+1);
+  *len = fread(s, 1, *len, in);
+  s[*len] = '\0';
+  fclose(in);
+  return s;
+}
+
+/*
+  Parses the Picat string literal at s (which starts with ").
+  Returns the end of the literal, and sets *out (malloc:ed) and *len.
+*/
+static const char* parse_picat_string(const char* s, const char* end, char** out, size_t* len) {
+  char* r = malloc(end - s + 1);
+  size_t n = 0;
+  s++;
+  while (s < end && *s != '"') {
+    if (*s == '\\' && s+1 < end) {
+      s++;
+      switch (*s) {
+      case 'n': r[n++] = '\n'; break;
+      case 't': r[n++] = '\t'; break;
+      case 'r': r[n++] = '\r'; break;
+      case '\\': case '"': case '\'': r[n++] = *s; break;
+      default: r[n++] = '\\'; r[n++] = *s; break;
+      }
+      s++;
+    } else {
+      r[n++] = *s++;
+    }
+  }
+  r[n] = '\0';
+  *out = r;
+  *len = n;
+  return s < end ? s+1 : s;
+}
+
+// true if the string literal at p is assigned to a variable *Regex or *Pattern
+static int is_pattern_assignment(const char* text, const char* p) {
+  const char* q = p - 1;
+  while (q >= text && (*q == ' ' || *q == '\t')) q--;
+  if (q < text || *q != '=' || (q > text && (q[-1] == '=' || q[-1] == ':'))) return 0;
+  q--;
+  while (q >= text && (*q == ' ' || *q == '\t')) q--;
+  const char* id_end = q + 1;
+  while (q >= text && (isalnum((unsigned char)*q) || *q == '_')) q--;
+  const char* id = q + 1;
+  return (id_end - id >= 5 && strncmp(id_end - 5, "Regex", 5) == 0) ||
+         (id_end - id >= 7 && strncmp(id_end - 7, "Pattern", 7) == 0);
+}
+
+/*
+  The patterns and subjects of the calls regex*(...) with string literals
+  in a Picat program.
+*/
+static void read_picat(const char* file) {
+  size_t size;
+  char* text = read_file(file, &size);
+  if (text == NULL) {
+    fprintf(stderr, "regex_diff: cannot open %s\n", file);
+    exit(2);
+  }
+  const char* end = text + size;
+  for (const char* p = text; p < end; p++) {
+    if (*p == '"') {
+      // the strings that are not arguments of a regex call
+      char* s;
+      size_t len;
+      int assigned = is_pattern_assignment(text, p);
+      p = parse_picat_string(p, end, &s, &len) - 1;
+      if (assigned) {
+        add_pattern(s, len);
+      }
+      free(s);
+      continue;
+    }
+    if (strncmp(p, "regex", 5) != 0 || (p > text && (isalnum((unsigned char)p[-1]) || p[-1] == '_'))) {
+      continue;
+    }
+    const char* name = p;
+    while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+    if (p >= end || *p != '(') {
+      p--;
+      continue;
+    }
+    int replace = strstr(name, "replace") != NULL && strstr(name, "replace") < p;
+    // the first three arguments: string literals or NULL
+    char* args[3] = { NULL, NULL, NULL };
+    size_t lens[3] = { 0, 0, 0 };
+    p++;
+    for (int a = 0; a < 3 && p < end; a++) {
+      while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+      if (p < end && *p == '"') {
+        p = parse_picat_string(p, end, &args[a], &lens[a]);
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+      }
+      // skip the rest of the argument
+      int depth = 0;
+      while (p < end && !(depth == 0 && (*p == ',' || *p == ')'))) {
+        if (*p == '(' || *p == '[' || *p == '{') depth++;
+        if (*p == ')' || *p == ']' || *p == '}') depth--;
+        if (*p == '"') {
+          char* skip;
+          size_t skip_len;
+          p = parse_picat_string(p, end, &skip, &skip_len);
+          free(skip);
+          if (args[a] != NULL) {
+            // e.g. "abc" ++ X: not a literal
+            free(args[a]);
+            args[a] = NULL;
+          }
+          continue;
+        }
+        p++;
+      }
+      if (p >= end || *p == ')') {
+        break;
+      }
+      p++;
+    }
+    int subject = replace ? 2 : 1;
+    if (args[0] != NULL) {
+      diff_pattern* d = add_pattern(args[0], lens[0]);
+      if (args[subject] != NULL) {
+        add_subject(d, args[subject], lens[subject]);
+      }
+    }
+    for (int a = 0; a < 3; a++) {
+      free(args[a]);
+    }
+    p--;
+  }
+  free(text);
+}
+
+/*
+  A corpus file: "p Pattern" and "s Subject" lines.
+*/
+static void read_corpus(const char* file) {
+  FILE* in = fopen(file, "r");
+  if (in == NULL) {
+    fprintf(stderr, "regex_diff: cannot open %s\n", file);
+    exit(2);
+  }
+  char line[65536];
+  diff_pattern* p = NULL;
+  int line_no = 0;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    line_no++;
+    size_t len = strlen(line);
+    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+    if (len == 0 || line[0] == '%') continue;
+    if (len >= 2 && line[0] == 'p' && line[1] == ' ') {
+      p = add_pattern(line+2, len-2);
+    } else if (len >= 1 && line[0] == 's' && (len == 1 || line[1] == ' ') && p != NULL) {
+      add_subject(p, len == 1 ? "" : line+2, len == 1 ? 0 : len-2);
+    } else {
+      fprintf(stderr, "regex_diff: %s:%d: should be \"p Pattern\" or \"s Subject\": %s\n", file, line_no, line);
+      exit(2);
+    }
+  }
+  fclose(in);
+}
+
+
+/*
+  Generated subjects.
+
+  The characters (1-4 bytes of UTF-8, or an invalid byte) of the
+  pattern and the subjects are the alphabet of the generated strings,
+  so the generated subjects are valid UTF-8 if the pattern and the
+  subjects are.
+*/
+typedef struct {
+  char c[4];
+  int len;
+} diff_char;
+
+static int char_len(const unsigned char* s, size_t n) {
+  int len = *s >= 0xf0 ? 4 : *s >= 0xe0 ? 3 : *s >= 0xc0 ? 2 : 1;
+  if ((size_t)len > n) return 1;
+  for (int k = 1; k < len; k++) {
+    if ((s[k] & 0xc0) != 0x80) return 1;
+  }
+  return len;
+}
+
+static void add_chars(diff_char** alphabet, int* n, const char* s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    int l = char_len((const unsigned char*)s+i, len-i);
+    int found = 0;
+    for (int k = 0; k < *n && !found; k++) {
+      found = (*alphabet)[k].len == l && memcmp((*alphabet)[k].c, s+i, l) == 0;
+    }
+    if (!found) {
+      *alphabet = realloc(*alphabet, (*n+1) * sizeof(diff_char));
+      memcpy((*alphabet)[*n].c, s+i, l);
+      (*alphabet)[*n].len = l;
+      (*n)++;
+    }
+    i += l;
+  }
+}
+
+static void append_random(char* buf, size_t* len, diff_char* alphabet, int n, int count) {
+  for (int k = 0; k < count; k++) {
+    diff_char* c = &alphabet[diff_rand() % n];
+    memcpy(buf + *len, c->c, c->len);
+    *len += c->len;
+  }
+}
+
+// a random string of the DFA (REGEX_DFA_FULL), 0 if none was found
+static int dfa_walk(regex_dfa* dfa, const unsigned char* live, char* buf, size_t* len, size_t max_len) {
+  int s = 0;
+  *len = 0;
+  int choices[256];
+  while (*len < max_len) {
+    if (dfa->final[s] && diff_rand() % 4 == 0) {
+      return 1;
+    }
+    int n = 0;
+    for (int c = 0; c < 256; c++) {
+      int t = dfa->next[s*256+c];
+      if (t >= 0 && live[t]) choices[n++] = c;
+    }
+    if (n == 0) {
+      return dfa->final[s];
+    }
+    int c = choices[diff_rand() % n];
+    buf[(*len)++] = (char)c;
+    s = dfa->next[s*256+c];
+  }
+  return dfa->final[s];
+}
+
+static void generate_subjects(diff_pattern* p, int count) {
+  diff_char* alphabet = NULL;
+  int n = 0;
+  add_chars(&alphabet, &n, p->pattern.s, p->pattern.len);
+  for (int i = 0; i < p->num_subjects; i++) {
+    add_chars(&alphabet, &n, p->subjects[i].s, p->subjects[i].len);
+  }
+  add_chars(&alphabet, &n, "a0 \n", 4);
+  int given = p->num_subjects;
+
+  const char* error;
+  int erroffset;
+  regex_dfa* dfa = regex_dfa_compile(p->pattern.s, (int)p->pattern.len, REGEX_DFA_FULL, DIFF_MAX_STATES,
+                                     &error, &erroffset);
+  unsigned char* live = NULL;
+  if (dfa != NULL) {
+    // the states from which a final state can be reached
+    live = calloc(dfa->num_states, 1);
+    int changed = 1;
+    while (changed) {
+      changed = 0;
+      for (int s = 0; s < dfa->num_states; s++) {
+        if (live[s]) continue;
+        int l = dfa->final[s];
+        for (int c = 0; c < 256 && !l; c++) {
+          int t = dfa->next[s*256+c];
+          l = t >= 0 && live[t];
+        }
+        if (l) {
+          live[s] = 1;
+          changed = 1;
+        }
+      }
+    }
+  }
+
+  char buf[1024];
+  for (int k = 0; k < count; k++) {
+    size_t len = 0;
+    int kind = diff_rand() % 3;
+    if (kind == 0 && dfa != NULL && live[0]) {
+      // a string of the pattern, perhaps with a prefix and suffix
+      size_t prefix = 0;
+      if (diff_rand() % 2) {
+        append_random(buf, &prefix, alphabet, n, diff_rand() % 4);
+      }
+      size_t walk;
+      if (!dfa_walk(dfa, live, buf + prefix, &walk, 64)) continue;
+      len = prefix + walk;
+      if (diff_rand() % 2) {
+        append_random(buf, &len, alphabet, n, diff_rand() % 4);
+      }
+    } else if (kind == 1 && given > 0) {
+      // a mutation of a subject
+      diff_string* s = &p->subjects[diff_rand() % given];
+      if (s->len > 512) continue;
+      // a character boundary
+      size_t pos = s->len > 0 ? diff_rand() % (s->len + 1) : 0;
+      while (pos < s->len && ((unsigned char)s->s[pos] & 0xc0) == 0x80) pos++;
+      memcpy(buf, s->s, pos);
+      len = pos;
+      size_t rest = pos;
+      int op = diff_rand() % 3;
+      if (op != 0) {
+        append_random(buf, &len, alphabet, n, 1); // insert or replace
+      }
+      if (op != 1 && rest < s->len) {
+        rest += char_len((const unsigned char*)s->s + rest, s->len - rest); // delete or replace
+      }
+      memcpy(buf + len, s->s + rest, s->len - rest);
+      len += s->len - rest;
+    } else {
+      append_random(buf, &len, alphabet, n, diff_rand() % 16);
+    }
+    add_subject(p, buf, len);
+  }
+
+  free(live);
+  regex_dfa_free(dfa);
+  free(alphabet);
+}
+
+
+/*
+  The engines
+*/
+
+// regex_dfa.c's DFA (REGEX_DFA_SEARCH), the same as the generated AOT matchers
+static int dfa_search(const regex_dfa* dfa, const unsigned char* s, size_t n) {
+  int state = 0;
+  size_t i = 0;
+  for (;;) {
+    if (dfa->final[state]) {
+      if (!dfa->eol) return 1;
+      if (i == n || (i+1 == n && s[i] == '\n')) return 1;
+    }
+    if (i == n) return 0;
+    state = dfa->next[state*256 + s[i++]];
+    if (state < 0) return 0;
+  }
+}
+
+typedef struct {
+  int rc;
+  PCRE2_SIZE ovector[2*DIFF_MAX_PAIRS];
+} diff_result;
+
+static void show_string(const char* s, size_t len) {
+  putchar('"');
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') printf("\\%c", c);
+    else if (c == '\n') printf("\\n");
+    else if (c < 32 || c == 127) printf("\\x%02x", c);
+    else putchar(c);
+  }
+  putchar('"');
+}
+
+static void show_result(diff_result* r, int pairs) {
+  printf("rc=%d", r->rc);
+  if (r->rc >= 0) {
+    for (int i = 0; i < pairs; i++) {
+      if (r->ovector[2*i] == PCRE2_UNSET) printf(" -");
+      else printf(" %d-%d", (int)r->ovector[2*i], (int)r->ovector[2*i+1]);
+    }
+  }
+}
+
+static void mismatch(int engine, diff_pattern* p, diff_string* s, diff_result* expected, diff_result* got, int pairs) {
+  engines[engine].mismatches++;
+  if (engines[engine].mismatches > DIFF_MAX_SHOWN) return;
+  printf("MISMATCH %s: pattern ", engine_names[engine]);
+  show_string(p->pattern.s, p->pattern.len);
+  printf(" subject ");
+  show_string(s->s, s->len);
+  printf("\n  %s: ", engine == E_DFA_FULL ? "pcre2 (anchored)" : engine == E_PCRE2_32 ? "pcre2 (UTF)" : "pcre2");
+  show_result(expected, pairs);
+  printf("\n  %s: ", engine_names[engine]);
+  show_result(got, pairs);
+  printf("\n");
+}
+
+static int is_match(int rc) {
+  return rc >= 0;
+}
+
+// a resource limit of the reference (e.g. catastrophic backtracking) is not a result
+static int is_limit(int rc) {
+  return rc == PCRE2_ERROR_MATCHLIMIT || rc == PCRE2_ERROR_DEPTHLIMIT || rc == PCRE2_ERROR_HEAPLIMIT;
+}
+
+// the result and the offsets of the first pairs captures are the same
+static int same_captures(diff_result* expected, diff_result* got, int pairs) {
+  if (is_limit(expected->rc)) {
+    return 1;
+  }
+  int same = got->rc == expected->rc;
+  int k = expected->rc == 0 ? pairs : expected->rc;
+  for (int j = 0; same && expected->rc >= 0 && j < 2*k && j < 2*pairs; j++) {
+    same = got->ovector[j] == expected->ovector[j];
+  }
+  return same;
+}
+
+/*
+  The code points of the (valid) UTF-8 string s in codes, and the byte
+  offset of each code point (and of the end) in offsets. Returns the
+  number of code points.
+*/
+static size_t utf8_to_codes(const unsigned char* s, size_t len, uint32_t* codes, PCRE2_SIZE* offsets) {
+  size_t n = 0, i = 0;
+  while (i < len) {
+    int l = char_len(s+i, len-i);
+    uint32_t c = l == 1 ? s[i] : s[i] & (0x7f >> l);
+    for (int k = 1; k < l; k++) {
+      c = (c << 6) | (s[i+k] & 0x3f);
+    }
+    offsets[n] = i;
+    codes[n++] = c;
+    i += l;
+  }
+  offsets[n] = len;
+  return n;
+}
+
+/*
+  The rewrite and rewrite_nc engines: the pattern rewritten by
+  regex_dfa_rewrite() with flags. Returns 0 if there is nothing to
+  rewrite, else 1; the captures are compared if flags is 0, otherwise
+  only the match.
+*/
+static int test_rewrite(diff_pattern* p, int flags, diff_result* expected, diff_result* got, int pairs,
+                        uint64_t* ns) {
+  int e = flags ? E_REWRITE_NC : E_REWRITE;
+  regex_rewrite* rewrites;
+  int num_rewrites;
+  char* rewritten = regex_dfa_rewrite(p->pattern.s, (int)p->pattern.len, flags, &rewrites, &num_rewrites);
+  regex_rewrites_free(rewrites, num_rewrites);
+  if (rewritten == NULL) {
+    return 0;
+  }
+  int errcode;
+  PCRE2_SIZE erroffset;
+  pcre2_code* re = pcre2_compile((PCRE2_SPTR)rewritten, PCRE2_ZERO_TERMINATED, 0, &errcode, &erroffset, NULL);
+  if (re == NULL) {
+    engines[e].mismatches++;
+    printf("MISMATCH %s: pattern ", engine_names[e]);
+    show_string(p->pattern.s, p->pattern.len);
+    printf(" is rewritten to ");
+    show_string(rewritten, strlen(rewritten));
+    printf(", which PCRE2 doesn't compile (error %d at %d)\n", errcode, (int)erroffset);
+    free(rewritten);
+    return 1;
+  }
+  pcre2_match_data* md = pcre2_match_data_create_from_pattern(re, NULL);
+  PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(md);
+  uint32_t ovector_pairs = pcre2_get_ovector_count(md);
+  int n = p->num_subjects;
+  uint64_t t0 = diff_ns();
+  for (int i = 0; i < n; i++) {
+    got[i].rc = pcre2_match(re, (PCRE2_SPTR)p->subjects[i].s, p->subjects[i].len, 0, PCRE2_NO_JIT, md, NULL);
+    memcpy(got[i].ovector, ovector, 2*(pairs < (int)ovector_pairs ? pairs : (int)ovector_pairs)*sizeof(PCRE2_SIZE));
+  }
+  *ns = diff_ns() - t0;
+  for (int i = 0; i < n; i++) {
+    int same = flags == 0 || is_limit(expected[i].rc) ? same_captures(&expected[i], &got[i], pairs)
+      : is_match(got[i].rc) == is_match(expected[i].rc) &&
+        (!is_match(got[i].rc) || (got[i].ovector[0] == expected[i].ovector[0] &&
+                                  got[i].ovector[1] == expected[i].ovector[1]));
+    if (!same) {
+      printf("REWRITTEN ");
+      show_string(rewritten, strlen(rewritten));
+      printf("\n");
+      mismatch(e, p, &p->subjects[i], &expected[i], &got[i], flags == 0 ? pairs : 1);
+    }
+  }
+  pcre2_match_data_free(md);
+  pcre2_code_free(re);
+  free(rewritten);
+  return 1;
+}
+
+/*
+  The pcre2_32 engine: the pattern compiled with PCRE2_UTF by the 8-bit
+  (the expected results) and the 32-bit library. Returns the number of
+  subjects that were compared (the valid UTF-8 subjects), or 0 if the
+  pattern is not valid in UTF mode.
+*/
+static int test_pcre2_32(diff_pattern* p, diff_result* expected, diff_result* got, uint64_t* ns) {
+  int errcode;
+  PCRE2_SIZE erroffset;
+  pcre2_code* re = pcre2_compile((PCRE2_SPTR)p->pattern.s, p->pattern.len, PCRE2_UTF, &errcode, &erroffset, NULL);
+  if (re == NULL) {
+    return 0;
+  }
+  uint32_t* codes = malloc((p->pattern.len+1) * sizeof(uint32_t));
+  PCRE2_SIZE* offsets = malloc((p->pattern.len+1) * sizeof(PCRE2_SIZE));
+  size_t num_codes = utf8_to_codes((const unsigned char*)p->pattern.s, p->pattern.len, codes, offsets);
+  pcre2_code_32* re32 = pcre2_compile_32((PCRE2_SPTR32)codes, num_codes, PCRE2_UTF, &errcode, &erroffset, NULL);
+  free(codes);
+  free(offsets);
+  if (re32 == NULL) {
+    engines[E_PCRE2_32].mismatches++;
+    printf("MISMATCH pcre2_32: pattern ");
+    show_string(p->pattern.s, p->pattern.len);
+    printf(" is not compiled by the 32-bit library (error %d at %d)\n", errcode, (int)erroffset);
+    pcre2_code_free(re);
+    return 1;
+  }
+  uint32_t capture_count;
+  pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+  int pairs = capture_count+1 < DIFF_MAX_PAIRS ? capture_count+1 : DIFF_MAX_PAIRS;
+  pcre2_match_data* md = pcre2_match_data_create_from_pattern(re, NULL);
+  pcre2_match_data_32* md32 = pcre2_match_data_create_from_pattern_32(re32, NULL);
+  PCRE2_SIZE* ovector32 = pcre2_get_ovector_pointer_32(md32);
+
+  // the valid UTF-8 subjects and their code points
+  int n = p->num_subjects;
+  diff_string** subjects = malloc(n * sizeof(diff_string*));
+  uint32_t** subject_codes = malloc(n * sizeof(uint32_t*));
+  PCRE2_SIZE** subject_offsets = malloc(n * sizeof(PCRE2_SIZE*));
+  size_t* lengths = malloc(n * sizeof(size_t));
+  int num_valid = 0;
+  for (int i = 0; i < n; i++) {
+    diff_string* s = &p->subjects[i];
+    int rc = pcre2_match(re, (PCRE2_SPTR)s->s, s->len, 0, PCRE2_NO_JIT, md, NULL);
+    if (rc <= PCRE2_ERROR_UTF8_ERR1 && rc >= PCRE2_ERROR_UTF8_ERR21) {
+      continue;
+    }
+    expected[num_valid].rc = rc;
+    memcpy(expected[num_valid].ovector, pcre2_get_ovector_pointer(md), 2*pairs*sizeof(PCRE2_SIZE));
+    subjects[num_valid] = s;
+    subject_codes[num_valid] = malloc((s->len+1) * sizeof(uint32_t));
+    subject_offsets[num_valid] = malloc((s->len+1) * sizeof(PCRE2_SIZE));
+    lengths[num_valid] = utf8_to_codes((const unsigned char*)s->s, s->len,
+                                       subject_codes[num_valid], subject_offsets[num_valid]);
+    num_valid++;
+  }
+
+  uint64_t t0 = diff_ns();
+  for (int i = 0; i < num_valid; i++) {
+    got[i].rc = pcre2_match_32(re32, (PCRE2_SPTR32)subject_codes[i], lengths[i], 0, 0, md32, NULL);
+    memcpy(got[i].ovector, ovector32, 2*pairs*sizeof(PCRE2_SIZE));
+  }
+  *ns = diff_ns() - t0;
+  for (int i = 0; i < num_valid; i++) {
+    // the code point offsets as byte offsets
+    if (got[i].rc >= 0) {
+      for (int j = 0; j < 2*pairs; j++) {
+        if (got[i].ovector[j] != PCRE2_UNSET) {
+          got[i].ovector[j] = subject_offsets[i][got[i].ovector[j]];
+        }
+      }
+    }
+    if (!same_captures(&expected[i], &got[i], pairs)) {
+      mismatch(E_PCRE2_32, p, subjects[i], &expected[i], &got[i], pairs);
+    }
+    free(subject_codes[i]);
+    free(subject_offsets[i]);
+  }
+
+  free(subjects);
+  free(subject_codes);
+  free(subject_offsets);
+  free(lengths);
+  pcre2_match_data_free(md);
+  pcre2_match_data_free_32(md32);
+  pcre2_code_free(re);
+  pcre2_code_free_32(re32);
+  return num_valid;
+}
+
+/*
+  Runs all the engines on the subjects of p.
+*/
+static void test_pattern(diff_pattern* p) {
+  int errcode;
+  PCRE2_SIZE erroffset;
+  pcre2_code* re = pcre2_compile((PCRE2_SPTR)p->pattern.s, p->pattern.len, 0, &errcode, &erroffset, NULL);
+  if (re == NULL) {
+    // e.g. a pattern in a test of the error handling
+    return;
+  }
+  int n = p->num_subjects;
+  diff_result* expected = calloc(n, sizeof(diff_result));
+  diff_result* expected_full = calloc(n, sizeof(diff_result));
+  diff_result* got = calloc(n, sizeof(diff_result));
+  pcre2_match_data* md = pcre2_match_data_create_from_pattern(re, NULL);
+  uint32_t capture_count;
+  pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+  int pairs = capture_count+1 < DIFF_MAX_PAIRS ? capture_count+1 : DIFF_MAX_PAIRS;
+  uint64_t ns[NUM_ENGINES];
+  for (int e = 0; e < NUM_ENGINES; e++) ns[e] = 0;
+
+  // pcre2 (the expected results)
+  uint64_t t0 = diff_ns();
+  for (int i = 0; i < n; i++) {
+    expected[i].rc = pcre2_match(re, (PCRE2_SPTR)p->subjects[i].s, p->subjects[i].len, 0, PCRE2_NO_JIT, md, NULL);
+    memcpy(expected[i].ovector, pcre2_get_ovector_pointer(md), 2*pairs*sizeof(PCRE2_SIZE));
+  }
+  ns[E_PCRE2] = diff_ns() - t0;
+  for (int i = 0; i < n; i++) {
+    expected_full[i].rc = pcre2_match(re, (PCRE2_SPTR)p->subjects[i].s, p->subjects[i].len, 0,
+                                      PCRE2_NO_JIT | PCRE2_ANCHORED | PCRE2_ENDANCHORED, md, NULL);
+  }
+  int tested[NUM_ENGINES] = { 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+  int counts[NUM_ENGINES]; // the subjects tested per engine
+  for (int e = 0; e < NUM_ENGINES; e++) counts[e] = n;
+
+  // pcre2_jit
+  pcre2_code* jit = pcre2_code_copy(re);
+  if (jit != NULL && pcre2_jit_compile(jit, PCRE2_JIT_COMPLETE) == 0) {
+    tested[E_JIT] = 1;
+    t0 = diff_ns();
+    for (int i = 0; i < n; i++) {
+      got[i].rc = pcre2_match(jit, (PCRE2_SPTR)p->subjects[i].s, p->subjects[i].len, 0, 0, md, NULL);
+      memcpy(got[i].ovector, pcre2_get_ovector_pointer(md), 2*pairs*sizeof(PCRE2_SIZE));
+    }
+    ns[E_JIT] = diff_ns() - t0;
+    for (int i = 0; i < n; i++) {
+      if (!same_captures(&expected[i], &got[i], pairs)) mismatch(E_JIT, p, &p->subjects[i], &expected[i], &got[i], pairs);
+    }
+  }
+  pcre2_code_free(jit);
+
+  // pcre2_dfa
+  int workspace[DIFF_WORKSPACE];
+  pcre2_match_data* dmd = pcre2_match_data_create(1, NULL);
+  int supported = 1;
+  for (int i = 0; i < n && supported; i++) {
+    int rc = pcre2_dfa_match(re, (PCRE2_SPTR)p->subjects[i].s, p->subjects[i].len, 0, 0, dmd, NULL,
+                             workspace, DIFF_WORKSPACE);
+    // unsupported items (backreferences, recursion etc) and too small workspace
+    supported = rc != PCRE2_ERROR_DFA_UITEM && rc != PCRE2_ERROR_DFA_UCOND && rc != PCRE2_ERROR_DFA_UFUNC &&
+                rc != PCRE2_ERROR_DFA_WSSIZE && rc != PCRE2_ERROR_DFA_RECURSE;
+  }
+  if (supported) {
+    tested[E_PCRE2_DFA] = 1;
+    t0 = diff_ns();
+    for (int i = 0; i < n; i++) {
+      got[i].rc = pcre2_dfa_match(re, (PCRE2_SPTR)p->subjects[i].s, p->subjects[i].len, 0, 0, dmd, NULL,
+                                  workspace, DIFF_WORKSPACE);
+      got[i].ovector[0] = pcre2_get_ovector_pointer(dmd)[0];
+    }
+    ns[E_PCRE2_DFA] = diff_ns() - t0;
+    for (int i = 0; i < n; i++) {
+      int same = is_match(got[i].rc) == is_match(expected[i].rc) &&
+                 (!is_match(got[i].rc) || got[i].ovector[0] == expected[i].ovector[0]);
+      if (!same) {
+        got[i].ovector[1] = got[i].ovector[0]; // only the start is compared
+        mismatch(E_PCRE2_DFA, p, &p->subjects[i], &expected[i], &got[i], 1);
+      }
+    }
+  }
+  pcre2_match_data_free(dmd);
+
+  // dfa and dfa_full
+  for (int mode = REGEX_DFA_SEARCH; mode <= REGEX_DFA_FULL; mode++) {
+    const char* error;
+    int erroff;
+    regex_dfa* dfa = regex_dfa_compile(p->pattern.s, (int)p->pattern.len, mode, DIFF_MAX_STATES, &error, &erroff);
+    if (dfa == NULL) continue;
+    int e = mode == REGEX_DFA_SEARCH ? E_DFA : E_DFA_FULL;
+    diff_result* exp = mode == REGEX_DFA_SEARCH ? expected : expected_full;
+    tested[e] = 1;
+    t0 = diff_ns();
+    for (int i = 0; i < n; i++) {
+      const unsigned char* s = (const unsigned char*)p->subjects[i].s;
+      got[i].rc = (mode == REGEX_DFA_SEARCH ? dfa_search(dfa, s, p->subjects[i].len)
+                                            : regex_dfa_full_match(dfa, s, p->subjects[i].len)) ? 1 : PCRE2_ERROR_NOMATCH;
+    }
+    ns[e] = diff_ns() - t0;
+    for (int i = 0; i < n; i++) {
+      if (is_match(got[i].rc) != is_match(exp[i].rc)) {
+        mismatch(e, p, &p->subjects[i], &exp[i], &got[i], 0);
+      }
+    }
+    regex_dfa_free(dfa);
+  }
+
+  // aot
+  for (size_t a = 0; a < sizeof(aot_matchers)/sizeof(aot_matchers[0]); a++) {
+    if (strlen(aot_matchers[a].pattern) != p->pattern.len ||
+        memcmp(aot_matchers[a].pattern, p->pattern.s, p->pattern.len) != 0) continue;
+    tested[E_AOT] = 1;
+    t0 = diff_ns();
+    for (int i = 0; i < n; i++) {
+      got[i].rc = aot_matchers[a].match((const unsigned char*)p->subjects[i].s, p->subjects[i].len)
+        ? 1 : PCRE2_ERROR_NOMATCH;
+    }
+    ns[E_AOT] = diff_ns() - t0;
+    for (int i = 0; i < n; i++) {
+      if (is_match(got[i].rc) != is_match(expected[i].rc)) {
+        mismatch(E_AOT, p, &p->subjects[i], &expected[i], &got[i], 0);
+      }
+    }
+  }
+
+  // rewrite and rewrite_nc
+  tested[E_REWRITE] = test_rewrite(p, 0, expected, got, pairs, &ns[E_REWRITE]);
+  tested[E_REWRITE_NC] = test_rewrite(p, REGEX_REWRITE_NO_CAPTURES, expected, got, pairs, &ns[E_REWRITE_NC]);
+
+  // pcre2_32 (the expected results of pcre2 with PCRE2_UTF replace expected_full)
+  counts[E_PCRE2_32] = test_pcre2_32(p, expected_full, got, &ns[E_PCRE2_32]);
+  tested[E_PCRE2_32] = counts[E_PCRE2_32] > 0;
+
+  for (int e = 0; e < NUM_ENGINES; e++) {
+    if (!tested[e]) continue;
+    engines[e].patterns++;
+    engines[e].subjects += counts[e];
+    engines[e].ns += ns[e];
+  }
+  if (verbose) {
+    printf("%5d", n);
+    for (int e = 0; e < NUM_ENGINES; e++) {
+      if (tested[e] && counts[e] > 0) printf(" %9.1f", (double)ns[e] / counts[e]);
+      else printf(" %9s", "-");
+    }
+    printf("  ");
+    show_string(p->pattern.s, p->pattern.len);
+    printf("\n");
+  }
+
+  pcre2_match_data_free(md);
+  pcre2_code_free(re);
+  free(expected);
+  free(expected_full);
+  free(got);
+}
+
+int main(int argc, char** argv) {
+  int generated = 50;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+      diff_seed = strtoull(argv[++i], NULL, 10);
+      if (diff_seed == 0) diff_seed = 1;
+    } else if (strcmp(argv[i], "-n") == 0 && i+1 < argc) {
+      generated = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = 1;
+    } else {
+      fprintf(stderr, "usage: regex_diff [-s Seed] [-n Generated] [-v] File ...\n");
+      return 2;
+    }
+  }
+  for (; i < argc; i++) {
+    size_t len = strlen(argv[i]);
+    if (len > 3 && strcmp(argv[i] + len - 3, ".pi") == 0) {
+      read_picat(argv[i]);
+    } else {
+      read_corpus(argv[i]);
+    }
+  }
+  for (size_t a = 0; a < sizeof(aot_matchers)/sizeof(aot_matchers[0]); a++) {
+    add_pattern(aot_matchers[a].pattern, strlen(aot_matchers[a].pattern));
+  }
+
+  if (verbose) {
+    printf("ns per subject:\n%5s", "n");
+    for (int e = 0; e < NUM_ENGINES; e++) printf(" %9s", engine_names[e]);
+    printf("  pattern\n");
+  }
+  for (int k = 0; k < num_patterns; k++) {
+    generate_subjects(&patterns[k], generated);
+    test_pattern(&patterns[k]);
+  }
+
+  uint64_t mismatches = 0;
+  printf("%-10s %8s %8s %10s %12s\n", "engine", "patterns", "subjects", "mismatches", "ns/subject");
+  for (int e = 0; e < NUM_ENGINES; e++) {
+    diff_engine* d = &engines[e];
+    printf("%-10s %8llu %8llu %10llu %12.1f\n", engine_names[e], (unsigned long long)d->patterns,
+           (unsigned long long)d->subjects, (unsigned long long)d->mismatches,
+           d->subjects ? (double)d->ns / d->subjects : 0.0);
+    mismatches += d->mismatches;
+  }
+  if (mismatches > 0) {
+    printf("regex_diff: %llu mismatches\n", (unsigned long long)mismatches);
+    return 1;
+  }
+  return 0;
+
+} // main